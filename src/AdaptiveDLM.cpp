@@ -0,0 +1,781 @@
+#include "AdaptiveDLM.hpp"
+#include "SuzukiKasami.hpp"
+
+#include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <string>
+#include <stdexcept>
+#include <base/Logging.hpp>
+
+using namespace fipa::acl;
+
+namespace fipa {
+namespace distributed_locking {
+
+AdaptiveDLM::AdaptiveDLM(const fipa::acl::AgentID& self, const std::vector<std::string>& resources)
+    : DLM(protocol::ADAPTIVE, self, resources)
+    , mDecisionWindow(16)
+{
+    mEngines[protocol::RICART_AGRAWALA] = DLM::create(protocol::RICART_AGRAWALA, self, resources);
+    mEngines[protocol::SUZUKI_KASAMI] = DLM::create(protocol::SUZUKI_KASAMI, self, resources);
+    for(std::map<protocol::Protocol, DLM::Ptr>::const_iterator it = mEngines.begin(); it != mEngines.end(); ++it)
+    {
+        embed(*it->second);
+    }
+}
+
+void AdaptiveDLM::setDecisionWindow(unsigned int acquisitions)
+{
+    if(acquisitions == 0)
+    {
+        throw std::invalid_argument("AdaptiveDLM::setDecisionWindow: the decision window must contain at least one acquisition");
+    }
+    mDecisionWindow = acquisitions;
+}
+
+protocol::Protocol AdaptiveDLM::getResourceProtocol(const std::string& resource) const
+{
+    std::map<std::string, ResourceState>::const_iterator cit = mResourceStates.find(resource);
+    if(cit != mResourceStates.end())
+    {
+        return cit->second.mProtocol;
+    }
+    return ResourceState().mProtocol;
+}
+
+DLM::Ptr AdaptiveDLM::getEngine(const std::string& resource) const
+{
+    return mEngines.find(getResourceProtocol(resource))->second;
+}
+
+void AdaptiveDLM::lock(const std::string& resource, const AgentIDList& agents)
+{
+    requestLock(resource, getPartners(agents), priority::NORMAL);
+}
+
+void AdaptiveDLM::requestLock(const std::string& resource, const AgentGroup& partners, priority::Priority priority)
+{
+    const AgentIDList& agents = *partners;
+    if(claimPrefetch(resource))
+    {
+        // Requested or held already
+        return;
+    }
+    if(reenter(resource))
+    {
+        return;
+    }
+
+    if(!hasKnownOwner(resource))
+    {
+        throw std::invalid_argument("AdaptiveDLM: cannot lock resource '" + resource + "' -- owner is unknown. Perform discovery first");
+    }
+
+    lock_state::LockState state = getLockState(resource);
+    // Only act we are not holding this resource and not already interested in it
+    if(state != lock_state::NOT_INTERESTED)
+    {
+        if(state == lock_state::UNREACHABLE)
+        {
+            // An unreachable resource cannot be locked. Throw exception
+            throw std::runtime_error("AdaptiveDLM::lock Cannot lock UNREACHABLE resource.");
+        }
+        return;
+    }
+
+    for(AgentIDList::const_iterator it = agents.begin(); it != agents.end(); ++it)
+    {
+        addKnownAgent(*it);
+    }
+    lockRequested(resource, priority);
+    if(getOwner(resource) == mSelf)
+    {
+        recordRequest(resource);
+    }
+
+    ResourceState& resourceState = mResourceStates[resource];
+    resourceState.mRequestAgents = agents;
+    resourceState.mRequestPriority = priority;
+    if(!resourceState.mSwitchConversationID.empty())
+    {
+        // The protocol is about to change, the request is issued afterwards
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' defers request for resource '" << resource << "' until the protocol switch is finished";
+        resourceState.mLockDeferred = true;
+        return;
+    }
+    passOnRequest(resource, agents, priority);
+}
+
+void AdaptiveDLM::passOnRequest(const std::string& resource, const AgentIDList& agents, priority::Priority priority)
+{
+    DLM::Ptr engine = getEngine(resource);
+    shareOwnerInformation(*engine, resource);
+    mResourceStates[resource].mAwaitingLock = true;
+    engine->lock(resource, agents, priority);
+    relayOutgoingMessages(*engine);
+    updateOwnRequests();
+}
+
+void AdaptiveDLM::unlock(const std::string& resource)
+{
+    if(leave(resource))
+    {
+        // Still held by an outer lock
+        return;
+    }
+    // Only act we are actually holding this resource
+    if(getLockState(resource) != lock_state::LOCKED)
+    {
+        return;
+    }
+
+    DLM::Ptr engine = getEngine(resource);
+    engine->unlock(resource);
+    relayOutgoingMessages(*engine);
+
+    ResourceState& resourceState = mResourceStates[resource];
+    resourceState.mHolders.erase(std::remove(resourceState.mHolders.begin(), resourceState.mHolders.end(), mSelf),
+            resourceState.mHolders.end());
+    resourceState.mSwitchRejected = false;
+    processSwitches();
+}
+
+lock_state::LockState AdaptiveDLM::getLockState(const std::string& resource) const
+{
+    std::map<std::string, ResourceState>::const_iterator cit = mResourceStates.find(resource);
+    if(cit != mResourceStates.end() && cit->second.mLockDeferred)
+    {
+        return lock_state::INTERESTED;
+    }
+    return getEngine(resource)->getLockState(resource);
+}
+
+bool AdaptiveDLM::onIncomingMessage(const fipa::acl::ACLMessage& message)
+{
+    std::string protocol = message.getProtocol();
+    for(std::map<protocol::Protocol, DLM::Ptr>::const_iterator it = mEngines.begin(); it != mEngines.end(); ++it)
+    {
+        if(protocol == it->second->getProtocolName())
+        {
+            addKnownAgents(message);
+            observe(message);
+            if(message.getPerformativeAsEnum() == ACLMessage::REQUEST)
+            {
+                checkRequestProtocol(message, it->first);
+            }
+            bool handled = forwardMessage(*it->second, message);
+            updateOwnRequests();
+            processSwitches();
+            return handled;
+        }
+    }
+
+    if(protocol == getProtocolTxt(protocol::DLM_DISCOVER))
+    {
+        // Agents discovering a resource are about to lock it
+        addKnownAgents(message);
+        handleDiscovery(message);
+    } else if(protocol == getProtocolTxt(protocol::DLM_PROBE) && message.getPerformativeAsEnum() == ACLMessage::CONFIRM)
+    {
+        // The embedded instances might be probing the sender as well
+        for(std::map<protocol::Protocol, DLM::Ptr>::const_iterator it = mEngines.begin(); it != mEngines.end(); ++it)
+        {
+            forwardMessage(*it->second, message);
+        }
+    }
+
+    // Call base method as required
+    if(DLM::onIncomingMessage(message))
+    {
+        return true;
+    }
+
+    // Check if it's the right protocol
+    if(protocol != getProtocolName())
+    {
+        return false;
+    }
+
+    switch(message.getPerformativeAsEnum())
+    {
+        case ACLMessage::PROPOSE:
+            handleProposal(message);
+            return true;
+        case ACLMessage::ACCEPT_PROPOSAL:
+            handleProposalAnswer(message, true);
+            return true;
+        case ACLMessage::REJECT_PROPOSAL:
+            handleProposalAnswer(message, false);
+            return true;
+        case ACLMessage::AGREE:
+            handleDecision(message, true);
+            return true;
+        case ACLMessage::CANCEL:
+            handleDecision(message, false);
+            return true;
+        case ACLMessage::FAILURE:
+            handleFailedSwitch(message.getConversationID());
+            return true;
+        case ACLMessage::REFUSE:
+            handleRefusal(message);
+            return true;
+        default:
+            // We ignore other performatives, as they are not part of our protocol.
+            return false;
+    }
+}
+
+bool AdaptiveDLM::forwardMessage(DLM& engine, const fipa::acl::ACLMessage& message)
+{
+    bool handled = engine.onIncomingMessage(message);
+    relayOutgoingMessages(engine);
+    return handled;
+}
+
+void AdaptiveDLM::trigger()
+{
+    DLM::trigger();
+    for(std::map<protocol::Protocol, DLM::Ptr>::const_iterator it = mEngines.begin(); it != mEngines.end(); ++it)
+    {
+        it->second->trigger();
+        relayOutgoingMessages(*it->second);
+    }
+    updateOwnRequests();
+    processSwitches();
+}
+
+void AdaptiveDLM::agentFailed(const fipa::acl::AgentID& agent)
+{
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' detected failed agent: '" << agent.getName() << "'";
+    for(std::map<protocol::Protocol, DLM::Ptr>::const_iterator it = mEngines.begin(); it != mEngines.end(); ++it)
+    {
+        it->second->agentFailed(agent);
+        relayOutgoingMessages(*it->second);
+    }
+    mKnownAgents.erase(std::remove(mKnownAgents.begin(), mKnownAgents.end(), agent), mKnownAgents.end());
+
+    for(std::map<std::string, ResourceState>::iterator it = mResourceStates.begin(); it != mResourceStates.end(); ++it)
+    {
+        ResourceState& resourceState = it->second;
+        // A failed agent does not release the lock any more
+        resourceState.mHolders.erase(std::remove(resourceState.mHolders.begin(), resourceState.mHolders.end(), agent),
+                resourceState.mHolders.end());
+        if(!resourceState.mSwitchConversationID.empty() && getOwner(it->first) == mSelf
+                && std::find(resourceState.mSwitchParticipants.begin(), resourceState.mSwitchParticipants.end(), agent)
+                    != resourceState.mSwitchParticipants.end())
+        {
+            resourceState.mSwitchParticipants.erase(std::remove(resourceState.mSwitchParticipants.begin(),
+                        resourceState.mSwitchParticipants.end(), agent), resourceState.mSwitchParticipants.end());
+            finishSwitch(it->first, false);
+        }
+    }
+    updateOwnRequests();
+}
+
+void AdaptiveDLM::onDeliveryFailure(const std::string& conversationID, const fipa::acl::AgentIDList& failedReceivers)
+{
+    // The conversation IDs of the embedded instances are distinct from each other and from ours
+    for(std::map<protocol::Protocol, DLM::Ptr>::const_iterator it = mEngines.begin(); it != mEngines.end(); ++it)
+    {
+        it->second->onDeliveryFailure(conversationID, failedReceivers);
+        relayOutgoingMessages(*it->second);
+    }
+    updateOwnRequests();
+    handleFailedSwitch(conversationID);
+    processSwitches();
+}
+
+void AdaptiveDLM::handleFailedSwitch(const std::string& conversationID)
+{
+    // A proposal or answer could not be delivered, so the switch of that conversation cannot succeed
+    std::map<std::string, ResourceState>::iterator it = mResourceStates.begin();
+    for(; it != mResourceStates.end(); ++it)
+    {
+        if(it->second.mSwitchConversationID == conversationID && getOwner(it->first) == mSelf)
+        {
+            finishSwitch(it->first, false);
+            break;
+        }
+    }
+}
+
+protocol::Protocol AdaptiveDLM::selectProtocol(const std::string& resource, const Statistics& statistics) const
+{
+    // A token pays off, if it stays with the same agent or if requests have to wait for it anyway
+    if(2 * (statistics.mRepeatedAcquisitions + statistics.mContendedRequests) >= statistics.mAcquisitions)
+    {
+        return protocol::SUZUKI_KASAMI;
+    }
+    return protocol::RICART_AGRAWALA;
+}
+
+void AdaptiveDLM::observe(const fipa::acl::ACLMessage& message)
+{
+    switch(message.getPerformativeAsEnum())
+    {
+        case ACLMessage::REQUEST:
+        {
+            std::vector<std::string> resources = getRequestedResources(message);
+            for(std::vector<std::string>::const_iterator it = resources.begin(); it != resources.end(); ++it)
+            {
+                if(getOwner(*it) == mSelf && getEngine(*it)->getProtocolName() == message.getProtocol())
+                {
+                    recordRequest(*it);
+                }
+            }
+            break;
+        }
+        case ACLMessage::CONFIRM:
+            // A lock obtained with an outdated protocol is released without being used
+            if(getOwner(message.getContent()) == mSelf && getEngine(message.getContent())->getProtocolName() == message.getProtocol())
+            {
+                recordAcquisition(message.getContent(), message.getSender());
+            }
+            break;
+        case ACLMessage::DISCONFIRM:
+            if(getOwner(message.getContent()) == mSelf)
+            {
+                ResourceState& resourceState = mResourceStates[message.getContent()];
+                resourceState.mHolders.erase(std::remove(resourceState.mHolders.begin(), resourceState.mHolders.end(),
+                            message.getSender()), resourceState.mHolders.end());
+                resourceState.mSwitchRejected = false;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+std::vector<std::string> AdaptiveDLM::getRequestedResources(const fipa::acl::ACLMessage& message)
+{
+    std::vector<std::string> strs;
+    std::string content = message.getContent();
+    boost::split(strs, content, boost::is_any_of("\n"));
+
+    std::vector<std::string> resources;
+    if(message.getProtocol() == getProtocolTxt(protocol::RICART_AGRAWALA))
+    {
+        // "LAMPORTTIME\nRESOURCE_IDENTIFIER[\nPRIORITY[\nMODE]]"
+        if(strs.size() > 1)
+        {
+            resources.push_back(strs[1]);
+        }
+    } else {
+        // "RESOURCE_IDENTIFIER\nSEQUENCE_NUMBER[\n...][\nPRIORITY]"
+        for(unsigned int i = 0; i + 1 < strs.size(); i += 2)
+        {
+            resources.push_back(strs[i]);
+        }
+    }
+    return resources;
+}
+
+void AdaptiveDLM::checkRequestProtocol(const fipa::acl::ACLMessage& message, protocol::Protocol protocol)
+{
+    std::vector<std::string> resources = getRequestedResources(message);
+    for(std::vector<std::string>::const_iterator it = resources.begin(); it != resources.end(); ++it)
+    {
+        if(getOwner(*it) != mSelf)
+        {
+            continue;
+        }
+        ResourceState& resourceState = mResourceStates[*it];
+        if(resourceState.mProtocol == protocol)
+        {
+            if(!resourceState.mSwitchConversationID.empty())
+            {
+                // The requester might not have been asked, so it would lock with the old protocol after the switch
+                LOG_DEBUG_S << "'" << mSelf.getName() << "' received request for resource '" << *it << "' from '"
+                    << message.getSender().getName() << "' during the switch";
+                finishSwitch(*it, false);
+            }
+            continue;
+        }
+
+        // The requester missed a switch. The refusal is sent before any answer of our instance, so that the
+        // requester knows not to use the lock, once it is granted with the outdated protocol.
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' refuses request for resource '" << *it << "' from '"
+            << message.getSender().getName() << "' with outdated protocol '" << message.getProtocol() << "'";
+        // Our refusals are in the format "RESOURCE_IDENTIFIER\nPROTOCOL"
+        ACLMessage refusal = prepareMessage(ACLMessage::REFUSE, getProtocolName(),
+                *it + "\n" + getProtocolTxt(resourceState.mProtocol));
+        refusal.addReceiver(message.getSender());
+        sendMessage(refusal);
+    }
+}
+
+void AdaptiveDLM::handleDiscovery(const fipa::acl::ACLMessage& message)
+{
+    if(message.getPerformativeAsEnum() != ACLMessage::QUERY_IF)
+    {
+        return;
+    }
+    std::string root = getOwnedRoot(message.getContent());
+    if(root.empty() || getOwner(root) != mSelf)
+    {
+        return;
+    }
+    std::map<std::string, ResourceState>::const_iterator cit = mResourceStates.find(root);
+    if(cit != mResourceStates.end() && !cit->second.mSwitchConversationID.empty()
+            && std::find(cit->second.mSwitchParticipants.begin(), cit->second.mSwitchParticipants.end(), message.getSender())
+                == cit->second.mSwitchParticipants.end())
+    {
+        // The agent is told the old protocol and was not asked, the switch is retried with it
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' received discovery of resource '" << root << "' from '"
+            << message.getSender().getName() << "' during the switch";
+        finishSwitch(root, false);
+    }
+}
+
+void AdaptiveDLM::handleRefusal(const fipa::acl::ACLMessage& message)
+{
+    std::string resource;
+    protocol::Protocol protocol;
+    extractInformation(message, resource, protocol);
+
+    ResourceState& resourceState = mResourceStates[resource];
+    if(resourceState.mProtocol == protocol || !resourceState.mSwitchConversationID.empty())
+    {
+        // We learned the protocol already, or the decision of the owner will tell it
+        return;
+    }
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' learned protocol '" << getProtocolTxt(protocol) << "' of resource '"
+        << resource << "' from '" << message.getSender().getName() << "'";
+    protocol::Protocol outdated = resourceState.mProtocol;
+    // The token is returned to the owner on a switch, so that it does not grant an outdated request before refusing it
+    bool held = getEngine(resource)->getLockState(resource) == lock_state::LOCKED;
+    if(held)
+    {
+        LOG_WARN_S << "'" << mSelf.getName() << "' obtained resource '" << resource << "' with outdated protocol '"
+            << getProtocolTxt(outdated) << "', it is released and requested again";
+    }
+    resourceState.mProtocol = protocol;
+    if((resourceState.mAwaitingLock || held) && !resourceState.mOutdatedRequest)
+    {
+        // Our request cannot be withdrawn, it is released once granted
+        resourceState.mAwaitingLock = false;
+        resourceState.mOutdatedRequest = true;
+        resourceState.mOutdatedProtocol = outdated;
+        if(held)
+        {
+            lockRequested(resource, resourceState.mRequestPriority);
+        }
+        passOnRequest(resource, resourceState.mRequestAgents, resourceState.mRequestPriority);
+    }
+}
+
+void AdaptiveDLM::returnToken(const std::string& resource)
+{
+    DLM::Ptr engine = mEngines.find(protocol::SUZUKI_KASAMI)->second;
+    if(boost::static_pointer_cast<SuzukiKasami>(engine)->returnToken(resource, getOwner(resource)))
+    {
+        relayOutgoingMessages(*engine);
+    }
+}
+
+void AdaptiveDLM::recordAcquisition(const std::string& resource, const fipa::acl::AgentID& agent)
+{
+    ResourceState& resourceState = mResourceStates[resource];
+    Statistics& statistics = resourceState.mStatistics;
+    ++statistics.mAcquisitions;
+    if(resourceState.mLastHolder == agent)
+    {
+        ++statistics.mRepeatedAcquisitions;
+    }
+    resourceState.mLastHolder = agent;
+    if(std::find(resourceState.mHolders.begin(), resourceState.mHolders.end(), agent) == resourceState.mHolders.end())
+    {
+        resourceState.mHolders.push_back(agent);
+    }
+
+    if(statistics.mAcquisitions >= mDecisionWindow)
+    {
+        resourceState.mSelectedProtocol = selectProtocol(resource, statistics);
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' selects protocol '" << getProtocolTxt(resourceState.mSelectedProtocol)
+            << "' for resource '" << resource << "' after " << statistics.mAcquisitions << " acquisitions, "
+            << statistics.mRepeatedAcquisitions << " repeated, " << statistics.mContendedRequests << " contended requests";
+        statistics = Statistics();
+    }
+}
+
+void AdaptiveDLM::recordRequest(const std::string& resource)
+{
+    ResourceState& resourceState = mResourceStates[resource];
+    if(!resourceState.mHolders.empty())
+    {
+        ++resourceState.mStatistics.mContendedRequests;
+    }
+}
+
+void AdaptiveDLM::addKnownAgent(const fipa::acl::AgentID& agent)
+{
+    if(agent != mSelf && std::find(mKnownAgents.begin(), mKnownAgents.end(), agent) == mKnownAgents.end())
+    {
+        mKnownAgents.push_back(agent);
+    }
+}
+
+void AdaptiveDLM::addKnownAgents(const fipa::acl::ACLMessage& message)
+{
+    addKnownAgent(message.getSender());
+    AgentIDList receivers = message.getAllReceivers();
+    for(AgentIDList::const_iterator it = receivers.begin(); it != receivers.end(); ++it)
+    {
+        addKnownAgent(*it);
+    }
+}
+
+void AdaptiveDLM::updateOwnRequests()
+{
+    for(std::map<std::string, ResourceState>::iterator it = mResourceStates.begin(); it != mResourceStates.end(); ++it)
+    {
+        if(it->second.mOutdatedRequest)
+        {
+            DLM::Ptr outdated = mEngines.find(it->second.mOutdatedProtocol)->second;
+            lock_state::LockState state = outdated->getLockState(it->first);
+            if(state == lock_state::LOCKED)
+            {
+                LOG_DEBUG_S << "'" << mSelf.getName() << "' releases resource '" << it->first << "' obtained with outdated protocol '"
+                    << outdated->getProtocolName() << "'";
+                if(it->second.mOutdatedProtocol == protocol::SUZUKI_KASAMI)
+                {
+                    // Passing the token on to the next requester would grant its outdated request before the refusal
+                    returnToken(it->first);
+                } else {
+                    outdated->unlock(it->first);
+                    relayOutgoingMessages(*outdated);
+                }
+                it->second.mOutdatedRequest = false;
+            } else if(state != lock_state::INTERESTED)
+            {
+                it->second.mOutdatedRequest = false;
+            }
+        }
+        if(!it->second.mAwaitingLock)
+        {
+            continue;
+        }
+        lock_state::LockState state = getEngine(it->first)->getLockState(it->first);
+        if(state == lock_state::LOCKED)
+        {
+            it->second.mAwaitingLock = false;
+            lockGranted(it->first);
+            if(getOwner(it->first) == mSelf)
+            {
+                recordAcquisition(it->first, mSelf);
+            }
+        } else if(state != lock_state::INTERESTED)
+        {
+            it->second.mAwaitingLock = false;
+            lockAbandoned(it->first);
+        }
+    }
+}
+
+void AdaptiveDLM::processSwitches()
+{
+    for(std::map<std::string, ResourceState>::iterator it = mResourceStates.begin(); it != mResourceStates.end(); ++it)
+    {
+        const ResourceState& resourceState = it->second;
+        if(resourceState.mSelectedProtocol == resourceState.mProtocol || resourceState.mSwitchRejected
+                || !resourceState.mSwitchConversationID.empty() || getOwner(it->first) != mSelf)
+        {
+            continue;
+        }
+        // The switch takes place, once the resource is idle
+        if(resourceState.mHolders.empty() && !resourceState.mAwaitingLock
+                && getEngine(it->first)->getLockState(it->first) == lock_state::NOT_INTERESTED)
+        {
+            startSwitch(it->first);
+        }
+    }
+}
+
+void AdaptiveDLM::startSwitch(const std::string& resource)
+{
+    ResourceState& resourceState = mResourceStates[resource];
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' proposes to switch resource '" << resource << "' to protocol '"
+        << getProtocolTxt(resourceState.mSelectedProtocol) << "'";
+
+    // Our proposals are in the format "RESOURCE_IDENTIFIER\nPROTOCOL"
+    ACLMessage message = prepareMessage(ACLMessage::PROPOSE, getProtocolName(),
+            resource + "\n" + getProtocolTxt(resourceState.mSelectedProtocol));
+    resourceState.mSwitchConversationID = message.getConversationID();
+    resourceState.mSwitchParticipants = mKnownAgents;
+    resourceState.mPendingAcceptances = mKnownAgents;
+    if(mKnownAgents.empty())
+    {
+        finishSwitch(resource, true);
+        return;
+    }
+    message.setAllReceivers(mKnownAgents);
+    sendMessage(message);
+}
+
+void AdaptiveDLM::finishSwitch(const std::string& resource, bool commit)
+{
+    ResourceState& resourceState = mResourceStates[resource];
+    if(commit)
+    {
+        resourceState.mProtocol = resourceState.mSelectedProtocol;
+    } else {
+        // Somebody is using the resource, so we retry once the lock was released again
+        resourceState.mSwitchRejected = true;
+    }
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' " << (commit ? "commits" : "aborts") << " the switch of resource '" << resource
+        << "', which uses protocol '" << getProtocolTxt(resourceState.mProtocol) << "'";
+
+    if(!resourceState.mSwitchParticipants.empty())
+    {
+        ACLMessage message = prepareMessage(commit ? ACLMessage::AGREE : ACLMessage::CANCEL, getProtocolName(),
+                resource + "\n" + getProtocolTxt(resourceState.mProtocol));
+        message.setConversationID(resourceState.mSwitchConversationID);
+        message.setAllReceivers(resourceState.mSwitchParticipants);
+        sendMessage(message);
+    }
+
+    resourceState.mSwitchConversationID.clear();
+    resourceState.mSwitchParticipants.clear();
+    resourceState.mPendingAcceptances.clear();
+    if(resourceState.mLockDeferred)
+    {
+        resourceState.mLockDeferred = false;
+        passOnRequest(resource, resourceState.mRequestAgents, resourceState.mRequestPriority);
+    }
+}
+
+void AdaptiveDLM::handleProposal(const fipa::acl::ACLMessage& message)
+{
+    std::string resource;
+    protocol::Protocol protocol;
+    extractInformation(message, resource, protocol);
+    addKnownAgent(message.getSender());
+
+    ResourceState& resourceState = mResourceStates[resource];
+    ACLMessage answer = prepareMessage(ACLMessage::REJECT_PROPOSAL, getProtocolName(), message.getContent());
+    answer.addReceiver(message.getSender());
+    answer.setConversationID(message.getConversationID());
+    // Only if we neither hold nor wait for the resource, we can switch
+    if(!resourceState.mAwaitingLock && !resourceState.mLockDeferred && !resourceState.mOutdatedRequest
+            && getEngine(resource)->getLockState(resource) == lock_state::NOT_INTERESTED)
+    {
+        // Until the owner decides, our requests are deferred
+        resourceState.mSwitchConversationID = message.getConversationID();
+        answer.setPerformative(ACLMessage::ACCEPT_PROPOSAL);
+        if(resourceState.mProtocol == protocol::SUZUKI_KASAMI)
+        {
+            // The token is parked at the owner, before it knows our answer. An agent missing the switch can only get
+            // the token from the owner then, after being refused.
+            returnToken(resource);
+        }
+    }
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' answers proposal to switch resource '" << resource << "': " << answer.getPerformative();
+    sendMessage(answer);
+}
+
+void AdaptiveDLM::handleProposalAnswer(const fipa::acl::ACLMessage& message, bool accepted)
+{
+    std::string resource;
+    protocol::Protocol protocol;
+    extractInformation(message, resource, protocol);
+
+    std::map<std::string, ResourceState>::iterator it = mResourceStates.find(resource);
+    if(it == mResourceStates.end() || it->second.mSwitchConversationID != message.getConversationID())
+    {
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' ignores outdated answer from '" << message.getSender().getName() << "' for resource '" << resource << "'";
+        return;
+    }
+
+    if(!accepted)
+    {
+        finishSwitch(resource, false);
+        return;
+    }
+    AgentIDList& pending = it->second.mPendingAcceptances;
+    pending.erase(std::remove(pending.begin(), pending.end(), message.getSender()), pending.end());
+    if(pending.empty())
+    {
+        finishSwitch(resource, true);
+    }
+}
+
+void AdaptiveDLM::handleDecision(const fipa::acl::ACLMessage& message, bool commit)
+{
+    std::string resource;
+    protocol::Protocol protocol;
+    extractInformation(message, resource, protocol);
+
+    std::map<std::string, ResourceState>::iterator it = mResourceStates.find(resource);
+    if(it == mResourceStates.end() || it->second.mSwitchConversationID != message.getConversationID())
+    {
+        // We rejected the proposal, or the decision is outdated
+        return;
+    }
+
+    ResourceState& resourceState = it->second;
+    if(commit)
+    {
+        resourceState.mProtocol = protocol;
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' switched resource '" << resource << "' to protocol '" << getProtocolTxt(protocol) << "'";
+    }
+    resourceState.mSwitchConversationID.clear();
+    if(resourceState.mLockDeferred)
+    {
+        resourceState.mLockDeferred = false;
+        passOnRequest(resource, resourceState.mRequestAgents, resourceState.mRequestPriority);
+    }
+}
+
+void AdaptiveDLM::extractInformation(const fipa::acl::ACLMessage& message, std::string& resource, protocol::Protocol& protocol) const
+{
+    std::vector<std::string> strs;
+    std::string content = message.getContent();
+    boost::split(strs, content, boost::is_any_of("\n"));
+    if(strs.size() != 2)
+    {
+        throw std::runtime_error("AdaptiveDLM::extractInformation ACLMessage content malformed: " + content);
+    }
+    resource = strs[0];
+    protocol = getEngineProtocol(strs[1]);
+}
+
+protocol::Protocol AdaptiveDLM::getEngineProtocol(const std::string& name) const
+{
+    for(std::map<protocol::Protocol, DLM::Ptr>::const_iterator it = mEngines.begin(); it != mEngines.end(); ++it)
+    {
+        if(it->second->getProtocolName() == name)
+        {
+            return it->first;
+        }
+    }
+    throw std::runtime_error("AdaptiveDLM::getEngineProtocol unknown protocol: " + name);
+}
+
+std::string AdaptiveDLM::describeResource(const std::string& resource) const
+{
+    // Agents discovering the resource during a switch are told the old protocol, the switch is aborted then
+    return getProtocolTxt(getResourceProtocol(resource));
+}
+
+void AdaptiveDLM::resourceDescribed(const std::string& resource, const std::string& description)
+{
+    protocol::Protocol protocol = getEngineProtocol(description);
+    ResourceState& resourceState = mResourceStates[resource];
+    if(resourceState.mProtocol == protocol)
+    {
+        return;
+    }
+    if(!resourceState.mSwitchConversationID.empty() || resourceState.mAwaitingLock || resourceState.mLockDeferred
+            || getEngine(resource)->getLockState(resource) != lock_state::NOT_INTERESTED)
+    {
+        // The decision of the owner tells the protocol, or it refuses our request
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' keeps protocol '" << getProtocolTxt(resourceState.mProtocol)
+            << "' of resource '" << resource << "' in use";
+        return;
+    }
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' learned protocol '" << description << "' of resource '" << resource << "'";
+    resourceState.mProtocol = protocol;
+}
+
+} // namespace distributed_locking
+} // namespace fipa
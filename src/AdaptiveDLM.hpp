@@ -0,0 +1,298 @@
+#ifndef DISTRIBUTED_LOCKING_ADAPTIVE_DLM_HPP
+#define DISTRIBUTED_LOCKING_ADAPTIVE_DLM_HPP
+
+#include <map>
+#include <fipa_acl/fipa_acl.h>
+#include <distributed_locking/DLM.hpp>
+
+namespace fipa {
+namespace distributed_locking {
+/**
+ * Selects the protocol per resource. A Ricart Agrawala and a Suzuki Kasami instance run side by side, each resource
+ * is locked with one of them. Ricart Agrawala does not keep any state between critical sections and suits rarely used
+ * resources, while Suzuki Kasami lets an agent lock a resource repeatedly without any message, as long as it keeps
+ * the token, and needs fewer messages if requests queue up.
+ *
+ * The owner of a resource collects statistics about the lock acquisitions and requests it sees. After every
+ * decision window (see setDecisionWindow), it selects the protocol for the resource (see selectProtocol). A switch
+ * takes place once the resource is idle: the owner proposes it to all agents it knows, and only if all of them
+ * accept, since none of them holds or waits for the resource, the new protocol is used. Lock requests issued during
+ * the switch are passed on afterwards. A request or discovery by any agent during the switch aborts it, as that agent
+ * might not have been asked.
+ *
+ * Agents learn the protocol of a resource along with its owner on discovery. The owner refuses requests with another
+ * protocol than the current one, telling the requester the current protocol, so that it requests the lock again with
+ * it. The request with the outdated protocol is released as soon as it is granted, without being used. Agents accepting
+ * a switch away from Suzuki Kasami return the token to the owner, so that nobody else grants an outdated request.
+ *
+ * All agents locking a resource must use this DLM and include the owner of the resource in the agents passed to lock,
+ * so that the owner learns about everyone involved.
+ */
+class AdaptiveDLM : public DLM
+{
+public:
+    /**
+     * What the owner observed about a resource since the last decision
+     */
+    struct Statistics
+    {
+        // Number of times the lock was obtained
+        unsigned int mAcquisitions;
+        // Number of times the lock was obtained by the same agent as before
+        unsigned int mRepeatedAcquisitions;
+        // Number of requests issued while the resource was held
+        unsigned int mContendedRequests;
+
+        Statistics() : mAcquisitions(0), mRepeatedAcquisitions(0), mContendedRequests(0) {}
+    };
+
+    /**
+     * Constructor
+     */
+    AdaptiveDLM(const fipa::acl::AgentID& self, const std::vector<std::string>& resources);
+
+    /**
+     * Sets the number of lock acquisitions, after which the owner selects the protocol of a resource again
+     */
+    void setDecisionWindow(unsigned int acquisitions);
+
+    /**
+     * Gets the number of lock acquisitions, after which the owner selects the protocol of a resource again
+     */
+    unsigned int getDecisionWindow() const { return mDecisionWindow; }
+
+    /**
+     * Gets the protocol the resource is currently locked with
+     */
+    protocol::Protocol getResourceProtocol(const std::string& resource) const;
+
+    /**
+     * Tries to lock a resource with the protocol currently selected for it
+     */
+    virtual void lock(const std::string& resource, const fipa::acl::AgentIDList& agents);
+    /**
+     * Unlocks a resource, that must have been locked before
+     */
+    virtual void unlock(const std::string& resource);
+    /**
+     * Gets the lock state for a resource.
+     */
+    virtual lock_state::LockState getLockState(const std::string& resource) const;
+    /**
+     * This message is triggered by the higher instance that uses this library, if a message is received.
+     * Messages of the embedded protocols are passed on to the respective instance.
+     */
+    virtual bool onIncomingMessage(const fipa::acl::ACLMessage& message);
+    /**
+     * Runs the embedded instances as well
+     */
+    virtual void trigger();
+    /**
+     * Passes the failure on to the embedded instances and aborts a switch the agent takes part in
+     */
+    virtual void agentFailed(const fipa::acl::AgentID& agent);
+    /**
+     * Passes the failure on to the embedded instances, and aborts the switch of the conversation
+     */
+    virtual void onDeliveryFailure(const std::string& conversationID, const fipa::acl::AgentIDList& failedReceivers);
+
+protected:
+    /**
+     * The state of a resource
+     */
+    struct ResourceState
+    {
+        // The protocol the resource is locked with
+        protocol::Protocol mProtocol;
+        // The protocol selected at the last decision (owner only)
+        protocol::Protocol mSelectedProtocol;
+        // Whether a switch was rejected, and must not be retried before the lock was released again (owner only)
+        bool mSwitchRejected;
+        // Statistics since the last decision (owner only)
+        Statistics mStatistics;
+        // The agent that obtained the lock last, and the agents holding it (owner only)
+        fipa::acl::AgentID mLastHolder;
+        fipa::acl::AgentIDList mHolders;
+        // The conversation of the switch in progress, empty if there is none
+        std::string mSwitchConversationID;
+        // The agents asked, and the ones which did not accept the switch yet (owner only)
+        fipa::acl::AgentIDList mSwitchParticipants;
+        fipa::acl::AgentIDList mPendingAcceptances;
+        // Whether our own request was passed to the instance of the protocol and is not granted yet
+        bool mAwaitingLock;
+        // A request issued during a switch, which is passed on afterwards
+        bool mLockDeferred;
+        // Our request passed to the instance of an outdated protocol, which is released as soon as it is granted
+        bool mOutdatedRequest;
+        protocol::Protocol mOutdatedProtocol;
+        // Agents and priority of our last request, to pass it on after a switch or with the current protocol
+        fipa::acl::AgentIDList mRequestAgents;
+        priority::Priority mRequestPriority;
+
+        ResourceState()
+            : mProtocol(protocol::RICART_AGRAWALA)
+            , mSelectedProtocol(protocol::RICART_AGRAWALA)
+            , mSwitchRejected(false)
+            , mAwaitingLock(false)
+            , mLockDeferred(false)
+            , mOutdatedRequest(false)
+            , mOutdatedProtocol(protocol::RICART_AGRAWALA)
+            , mRequestPriority(priority::NORMAL)
+        {}
+    };
+
+    // The embedded instances, mapped to their protocols
+    std::map<protocol::Protocol, DLM::Ptr> mEngines;
+    // All resources mapped to their ResourceStates
+    std::map<std::string, ResourceState> mResourceStates;
+    // All agents we exchanged lock messages with. A switch is proposed to all of them.
+    fipa::acl::AgentIDList mKnownAgents;
+    unsigned int mDecisionWindow;
+
+    /**
+     * Selects the protocol for a resource, after the decision window is full. Subclasses can implement other policies.
+     * The default selects Suzuki Kasami, if at least half of the acquisitions were repeated by the same agent or
+     * had to wait, and Ricart Agrawala otherwise.
+     */
+    virtual protocol::Protocol selectProtocol(const std::string& resource, const Statistics& statistics) const;
+
+    /**
+     * Gets the instance the resource is currently locked with
+     */
+    DLM::Ptr getEngine(const std::string& resource) const;
+
+    /**
+     * Aborts the switch of the given conversation, if we own the resource
+     */
+    void handleFailedSwitch(const std::string& conversationID);
+
+    /**
+     * Passes the token of a resource, if we hold it, back to the owner, releasing a lock of the embedded Suzuki
+     * Kasami instance
+     */
+    void returnToken(const std::string& resource);
+
+    /**
+     * Passes a message on to an embedded instance
+     */
+    bool forwardMessage(DLM& engine, const fipa::acl::ACLMessage& message);
+
+    /**
+     * Updates the statistics of our own resources from a message of an embedded protocol. Messages of another
+     * protocol than the one of the resource are not counted.
+     */
+    void observe(const fipa::acl::ACLMessage& message);
+
+    /**
+     * Checks the protocol of a request for our own resources: a request with the current protocol aborts a switch in
+     * progress, a request with another protocol is refused (owner only)
+     */
+    void checkRequestProtocol(const fipa::acl::ACLMessage& message, protocol::Protocol protocol);
+
+    /**
+     * Aborts a switch of an owned resource in progress, if the sender of the discovery was not asked (owner only)
+     */
+    void handleDiscovery(const fipa::acl::ACLMessage& message);
+
+    /**
+     * Adopts the current protocol of a resource, after the owner refused a request with an outdated one, and requests
+     * the lock again with it if the request was ours
+     */
+    void handleRefusal(const fipa::acl::ACLMessage& message);
+
+    /**
+     * Gets the resources a request of an embedded protocol refers to
+     */
+    static std::vector<std::string> getRequestedResources(const fipa::acl::ACLMessage& message);
+
+    /**
+     * Counts a lock acquisition of an owned resource, and selects the protocol after a full decision window
+     */
+    void recordAcquisition(const std::string& resource, const fipa::acl::AgentID& agent);
+
+    /**
+     * Counts a request for an owned resource
+     */
+    void recordRequest(const std::string& resource);
+
+    /**
+     * Adds an agent to the known agents
+     */
+    void addKnownAgent(const fipa::acl::AgentID& agent);
+
+    /**
+     * Adds sender and receivers of a message to the known agents
+     */
+    void addKnownAgents(const fipa::acl::ACLMessage& message);
+
+    /**
+     * Checks whether our own requests were granted, and releases granted requests of outdated protocols
+     */
+    void updateOwnRequests();
+
+    /**
+     * Starts the switches of all idle resources, for which another protocol was selected (owner only)
+     */
+    void processSwitches();
+
+    /**
+     * Proposes the switch of a resource to all known agents (owner only)
+     */
+    void startSwitch(const std::string& resource);
+
+    /**
+     * Commits or aborts the switch of a resource (owner only)
+     */
+    void finishSwitch(const std::string& resource, bool commit);
+
+    /**
+     * Accepts or rejects the proposed switch of a resource
+     */
+    void handleProposal(const fipa::acl::ACLMessage& message);
+
+    /**
+     * Handles the answer of an agent to our proposal (owner only)
+     */
+    void handleProposalAnswer(const fipa::acl::ACLMessage& message, bool accepted);
+
+    /**
+     * Handles the decision of the owner about a switch
+     */
+    void handleDecision(const fipa::acl::ACLMessage& message, bool commit);
+
+    /**
+     * Tries to lock a resource with the given priority class, with the protocol currently selected for it
+     */
+    virtual void requestLock(const std::string& resource, const AgentGroup& agents, priority::Priority priority);
+
+    /**
+     * Passes a request on to the instance of the protocol, also one deferred during a switch
+     */
+    void passOnRequest(const std::string& resource, const fipa::acl::AgentIDList& agents, priority::Priority priority);
+
+    /**
+     * Extracts resource and protocol from the content of a switch message
+     */
+    void extractInformation(const fipa::acl::ACLMessage& message, std::string& resource, protocol::Protocol& protocol) const;
+
+    /**
+     * Gets the protocol of the embedded instance with the given protocol name
+     * \throws std::runtime_error if there is no such instance
+     */
+    protocol::Protocol getEngineProtocol(const std::string& name) const;
+
+    /**
+     * Tells discovering agents the protocol of the resource
+     */
+    virtual std::string describeResource(const std::string& resource) const;
+
+    /**
+     * Adopts the protocol the owner told, unless a switch or our own request decides the protocol
+     */
+    virtual void resourceDescribed(const std::string& resource, const std::string& description);
+};
+
+} // namespace distributed_locking
+} // namespace fipa
+
+#endif // DISTRIBUTED_LOCKING_ADAPTIVE_DLM_HPP
@@ -0,0 +1,32 @@
+#include "AgentDirectory.hpp"
+
+namespace fipa {
+namespace distributed_locking {
+
+unsigned int AgentDirectory::insert(const fipa::acl::AgentID& agent)
+{
+    std::map<fipa::acl::AgentID, unsigned int>::const_iterator cit = mIndices.find(agent);
+    if(cit != mIndices.end())
+    {
+        return cit->second;
+    }
+
+    unsigned int index = mAgents.size();
+    mAgents.push_back(agent);
+    mIndices[agent] = index;
+    return index;
+}
+
+bool AgentDirectory::find(const fipa::acl::AgentID& agent, unsigned int& index) const
+{
+    std::map<fipa::acl::AgentID, unsigned int>::const_iterator cit = mIndices.find(agent);
+    if(cit == mIndices.end())
+    {
+        return false;
+    }
+    index = cit->second;
+    return true;
+}
+
+} // namespace distributed_locking
+} // namespace fipa
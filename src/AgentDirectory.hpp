@@ -0,0 +1,47 @@
+#ifndef DISTRIBUTED_LOCKING_AGENT_DIRECTORY_HPP
+#define DISTRIBUTED_LOCKING_AGENT_DIRECTORY_HPP
+
+#include <map>
+#include <vector>
+#include <fipa_acl/fipa_acl.h>
+
+namespace fipa {
+namespace distributed_locking {
+/**
+ * Maps agents to dense indices, so that per-agent state can be kept in index-aligned vectors and bitsets instead of
+ * maps keyed by agent. Indices are local to one DLM instance and remain valid for its lifetime.
+ */
+class AgentDirectory
+{
+public:
+    /**
+     * Gets the index of an agent, the agent is added if it is not known yet
+     */
+    unsigned int insert(const fipa::acl::AgentID& agent);
+
+    /**
+     * Looks up the index of an agent, returns false if the agent is not known
+     */
+    bool find(const fipa::acl::AgentID& agent, unsigned int& index) const;
+
+    /**
+     * Gets the agent with the given index
+     */
+    const fipa::acl::AgentID& getAgent(unsigned int index) const { return mAgents.at(index); }
+
+    /**
+     * Number of known agents, all indices are below
+     */
+    unsigned int size() const { return mAgents.size(); }
+
+private:
+    // All agents, by index
+    std::vector<fipa::acl::AgentID> mAgents;
+    // All agents mapped to their index
+    std::map<fipa::acl::AgentID, unsigned int> mIndices;
+};
+
+} // namespace distributed_locking
+} // namespace fipa
+
+#endif // DISTRIBUTED_LOCKING_AGENT_DIRECTORY_HPP
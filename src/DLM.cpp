@@ -3,6 +3,9 @@
 #include "RicartAgrawalaExtended.hpp"
 #include "SuzukiKasami.hpp"
 #include "SuzukiKasamiExtended.hpp"
+#include "HierarchicalDLM.hpp"
+#include "LodhaKshemkalyani.hpp"
+#include "AdaptiveDLM.hpp"
 
 #include <stdexcept>
 #include <boost/assign/list_of.hpp>
@@ -16,6 +19,25 @@ using namespace fipa::acl;
 namespace fipa {
 namespace distributed_locking {
 
+namespace {
+
+/**
+ * Whether a map of resources contains the given resource, or a part of it
+ */
+template<typename T>
+bool containsPart(const std::map<std::string, T>& resources, const std::string& resource)
+{
+    if(resources.count(resource) != 0)
+    {
+        return true;
+    }
+    std::string prefix = resource + DLM::RESOURCE_SEPARATOR;
+    typename std::map<std::string, T>::const_iterator it = resources.lower_bound(prefix);
+    return it != resources.end() && it->first.compare(0, prefix.size(), prefix) == 0;
+}
+
+} // namespace
+
 // Initialize the Protocol->string mapping
 std::map<protocol::Protocol, std::string> DLM::protocolTxt = boost::assign::map_list_of
     (protocol::DLM_DISCOVER, "dlm_discover")
@@ -23,7 +45,10 @@ std::map<protocol::Protocol, std::string> DLM::protocolTxt = boost::assign::map_
     (protocol::RICART_AGRAWALA, "ricart_agrawala")
     (protocol::RICART_AGRAWALA_EXTENDED, "ricart_agrawala_extended")
     (protocol::SUZUKI_KASAMI, "suzuki_kasami")
-    (protocol::SUZUKI_KASAMI_EXTENDED, "suzuki_kasami_extended");
+    (protocol::SUZUKI_KASAMI_EXTENDED, "suzuki_kasami_extended")
+    (protocol::HIERARCHICAL, "hierarchical")
+    (protocol::LODHA_KSHEMKALYANI, "lodha_kshemkalyani")
+    (protocol::ADAPTIVE, "adaptive");
 
 
 DLM::Ptr DLM::create(fipa::distributed_locking::protocol::Protocol implementation, const fipa::acl::AgentID& self, const std::vector< std::string >& resources)
@@ -38,6 +63,12 @@ DLM::Ptr DLM::create(fipa::distributed_locking::protocol::Protocol implementatio
             return DLM::Ptr( new SuzukiKasami(self, resources) );
         case protocol::SUZUKI_KASAMI_EXTENDED:
             return DLM::Ptr( new SuzukiKasamiExtended(self, resources) );
+        case protocol::HIERARCHICAL:
+            return DLM::Ptr( new HierarchicalDLM(self, resources) );
+        case protocol::LODHA_KSHEMKALYANI:
+            return DLM::Ptr( new LodhaKshemkalyani(self, resources) );
+        case protocol::ADAPTIVE:
+            return DLM::Ptr( new AdaptiveDLM(self, resources) );
         default:
             throw std::invalid_argument("fipa::distributed_locking::DLM: unknown protocol requested");
     }
@@ -47,14 +78,17 @@ DLM::DLM(protocol::Protocol protocol, const fipa::acl::AgentID& self, const std:
     : mSelf(self)
     , mProtocol(protocol)
     , mConversationIDnum(0)
-    , mConversationMonitor(self)
+    , mCachedOwners(0)
+    , mOwnerCacheCapacity(0)
+    , mReentrant(false)
     , mProbeTimeoutInS(3)
+    , mPrefetchWindowInS(1)
 {
     std::vector<std::string>::const_iterator cit = resources.begin();
     for(; cit != resources.end(); ++cit)
     {
         LOG_DEBUG_S << "Register: resource '" << *cit << "' with owner: '" << self.getName() << "'";
-        mOwnedResources[*cit] = mSelf;
+        mOwnedResources[*cit].mOwner = mSelf;
     }
 }
 
@@ -79,19 +113,26 @@ void DLM::setSelf(const fipa::acl::AgentID& self)
 }
 
 fipa::acl::ACLMessage DLM::popNextOutgoingMessage()
+{
+    fipa::acl::ACLMessage msg;
+    popNextOutgoingMessage(msg);
+    return msg;
+}
+
+void DLM::popNextOutgoingMessage(fipa::acl::ACLMessage& message)
 {
     if(!hasOutgoingMessages())
     {
         throw std::runtime_error("DLM::popNextOutgoingMessage no messages");
     }
-    fipa::acl::ACLMessage msg = mOutgoingMessages.front();
-    mOutgoingMessages.pop_front();
-    return msg;
+    message = mOutgoingMessages.front();
+    // Keep the node for the next outgoing message
+    mSpareMessages.splice(mSpareMessages.end(), mOutgoingMessages, mOutgoingMessages.begin());
 }
 
 bool DLM::hasOutgoingMessages() const
 {
-    return mOutgoingMessages.size() != 0;
+    return !mOutgoingMessages.empty();
 }
 
 void DLM::lock(const std::string& resource, const AgentIDList& agents)
@@ -99,6 +140,241 @@ void DLM::lock(const std::string& resource, const AgentIDList& agents)
     throw std::runtime_error("DLM::lock not implemented");
 }
 
+void DLM::lock(const std::string& resource, const AgentIDList& agents, priority::Priority priority)
+{
+    requestLock(resource, getPartners(agents), priority);
+}
+
+void DLM::requestLock(const std::string& resource, const AgentGroup& agents, priority::Priority priority)
+{
+    lock(resource, *agents);
+}
+
+void DLM::lockGroup(const std::string& resource, const std::string& group, priority::Priority priority)
+{
+    // The implementations share the snapshot instead of copying the agents
+    requestLock(resource, getGroup(group), priority);
+}
+
+void DLM::defineGroup(const std::string& group, const AgentIDList& agents)
+{
+    Group& entry = mGroups[group];
+    entry.mAgents.reset(new AgentIDList(agents));
+    ++entry.mVersion;
+}
+
+void DLM::joinGroup(const std::string& group, const fipa::acl::AgentID& agent)
+{
+    Group& entry = mGroups[group];
+    if(std::find(entry.mAgents->begin(), entry.mAgents->end(), agent) != entry.mAgents->end())
+    {
+        return;
+    }
+    boost::shared_ptr<AgentIDList> agents(new AgentIDList(*entry.mAgents));
+    agents->push_back(agent);
+    entry.mAgents = agents;
+    ++entry.mVersion;
+}
+
+void DLM::leaveGroup(const std::string& group, const fipa::acl::AgentID& agent)
+{
+    std::map<std::string, Group>::iterator it = mGroups.find(group);
+    if(it == mGroups.end() || std::find(it->second.mAgents->begin(), it->second.mAgents->end(), agent) == it->second.mAgents->end())
+    {
+        return;
+    }
+    boost::shared_ptr<AgentIDList> agents(new AgentIDList(*it->second.mAgents));
+    agents->erase(std::remove(agents->begin(), agents->end(), agent), agents->end());
+    it->second.mAgents = agents;
+    ++it->second.mVersion;
+}
+
+DLM::AgentGroup DLM::getGroup(const std::string& group) const
+{
+    std::map<std::string, Group>::const_iterator cit = mGroups.find(group);
+    if(cit == mGroups.end())
+    {
+        throw std::invalid_argument("DLM::getGroup: group '" + group + "' is not defined");
+    }
+    return cit->second.mAgents;
+}
+
+unsigned int DLM::getGroupVersion(const std::string& group) const
+{
+    std::map<std::string, Group>::const_iterator cit = mGroups.find(group);
+    if(cit == mGroups.end())
+    {
+        return 0;
+    }
+    return cit->second.mVersion;
+}
+
+DLM::AgentGroup DLM::getPartners(const AgentIDList& agents) const
+{
+    return AgentGroup(new AgentIDList(agents));
+}
+
+DLM::LatencyStatistics DLM::getLatencyStatistics(priority::Priority priority) const
+{
+    std::map<priority::Priority, LatencyStatistics>::const_iterator cit = mLatencyStatistics.find(priority);
+    if(cit != mLatencyStatistics.end())
+    {
+        return cit->second;
+    }
+    return LatencyStatistics();
+}
+
+void DLM::lockRequested(const std::string& resource, priority::Priority priority)
+{
+    touchOwner(resource);
+    mPendingRequests[resource] = std::make_pair(base::Time::now(), priority);
+}
+
+void DLM::lockGranted(const std::string& resource)
+{
+    std::map<std::string, std::pair<base::Time, priority::Priority> >::iterator it = mPendingRequests.find(resource);
+    if(it == mPendingRequests.end())
+    {
+        return;
+    }
+    double latency = (base::Time::now() - it->second.first).toSeconds();
+    LatencyStatistics& statistics = mLatencyStatistics[it->second.second];
+    ++statistics.mCount;
+    statistics.mTotalInS += latency;
+    statistics.mMaxInS = std::max(statistics.mMaxInS, latency);
+    mPendingRequests.erase(it);
+}
+
+void DLM::lockAbandoned(const std::string& resource)
+{
+    mPendingRequests.erase(resource);
+}
+
+void DLM::prefetch(const std::string& resource, const AgentIDList& agents)
+{
+    lock_state::LockState state = getLockState(resource);
+    if(state == lock_state::INTERESTED || state == lock_state::LOCKED)
+    {
+        // Requested or held by lock() already, which must not be released by the prefetch window
+        return;
+    }
+    lock(resource, agents);
+    // The lock may have been granted at once, e.g. if we hold the token already
+    mPrefetches[resource] = getLockState(resource) == lock_state::LOCKED ? base::Time::now() : base::Time();
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' prefetches resource '" << resource << "'";
+}
+
+bool DLM::isPrefetched(const std::string& resource) const
+{
+    return mPrefetches.count(resource) != 0;
+}
+
+void DLM::setPrefetchWindow(double timeInS)
+{
+    if(timeInS < 0)
+    {
+        throw std::invalid_argument("DLM::setPrefetchWindow: the window must not be negative");
+    }
+    mPrefetchWindowInS = timeInS;
+}
+
+bool DLM::claimPrefetch(const std::string& resource)
+{
+    if(mPrefetches.erase(resource) == 0)
+    {
+        return false;
+    }
+    // If the prefetched request failed, lock() has to deal with it
+    lock_state::LockState state = getLockState(resource);
+    return state == lock_state::INTERESTED || state == lock_state::LOCKED;
+}
+
+bool DLM::reenter(const std::string& resource)
+{
+    if(!mReentrant)
+    {
+        return false;
+    }
+    lock_state::LockState state = getLockState(resource);
+    if(state != lock_state::INTERESTED && state != lock_state::LOCKED)
+    {
+        return false;
+    }
+    unsigned int& reentries = mReentries[resource];
+    ++reentries;
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' reenters resource '" << resource << "', nesting " << reentries + 1;
+    return true;
+}
+
+bool DLM::leave(const std::string& resource)
+{
+    // A prefetched lock can be released without taking it over
+    mPrefetches.erase(resource);
+    std::map<std::string, unsigned int>::iterator it = mReentries.find(resource);
+    if(it == mReentries.end())
+    {
+        return false;
+    }
+    lock_state::LockState state = getLockState(resource);
+    if(state != lock_state::INTERESTED && state != lock_state::LOCKED)
+    {
+        // The lock failed meanwhile, so the nesting is void
+        mReentries.erase(it);
+        return false;
+    }
+    if(--it->second == 0)
+    {
+        mReentries.erase(it);
+    }
+    return true;
+}
+
+unsigned int DLM::getLockCount(const std::string& resource) const
+{
+    lock_state::LockState state = getLockState(resource);
+    if(state != lock_state::INTERESTED && state != lock_state::LOCKED)
+    {
+        return 0;
+    }
+    std::map<std::string, unsigned int>::const_iterator cit = mReentries.find(resource);
+    return cit == mReentries.end() ? 1 : cit->second + 1;
+}
+
+void DLM::releaseExpiredPrefetches()
+{
+    base::Time now = base::Time::now();
+    std::vector<std::string> expired;
+    std::map<std::string, base::Time>::iterator it = mPrefetches.begin();
+    while(it != mPrefetches.end())
+    {
+        lock_state::LockState state = getLockState(it->first);
+        if(state == lock_state::LOCKED)
+        {
+            if(it->second.isNull())
+            {
+                it->second = now;
+            } else if(now > it->second + base::Time::fromSeconds(mPrefetchWindowInS))
+            {
+                expired.push_back(it->first);
+            }
+            ++it;
+        } else if(state != lock_state::INTERESTED)
+        {
+            // The request failed, there is nothing to release
+            mPrefetches.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+
+    for(std::vector<std::string>::const_iterator cit = expired.begin(); cit != expired.end(); ++cit)
+    {
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' releases prefetched resource '" << *cit << "', which was not locked in time";
+        mPrefetches.erase(*cit);
+        unlock(*cit);
+    }
+}
+
 void DLM::unlock(const std::string& resource)
 {
     throw std::runtime_error("DLM::unlock not implemented");
@@ -114,10 +390,14 @@ void DLM::agentFailed(const fipa::acl::AgentID& agent)
     throw std::runtime_error("DLM::agentFailed not implemented");
 }
 
+void DLM::onDeliveryFailure(const std::string& conversationID, const fipa::acl::AgentIDList& failedReceivers)
+{
+    throw std::runtime_error("DLM::onDeliveryFailure not implemented");
+}
+
 bool DLM::onIncomingMessage(const acl::ACLMessage& message)
 {
-    fipa::acl::ConversationPtr conversation = mConversationMonitor.getOrCreateConversation(message.getConversationID());
-    conversation->update(message);
+    mProtocolValidator.update(message);
 
     // Debug:
     if(fipa::acl::ACLMessage::performativeFromString(message.getPerformative()) == fipa::acl::ACLMessage::FAILURE)
@@ -156,7 +436,7 @@ void DLM::discover(const std::string& resource, const AgentIDList& agents)
     {
         return;
     } else {
-        mOwnedResources[resource] = AgentID();
+        addPendingOwnerQuery(resource);
         LOG_DEBUG_S << "'" << mSelf.getName() << "' query ownership information on '" << resource << "'";
         // Otherwise send a broadcast message to get that information
         using namespace fipa::acl;
@@ -183,11 +463,30 @@ bool DLM::onIncomingDLMMessage(const acl::ACLMessage& message)
         case ACLMessage::QUERY_IF:
         {
             std::string resource = message.getContent();
-            // If we are the physical owner of that resource, we reply with that information. Otherwise, we ignore the message
-            if(mOwnedResources[resource] == mSelf)
+            // If we are the physical owner of that resource (or a resource it is part of), we reply with that information.
+            // Otherwise, we ignore the message
+            std::string root = getOwnedRoot(resource);
+            if(root.empty())
+            {
+                // The owner's reply is broadcast, so we can learn the owner as well
+                addPendingOwnerQuery(resource, false);
+            }
+            else if(mOwnedResources[root].mOwner == mSelf)
             {
                 // By making the reply also a broadcast, we can save messages later, if other agents want to lock the same resource
-                ACLMessage response = prepareMessage(ACLMessage::INFORM, getProtocolTxt(protocol::DLM_DISCOVER), resource);
+                ACLMessage response = prepareMessage(ACLMessage::INFORM, getProtocolTxt(protocol::DLM_DISCOVER), root);
+                // Our inform messages are in the format "RESOURCE_IDENTIFIER[\nCAPACITY[\nDESCRIPTION]]", the capacity is
+                // only given if it is not 1 or a description follows
+                unsigned int capacity = getResourceCapacity(root);
+                std::string description = describeResource(root);
+                if(capacity != 1 || !description.empty())
+                {
+                    response.setContent(root + "\n" + boost::lexical_cast<std::string>(capacity));
+                }
+                if(!description.empty())
+                {
+                    response.setContent(response.getContent() + "\n" + description);
+                }
 
                 // Broadcasting to all receivers
                 fipa::acl::AgentIDList receivers = message.getAllReceivers();
@@ -215,11 +514,27 @@ bool DLM::onIncomingDLMMessage(const acl::ACLMessage& message)
         case ACLMessage::INFORM:
             {
                 // inform about ownership of this resource
-                std::string resource = message.getContent();
+                std::vector<std::string> strs;
+                std::string content = message.getContent();
+                boost::split(strs, content, boost::is_any_of("\n"));
+                std::string resource = strs[0];
                 ResourceAgentMap::iterator it = mOwnedResources.find(resource);
                 if(it != mOwnedResources.end())
                 {
-                    mOwnedResources[resource] = message.getSender();
+                    // The query was the use, if it was ours
+                    setOwner(resource, message.getSender(), false);
+                    addParticipant(resource, message.getSender());
+                    unsigned int capacity = strs.size() > 1 ? boost::lexical_cast<unsigned int>(strs[1]) : 1;
+                    if(capacity != 1)
+                    {
+                        mResourceCapacities[resource] = capacity;
+                    } else {
+                        mResourceCapacities.erase(resource);
+                    }
+                    if(strs.size() > 2)
+                    {
+                        resourceDescribed(resource, strs[2]);
+                    }
                     LOG_DEBUG_S << "'" << mSelf.getName() << "' received owner information about '" << resource << "': " << message.getSender().getName();
                     return true;
                 } else {
@@ -233,7 +548,7 @@ bool DLM::onIncomingDLMMessage(const acl::ACLMessage& message)
                 // confirmed that resource lock is held by the sender of
                 // the received message
                 std::string resource = message.getContent();
-                mLockHolders[resource] = message.getSender();
+                addLockHolder(resource, message.getSender());
 
                 LOG_DEBUG_S << "'" << mSelf.getName() << "' received confirmation about lock on resource '" << resource << "' from " << message.getSender().getName();
 
@@ -250,11 +565,8 @@ bool DLM::onIncomingDLMMessage(const acl::ACLMessage& message)
                 stopRequestingProbes(message.getSender(), resource);
 
                 LOG_DEBUG_S << "'" << mSelf.getName() << "' received confirmation about release of lock on resource '" << resource << "' from " << message.getSender().getName();
-                if(message.getSender() == mLockHolders[resource])
-                {
-                    // Only erase if the sender was the logical owner, as messages can come in wrong order
-                    mLockHolders.erase(resource);
-                }
+                // Only erases if the sender was a logical owner, as messages can come in wrong order
+                removeLockHolder(resource, message.getSender());
             }
             return true;
         default:
@@ -281,7 +593,11 @@ bool DLM::onIncomingProbeMessage(const acl::ACLMessage& message)
     {
         LOG_DEBUG_S << "'" << mSelf.getName() << "' received probe reply from '" << message.getSender().getName();
         // Set success in the ProbeRunner
-        mProbeRunners[message.getSender()].mSuccess = true;
+        ProbeRunnerMap::iterator it = mProbeRunners.find(message.getSender());
+        if(it != mProbeRunners.end())
+        {
+            it->second.mSuccess = true;
+        }
     }
 
     return true;
@@ -289,24 +605,179 @@ bool DLM::onIncomingProbeMessage(const acl::ACLMessage& message)
 
 bool DLM::hasKnownOwner(const std::string& resource) const
 {
-    ResourceAgentMap::const_iterator cit = mOwnedResources.find(resource);
+    std::string root = getOwnedRoot(resource);
     // if we already know the physical owner of that resource, we don't have to do anything
-    if(cit !=  mOwnedResources.end() && cit->second != fipa::acl::AgentID())
+    if(!root.empty())
     {
-        LOG_DEBUG_S << "Found owner: '" << cit->second.getName() << "' for resource '" << resource << "'";
+        LOG_DEBUG_S << "Found owner: '" << mOwnedResources.find(root)->second.mOwner.getName() << "' for resource '" << resource << "'";
         return true;
     }
     LOG_WARN_S << mSelf.getName() << " did not know the owner of '" << resource << "'";
     return false;
 }
 
+std::string DLM::getOwnedRoot(const std::string& resource) const
+{
+    std::string name = resource;
+    while(true)
+    {
+        ResourceAgentMap::const_iterator cit = mOwnedResources.find(name);
+        if(cit != mOwnedResources.end() && cit->second.mOwner != fipa::acl::AgentID())
+        {
+            return name;
+        }
+        size_t pos = name.rfind(RESOURCE_SEPARATOR);
+        if(pos == std::string::npos)
+        {
+            return std::string();
+        }
+        name.erase(pos);
+    }
+}
+
+void DLM::addPendingOwnerQuery(const std::string& resource, bool used)
+{
+    // The owner answers with the resource it physically owns, which can be any resource the given one is part of
+    std::string name = resource;
+    while(true)
+    {
+        if(mOwnedResources.find(name) == mOwnedResources.end())
+        {
+            setOwner(name, fipa::acl::AgentID(), used);
+        }
+        size_t pos = name.rfind(RESOURCE_SEPARATOR);
+        if(pos == std::string::npos)
+        {
+            break;
+        }
+        name.erase(pos);
+    }
+}
+
+std::string DLM::describeResource(const std::string& resource) const
+{
+    return std::string();
+}
+
+void DLM::resourceDescribed(const std::string& resource, const std::string& description)
+{
+}
+
+fipa::acl::AgentID DLM::getOwner(const std::string& resource) const
+{
+    std::string root = getOwnedRoot(resource);
+    if(root.empty())
+    {
+        return fipa::acl::AgentID();
+    }
+    return mOwnedResources.find(root)->second.mOwner;
+}
+
+void DLM::setOwner(const std::string& resource, const fipa::acl::AgentID& owner, bool used)
+{
+    ResourceAgentMap::iterator it = mOwnedResources.insert(std::make_pair(resource, OwnerInformation())).first;
+    it->second.mOwner = owner;
+    touchOwner(it, used);
+}
+
+void DLM::touchOwner(const std::string& resource)
+{
+    if(mOwnerCacheCapacity == 0)
+    {
+        return;
+    }
+    std::string root = getOwnedRoot(resource);
+    if(!root.empty())
+    {
+        touchOwner(mOwnedResources.find(root));
+    }
+}
+
+void DLM::touchOwner(ResourceAgentMap::iterator it, bool used)
+{
+    if(mOwnerCacheCapacity == 0 || it->second.mOwner == mSelf)
+    {
+        return;
+    }
+    if(it->second.mCached)
+    {
+        if(used)
+        {
+            // Move to the most recently used end
+            mOwnerRecency.splice(mOwnerRecency.end(), mOwnerRecency, it->second.mRecency);
+        }
+    } else {
+        it->second.mCached = true;
+        it->second.mRecency = mOwnerRecency.insert(used ? mOwnerRecency.end() : mOwnerRecency.begin(), &it->first);
+        ++mCachedOwners;
+        evictOwners();
+    }
+}
+
+void DLM::evictOwners()
+{
+    std::list<const std::string*>::iterator it = mOwnerRecency.begin();
+    while(mCachedOwners > mOwnerCacheCapacity && it != mOwnerRecency.end())
+    {
+        const std::string* resource = *it;
+        if(isInUse(*resource))
+        {
+            // Otherwise the confirmations of the lock could not be sent any more
+            ++it;
+            continue;
+        }
+        it = mOwnerRecency.erase(it);
+        --mCachedOwners;
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' forgets the owner of resource '" << *resource << "'";
+        // The capacity is sent along with the owner information, so it is forgotten as well
+        mResourceCapacities.erase(*resource);
+        ResourceAgentMap::iterator owned = mOwnedResources.find(*resource);
+        // The owner was recorded as participant, when we learned about it
+        removeParticipant(*resource, owned->second.mOwner);
+        mOwnedResources.erase(owned);
+    }
+}
+
+bool DLM::isInUse(const std::string& resource) const
+{
+    lock_state::LockState state = getLockState(resource);
+    return state == lock_state::INTERESTED || state == lock_state::LOCKED
+        || containsPart(mPendingRequests, resource) || containsPart(mPrefetches, resource)
+        || containsPart(mReentries, resource);
+}
+
+void DLM::setOwnerCacheCapacity(unsigned int resources)
+{
+    if(resources == 0)
+    {
+        // Nothing is forgotten any more
+        for(ResourceAgentMap::iterator it = mOwnedResources.begin(); it != mOwnedResources.end(); ++it)
+        {
+            it->second.mCached = false;
+        }
+        mOwnerRecency.clear();
+        mCachedOwners = 0;
+    }
+    bool wasLimited = mOwnerCacheCapacity != 0;
+    mOwnerCacheCapacity = resources;
+    if(resources != 0 && !wasLimited)
+    {
+        // The information known so far is regarded as used in the order of the resource names
+        for(ResourceAgentMap::iterator it = mOwnedResources.begin(); it != mOwnedResources.end(); ++it)
+        {
+            touchOwner(it);
+        }
+    }
+    evictOwners();
+}
+
 void DLM::lockObtained(const std::string& resource, const std::string& conversationId)
 {
     LOG_DEBUG_S << "CONFIRM that '" << mSelf.getName() << " obtained lock for '" << resource << "'";
-    if(mOwnedResources[resource] == mSelf)
+    if(getOwner(resource) == mSelf)
     {
         // If this is our own resource, we can simply set us as the logical owner
-        mLockHolders[resource] = mSelf;
+        addLockHolder(resource, mSelf);
     } else
     {
         if(!hasKnownOwner(resource))
@@ -321,7 +792,7 @@ void DLM::lockObtained(const std::string& resource, const std::string& conversat
         ACLMessage message = prepareMessage(ACLMessage::CONFIRM, getProtocolName(), resource);
         message.setConversationID(conversationId);
         // send to owner
-        message.addReceiver( mOwnedResources[resource] );
+        message.addReceiver( getOwner(resource) );
         // Add to outgoing messages
         sendMessage(message);
     }
@@ -329,27 +800,50 @@ void DLM::lockObtained(const std::string& resource, const std::string& conversat
 
 fipa::acl::ACLMessage DLM::prepareMessage(fipa::acl::ACLMessage::Performative performative, const std::string& protocol, const std::string& content)
 {
-    ACLMessage message(performative);
+    ACLMessage message;
+    prepareMessage(message, performative, protocol, content);
+    return message;
+}
+
+void DLM::prepareMessage(fipa::acl::ACLMessage& message, fipa::acl::ACLMessage::Performative performative, const std::string& protocol,
+        const std::string& content)
+{
+    message.setPerformative(performative);
     // Add sender
     message.setSender(mSelf);
     // The DLM protocol is not in the Protocol enum, as it is not a DLM implementation!
     message.setProtocol(protocol);
     message.setContent(content);
     // Set and increase conversation ID
-    message.setConversationID(mSelf.getName() + "_" + boost::lexical_cast<std::string>(mConversationIDnum++));
-    return message;
+    mConversationIDBuffer = mSelf.getName();
+    mConversationIDBuffer += '_';
+    mConversationIDBuffer += mConversationIDTag;
+    appendNumber(mConversationIDBuffer, mConversationIDnum++);
+    message.setConversationID(mConversationIDBuffer);
+}
+
+void DLM::appendNumber(std::string& buffer, unsigned long long number)
+{
+    char digits[20];
+    unsigned int count = 0;
+    do
+    {
+        digits[count++] = '0' + number % 10;
+        number /= 10;
+    } while(number != 0);
+    while(count != 0)
+    {
+        buffer += digits[--count];
+    }
 }
 
 void DLM::lockReleased(const std::string& resource, const std::string& conversationId)
 {
-    if(mOwnedResources[resource] == mSelf)
+    if(getOwner(resource) == mSelf)
     {
         // If this is our own resource, we can simply unset us as the logical owner
-        // Only erase if we were the logical owner
-        if(mLockHolders[resource] == mSelf)
-        {
-            mLockHolders.erase(resource);
-        }
+        // Only erases if we were the logical owner
+        removeLockHolder(resource, mSelf);
     }
     else
     {
@@ -362,13 +856,74 @@ void DLM::lockReleased(const std::string& resource, const std::string& conversat
 
         using namespace fipa::acl;
         ACLMessage message = prepareMessage(ACLMessage::DISCONFIRM, getProtocolName(), resource);
-        message.addReceiver(mOwnedResources[resource]);
+        message.addReceiver(getOwner(resource));
         message.setConversationID(conversationId);
         // Add to outgoing messages
         sendMessage(message);
     }
 }
 
+void DLM::addLockHolder(const std::string& resource, const fipa::acl::AgentID& agent)
+{
+    AgentIDList& holders = mLockHolders[resource];
+    if(std::find(holders.begin(), holders.end(), agent) == holders.end())
+    {
+        holders.push_back(agent);
+    }
+}
+
+bool DLM::removeLockHolder(const std::string& resource, const fipa::acl::AgentID& agent)
+{
+    ResourceAgentsMap::iterator it = mLockHolders.find(resource);
+    if(it == mLockHolders.end())
+    {
+        return false;
+    }
+
+    AgentIDList& holders = it->second;
+    AgentIDList::iterator hit = std::find(holders.begin(), holders.end(), agent);
+    if(hit == holders.end())
+    {
+        return false;
+    }
+    holders.erase(hit);
+    if(holders.empty())
+    {
+        mLockHolders.erase(it);
+    }
+    return true;
+}
+
+void DLM::setResourceCapacity(const std::string& resource, unsigned int capacity)
+{
+    ResourceAgentMap::const_iterator cit = mOwnedResources.find(resource);
+    if(cit == mOwnedResources.end() || cit->second.mOwner != mSelf)
+    {
+        throw std::invalid_argument("DLM::setResourceCapacity: '" + mSelf.getName() + "' is not the owner of resource '" + resource + "'");
+    }
+    if(capacity == 0)
+    {
+        throw std::invalid_argument("DLM::setResourceCapacity: capacity of resource '" + resource + "' must be at least 1");
+    }
+
+    if(capacity == 1)
+    {
+        mResourceCapacities.erase(resource);
+    } else {
+        mResourceCapacities[resource] = capacity;
+    }
+}
+
+unsigned int DLM::getResourceCapacity(const std::string& resource) const
+{
+    std::map<std::string, unsigned int>::const_iterator cit = mResourceCapacities.find(resource);
+    if(cit != mResourceCapacities.end())
+    {
+        return cit->second;
+    }
+    return 1;
+}
+
 void DLM::startRequestingProbes(const fipa::acl::AgentID& agent, const std::string resourceName)
 {
     LOG_DEBUG_S << "'" << mSelf.getName() << "' start probing '" << agent.getName() << " -- resource: " << resourceName;
@@ -445,6 +1000,50 @@ void DLM::trigger()
     {
         mProbeRunners.erase(*cit);
     }
+
+    releaseExpiredPrefetches();
+}
+
+void DLM::addParticipant(const std::string& resource, const fipa::acl::AgentID& agent)
+{
+    if(agent == mSelf)
+    {
+        return;
+    }
+    unsigned int index = mAgentDirectory.insert(agent);
+    if(mParticipations.size() <= index)
+    {
+        mParticipations.resize(index + 1);
+    }
+    mParticipations[index].insert(resource);
+}
+
+void DLM::removeParticipant(const std::string& resource, const fipa::acl::AgentID& agent)
+{
+    unsigned int index;
+    if(mAgentDirectory.find(agent, index) && index < mParticipations.size())
+    {
+        mParticipations[index].erase(resource);
+    }
+}
+
+void DLM::removeParticipant(const fipa::acl::AgentID& agent)
+{
+    unsigned int index;
+    if(mAgentDirectory.find(agent, index) && index < mParticipations.size())
+    {
+        mParticipations[index].clear();
+    }
+}
+
+std::vector<std::string> DLM::getParticipations(const fipa::acl::AgentID& agent) const
+{
+    unsigned int index;
+    if(mAgentDirectory.find(agent, index) && index < mParticipations.size())
+    {
+        return std::vector<std::string>(mParticipations[index].begin(), mParticipations[index].end());
+    }
+    return std::vector<std::string>();
 }
 
 void DLM::sendProbe(const fipa::acl::AgentID& agent)
@@ -468,9 +1067,56 @@ protocol::Protocol DLM::getProtocol() const
 
 void DLM::sendMessage(const fipa::acl::ACLMessage& message)
 {
-    fipa::acl::ConversationPtr conversation = mConversationMonitor.getOrCreateConversation(message.getConversationID());
-    conversation->update(message);
-    mOutgoingMessages.push_back(message);
+    mProtocolValidator.update(message);
+    bool first = mOutgoingMessages.empty();
+    if(mSpareMessages.empty())
+    {
+        mOutgoingMessages.push_back(message);
+    } else {
+        // Assigning to a spare message reuses its node and buffers
+        mOutgoingMessages.splice(mOutgoingMessages.end(), mSpareMessages, mSpareMessages.begin());
+        mOutgoingMessages.back() = message;
+    }
+    if(first && mOutgoingMessageNotifier)
+    {
+        mOutgoingMessageNotifier();
+    }
+}
+
+fipa::acl::AgentIDList DLM::getFailedReceivers(const fipa::acl::ACLMessage& failure)
+{
+    ACLMessage original;
+    MessageParser::parseData(failure.getContent(), original, representation::STRING_REP);
+    return original.getAllReceivers();
+}
+
+void DLM::embed(DLM& embedded) const
+{
+    // Conversations of the embedded DLM must not be confused with our own
+    embedded.mConversationIDTag = mConversationIDTag + embedded.getProtocolName() + "_";
+    mProtocolValidator.share(embedded.mProtocolValidator);
+}
+
+void DLM::relayOutgoingMessages(DLM& embedded)
+{
+    // The embedded DLM already tracked these messages in its own conversations
+    bool first = mOutgoingMessages.empty() && !embedded.mOutgoingMessages.empty();
+    mOutgoingMessages.splice(mOutgoingMessages.end(), embedded.mOutgoingMessages);
+    if(first && mOutgoingMessageNotifier)
+    {
+        mOutgoingMessageNotifier();
+    }
+}
+
+void DLM::shareOwnerInformation(DLM& embedded, const std::string& resource) const
+{
+    std::string root = getOwnedRoot(resource);
+    if(!root.empty())
+    {
+        fipa::acl::AgentID owner = mOwnedResources.find(root)->second.mOwner;
+        embedded.setOwner(root, owner);
+        embedded.addParticipant(resource, owner);
+    }
 }
 
 } // namespace distributed_locking
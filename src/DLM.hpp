@@ -1,14 +1,34 @@
 #ifndef DISTRIBUTED_LOCKING_DLM_HPP
 #define DISTRIBUTED_LOCKING_DLM_HPP
 
+#include <list>
+#include <set>
+#include <vector>
 #include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
 #include <fipa_acl/fipa_acl.h>
+#include <distributed_locking/AgentDirectory.hpp>
+#include <distributed_locking/ProtocolValidator.hpp>
 
 /** \mainpage Distributed Locking Mechanism
  *  This library provides an interface for a locking mechanism on distributed systems. This interface is given by the abstract class DLM.
  *
  * Currently, the Ricart Agrawala algorithm ( http://en.wikipedia.org/wiki/Ricart-Agrawala_algorithm )
  * and the Suzuki Kasami algorithm ( http://en.wikipedia.org/wiki/Suzuki-Kasami_algorithm ) are implemented.
+ * The owner of a resource can allow up to k agents to hold it at the same time (k-mutual exclusion, see DLM::setResourceCapacity),
+ * which is supported by the Ricart Agrawala algorithm.
+ * For teams of agents connected by slow links, HierarchicalDLM negotiates locks among team coordinators only.
+ * For heavily contended resources, LodhaKshemkalyani saves messages by treating concurrent requests as implicit replies.
+ * AdaptiveDLM selects Ricart Agrawala or Suzuki Kasami per resource, depending on how the resource is used.
+ * Processes hosting many agents can run their DLMs in a DLMHost, which delivers messages between them in-process.
+ * The messages are checked against the protocol state machines, which are compiled into the library (see
+ * ProtocolTable); the validation can be sampled or turned off (see DLM::setValidationLevel).
+ * Locks can be prefetched while still working in another critical section (see DLM::prefetch).
+ * Locks can be made reentrant, so that nested locks of a resource do not release it early (see DLM::setReentrant).
+ * Several threads of one agent can share the locks of its DLM through a LockCombiner, which hands them over locally.
+ * Lock requests can carry a priority class (see priority::Priority), which is respected by Ricart Agrawala and Suzuki Kasami.
+ * Resource names can be hierarchical (e.g. "arm/joint3"): the owner of "arm" owns all its parts, and Ricart Agrawala
+ * locks them with intention locks (see lock_mode::LockMode), so that disjoint parts can be held at the same time.
  *
  * \section Code
  * The following code snippet shows the basic usage of this library. This is relevant implementing
@@ -68,12 +88,37 @@ namespace protocol {
     \brief an enum of all the implementations
 */
 enum Protocol { DLM_DISCOVER = -2, DLM_PROBE = -1, RICART_AGRAWALA = 0, RICART_AGRAWALA_EXTENDED, SUZUKI_KASAMI, SUZUKI_KASAMI_EXTENDED,
+    HIERARCHICAL, LODHA_KSHEMKALYANI, ADAPTIVE,
     // Following values only for enumerating over this enum
-    PROTOCOL_START = RICART_AGRAWALA, PROTOCOL_END = SUZUKI_KASAMI_EXTENDED
+    PROTOCOL_START = RICART_AGRAWALA, PROTOCOL_END = ADAPTIVE
 };
 
 } // namespace protocol
 
+namespace priority {
+/**
+    \enum Priority
+    \brief the priority classes of lock requests, requests of a higher class are served first
+*/
+enum Priority { LOW = 0, NORMAL, HIGH, URGENT,
+    // Following values only for enumerating over this enum
+    PRIORITY_START = LOW, PRIORITY_END = URGENT
+};
+} // namespace priority
+
+namespace lock_mode {
+/**
+    \enum LockMode
+    \brief the modes a resource can be locked in. Resource names can be hierarchical (e.g. "arm/joint3"), a lock
+    on a resource covers all resources below it. Before locking a resource, intention locks are taken on the
+    resources above it, so that locks on disjoint parts of the hierarchy do not conflict.
+*/
+enum LockMode { INTENTION_SHARED = 0, INTENTION_EXCLUSIVE, SHARED, EXCLUSIVE,
+    // Following values only for enumerating over this enum
+    LOCK_MODE_START = INTENTION_SHARED, LOCK_MODE_END = EXCLUSIVE
+};
+} // namespace lock_mode
+
 /**
  * A distributed locking mechanism. This class is abstract.
  */
@@ -82,6 +127,29 @@ class DLM
 
 public:
     typedef boost::shared_ptr<DLM> Ptr;
+    // An immutable snapshot of the members of an agent group
+    typedef boost::shared_ptr<const fipa::acl::AgentIDList> AgentGroup;
+
+    // Separates the levels of hierarchical resource names, e.g. "arm/joint3" is part of "arm"
+    static const char RESOURCE_SEPARATOR = '/';
+
+    /**
+     * Time from requesting a lock until obtaining it, for the requests of one priority class
+     */
+    struct LatencyStatistics
+    {
+        // Number of obtained locks
+        unsigned int mCount;
+        double mTotalInS;
+        double mMaxInS;
+
+        LatencyStatistics() : mCount(0), mTotalInS(0), mMaxInS(0) {}
+
+        /**
+         * Mean latency in seconds, 0 if no lock was obtained
+         */
+        double getMeanInS() const { return mCount == 0 ? 0 : mTotalInS / mCount; }
+    };
 
     /**
      * Factory method to create an instance of a certain DLM implementation
@@ -124,11 +192,24 @@ public:
      */
     fipa::acl::ACLMessage popNextOutgoingMessage();
 
+    /**
+     * Same as above, but assigns the message to the given one, so that a message object reused by the caller keeps
+     * its buffers instead of allocating new ones.
+     */
+    void popNextOutgoingMessage(fipa::acl::ACLMessage& message);
+
     /**
      * True, if there are outgoing messages than can be obtained with popNextOutgoingMessage.
      */
     bool hasOutgoingMessages() const;
 
+    /**
+     * Sets a function, which is called whenever an outgoing message is queued while none was pending. Lets a host of
+     * many DLMs collect the messages of those which sent any, instead of polling all of them. An empty function
+     * removes it.
+     */
+    void setOutgoingMessageNotifier(const boost::function<void ()>& notifier) { mOutgoingMessageNotifier = notifier; }
+
     /**
      * This method MUST be called periodically by the wrapping component. It runs everything, that needs to be done regularly.
      * For DLM, this is sending PROBE messages and checking if SUCCESS messages were received.
@@ -140,6 +221,91 @@ public:
      */
     virtual void lock(const std::string& resource, const fipa::acl::AgentIDList& agents);
 
+    /**
+     * Tries to lock a resource with the given priority class. Protocols without support for priorities handle the
+     * request like one of priority::NORMAL.
+     */
+    void lock(const std::string& resource, const fipa::acl::AgentIDList& agents, priority::Priority priority);
+
+    /**
+     * Tries to lock a resource, with the members of a group (see defineGroup) as communication partners.
+     * The current members are used until the lock is released, even if the group changes meanwhile.
+     */
+    void lockGroup(const std::string& resource, const std::string& group, priority::Priority priority = priority::NORMAL);
+
+    /**
+     * Defines a named group of agents, which can be passed to lockGroup instead of the agents. Redefining a group
+     * replaces its members.
+     */
+    void defineGroup(const std::string& group, const fipa::acl::AgentIDList& agents);
+
+    /**
+     * Adds an agent to a group
+     */
+    void joinGroup(const std::string& group, const fipa::acl::AgentID& agent);
+
+    /**
+     * Removes an agent from a group
+     */
+    void leaveGroup(const std::string& group, const fipa::acl::AgentID& agent);
+
+    /**
+     * Gets the current members of a group
+     */
+    AgentGroup getGroup(const std::string& group) const;
+
+    /**
+     * Gets the version of a group, which is incremented by every change of its members
+     */
+    unsigned int getGroupVersion(const std::string& group) const;
+
+    /**
+     * Gets the latency statistics of the locks obtained by this agent for the given priority class
+     */
+    LatencyStatistics getLatencyStatistics(priority::Priority priority) const;
+
+    /**
+     * Requests a lock in the background, e.g. for the next critical section while still in the current one. A later
+     * lock() of the resource takes the request over, and completes at once if the lock was granted meanwhile.
+     * A prefetched lock, which is not taken over within the prefetch window after trigger() noticed the grant,
+     * is released again. Does nothing if the resource is requested or held already.
+     */
+    void prefetch(const std::string& resource, const fipa::acl::AgentIDList& agents);
+
+    /**
+     * Whether a lock of the resource was prefetched and not taken over by lock() yet
+     */
+    bool isPrefetched(const std::string& resource) const;
+
+    /**
+     * Sets how long a granted prefetched lock is kept without being taken over, in seconds
+     * \throws std::invalid_argument if the time is negative
+     */
+    void setPrefetchWindow(double timeInS);
+
+    /**
+     * Gets how long a granted prefetched lock is kept without being taken over, in seconds
+     * default is 1 second
+     */
+    double getPrefetchWindow() const { return mPrefetchWindowInS; }
+
+    /**
+     * Sets whether locks are reentrant. A reentrant lock of a resource requested or held already only counts the
+     * nesting, and only the outermost unlock releases the resource and sends the release messages. Otherwise,
+     * locking such a resource again does nothing, and the first unlock releases it (the default).
+     */
+    void setReentrant(bool reentrant) { mReentrant = reentrant; }
+
+    /**
+     * Whether locks are reentrant
+     */
+    bool isReentrant() const { return mReentrant; }
+
+    /**
+     * Gets how often a resource requested or held is locked (more than once by reentrant locks), 0 if it is not
+     */
+    unsigned int getLockCount(const std::string& resource) const;
+
     /**
      * Unlocks a resource, that should have been locked before.
      */
@@ -157,6 +323,13 @@ public:
      */
     virtual bool onIncomingMessage(const fipa::acl::ACLMessage& message);
 
+    /**
+     * Handles the failure to deliver a message of the given conversation to some of its receivers. Transports,
+     * which know what failed, should call this instead of passing a FAILURE message to onIncomingMessage, so that
+     * the original message does not have to be encoded into the FAILURE message and parsed again.
+     */
+    virtual void onDeliveryFailure(const std::string& conversationID, const fipa::acl::AgentIDList& failedReceivers);
+
     /**
      * This message is called by the DLM, if an agent does not respond REQUEST messages with CONFIRM after a certain timeout.
      * Subclasses can and should react according to the algorithm.
@@ -164,7 +337,8 @@ public:
     virtual void agentFailed(const fipa::acl::AgentID& agent);
 
     /**
-     * Discover a resource from a set of given agents
+     * Discover a resource from a set of given agents. For a hierarchical resource name, the owner of any resource
+     * above it answers, since it owns the whole subtree.
      */
     void discover(const std::string& resource, const fipa::acl::AgentIDList& agents);
 
@@ -173,6 +347,18 @@ public:
      */
     bool hasKnownOwner(const std::string& resource) const;
 
+    /**
+     * Set the number of agents that may hold the given resource at the same time (k-mutual exclusion).
+     * Only the owner of a resource can configure it; other agents learn the capacity during discovery.
+     * The default capacity of 1 results in an exclusive lock.
+     */
+    void setResourceCapacity(const std::string& resource, unsigned int capacity);
+
+    /**
+     * Get the number of agents that may hold the given resource at the same time, 1 if not known otherwise
+     */
+    unsigned int getResourceCapacity(const std::string& resource) const;
+
     /**
      * Set the probe timeout in seconds
      */
@@ -184,6 +370,41 @@ public:
      */
     double getProbeTimeout() const { return mProbeTimeoutInS; }
 
+    /**
+     * Limits the number of resources of other agents, whose owner is remembered. Beyond that, the owner information
+     * used least recently (by discovery or locking) is forgotten, and has to be discovered again before the resource
+     * is locked. 0, the default, means no limit. The owner of a resource requested, held or prefetched is not
+     * forgotten, so the limit is exceeded while more resources are in use.
+     */
+    void setOwnerCacheCapacity(unsigned int resources);
+
+    /**
+     * Gets the number of resources of other agents, whose owner is remembered at most
+     */
+    unsigned int getOwnerCacheCapacity() const { return mOwnerCacheCapacity; }
+
+    /**
+     * Sets how thoroughly messages are checked against their protocol. Checking every conversation
+     * (validation::FULL) is the default. Embedded DLMs use the same level.
+     */
+    void setValidationLevel(validation::Level level) { mProtocolValidator.setLevel(level); }
+
+    /**
+     * Gets how thoroughly messages are checked against their protocol
+     */
+    validation::Level getValidationLevel() const { return mProtocolValidator.getLevel(); }
+
+    /**
+     * Sets which share of the conversations is checked with validation::SAMPLED, one out of the given number
+     * \throws std::invalid_argument if conversations is 0
+     */
+    void setValidationSampleRate(unsigned int conversations) { mProtocolValidator.setSampleRate(conversations); }
+
+    /**
+     * Gets the number of messages sent or received, which violated their protocol
+     */
+    unsigned int getProtocolViolations() const { return mProtocolValidator.getViolations(); }
+
 protected:
     /**
      * A structure for organizing sending probe messages
@@ -214,14 +435,75 @@ protected:
 
     // List of outgoing messages.
     std::list<fipa::acl::ACLMessage> mOutgoingMessages;
+    // Nodes of messages already popped, which are reused for the next outgoing messages
+    std::list<fipa::acl::ACLMessage> mSpareMessages;
+    // Called when the first outgoing message is queued, see setOutgoingMessageNotifier
+    boost::function<void ()> mOutgoingMessageNotifier;
     // Current number for conversation IDs
     int mConversationIDnum;
+    // Tag added to conversation IDs, so that embedded DLMs of the same agent create distinct IDs
+    std::string mConversationIDTag;
+    // Buffer the conversation IDs are built in
+    std::string mConversationIDBuffer;
+
+    /**
+     * The physical owner of a resource, as far as known
+     */
+    struct OwnerInformation
+    {
+        // The owner, empty while the owner is queried
+        fipa::acl::AgentID mOwner;
+        // Whether the information can be forgotten, and its position in mOwnerRecency then
+        bool mCached;
+        std::list<const std::string*>::iterator mRecency;
+
+        OwnerInformation() : mCached(false) {}
+    };
 
-    typedef std::map<std::string, fipa::acl::AgentID> ResourceAgentMap;
+    typedef std::map<std::string, OwnerInformation> ResourceAgentMap;
     // The physically owned resources of all agents known. Maps resource->agent
     ResourceAgentMap mOwnedResources;
-    // The (logical) lock holders of the owned resources. Maps resource->agent
-    ResourceAgentMap mLockHolders;
+    // The resources of other agents in mOwnedResources, least recently used first. Only kept with a limited owner
+    // cache capacity.
+    std::list<const std::string*> mOwnerRecency;
+    unsigned int mCachedOwners;
+    unsigned int mOwnerCacheCapacity;
+    typedef std::map<std::string, fipa::acl::AgentIDList> ResourceAgentsMap;
+    // The (logical) lock holders of the owned resources. Maps resource->agents,
+    // which are more than one if the resource capacity is greater than 1
+    ResourceAgentsMap mLockHolders;
+    // The number of agents allowed to hold a resource at the same time. Resources not listed have a capacity of 1
+    std::map<std::string, unsigned int> mResourceCapacities;
+    // Dense indices of all agents this DLM deals with, for index-aligned per-agent state
+    AgentDirectory mAgentDirectory;
+    // The resources each agent takes part in, index-aligned with mAgentDirectory. Used to limit failure handling
+    // to the resources involving the failed agent.
+    std::vector< std::set<std::string> > mParticipations;
+
+
+    /**
+     * The members of an agent group. Changes replace the members, so that snapshots handed out stay valid.
+     */
+    struct Group
+    {
+        AgentGroup mAgents;
+        unsigned int mVersion;
+
+        Group() : mAgents(new fipa::acl::AgentIDList()), mVersion(0) {}
+    };
+    // All groups mapped to their names
+    std::map<std::string, Group> mGroups;
+    // Start and priority of the pending lock requests of this agent, and the latencies per priority class
+    std::map<std::string, std::pair<base::Time, priority::Priority> > mPendingRequests;
+    std::map<priority::Priority, LatencyStatistics> mLatencyStatistics;
+
+    // The locks prefetched and not taken over by lock() yet, mapped to the time their grant was noticed (null
+    // while not granted)
+    std::map<std::string, base::Time> mPrefetches;
+
+    // Whether locks are reentrant, and the resources locked more than once mapped to the number of nested locks
+    bool mReentrant;
+    std::map<std::string, unsigned int> mReentries;
 
     // All probe runners. agent -> ProbeRunner
     typedef std::map<fipa::acl::AgentID, ProbeRunner> ProbeRunnerMap;
@@ -232,6 +514,118 @@ protected:
      */
     void setProtocol(protocol::Protocol protocol) { mProtocol = protocol; }
 
+    /**
+     * Issues a lock request with the given priority class, the agents are shared with the group the request refers
+     * to, if any. Implementations supporting priorities or groups override this, the default ignores the priority and
+     * calls lock().
+     */
+    virtual void requestLock(const std::string& resource, const AgentGroup& agents, priority::Priority priority);
+
+    /**
+     * Records the start of a lock request with the given priority, for the latency statistics
+     */
+    void lockRequested(const std::string& resource, priority::Priority priority);
+
+    /**
+     * Records, that a requested lock was obtained, for the latency statistics
+     */
+    void lockGranted(const std::string& resource);
+
+    /**
+     * This method MUST be called by implementing subclasses, when a requested lock will not be granted any more,
+     * e.g. since the resource became unreachable. Forgets the request.
+     */
+    void lockAbandoned(const std::string& resource);
+
+    /**
+     * This method MUST be called by implementing subclasses at the start of lock(), and lock() must return if it
+     * returns true. Takes over a prefetched lock of the resource.
+     * \return true if the lock was prefetched, and is still requested or held therefore
+     */
+    bool claimPrefetch(const std::string& resource);
+
+    /**
+     * This method MUST be called by implementing subclasses at the start of lock() after claimPrefetch, and lock()
+     * must return if it returns true. Counts a reentrant lock.
+     * \return true if locks are reentrant, and the resource is requested or held already
+     */
+    bool reenter(const std::string& resource);
+
+    /**
+     * This method MUST be called by implementing subclasses at the start of unlock(), and unlock() must return if it
+     * returns true. Counts the unlock of a reentrant lock, and forgets a prefetch of the resource.
+     * \return true if the resource is still locked by an outer lock
+     */
+    bool leave(const std::string& resource);
+
+    /**
+     * Notes the grant of prefetched locks, and releases those not taken over within the prefetch window
+     */
+    void releaseExpiredPrefetches();
+
+    /**
+     * Get the resource with a known owner, which the given resource is part of (or the resource itself).
+     * Empty, if the owner is not known.
+     */
+    std::string getOwnedRoot(const std::string& resource) const;
+
+    /**
+     * Sets the owner of a resource, an empty owner registers a pending query
+     * \param used whether this counts as a use for the owner cache, see touchOwner
+     */
+    void setOwner(const std::string& resource, const fipa::acl::AgentID& owner, bool used = true);
+
+    /**
+     * Marks the owner information of a resource (or the resource it is part of) as used, for the owner cache
+     */
+    void touchOwner(const std::string& resource);
+
+    /**
+     * Marks owner information as used, for the owner cache. Without a use, new information is added as the least
+     * recently used one, and cached information keeps its place.
+     */
+    void touchOwner(ResourceAgentMap::iterator it, bool used = true);
+
+    /**
+     * Forgets the least recently used owner information beyond the owner cache capacity. The owner information of
+     * resources in use is kept, so the cache may exceed its capacity while all of them are in use.
+     */
+    void evictOwners();
+
+    /**
+     * Whether the owner information of a resource is needed by this agent, since the resource (or a part of it) is
+     * requested, held or prefetched
+     */
+    virtual bool isInUse(const std::string& resource) const;
+
+    /**
+     * Registers that owner information is expected for the resource, so that the owner's INFORM is accepted
+     * \param used false for queries of other agents, which must not displace the owner information used by this one
+     */
+    void addPendingOwnerQuery(const std::string& resource, bool used = true);
+
+    /**
+     * Describes an owned resource to discovering agents, the description is sent along with the owner information.
+     * The default has nothing to add.
+     */
+    virtual std::string describeResource(const std::string& resource) const;
+
+    /**
+     * Receives the description of a resource sent along with its owner information. The default ignores it.
+     */
+    virtual void resourceDescribed(const std::string& resource, const std::string& description);
+
+    /**
+     * Get the physical owner of a resource, which is the owner of the resource it is part of for hierarchical
+     * resource names. An empty AgentID, if the owner is not known.
+     */
+    fipa::acl::AgentID getOwner(const std::string& resource) const;
+
+    /**
+     * Copies the agents of a lock request into an immutable list, to be kept as communication partners
+     */
+    AgentGroup getPartners(const fipa::acl::AgentIDList& agents) const;
+
     /**
      * This method MUST be called by implementing subclasses, when the lock is obtained.
      * Like this we can keep track of logical owners of our own resources.
@@ -244,6 +638,37 @@ protected:
      */
     void lockReleased(const std::string& resource, const std::string& conversationId);
 
+    /**
+     * Add an agent to the (logical) lock holders of a resource
+     */
+    void addLockHolder(const std::string& resource, const fipa::acl::AgentID& agent);
+
+    /**
+     * Remove an agent from the (logical) lock holders of a resource
+     * \return true if the agent was a lock holder
+     */
+    bool removeLockHolder(const std::string& resource, const fipa::acl::AgentID& agent);
+
+    /**
+     * Records, that an agent takes part in locking a resource (as owner, communication partner or requestor)
+     */
+    void addParticipant(const std::string& resource, const fipa::acl::AgentID& agent);
+
+    /**
+     * Removes the record, that an agent takes part in locking a resource
+     */
+    void removeParticipant(const std::string& resource, const fipa::acl::AgentID& agent);
+
+    /**
+     * Removes all records of an agent, e.g. after it failed
+     */
+    void removeParticipant(const fipa::acl::AgentID& agent);
+
+    /**
+     * Gets the resources an agent takes part in
+     */
+    std::vector<std::string> getParticipations(const fipa::acl::AgentID& agent) const;
+
     /**
      * Tells the DLM to send PROBE messages to the agent in intervals, and call agentFailed, if it does not respond.
      */
@@ -260,15 +685,50 @@ protected:
      */
     fipa::acl::ACLMessage prepareMessage(fipa::acl::ACLMessage::Performative performative, const std::string& protocol, const std::string& content = "");
 
+    /**
+     * Same as above, but overwrites an existing message, e.g. a prototype kept by the caller, so that its buffers are
+     * reused. The receivers of the message are kept and must be set by the caller.
+     */
+    void prepareMessage(fipa::acl::ACLMessage& message, fipa::acl::ACLMessage::Performative performative, const std::string& protocol,
+            const std::string& content = "");
+
+    /**
+     * Appends the decimal representation of a number to a buffer, without creating temporary strings
+     */
+    static void appendNumber(std::string& buffer, unsigned long long number);
+
     /**
      * Send a message
      */
     void sendMessage(const fipa::acl::ACLMessage& msg);
 
+    /**
+     * Gets the receivers a FAILURE message reports, from the original message encoded in its content
+     */
+    static fipa::acl::AgentIDList getFailedReceivers(const fipa::acl::ACLMessage& failure);
+
+    /**
+     * Prepares a DLM to be embedded into this one, i.e. to work for the same agent
+     */
+    void embed(DLM& embedded) const;
+
+    /**
+     * Moves all outgoing messages of an embedded DLM (working for the same agent) to the own outgoing messages
+     */
+    void relayOutgoingMessages(DLM& embedded);
+
+    /**
+     * Passes the known owner of a resource on to an embedded DLM
+     */
+    void shareOwnerInformation(DLM& embedded, const std::string& resource) const;
+
 private:
-    fipa::acl::ConversationMonitor mConversationMonitor;
+    // Checks the conversations against the protocol state machines
+    ProtocolValidator mProtocolValidator;
     // The timeout of probe messages in seconds
     double mProbeTimeoutInS;
+    // The time a granted prefetched lock is kept without being taken over in seconds
+    double mPrefetchWindowInS;
 
     /**
      * Send a probe message to the agent
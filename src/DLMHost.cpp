@@ -0,0 +1,237 @@
+#include "DLMHost.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <boost/bind.hpp>
+#include <base/Logging.hpp>
+
+using namespace fipa::acl;
+
+namespace fipa {
+namespace distributed_locking {
+
+DLMHost::DLMHost()
+    : mSlots(1)
+    , mCurrentSlot(0)
+{
+}
+
+DLMHost::~DLMHost()
+{
+    for(AgentMap::const_iterator cit = mAgents.begin(); cit != mAgents.end(); ++cit)
+    {
+        cit->second->setOutgoingMessageNotifier(boost::function<void ()>());
+    }
+}
+
+DLM::Ptr DLMHost::addAgent(protocol::Protocol protocol, const fipa::acl::AgentID& self, const std::vector<std::string>& resources)
+{
+    if(isHosted(self))
+    {
+        throw std::invalid_argument("DLMHost::addAgent: agent '" + self.getName() + "' is already hosted");
+    }
+    DLM::Ptr dlm = DLM::create(protocol, self, resources);
+    addAgent(dlm);
+    return dlm;
+}
+
+void DLMHost::addAgent(const DLM::Ptr& dlm)
+{
+    const AgentID& self = dlm->getSelf();
+    if(isHosted(self))
+    {
+        throw std::invalid_argument("DLMHost::addAgent: agent '" + self.getName() + "' is already hosted");
+    }
+    mAgents[self] = dlm;
+    mSlots[getEmptiestSlot()].push_back(dlm);
+    dlm->setOutgoingMessageNotifier(boost::bind(&DLMHost::markDirty, this, dlm.get()));
+    if(dlm->hasOutgoingMessages())
+    {
+        markDirty(dlm.get());
+    }
+    LOG_DEBUG_S << "DLMHost: hosting agent '" << self.getName() << "', " << mAgents.size() << " agents hosted";
+}
+
+void DLMHost::removeAgent(const fipa::acl::AgentID& agent)
+{
+    AgentMap::iterator it = mAgents.find(agent);
+    if(it == mAgents.end())
+    {
+        return;
+    }
+    DLM::Ptr dlm = it->second;
+    mAgents.erase(it);
+    for(unsigned int i = 0; i < mSlots.size(); ++i)
+    {
+        mSlots[i].erase(std::remove(mSlots[i].begin(), mSlots[i].end(), dlm), mSlots[i].end());
+    }
+    dlm->setOutgoingMessageNotifier(boost::function<void ()>());
+    mDirtyAgents.erase(std::remove(mDirtyAgents.begin(), mDirtyAgents.end(), dlm.get()), mDirtyAgents.end());
+    // Messages it sent are still delivered, messages for it go to the transport from now on
+    collect(*dlm);
+    deliverLocalMessages();
+}
+
+DLM::Ptr DLMHost::getAgent(const fipa::acl::AgentID& agent) const
+{
+    AgentMap::const_iterator cit = mAgents.find(agent);
+    if(cit == mAgents.end())
+    {
+        throw std::invalid_argument("DLMHost::getAgent: agent '" + agent.getName() + "' is not hosted");
+    }
+    return cit->second;
+}
+
+bool DLMHost::isHosted(const fipa::acl::AgentID& agent) const
+{
+    return mAgents.count(agent) != 0;
+}
+
+void DLMHost::setTriggerSlots(unsigned int slots)
+{
+    if(slots == 0)
+    {
+        throw std::invalid_argument("DLMHost::setTriggerSlots: at least one trigger slot is required");
+    }
+    mSlots.assign(slots, std::vector<DLM::Ptr>());
+    mCurrentSlot = 0;
+    unsigned int i = 0;
+    for(AgentMap::const_iterator cit = mAgents.begin(); cit != mAgents.end(); ++cit, ++i)
+    {
+        mSlots[i % slots].push_back(cit->second);
+    }
+}
+
+void DLMHost::trigger()
+{
+    std::vector<DLM::Ptr>& slot = mSlots[mCurrentSlot];
+    for(std::vector<DLM::Ptr>::const_iterator cit = slot.begin(); cit != slot.end(); ++cit)
+    {
+        (*cit)->trigger();
+    }
+    mCurrentSlot = (mCurrentSlot + 1) % mSlots.size();
+
+    deliverLocalMessages();
+}
+
+bool DLMHost::onIncomingMessage(const fipa::acl::ACLMessage& message)
+{
+    bool handled = dispatch(message);
+    deliverLocalMessages();
+    return handled;
+}
+
+fipa::acl::ACLMessage DLMHost::popNextOutgoingMessage()
+{
+    if(!hasOutgoingMessages())
+    {
+        throw std::runtime_error("DLMHost::popNextOutgoingMessage no messages");
+    }
+    ACLMessage message = mOutgoingMessages.front();
+    mOutgoingMessages.pop_front();
+    return message;
+}
+
+bool DLMHost::hasOutgoingMessages() const
+{
+    return !mOutgoingMessages.empty();
+}
+
+void DLMHost::collect(DLM& dlm)
+{
+    while(dlm.hasOutgoingMessages())
+    {
+        route(dlm.popNextOutgoingMessage());
+    }
+}
+
+void DLMHost::route(const fipa::acl::ACLMessage& message)
+{
+    const AgentIDList& receivers = message.getAllReceivers();
+    AgentIDList remoteReceivers;
+    bool local = false;
+    for(AgentIDList::const_iterator cit = receivers.begin(); cit != receivers.end(); ++cit)
+    {
+        if(isHosted(*cit))
+        {
+            local = true;
+        } else {
+            remoteReceivers.push_back(*cit);
+        }
+    }
+
+    if(local)
+    {
+        mLocalMessages.push_back(message);
+    }
+    if(!remoteReceivers.empty())
+    {
+        mOutgoingMessages.push_back(message);
+        if(local)
+        {
+            // The hosted receivers got the message already
+            mOutgoingMessages.back().setAllReceivers(remoteReceivers);
+        }
+    }
+}
+
+void DLMHost::markDirty(DLM* dlm)
+{
+    mDirtyAgents.push_back(dlm);
+}
+
+void DLMHost::collectDirty()
+{
+    // Collecting does not make a DLM queue messages, so the list does not grow meanwhile
+    for(std::vector<DLM*>::const_iterator cit = mDirtyAgents.begin(); cit != mDirtyAgents.end(); ++cit)
+    {
+        collect(**cit);
+    }
+    mDirtyAgents.clear();
+}
+
+void DLMHost::deliverLocalMessages()
+{
+    collectDirty();
+    while(!mLocalMessages.empty())
+    {
+        ACLMessage message = mLocalMessages.front();
+        mLocalMessages.pop_front();
+        dispatch(message);
+        collectDirty();
+    }
+}
+
+bool DLMHost::dispatch(const fipa::acl::ACLMessage& message)
+{
+    bool handled = false;
+    const AgentIDList& receivers = message.getAllReceivers();
+    for(AgentIDList::const_iterator cit = receivers.begin(); cit != receivers.end(); ++cit)
+    {
+        AgentMap::const_iterator ait = mAgents.find(*cit);
+        if(ait == mAgents.end())
+        {
+            continue;
+        }
+        DLM::Ptr dlm = ait->second;
+        LOG_DEBUG_S << "DLMHost: '" << message.getSender().getName() << "' --> '" << cit->getName() << "'";
+        handled = dlm->onIncomingMessage(message) || handled;
+    }
+    return handled;
+}
+
+unsigned int DLMHost::getEmptiestSlot() const
+{
+    unsigned int emptiest = 0;
+    for(unsigned int i = 1; i < mSlots.size(); ++i)
+    {
+        if(mSlots[i].size() < mSlots[emptiest].size())
+        {
+            emptiest = i;
+        }
+    }
+    return emptiest;
+}
+
+} // namespace distributed_locking
+} // namespace fipa
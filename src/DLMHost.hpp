@@ -0,0 +1,170 @@
+#ifndef DISTRIBUTED_LOCKING_DLM_HOST_HPP
+#define DISTRIBUTED_LOCKING_DLM_HOST_HPP
+
+#include <map>
+#include <list>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <fipa_acl/fipa_acl.h>
+#include <distributed_locking/DLM.hpp>
+
+namespace fipa {
+namespace distributed_locking {
+/**
+ * Hosts the DLMs of many agents living in one process, e.g. in a simulation or on a gateway node.
+ *
+ * Messages between hosted agents are handed over in-process, without going through the transport. Messages for
+ * other agents are collected in a single outgoing queue, and incoming messages are passed on to the hosted
+ * receivers. The hosted DLMs notify the host when they queue messages (see DLM::setOutgoingMessageNotifier), so
+ * only the agents which sent any are collected from. The wrapping component therefore only calls trigger, onIncomingMessage and popNextOutgoingMessage of
+ * the host, instead of the ones of every agent.
+ *
+ * The hosted agents are spread over a number of trigger slots (see setTriggerSlots). Each call to trigger runs the
+ * agents of the next slot only, so that dense deployments do not run the timeouts of every agent on every cycle.
+ * Messages are delivered on every call regardless of the slots.
+ */
+class DLMHost
+{
+public:
+    typedef boost::shared_ptr<DLMHost> Ptr;
+
+    /**
+     * Constructor, creates a host with a single trigger slot
+     */
+    DLMHost();
+
+    /**
+     * Destructor, detaches the hosted DLMs, which may be used on their own afterwards
+     */
+    ~DLMHost();
+
+    /**
+     * Creates a DLM for an agent and hosts it
+     * \throws std::invalid_argument if the agent is already hosted
+     */
+    DLM::Ptr addAgent(protocol::Protocol protocol, const fipa::acl::AgentID& self, const std::vector<std::string>& resources);
+
+    /**
+     * Hosts an existing DLM
+     * \throws std::invalid_argument if its agent is already hosted
+     */
+    void addAgent(const DLM::Ptr& dlm);
+
+    /**
+     * Stops hosting an agent. Its pending outgoing messages are routed before.
+     */
+    void removeAgent(const fipa::acl::AgentID& agent);
+
+    /**
+     * Gets the DLM of a hosted agent
+     * \throws std::invalid_argument if the agent is not hosted
+     */
+    DLM::Ptr getAgent(const fipa::acl::AgentID& agent) const;
+
+    /**
+     * True, if the agent is hosted here
+     */
+    bool isHosted(const fipa::acl::AgentID& agent) const;
+
+    /**
+     * Number of hosted agents
+     */
+    unsigned int getAgentCount() const { return mAgents.size(); }
+
+    /**
+     * Sets the number of trigger slots. An agent is triggered on every slots-th call of trigger only, so its
+     * timeouts are detected up to slots-1 cycles later.
+     * \throws std::invalid_argument if slots is 0
+     */
+    void setTriggerSlots(unsigned int slots);
+
+    /**
+     * Gets the number of trigger slots
+     */
+    unsigned int getTriggerSlots() const { return mSlots.size(); }
+
+    /**
+     * MUST be called periodically. Triggers the agents of the next slot, and delivers all messages between hosted
+     * agents.
+     */
+    void trigger();
+
+    /**
+     * Passes a message from the transport on to all hosted receivers, and delivers the resulting messages between
+     * hosted agents. Returns true, if any receiver handled it.
+     */
+    bool onIncomingMessage(const fipa::acl::ACLMessage& message);
+
+    /**
+     * Gets the next message for agents not hosted here, and removes it from the queue.
+     * Must only be called if hasOutgoingMessages == true.
+     * \throws std::runtime_error if there are no messages
+     */
+    fipa::acl::ACLMessage popNextOutgoingMessage();
+
+    /**
+     * True, if there are messages for agents not hosted here
+     */
+    bool hasOutgoingMessages() const;
+
+protected:
+    typedef std::map<fipa::acl::AgentID, DLM::Ptr> AgentMap;
+    // All hosted agents mapped to their DLMs
+    AgentMap mAgents;
+    // The agents of every trigger slot
+    std::vector< std::vector<DLM::Ptr> > mSlots;
+    // The slot triggered next
+    unsigned int mCurrentSlot;
+    // Messages for hosted agents, which are not delivered yet
+    std::list<fipa::acl::ACLMessage> mLocalMessages;
+    // Messages for agents not hosted here
+    std::list<fipa::acl::ACLMessage> mOutgoingMessages;
+    // The hosted DLMs, which queued outgoing messages since they were collected last. Collecting one twice is harmless.
+    std::vector<DLM*> mDirtyAgents;
+
+    /**
+     * Notes that a hosted DLM queued outgoing messages
+     */
+    void markDirty(DLM* dlm);
+
+    /**
+     * Collects the outgoing messages of the DLMs, which queued any
+     */
+    void collectDirty();
+
+    /**
+     * Collects the outgoing messages of a DLM
+     */
+    void collect(DLM& dlm);
+
+    /**
+     * Queues a message for the hosted receivers, and a copy without them for the others
+     */
+    void route(const fipa::acl::ACLMessage& message);
+
+    /**
+     * Collects the outgoing messages of the hosted agents and delivers them, until no message between hosted agents
+     * is left
+     */
+    void deliverLocalMessages();
+
+    /**
+     * Passes a message on to all hosted receivers, returns true if any of them handled it
+     */
+    bool dispatch(const fipa::acl::ACLMessage& message);
+
+    /**
+     * Gets the slot with the fewest agents
+     */
+    unsigned int getEmptiestSlot() const;
+
+private:
+    // The hosted DLMs notify this instance, so it must not be copied
+    DLMHost(const DLMHost&);
+    DLMHost& operator=(const DLMHost&);
+};
+
+} // namespace distributed_locking
+} // namespace fipa
+
+#endif // DISTRIBUTED_LOCKING_DLM_HOST_HPP
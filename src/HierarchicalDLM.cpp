@@ -0,0 +1,445 @@
+#include "HierarchicalDLM.hpp"
+
+#include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <string>
+#include <stdexcept>
+#include <base/Logging.hpp>
+
+using namespace fipa::acl;
+
+namespace fipa {
+namespace distributed_locking {
+
+HierarchicalDLM::HierarchicalDLM(const fipa::acl::AgentID& self, const std::vector<std::string>& resources, protocol::Protocol globalProtocol)
+    : DLM(protocol::HIERARCHICAL, self, resources)
+    , mCoordinator(self)
+    , mMaxBatchSize(8)
+{
+    if(globalProtocol != protocol::RICART_AGRAWALA && globalProtocol != protocol::SUZUKI_KASAMI)
+    {
+        throw std::invalid_argument("HierarchicalDLM: global protocol '" + getProtocolTxt(globalProtocol) + "' is not supported");
+    }
+    mGlobal = DLM::create(globalProtocol, self, resources);
+    embed(*mGlobal);
+}
+
+void HierarchicalDLM::setCoordinator(const fipa::acl::AgentID& coordinator)
+{
+    mCoordinator = coordinator;
+}
+
+void HierarchicalDLM::setCoordinators(const fipa::acl::AgentIDList& coordinators)
+{
+    mCoordinators = coordinators;
+}
+
+void HierarchicalDLM::lock(const std::string& resource, const AgentIDList& agents)
+{
+    if(claimPrefetch(resource))
+    {
+        // Requested or held already
+        return;
+    }
+    if(reenter(resource))
+    {
+        return;
+    }
+
+    if(!hasKnownOwner(resource))
+    {
+        throw std::invalid_argument("HierarchicalDLM: cannot lock resource '" + resource + "' -- owner is unknown. Perform discovery first");
+    }
+
+    lock_state::LockState state = getLockState(resource);
+    // Only act we are not holding this resource and not already interested in it
+    if(state != lock_state::NOT_INTERESTED)
+    {
+        if(state == lock_state::UNREACHABLE)
+        {
+            // An unreachable resource cannot be locked. Throw exception
+            throw std::runtime_error("HierarchicalDLM::lock Cannot lock UNREACHABLE resource.");
+        }
+        return;
+    }
+
+    mLockStates[resource].mState = lock_state::INTERESTED;
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' mark INTERESTED for resource '" << resource << "'";
+
+    if(isCoordinator())
+    {
+        handleTeamRequest(resource, mSelf, "");
+        return;
+    }
+
+    // Request the lock from the coordinator
+    ACLMessage message = prepareMessage(ACLMessage::REQUEST, getProtocolName());
+    // Our request messages are in the format "RESOURCE_IDENTIFIER\nOWNER", so the coordinator does not need discovery
+    message.setContent(resource + "\n" + getOwner(resource).getName());
+    message.addReceiver(mCoordinator);
+    sendMessage(message);
+
+    mLockStates[resource].mConversationID = message.getConversationID();
+    // Check whether the coordinator is still alive
+    startRequestingProbes(mCoordinator, resource);
+}
+
+void HierarchicalDLM::unlock(const std::string& resource)
+{
+    if(leave(resource))
+    {
+        // Still held by an outer lock
+        return;
+    }
+    // Only act we are actually holding this resource
+    if(getLockState(resource) != lock_state::LOCKED)
+    {
+        return;
+    }
+
+    ResourceLockState& lockState = mLockStates[resource];
+    lockState.mState = lock_state::NOT_INTERESTED;
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' mark NOT_INTERESTED for resource '" << resource << "'";
+
+    if(isCoordinator())
+    {
+        handleTeamRelease(resource, mSelf);
+        return;
+    }
+
+    // Give the lock back to the coordinator
+    ACLMessage message = prepareMessage(ACLMessage::CANCEL, getProtocolName(), resource);
+    message.addReceiver(mCoordinator);
+    message.setConversationID(lockState.mConversationID);
+    sendMessage(message);
+
+    stopRequestingProbes(mCoordinator, resource);
+}
+
+lock_state::LockState HierarchicalDLM::getLockState(const std::string& resource) const
+{
+    std::map<std::string, ResourceLockState>::const_iterator cit = mLockStates.find(resource);
+    if(cit != mLockStates.end())
+    {
+        return cit->second.mState;
+    }
+    // Otherwise return the default state
+    return lock_state::NOT_INTERESTED;
+}
+
+bool HierarchicalDLM::onIncomingMessage(const fipa::acl::ACLMessage& message)
+{
+    std::string protocol = message.getProtocol();
+    if(protocol == mGlobal->getProtocolName())
+    {
+        // The lock among the coordinators
+        bool handled = mGlobal->onIncomingMessage(message);
+        relayOutgoingMessages(*mGlobal);
+        processTeamStates();
+        return handled;
+    }
+
+    if(protocol == getProtocolTxt(protocol::DLM_PROBE) && message.getPerformativeAsEnum() == ACLMessage::CONFIRM)
+    {
+        // The global instance might be probing the sender as well
+        mGlobal->onIncomingMessage(message);
+    }
+
+    // Call base method as required
+    if(DLM::onIncomingMessage(message))
+    {
+        return true;
+    }
+
+    // Check if it's the right protocol
+    if(protocol != getProtocolName())
+    {
+        return false;
+    }
+
+    switch(message.getPerformativeAsEnum())
+    {
+        case ACLMessage::REQUEST:
+        {
+            // Request of a team member
+            std::vector<std::string> strs;
+            std::string content = message.getContent();
+            boost::split(strs, content, boost::is_any_of("\n"));
+            if(strs.size() != 2)
+            {
+                throw std::runtime_error("HierarchicalDLM::onIncomingMessage ACLMessage content malformed: " + content);
+            }
+            const std::string& resource = strs[0];
+            ResourceAgentMap::const_iterator cit = mOwnedResources.find(resource);
+            if(cit == mOwnedResources.end() || cit->second.mOwner == AgentID())
+            {
+                setOwner(resource, AgentID(strs[1]));
+            }
+            handleTeamRequest(resource, message.getSender(), message.getConversationID());
+            return true;
+        }
+        case ACLMessage::AGREE:
+        {
+            // The coordinator granted the lock
+            std::string resource = message.getContent();
+            std::map<std::string, ResourceLockState>::iterator it = mLockStates.find(resource);
+            if(it != mLockStates.end() && it->second.mState == lock_state::INTERESTED
+                    && it->second.mConversationID == message.getConversationID())
+            {
+                it->second.mState = lock_state::LOCKED;
+                LOG_DEBUG_S << "'" << mSelf.getName() << "' obtained lock for resource '" << resource << "' from coordinator";
+            }
+            return true;
+        }
+        case ACLMessage::CANCEL:
+            // A team member released the lock
+            handleTeamRelease(message.getContent(), message.getSender());
+            return true;
+        case ACLMessage::REFUSE:
+        {
+            // The coordinator cannot obtain the lock
+            std::string resource = message.getContent();
+            std::map<std::string, ResourceLockState>::iterator it = mLockStates.find(resource);
+            if(it != mLockStates.end() && it->second.mState == lock_state::INTERESTED)
+            {
+                it->second.mState = lock_state::UNREACHABLE;
+                stopRequestingProbes(message.getSender(), resource);
+            }
+            return true;
+        }
+        case ACLMessage::FAILURE:
+            handleIncomingFailure(message.getConversationID());
+            return true;
+        default:
+            // We ignore other performatives, as they are not part of our protocol.
+            return false;
+    }
+}
+
+void HierarchicalDLM::trigger()
+{
+    DLM::trigger();
+    mGlobal->trigger();
+    relayOutgoingMessages(*mGlobal);
+    processTeamStates();
+}
+
+void HierarchicalDLM::agentFailed(const fipa::acl::AgentID& agent)
+{
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' detected failed agent: '" << agent.getName() << "'";
+    if(agent == mCoordinator && !isCoordinator())
+    {
+        // Without our coordinator, we cannot obtain any lock
+        std::map<std::string, ResourceLockState>::iterator it = mLockStates.begin();
+        for(; it != mLockStates.end(); ++it)
+        {
+            if(it->second.mState == lock_state::INTERESTED || it->second.mState == lock_state::LOCKED)
+            {
+                it->second.mState = lock_state::UNREACHABLE;
+            }
+        }
+    }
+
+    // A failed team member cannot hold or wait for a lock any more
+    std::vector<std::string> resources;
+    for(std::map<std::string, TeamState>::iterator it = mTeamStates.begin(); it != mTeamStates.end(); ++it)
+    {
+        TeamState& team = it->second;
+        team.mWaiting.erase(std::remove(team.mWaiting.begin(), team.mWaiting.end(), agent), team.mWaiting.end());
+        team.mConversationID.erase(agent);
+        if(team.mHasHolder && team.mHolder == agent)
+        {
+            // Probes are stopped by the caller
+            team.mHasHolder = false;
+            resources.push_back(it->first);
+        }
+    }
+
+    for(std::vector<std::string>::const_iterator cit = resources.begin(); cit != resources.end(); ++cit)
+    {
+        if(mTeamStates.count(*cit) != 0)
+        {
+            processTeamState(*cit);
+        }
+    }
+}
+
+void HierarchicalDLM::handleTeamRequest(const std::string& resource, const fipa::acl::AgentID& requestor, const std::string& conversationID)
+{
+    TeamState& team = mTeamStates[resource];
+    if((team.mHasHolder && team.mHolder == requestor)
+            || std::find(team.mWaiting.begin(), team.mWaiting.end(), requestor) != team.mWaiting.end())
+    {
+        LOG_INFO_S << "'" << mSelf.getName() << "' received an outdated request from '" << requestor.getName() << "' for resource '" << resource << "'";
+        return;
+    }
+
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' queue request of team member '" << requestor.getName() << "' for resource '" << resource << "'";
+    team.mWaiting.push_back(requestor);
+    team.mConversationID[requestor] = conversationID;
+    processTeamState(resource);
+}
+
+void HierarchicalDLM::handleTeamRelease(const std::string& resource, const fipa::acl::AgentID& agent)
+{
+    std::map<std::string, TeamState>::iterator it = mTeamStates.find(resource);
+    if(it == mTeamStates.end() || !it->second.mHasHolder || it->second.mHolder != agent)
+    {
+        LOG_INFO_S << "'" << mSelf.getName() << "' ignores release of resource '" << resource << "' by '" << agent.getName() << "', who is not holding it";
+        return;
+    }
+
+    it->second.mHasHolder = false;
+    it->second.mConversationID.erase(agent);
+    if(agent != mSelf)
+    {
+        stopRequestingProbes(agent, resource);
+    }
+    processTeamState(resource);
+}
+
+void HierarchicalDLM::processTeamState(const std::string& resource)
+{
+    TeamState& team = mTeamStates[resource];
+    if(team.mHasHolder)
+    {
+        return;
+    }
+
+    lock_state::LockState globalState = mGlobal->getLockState(resource);
+    if(globalState == lock_state::LOCKED)
+    {
+        if(!team.mWaiting.empty() && (mMaxBatchSize == 0 || team.mBatchCount < mMaxBatchSize))
+        {
+            // Pass the global lock on within the team
+            team.mHolder = team.mWaiting.front();
+            team.mWaiting.pop_front();
+            team.mHasHolder = true;
+            ++team.mBatchCount;
+            grantLock(resource, team.mHolder, team.mConversationID[team.mHolder]);
+            return;
+        }
+
+        // The batch is finished, let the other teams have the resource
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' releases global lock for resource '" << resource << "' after " << team.mBatchCount << " team members";
+        team.mBatchCount = 0;
+        mGlobal->unlock(resource);
+        relayOutgoingMessages(*mGlobal);
+        globalState = mGlobal->getLockState(resource);
+    }
+
+    if(team.mWaiting.empty())
+    {
+        mTeamStates.erase(resource);
+        return;
+    }
+
+    if(globalState == lock_state::NOT_INTERESTED)
+    {
+        shareOwnerInformation(*mGlobal, resource);
+        mGlobal->lock(resource, mCoordinators);
+        relayOutgoingMessages(*mGlobal);
+        // The global lock might be obtained right away, e.g. if the token is held already
+        if(mGlobal->getLockState(resource) == lock_state::LOCKED)
+        {
+            processTeamState(resource);
+        }
+    } else if(globalState == lock_state::UNREACHABLE)
+    {
+        // Nobody in the team will get the lock
+        for(std::deque<AgentID>::const_iterator cit = team.mWaiting.begin(); cit != team.mWaiting.end(); ++cit)
+        {
+            if(*cit == mSelf)
+            {
+                mLockStates[resource].mState = lock_state::UNREACHABLE;
+                continue;
+            }
+            ACLMessage message = prepareMessage(ACLMessage::REFUSE, getProtocolName(), resource);
+            message.addReceiver(*cit);
+            message.setConversationID(team.mConversationID[*cit]);
+            sendMessage(message);
+        }
+        mTeamStates.erase(resource);
+    }
+}
+
+void HierarchicalDLM::processTeamStates()
+{
+    // Processing can remove team states
+    std::vector<std::string> resources;
+    for(std::map<std::string, TeamState>::const_iterator cit = mTeamStates.begin(); cit != mTeamStates.end(); ++cit)
+    {
+        resources.push_back(cit->first);
+    }
+
+    for(std::vector<std::string>::const_iterator cit = resources.begin(); cit != resources.end(); ++cit)
+    {
+        if(mTeamStates.count(*cit) != 0)
+        {
+            processTeamState(*cit);
+        }
+    }
+}
+
+void HierarchicalDLM::grantLock(const std::string& resource, const fipa::acl::AgentID& agent, const std::string& conversationID)
+{
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' grants lock for resource '" << resource << "' to team member '" << agent.getName() << "'";
+    if(agent == mSelf)
+    {
+        mLockStates[resource].mState = lock_state::LOCKED;
+        return;
+    }
+
+    ACLMessage message = prepareMessage(ACLMessage::AGREE, getProtocolName(), resource);
+    message.addReceiver(agent);
+    // Answer within the conversation of the request
+    message.setConversationID(conversationID);
+    sendMessage(message);
+
+    // The team member has to give the lock back at some point
+    startRequestingProbes(agent, resource);
+}
+
+void HierarchicalDLM::onDeliveryFailure(const std::string& conversationID, const fipa::acl::AgentIDList& failedReceivers)
+{
+    // The conversation IDs of the global instance are distinct from ours
+    mGlobal->onDeliveryFailure(conversationID, failedReceivers);
+    relayOutgoingMessages(*mGlobal);
+    processTeamStates();
+
+    handleIncomingFailure(conversationID);
+}
+
+void HierarchicalDLM::handleIncomingFailure(const std::string& conversationID)
+{
+    // Our request or release did not reach the coordinator
+    std::map<std::string, ResourceLockState>::iterator it = mLockStates.begin();
+    for(; it != mLockStates.end(); ++it)
+    {
+        if(it->second.mConversationID == conversationID)
+        {
+            if(it->second.mState == lock_state::INTERESTED)
+            {
+                LOG_DEBUG_S << "'" << mSelf.getName()  << "' mark resource: '" << it->first << "' unreachable";
+                it->second.mState = lock_state::UNREACHABLE;
+                stopRequestingProbes(mCoordinator, it->first);
+            }
+            return;
+        }
+    }
+
+    // The grant did not reach the team member, so it will never release the lock
+    std::map<std::string, TeamState>::iterator tit = mTeamStates.begin();
+    for(; tit != mTeamStates.end(); ++tit)
+    {
+        TeamState& team = tit->second;
+        if(team.mHasHolder && team.mConversationID[team.mHolder] == conversationID)
+        {
+            handleTeamRelease(tit->first, team.mHolder);
+            return;
+        }
+    }
+}
+
+} // namespace distributed_locking
+} // namespace fipa
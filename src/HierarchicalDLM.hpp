@@ -0,0 +1,171 @@
+#ifndef DISTRIBUTED_LOCKING_HIERARCHICAL_DLM_HPP
+#define DISTRIBUTED_LOCKING_HIERARCHICAL_DLM_HPP
+
+#include <deque>
+#include <map>
+#include <fipa_acl/fipa_acl.h>
+#include <distributed_locking/DLM.hpp>
+
+namespace fipa {
+namespace distributed_locking {
+/**
+ * Two-level locking for teams of agents. Each team has a local coordinator, which collects the lock requests of its
+ * team members. Only the coordinators compete for a resource, using a global Ricart Agrawala or Suzuki Kasami instance.
+ * Once a coordinator obtained the global lock, it grants the lock to the waiting members of its team one after another
+ * (a batch), before it releases the global lock again. Like this, the messages between teams per critical section
+ * depend on the number of teams rather than the number of agents.
+ *
+ * Every agent knows the coordinator of its team (setCoordinator), the coordinators know each other (setCoordinators).
+ * An agent without a coordinator is the coordinator of its own team.
+ */
+class HierarchicalDLM : public DLM
+{
+public:
+    /**
+     * Constructor, the global protocol can be RICART_AGRAWALA or SUZUKI_KASAMI
+     */
+    HierarchicalDLM(const fipa::acl::AgentID& self, const std::vector<std::string>& resources,
+            protocol::Protocol globalProtocol = protocol::RICART_AGRAWALA);
+
+    /**
+     * Sets the coordinator of the team this agent belongs to
+     */
+    void setCoordinator(const fipa::acl::AgentID& coordinator);
+
+    /**
+     * Gets the coordinator of the team this agent belongs to
+     */
+    const fipa::acl::AgentID& getCoordinator() const { return mCoordinator; }
+
+    /**
+     * Sets the coordinators of all other teams, which take part in the global lock
+     */
+    void setCoordinators(const fipa::acl::AgentIDList& coordinators);
+
+    /**
+     * Sets the maximum number of team members a coordinator grants the lock to, before releasing the global lock.
+     * 0 means the global lock is released only if no team member is waiting any more.
+     */
+    void setMaxBatchSize(unsigned int batchSize) { mMaxBatchSize = batchSize; }
+
+    /**
+     * Gets the maximum number of team members a coordinator grants the lock to, before releasing the global lock.
+     */
+    unsigned int getMaxBatchSize() const { return mMaxBatchSize; }
+
+    /**
+     * Tries to lock a resource via the team coordinator. The agents are not used, as the global lock is
+     * negotiated among the coordinators.
+     */
+    virtual void lock(const std::string& resource, const fipa::acl::AgentIDList& agents);
+    /**
+     * Unlocks a resource, that must have been locked before
+     */
+    virtual void unlock(const std::string& resource);
+    /**
+     * Gets the lock state for a resource.
+     */
+    virtual lock_state::LockState getLockState(const std::string& resource) const;
+    /**
+     * This message is triggered by the higher instance that uses this library, if a message is received.
+     * Messages of the global protocol are passed on to the global instance.
+     */
+    virtual bool onIncomingMessage(const fipa::acl::ACLMessage& message);
+    /**
+     * Runs the global instance as well
+     */
+    virtual void trigger();
+    /**
+     * Called if the coordinator or a team member holding a lock does not respond PROBE messages
+     */
+    virtual void agentFailed(const fipa::acl::AgentID& agent);
+    /**
+     * Handles the failure to deliver a message of the given conversation. Conversations of the global protocol are
+     * passed on to the global instance.
+     */
+    virtual void onDeliveryFailure(const std::string& conversationID, const fipa::acl::AgentIDList& failedReceivers);
+
+protected:
+    /**
+     * The lock state of this agent for a certain resource
+     */
+    struct ResourceLockState
+    {
+        lock_state::LockState mState;
+        // The conversation with the coordinator
+        std::string mConversationID;
+
+        ResourceLockState() : mState(lock_state::NOT_INTERESTED) {}
+    };
+
+    /**
+     * The state a coordinator keeps per resource for its team
+     */
+    struct TeamState
+    {
+        // Team members waiting for the lock, in order of their requests
+        std::deque<fipa::acl::AgentID> mWaiting;
+        // The requestor mapped to the conversationID of its request
+        std::map<fipa::acl::AgentID, std::string> mConversationID;
+        // The team member currently holding the lock, if mHasHolder
+        fipa::acl::AgentID mHolder;
+        bool mHasHolder;
+        // Number of team members, which got the lock since the global lock was obtained
+        unsigned int mBatchCount;
+
+        TeamState() : mHasHolder(false), mBatchCount(0) {}
+    };
+
+    // The global instance, used by the coordinators
+    DLM::Ptr mGlobal;
+    // Coordinator of the own team
+    fipa::acl::AgentID mCoordinator;
+    // Coordinators of all other teams
+    fipa::acl::AgentIDList mCoordinators;
+    unsigned int mMaxBatchSize;
+
+    // All resources mapped to the their ResourceLockStates
+    std::map<std::string, ResourceLockState> mLockStates;
+    // All resources mapped to the state of the team (only used by coordinators)
+    std::map<std::string, TeamState> mTeamStates;
+
+    /**
+     * Whether this agent is the coordinator of its team
+     */
+    bool isCoordinator() const { return mCoordinator == mSelf; }
+
+    /**
+     * Queues a lock request of a team member (coordinator only)
+     */
+    void handleTeamRequest(const std::string& resource, const fipa::acl::AgentID& requestor, const std::string& conversationID);
+
+    /**
+     * Handles the release of the lock by a team member (coordinator only)
+     */
+    void handleTeamRelease(const std::string& resource, const fipa::acl::AgentID& agent);
+
+    /**
+     * Obtains or releases the global lock and grants the lock to the next team member, as required (coordinator only)
+     */
+    void processTeamState(const std::string& resource);
+
+    /**
+     * Processes the team states of all resources, after the global instance was active
+     */
+    void processTeamStates();
+
+    /**
+     * Grants the lock to a team member
+     */
+    void grantLock(const std::string& resource, const fipa::acl::AgentID& agent, const std::string& conversationID);
+
+    /**
+     * Handles the failure to deliver a message of one of our conversations, the receivers do not matter
+     */
+    void handleIncomingFailure(const std::string& conversationID);
+};
+
+} // namespace distributed_locking
+} // namespace fipa
+
+#endif // DISTRIBUTED_LOCKING_HIERARCHICAL_DLM_HPP
@@ -0,0 +1,212 @@
+#include "LockCombiner.hpp"
+
+#include <stdexcept>
+#include <base/Logging.hpp>
+
+using namespace fipa::acl;
+
+namespace fipa {
+namespace distributed_locking {
+
+LockCombiner::LockCombiner(const DLM::Ptr& dlm)
+    : mDLM(dlm)
+    , mFairnessBudget(8)
+    , mDistributedAcquisitions(0)
+    , mLocalHandOvers(0)
+{
+    if(!mDLM)
+    {
+        throw std::invalid_argument("LockCombiner: no DLM given");
+    }
+}
+
+void LockCombiner::setFairnessBudget(unsigned int handOvers)
+{
+    boost::mutex::scoped_lock guard(mMutex);
+    mFairnessBudget = handOvers;
+}
+
+unsigned int LockCombiner::getFairnessBudget() const
+{
+    boost::mutex::scoped_lock guard(mMutex);
+    return mFairnessBudget;
+}
+
+void LockCombiner::lock(const std::string& resource, const AgentIDList& agents)
+{
+    boost::mutex::scoped_lock guard(mMutex);
+    Waiter waiter(agents);
+    std::map<std::string, LocalQueue>::iterator it = mQueues.insert(std::make_pair(resource, LocalQueue())).first;
+    it->second.mWaiters.push_back(&waiter);
+    if(!it->second.mHeld && !it->second.mRequested)
+    {
+        // Nobody holds or waits for the resource locally, so the distributed lock is needed
+        try
+        {
+            mDLM->lock(resource, agents);
+        } catch(...)
+        {
+            mQueues.erase(it);
+            throw;
+        }
+        it->second.mRequested = true;
+        update(it);
+    }
+
+    while(!waiter.mGranted && !waiter.mFailed)
+    {
+        waiter.mCondition.wait(guard);
+    }
+    if(waiter.mFailed)
+    {
+        throw std::runtime_error("LockCombiner::lock: cannot lock UNREACHABLE resource '" + resource + "'");
+    }
+}
+
+void LockCombiner::unlock(const std::string& resource)
+{
+    boost::mutex::scoped_lock guard(mMutex);
+    std::map<std::string, LocalQueue>::iterator it = mQueues.find(resource);
+    if(it == mQueues.end() || !it->second.mHeld)
+    {
+        throw std::invalid_argument("LockCombiner::unlock: resource '" + resource + "' is not locked");
+    }
+    LocalQueue& queue = it->second;
+    queue.mHeld = false;
+    if(!queue.mWaiters.empty() && queue.mHandOvers < mFairnessBudget)
+    {
+        ++queue.mHandOvers;
+        ++mLocalHandOvers;
+        grant(queue);
+        return;
+    }
+
+    queue.mHandOvers = 0;
+    mDLM->unlock(resource);
+    if(queue.mWaiters.empty())
+    {
+        mQueues.erase(it);
+        return;
+    }
+    // The budget is used up, so the remaining threads queue up behind the other agents
+    LOG_DEBUG_S << "LockCombiner: '" << mDLM->getSelf().getName() << "' releases resource '" << resource << "' with "
+        << queue.mWaiters.size() << " local threads waiting";
+    request(it);
+}
+
+unsigned int LockCombiner::getDistributedAcquisitions() const
+{
+    boost::mutex::scoped_lock guard(mMutex);
+    return mDistributedAcquisitions;
+}
+
+unsigned int LockCombiner::getLocalHandOvers() const
+{
+    boost::mutex::scoped_lock guard(mMutex);
+    return mLocalHandOvers;
+}
+
+void LockCombiner::trigger()
+{
+    boost::mutex::scoped_lock guard(mMutex);
+    mDLM->trigger();
+    updateAll();
+}
+
+bool LockCombiner::onIncomingMessage(const fipa::acl::ACLMessage& message)
+{
+    boost::mutex::scoped_lock guard(mMutex);
+    bool handled = mDLM->onIncomingMessage(message);
+    updateAll();
+    return handled;
+}
+
+void LockCombiner::onDeliveryFailure(const std::string& conversationID, const fipa::acl::AgentIDList& failedReceivers)
+{
+    boost::mutex::scoped_lock guard(mMutex);
+    mDLM->onDeliveryFailure(conversationID, failedReceivers);
+    updateAll();
+}
+
+fipa::acl::ACLMessage LockCombiner::popNextOutgoingMessage()
+{
+    boost::mutex::scoped_lock guard(mMutex);
+    return mDLM->popNextOutgoingMessage();
+}
+
+bool LockCombiner::hasOutgoingMessages() const
+{
+    boost::mutex::scoped_lock guard(mMutex);
+    return mDLM->hasOutgoingMessages();
+}
+
+bool LockCombiner::request(std::map<std::string, LocalQueue>::iterator it)
+{
+    try
+    {
+        mDLM->lock(it->first, *it->second.mWaiters.front()->mAgents);
+    } catch(const std::exception& e)
+    {
+        LOG_WARN_S << "LockCombiner: '" << mDLM->getSelf().getName() << "' cannot lock resource '" << it->first << "' again: " << e.what();
+        fail(it);
+        return false;
+    }
+    it->second.mRequested = true;
+    return update(it);
+}
+
+bool LockCombiner::update(std::map<std::string, LocalQueue>::iterator it)
+{
+    if(!it->second.mRequested)
+    {
+        return true;
+    }
+    switch(mDLM->getLockState(it->first))
+    {
+        case lock_state::LOCKED:
+            it->second.mRequested = false;
+            ++mDistributedAcquisitions;
+            grant(it->second);
+            return true;
+        case lock_state::UNREACHABLE:
+            fail(it);
+            return false;
+        default:
+            return true;
+    }
+}
+
+void LockCombiner::updateAll()
+{
+    std::map<std::string, LocalQueue>::iterator it = mQueues.begin();
+    while(it != mQueues.end())
+    {
+        // A failed queue is removed, so the iterator has to be advanced before
+        std::map<std::string, LocalQueue>::iterator current = it++;
+        update(current);
+    }
+}
+
+void LockCombiner::fail(std::map<std::string, LocalQueue>::iterator it)
+{
+    std::deque<Waiter*>& waiters = it->second.mWaiters;
+    for(std::deque<Waiter*>::iterator wit = waiters.begin(); wit != waiters.end(); ++wit)
+    {
+        (*wit)->mFailed = true;
+        (*wit)->mCondition.notify_one();
+    }
+    mQueues.erase(it);
+}
+
+void LockCombiner::grant(LocalQueue& queue)
+{
+    // The waiter is gone as soon as it returns from lock()
+    Waiter* waiter = queue.mWaiters.front();
+    queue.mWaiters.pop_front();
+    queue.mHeld = true;
+    waiter->mGranted = true;
+    waiter->mCondition.notify_one();
+}
+
+} // namespace distributed_locking
+} // namespace fipa
@@ -0,0 +1,172 @@
+#ifndef DISTRIBUTED_LOCKING_LOCK_COMBINER_HPP
+#define DISTRIBUTED_LOCKING_LOCK_COMBINER_HPP
+
+#include <map>
+#include <deque>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <fipa_acl/fipa_acl.h>
+#include <distributed_locking/DLM.hpp>
+
+namespace fipa {
+namespace distributed_locking {
+/**
+ * Lets several threads of one agent lock the resources of a DLM.
+ *
+ * The threads wait in a local queue per resource, each on its own condition, so that only the next thread is woken
+ * when the lock is passed on. The first thread of the queue acquires the distributed lock. When it unlocks, the lock
+ * is handed over to the next local thread without any message, until the fairness budget is used up (see
+ * setFairnessBudget). Then the distributed lock is released to the other agents, and requested again for the threads
+ * still waiting.
+ *
+ * The DLM must not be used directly anymore: the wrapping component calls trigger, onIncomingMessage and
+ * popNextOutgoingMessage of the combiner instead, which may be done from another thread than the locking ones.
+ */
+class LockCombiner
+{
+public:
+    typedef boost::shared_ptr<LockCombiner> Ptr;
+
+    /**
+     * Constructor, with the DLM of the agent, and a fairness budget of 8 local hand-overs
+     */
+    LockCombiner(const DLM::Ptr& dlm);
+
+    /**
+     * Gets the DLM, which must not be used while other threads use the combiner
+     */
+    DLM::Ptr getDLM() const { return mDLM; }
+
+    /**
+     * Sets how often the lock of a resource is handed over between local threads at most, before it is released to
+     * the other agents. 0 releases it on every unlock.
+     */
+    void setFairnessBudget(unsigned int handOvers);
+
+    /**
+     * Gets how often the lock of a resource is handed over between local threads at most
+     */
+    unsigned int getFairnessBudget() const;
+
+    /**
+     * Locks a resource for the calling thread, and blocks until it is held
+     * \throws std::runtime_error if the resource is unreachable
+     */
+    void lock(const std::string& resource, const fipa::acl::AgentIDList& agents);
+
+    /**
+     * Unlocks a resource held by the calling thread, and passes it on to the next local thread if the fairness
+     * budget allows
+     * \throws std::invalid_argument if the resource is not held
+     */
+    void unlock(const std::string& resource);
+
+    /**
+     * Gets the number of times the distributed lock of any resource was obtained
+     */
+    unsigned int getDistributedAcquisitions() const;
+
+    /**
+     * Gets the number of times a lock was handed over between local threads, without messages
+     */
+    unsigned int getLocalHandOvers() const;
+
+    /**
+     * MUST be called periodically, triggers the DLM
+     */
+    void trigger();
+
+    /**
+     * Passes a message on to the DLM
+     * \return true if message was handled, false otherwise
+     */
+    bool onIncomingMessage(const fipa::acl::ACLMessage& message);
+
+    /**
+     * Passes a delivery failure on to the DLM
+     */
+    void onDeliveryFailure(const std::string& conversationID, const fipa::acl::AgentIDList& failedReceivers);
+
+    /**
+     * Gets the next outgoing message of the DLM.
+     * Must only be called if hasOutgoingMessages == true.
+     */
+    fipa::acl::ACLMessage popNextOutgoingMessage();
+
+    /**
+     * True, if the DLM has outgoing messages
+     */
+    bool hasOutgoingMessages() const;
+
+protected:
+    /**
+     * A thread waiting for or holding a lock
+     */
+    struct Waiter
+    {
+        const fipa::acl::AgentIDList* mAgents;
+        boost::condition_variable mCondition;
+        bool mGranted;
+        bool mFailed;
+
+        Waiter(const fipa::acl::AgentIDList& agents) : mAgents(&agents), mGranted(false), mFailed(false) {}
+    };
+
+    /**
+     * The local threads of a resource. The waiters are removed, when they get the lock.
+     */
+    struct LocalQueue
+    {
+        std::deque<Waiter*> mWaiters;
+        // Whether a local thread holds the lock
+        bool mHeld;
+        // Whether the distributed lock is requested for the first waiter and not obtained yet
+        bool mRequested;
+        // Number of hand-overs between local threads since the distributed lock was obtained
+        unsigned int mHandOvers;
+
+        LocalQueue() : mHeld(false), mRequested(false), mHandOvers(0) {}
+    };
+
+    DLM::Ptr mDLM;
+    // Guards the DLM and all of the following
+    mutable boost::mutex mMutex;
+    std::map<std::string, LocalQueue> mQueues;
+    unsigned int mFairnessBudget;
+    unsigned int mDistributedAcquisitions;
+    unsigned int mLocalHandOvers;
+
+    /**
+     * Requests the distributed lock for the first waiter of a queue. Fails the queue, if this is not possible.
+     * \return false if the queue failed and was removed
+     */
+    bool request(std::map<std::string, LocalQueue>::iterator it);
+
+    /**
+     * Wakes the first waiter of a queue, once the distributed lock is obtained. Fails the queue, if the resource
+     * became unreachable.
+     * \return false if the queue failed and was removed
+     */
+    bool update(std::map<std::string, LocalQueue>::iterator it);
+
+    /**
+     * Wakes the threads of all queues, whose distributed lock was obtained or became unreachable
+     */
+    void updateAll();
+
+    /**
+     * Wakes all threads of a queue with a failure, and removes it
+     */
+    void fail(std::map<std::string, LocalQueue>::iterator it);
+
+    /**
+     * Passes the lock on to the first waiter of a queue
+     */
+    static void grant(LocalQueue& queue);
+};
+
+} // namespace distributed_locking
+} // namespace fipa
+
+#endif // DISTRIBUTED_LOCKING_LOCK_COMBINER_HPP
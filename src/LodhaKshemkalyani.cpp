@@ -0,0 +1,66 @@
+#include "LodhaKshemkalyani.hpp"
+
+#include <base/Logging.hpp>
+
+using namespace fipa::acl;
+
+namespace fipa {
+namespace distributed_locking {
+
+LodhaKshemkalyani::LodhaKshemkalyani(const fipa::acl::AgentID& self, const std::vector< std::string >& resources)
+    : RicartAgrawala(self, resources)
+{
+    setProtocol(protocol::LODHA_KSHEMKALYANI);
+}
+
+void LodhaKshemkalyani::handleIncomingRequest(const fipa::acl::ACLMessage& message)
+{
+    LOG_DEBUG_S << "Handling incoming request";
+    LamportTime otherTime;
+    std::string resource;
+    priority::Priority otherPriority;
+    extractInformation(message, otherTime, resource, otherPriority);
+
+    // Synchronize internal Lamport Clock with that of the sender
+    synchronizeLamportClock(otherTime);
+
+    const AgentID& sender = message.getSender();
+    lock_state::LockState state = getResourceLockState(resource);
+    if(state == lock_state::NOT_INTERESTED)
+    {
+        sendResponse(message, resource);
+        return;
+    }
+
+    bool otherHasPrecedence = state == lock_state::INTERESTED && hasPrecedence(resource, otherTime, sender, otherPriority);
+    // Only a concurrent request to an agent we requested the lock from can replace a response
+    if(state != lock_state::INTERESTED || !isCommunicationPartner(resource, sender))
+    {
+        if(otherHasPrecedence)
+        {
+            sendResponse(message, resource);
+        } else {
+            deferResponse(message, resource);
+        }
+        return;
+    }
+
+    if(otherHasPrecedence)
+    {
+        // The sender will enter first. It receives our request as well, which acts as our response.
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' suppresses response to '" << sender.getName() << "' for resource '" << resource << "'";
+        return;
+    }
+
+    // The sender has to wait for our deferred response, so its request acts as its response to us
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' uses request of '" << sender.getName() << "' as response for resource '" << resource << "'";
+    deferResponse(message, resource);
+    // An explicit response of the same agent, which may still arrive, is dropped
+    if(addRespondedAgent(sender, resource))
+    {
+        tryObtainLock(resource);
+    }
+}
+
+} // namespace distributed_locking
+} // namespace fipa
@@ -0,0 +1,40 @@
+#ifndef DISTRIBUTED_LOCKING_LODHA_KSHEMKALYANI_HPP
+#define DISTRIBUTED_LOCKING_LODHA_KSHEMKALYANI_HPP
+
+#include <fipa_acl/fipa_acl.h>
+#include <distributed_locking/RicartAgrawala.hpp>
+
+namespace fipa {
+namespace distributed_locking {
+/**
+ * Implementation of the Lodha Kshemkalyani algorithm, a refinement of Ricart Agrawala. A request which is concurrent
+ * to our own request acts as an implicit reply:
+ *  - a concurrent request with a lower priority is counted as response of its sender, since the sender cannot enter
+ *    the critical section before it got our (deferred) response
+ *  - a concurrent request with a higher priority is not responded at all, since our own request already tells the sender
+ *    that it may enter before us
+ * Like this, between N-1 and 2(N-1) messages are required per critical section, the more contention the less.
+ *
+ * Lock modes are not taken into account: all requests are treated like exclusive ones, which is safe but lets
+ * compatible locks wait for each other.
+ *
+ * All agents competing for a resource must use this protocol.
+ */
+class LodhaKshemkalyani : public RicartAgrawala
+{
+public:
+    /**
+     * Constructor
+     */
+    LodhaKshemkalyani(const fipa::acl::AgentID& self, const std::vector<std::string>& resources);
+
+protected:
+    /**
+     * Handles an incoming request, concurrent requests are used as implicit replies
+     */
+    virtual void handleIncomingRequest(const fipa::acl::ACLMessage& message);
+};
+} // namespace distributed_locking
+} // namespace fipa
+
+#endif // DISTRIBUTED_LOCKING_LODHA_KSHEMKALYANI_HPP
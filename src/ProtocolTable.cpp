@@ -0,0 +1,195 @@
+#include "ProtocolTable.hpp"
+
+#include <algorithm>
+
+namespace fipa {
+namespace distributed_locking {
+
+const char* ProtocolTable::INITIATOR = "initiator";
+const char* ProtocolTable::ANY = ".*";
+
+namespace {
+
+// protocols/dlm_discover
+const ProtocolTable::Transition dlmDiscoverTransitions[] = {
+    { 1, "query-if", "initiator", "B", 2 },
+    { 1, "inform", "B", ".*", 2 },
+    { 2, "inform", "B", ".*", 2 }
+};
+const unsigned int dlmDiscoverFinalStates[] = { 3 };
+
+// protocols/dlm_probe
+const ProtocolTable::Transition dlmProbeTransitions[] = {
+    { 1, "request", "initiator", "B", 2 },
+    { 2, "confirm", "B", "initiator", 3 }
+};
+const unsigned int dlmProbeFinalStates[] = { 3 };
+
+// protocols/ricart_agrawala
+const ProtocolTable::Transition ricartAgrawalaTransitions[] = {
+    { 1, "request", "initiator", "all", 2 },
+    { 2, "agree", "all", "initiator", 3 },
+    { 2, "confirm", "initiator", "owner", 4 },
+    { 3, "agree", "all", "initiator", 3 },
+    { 3, "confirm", "initiator", "owner", 4 },
+    { 4, "disconfirm", "initiator", "owner", 5 },
+    { 4, "agree", "all", "initiator", 4 },
+    { 5, "agree", "initiator", ".*", 5 },
+    { 5, "agree", "all", "initiator", 5 }
+};
+const unsigned int ricartAgrawalaFinalStates[] = { 5 };
+
+// protocols/ricart_agrawala_extended
+const ProtocolTable::Transition ricartAgrawalaExtendedTransitions[] = {
+    { 1, "request", "initiator", "all", 2 },
+    { 2, "agree", "all", "initiator", 3 },
+    { 2, "confirm", "initiator", "owner", 4 },
+    { 3, "agree", "all", "initiator", 3 },
+    { 3, "confirm", "initiator", "owner", 4 },
+    { 4, "disconfirm", "initiator", "owner", 5 },
+    { 4, "agree", "all", "initiator", 4 },
+    { 5, "agree", "initiator", ".*", 5 },
+    { 5, "agree", "all", "initiator", 5 }
+};
+const unsigned int ricartAgrawalaExtendedFinalStates[] = { 5 };
+
+// protocols/suzuki_kasami
+const ProtocolTable::Transition suzukiKasamiTransitions[] = {
+    { 1, "request", "initiator", "all", 2 },
+    { 2, "propagate", "all", "initiator", 3 },
+    { 2, "request", "initiator", ".*", 2 },
+    { 2, "propagate", ".*", "initiator", 3 }
+};
+const unsigned int suzukiKasamiFinalStates[] = { 3 };
+
+// protocols/suzuki_kasami_extended
+const ProtocolTable::Transition suzukiKasamiExtendedTransitions[] = {
+    { 1, "request", "initiator", "all", 2 },
+    { 1, "failure", ".*", "initiator", 2 },
+    { 2, "propagate", "all", "initiator", 3 },
+    { 2, "request", "initiator", ".*", 2 },
+    { 2, "propagate", ".*", "initiator", 3 },
+    { 2, "failure", ".*", "initiator", 3 },
+    { 2, "inform-ref", ".*", ".*", 3 },
+    { 3, "propagate", "initiator", "all", 3 },
+    { 3, "propagate", "all", ".*", 3 },
+    { 3, "inform-ref", ".*", ".*", 3 },
+    { 3, "failure", ".*", "initiator", 3 }
+};
+const unsigned int suzukiKasamiExtendedFinalStates[] = { 3 };
+
+// protocols/hierarchical
+const ProtocolTable::Transition hierarchicalTransitions[] = {
+    { 1, "request", "initiator", "coordinator", 2 },
+    { 2, "agree", "coordinator", "initiator", 3 },
+    { 2, "refuse", "coordinator", "initiator", 4 },
+    { 2, "failure", ".*", ".*", 4 },
+    { 3, "cancel", "initiator", "coordinator", 4 },
+    { 3, "failure", ".*", ".*", 4 }
+};
+const unsigned int hierarchicalFinalStates[] = { 4 };
+
+// protocols/lodha_kshemkalyani
+const ProtocolTable::Transition lodhaKshemkalyaniTransitions[] = {
+    { 1, "request", "initiator", "all", 2 },
+    { 2, "agree", "all", "initiator", 2 },
+    { 2, "confirm", "initiator", "owner", 3 },
+    { 3, "disconfirm", "initiator", "owner", 4 },
+    { 3, "agree", "all", "initiator", 3 },
+    { 4, "agree", "initiator", ".*", 4 },
+    { 4, "agree", "all", "initiator", 4 }
+};
+const unsigned int lodhaKshemkalyaniFinalStates[] = { 4 };
+
+// protocols/adaptive
+const ProtocolTable::Transition adaptiveTransitions[] = {
+    { 1, "propose", "initiator", "all", 2 },
+    { 1, "refuse", "initiator", "all", 3 },
+    { 2, "accept-proposal", "all", "initiator", 2 },
+    { 2, "reject-proposal", "all", "initiator", 2 },
+    { 2, "agree", "initiator", "all", 3 },
+    { 2, "cancel", "initiator", "all", 3 },
+    { 2, "failure", ".*", ".*", 3 },
+    { 3, "accept-proposal", "all", "initiator", 3 },
+    { 3, "reject-proposal", "all", "initiator", 3 }
+};
+const unsigned int adaptiveFinalStates[] = { 3 };
+
+#define PROTOCOL_TABLE(name, prefix) \
+    ProtocolTable(name, 1, prefix##Transitions, sizeof(prefix##Transitions) / sizeof(ProtocolTable::Transition), \
+            prefix##FinalStates, sizeof(prefix##FinalStates) / sizeof(unsigned int))
+
+} // namespace
+
+ProtocolTable::ProtocolTable(const std::string& name, unsigned int initialState, const Transition* transitions, unsigned int transitionCount,
+        const unsigned int* finalStates, unsigned int finalStateCount)
+    : mName(name)
+    , mInitialState(initialState)
+    , mTransitions(transitions, transitions + transitionCount)
+    , mFinalStates(finalStates, finalStates + finalStateCount)
+{
+}
+
+const std::vector<ProtocolTable>& ProtocolTable::getTables()
+{
+    static std::vector<ProtocolTable> tables;
+    if(tables.empty())
+    {
+        tables.push_back(PROTOCOL_TABLE("dlm_discover", dlmDiscover));
+        tables.push_back(PROTOCOL_TABLE("dlm_probe", dlmProbe));
+        tables.push_back(PROTOCOL_TABLE("ricart_agrawala", ricartAgrawala));
+        tables.push_back(PROTOCOL_TABLE("ricart_agrawala_extended", ricartAgrawalaExtended));
+        tables.push_back(PROTOCOL_TABLE("suzuki_kasami", suzukiKasami));
+        tables.push_back(PROTOCOL_TABLE("suzuki_kasami_extended", suzukiKasamiExtended));
+        tables.push_back(PROTOCOL_TABLE("hierarchical", hierarchical));
+        tables.push_back(PROTOCOL_TABLE("lodha_kshemkalyani", lodhaKshemkalyani));
+        tables.push_back(PROTOCOL_TABLE("adaptive", adaptive));
+    }
+    return tables;
+}
+
+#undef PROTOCOL_TABLE
+
+const ProtocolTable* ProtocolTable::get(const std::string& protocol)
+{
+    const std::vector<ProtocolTable>& tables = getTables();
+    for(std::vector<ProtocolTable>::const_iterator cit = tables.begin(); cit != tables.end(); ++cit)
+    {
+        if(cit->mName == protocol)
+        {
+            return &*cit;
+        }
+    }
+    return NULL;
+}
+
+std::vector<std::string> ProtocolTable::getProtocols()
+{
+    std::vector<std::string> protocols;
+    const std::vector<ProtocolTable>& tables = getTables();
+    for(std::vector<ProtocolTable>::const_iterator cit = tables.begin(); cit != tables.end(); ++cit)
+    {
+        protocols.push_back(cit->mName);
+    }
+    return protocols;
+}
+
+bool ProtocolTable::isFinal(unsigned int state) const
+{
+    return std::find(mFinalStates.begin(), mFinalStates.end(), state) != mFinalStates.end();
+}
+
+bool ProtocolTable::hasTransitions(unsigned int state) const
+{
+    for(std::vector<Transition>::const_iterator cit = mTransitions.begin(); cit != mTransitions.end(); ++cit)
+    {
+        if(cit->mState == state)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace distributed_locking
+} // namespace fipa
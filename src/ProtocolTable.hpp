@@ -0,0 +1,95 @@
+#ifndef DISTRIBUTED_LOCKING_PROTOCOL_TABLE_HPP
+#define DISTRIBUTED_LOCKING_PROTOCOL_TABLE_HPP
+
+#include <string>
+#include <vector>
+
+namespace fipa {
+namespace distributed_locking {
+/**
+ * The state machine of a DLM protocol as static transition table, compiled from the SCXML description of the
+ * protocol (see the protocols directory). The tables are part of the library, so that conversations can be checked
+ * without loading and interpreting the SCXML files at runtime.
+ *
+ * The tables MUST be kept in sync with the SCXML files, which the test suite checks.
+ */
+class ProtocolTable
+{
+public:
+    // Role of the agent who started a conversation
+    static const char* INITIATOR;
+    // Role matching any agent
+    static const char* ANY;
+
+    /**
+     * A transition, which is taken for a message with the given performative from and to agents of the given
+     * roles. Roles other than INITIATOR and ANY are played by agents other than the initiator.
+     */
+    struct Transition
+    {
+        unsigned int mState;
+        const char* mPerformative;
+        const char* mFrom;
+        const char* mTo;
+        unsigned int mTarget;
+    };
+
+    /**
+     * Gets the table of a protocol, NULL if there is none
+     */
+    static const ProtocolTable* get(const std::string& protocol);
+
+    /**
+     * Gets the names of all protocols with a table
+     */
+    static std::vector<std::string> getProtocols();
+
+    /**
+     * Gets the name of the protocol
+     */
+    const std::string& getName() const { return mName; }
+
+    /**
+     * Gets the state a conversation starts in
+     */
+    unsigned int getInitialState() const { return mInitialState; }
+
+    /**
+     * True, if the conversation may end in the given state
+     */
+    bool isFinal(unsigned int state) const;
+
+    /**
+     * True, if a message may follow in the given state
+     */
+    bool hasTransitions(unsigned int state) const;
+
+    /**
+     * Gets all transitions, in the order of the SCXML description
+     */
+    const std::vector<Transition>& getTransitions() const { return mTransitions; }
+
+    /**
+     * Gets all final states
+     */
+    const std::vector<unsigned int>& getFinalStates() const { return mFinalStates; }
+
+protected:
+    ProtocolTable(const std::string& name, unsigned int initialState, const Transition* transitions, unsigned int transitionCount,
+            const unsigned int* finalStates, unsigned int finalStateCount);
+
+    std::string mName;
+    unsigned int mInitialState;
+    std::vector<Transition> mTransitions;
+    std::vector<unsigned int> mFinalStates;
+
+    /**
+     * Gets the tables of all protocols
+     */
+    static const std::vector<ProtocolTable>& getTables();
+};
+
+} // namespace distributed_locking
+} // namespace fipa
+
+#endif // DISTRIBUTED_LOCKING_PROTOCOL_TABLE_HPP
@@ -0,0 +1,214 @@
+#include "ProtocolValidator.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/functional/hash.hpp>
+#include <boost/lexical_cast.hpp>
+#include <base/Logging.hpp>
+
+using namespace fipa::acl;
+
+namespace fipa {
+namespace distributed_locking {
+
+namespace {
+
+/**
+ * Whether an agent can play a role of a transition. Roles other than the initiator are played by everyone else.
+ */
+bool playsRole(const char* role, const AgentID& agent, const AgentID& initiator)
+{
+    if(std::strcmp(role, ProtocolTable::ANY) == 0 || initiator.getName().empty())
+    {
+        return true;
+    }
+    return (std::strcmp(role, ProtocolTable::INITIATOR) == 0) == (agent == initiator);
+}
+
+/**
+ * Whether a message matches a transition
+ */
+bool matches(const ProtocolTable::Transition& transition, const std::string& performative, const ACLMessage& message,
+        const AgentID& initiator)
+{
+    if(performative != transition.mPerformative || !playsRole(transition.mFrom, message.getSender(), initiator))
+    {
+        return false;
+    }
+    if(std::strcmp(transition.mTo, ProtocolTable::INITIATOR) != 0 || initiator.getName().empty())
+    {
+        return true;
+    }
+    const AgentIDList& receivers = message.getAllReceivers();
+    return std::find(receivers.begin(), receivers.end(), initiator) != receivers.end();
+}
+
+} // namespace
+
+ProtocolValidator::ProtocolValidator()
+    : mConfiguration(new Configuration())
+    , mVersion(0)
+{
+}
+
+void ProtocolValidator::setLevel(validation::Level level)
+{
+    mConfiguration->mLevel = level;
+    ++mConfiguration->mVersion;
+}
+
+void ProtocolValidator::setSampleRate(unsigned int conversations)
+{
+    if(conversations == 0)
+    {
+        throw std::invalid_argument("ProtocolValidator::setSampleRate: the sample rate must be at least 1");
+    }
+    mConfiguration->mSampleRate = conversations;
+    ++mConfiguration->mVersion;
+}
+
+void ProtocolValidator::share(ProtocolValidator& other) const
+{
+    other.mConfiguration = mConfiguration;
+    other.mVersion = mConfiguration->mVersion;
+}
+
+bool ProtocolValidator::update(const fipa::acl::ACLMessage& message)
+{
+    if(mVersion != mConfiguration->mVersion)
+    {
+        // Messages might have been missed since the configuration changed
+        mConversations.clear();
+        mConversationOrder.clear();
+        mVersion = mConfiguration->mVersion;
+    }
+    const std::string& conversationID = message.getConversationID();
+    if(!isSelected(conversationID))
+    {
+        return true;
+    }
+    const ProtocolTable* table = ProtocolTable::get(message.getProtocol());
+    if(table == NULL)
+    {
+        // Not one of our protocols
+        return true;
+    }
+
+    std::string performative = message.getPerformative();
+    std::map<std::string, Conversation>::iterator it = mConversations.find(conversationID);
+    const ProtocolTable::Transition* transition = NULL;
+    if(it == mConversations.end())
+    {
+        // A conversation seen for the first time may have started without us, so any transition is accepted
+        static const AgentID unknown;
+        const std::vector<ProtocolTable::Transition>& transitions = table->getTransitions();
+        for(std::vector<ProtocolTable::Transition>::const_iterator cit = transitions.begin(); cit != transitions.end(); ++cit)
+        {
+            if(matches(*cit, performative, message, unknown))
+            {
+                transition = &*cit;
+                break;
+            }
+        }
+        if(transition == NULL)
+        {
+            if(message.getPerformativeAsEnum() == ACLMessage::FAILURE)
+            {
+                return true;
+            }
+            reportViolation(message, "is not part of the protocol");
+            return false;
+        }
+        if(table->isFinal(transition->mTarget) && !table->hasTransitions(transition->mTarget))
+        {
+            // Nothing can follow, so the conversation is not tracked at all
+            return true;
+        }
+        it = addConversation(conversationID, table);
+        it->second.mState = transition->mTarget;
+    } else {
+        Conversation& conversation = it->second;
+        if(conversation.mTable != table)
+        {
+            reportViolation(message, "belongs to a conversation of protocol '" + conversation.mTable->getName() + "'");
+            return false;
+        }
+        const std::vector<ProtocolTable::Transition>& transitions = table->getTransitions();
+        for(std::vector<ProtocolTable::Transition>::const_iterator cit = transitions.begin(); cit != transitions.end(); ++cit)
+        {
+            if(cit->mState == conversation.mState && matches(*cit, performative, message, conversation.mInitiator))
+            {
+                transition = &*cit;
+                break;
+            }
+        }
+        if(transition == NULL)
+        {
+            if(message.getPerformativeAsEnum() == ACLMessage::FAILURE)
+            {
+                // Delivery failures can be reported in any state
+                return true;
+            }
+            reportViolation(message, "is not allowed in state " + boost::lexical_cast<std::string>(conversation.mState));
+            return false;
+        }
+        conversation.mState = transition->mTarget;
+    }
+
+    Conversation& conversation = it->second;
+    if(conversation.mInitiator.getName().empty())
+    {
+        if(std::strcmp(transition->mFrom, ProtocolTable::INITIATOR) == 0)
+        {
+            conversation.mInitiator = message.getSender();
+        } else if(std::strcmp(transition->mTo, ProtocolTable::INITIATOR) == 0 && message.getAllReceivers().size() == 1)
+        {
+            conversation.mInitiator = message.getAllReceivers().front();
+        }
+    }
+    if(table->isFinal(conversation.mState) && !table->hasTransitions(conversation.mState))
+    {
+        // The conversation is over
+        mConversations.erase(it);
+    }
+    return true;
+}
+
+bool ProtocolValidator::isSelected(const std::string& conversationID) const
+{
+    switch(mConfiguration->mLevel)
+    {
+        case validation::FULL:
+            return true;
+        case validation::SAMPLED:
+            return boost::hash<std::string>()(conversationID) % mConfiguration->mSampleRate == 0;
+        default:
+            return false;
+    }
+}
+
+std::map<std::string, ProtocolValidator::Conversation>::iterator ProtocolValidator::addConversation(const std::string& conversationID, const ProtocolTable* table)
+{
+    while(mConversationOrder.size() >= MAX_CONVERSATIONS)
+    {
+        // Finished conversations are not tracked anymore, so the id may be unknown
+        mConversations.erase(mConversationOrder.front());
+        mConversationOrder.pop_front();
+    }
+    mConversationOrder.push_back(conversationID);
+    std::map<std::string, Conversation>::iterator it = mConversations.insert(std::make_pair(conversationID, Conversation())).first;
+    it->second.mTable = table;
+    it->second.mState = table->getInitialState();
+    return it;
+}
+
+void ProtocolValidator::reportViolation(const fipa::acl::ACLMessage& message, const std::string& reason)
+{
+    ++mConfiguration->mViolations;
+    LOG_WARN_S << "ProtocolValidator: message '" << message.getPerformative() << "' from '" << message.getSender().getName()
+        << "' in conversation '" << message.getConversationID() << "' of protocol '" << message.getProtocol() << "' " << reason;
+}
+
+} // namespace distributed_locking
+} // namespace fipa
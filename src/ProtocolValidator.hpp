@@ -0,0 +1,141 @@
+#ifndef DISTRIBUTED_LOCKING_PROTOCOL_VALIDATOR_HPP
+#define DISTRIBUTED_LOCKING_PROTOCOL_VALIDATOR_HPP
+
+#include <map>
+#include <deque>
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <fipa_acl/fipa_acl.h>
+#include <distributed_locking/ProtocolTable.hpp>
+
+namespace fipa {
+namespace distributed_locking {
+
+namespace validation {
+/**
+    \enum Level
+    \brief how thoroughly the messages sent and received are checked against the protocol state machines
+*/
+enum Level { OFF = 0, SAMPLED, FULL,
+    // Following values only for enumerating over this enum
+    LEVEL_START = OFF, LEVEL_END = FULL
+};
+} // namespace validation
+
+/**
+ * Checks the conversations of a DLM against the transition tables of their protocols (see ProtocolTable).
+ *
+ * An agent only sees the messages it sends and receives, so a conversation may be seen first in its middle, e.g. by
+ * the owner of a resource. The first message of a conversation is therefore accepted in any state it is allowed in.
+ * Delivery failures, which are reported by the transport, are accepted in every state. Violations are logged and
+ * counted, they do not change how messages are handled.
+ *
+ * With validation::SAMPLED, only every n-th conversation is checked (see setSampleRate). Conversations are selected
+ * by a hash of their id, so all agents check the same conversations.
+ */
+class ProtocolValidator
+{
+public:
+    // Number of conversations, which are tracked at most. Beyond that, the oldest conversation is forgotten.
+    static const unsigned int MAX_CONVERSATIONS = 1024;
+
+    /**
+     * Constructor, validates all conversations
+     */
+    ProtocolValidator();
+
+    /**
+     * Sets the validation level
+     */
+    void setLevel(validation::Level level);
+
+    /**
+     * Gets the validation level
+     */
+    validation::Level getLevel() const { return mConfiguration->mLevel; }
+
+    /**
+     * Sets which share of the conversations is checked with validation::SAMPLED, one out of the given number
+     * \throws std::invalid_argument if conversations is 0
+     */
+    void setSampleRate(unsigned int conversations);
+
+    /**
+     * Gets which share of the conversations is checked with validation::SAMPLED
+     */
+    unsigned int getSampleRate() const { return mConfiguration->mSampleRate; }
+
+    /**
+     * Gets the number of messages, which violated their protocol
+     */
+    unsigned int getViolations() const { return mConfiguration->mViolations; }
+
+    /**
+     * Gets the number of conversations currently tracked
+     */
+    unsigned int getConversationCount() const { return mConversations.size(); }
+
+    /**
+     * Lets another validator use the configuration of this one, and count its violations here. Used for the
+     * validators of embedded DLMs.
+     */
+    void share(ProtocolValidator& other) const;
+
+    /**
+     * Checks a message sent or received, and advances its conversation
+     * \return false if the message violates its protocol
+     */
+    bool update(const fipa::acl::ACLMessage& message);
+
+protected:
+    /**
+     * The configuration, shared with the validators of embedded DLMs
+     */
+    struct Configuration
+    {
+        validation::Level mLevel;
+        unsigned int mSampleRate;
+        unsigned int mViolations;
+        // Incremented by every change, since conversations not checked meanwhile have to be forgotten
+        unsigned int mVersion;
+
+        Configuration() : mLevel(validation::FULL), mSampleRate(1), mViolations(0), mVersion(0) {}
+    };
+    boost::shared_ptr<Configuration> mConfiguration;
+    // The version of the configuration the tracked conversations were checked with
+    unsigned int mVersion;
+
+    /**
+     * A conversation, as far as seen
+     */
+    struct Conversation
+    {
+        const ProtocolTable* mTable;
+        unsigned int mState;
+        // The agent who started the conversation, empty while not known
+        fipa::acl::AgentID mInitiator;
+    };
+    std::map<std::string, Conversation> mConversations;
+    // The ids of the tracked conversations, oldest first
+    std::deque<std::string> mConversationOrder;
+
+    /**
+     * Whether a conversation is checked at the current level
+     */
+    bool isSelected(const std::string& conversationID) const;
+
+    /**
+     * Starts tracking a conversation, and forgets the oldest ones beyond MAX_CONVERSATIONS
+     */
+    std::map<std::string, Conversation>::iterator addConversation(const std::string& conversationID, const ProtocolTable* table);
+
+    /**
+     * Logs and counts a violation
+     */
+    void reportViolation(const fipa::acl::ACLMessage& message, const std::string& reason);
+};
+
+} // namespace distributed_locking
+} // namespace fipa
+
+#endif // DISTRIBUTED_LOCKING_PROTOCOL_VALIDATOR_HPP
@@ -17,21 +17,54 @@ namespace distributed_locking {
 RicartAgrawala::RicartAgrawala(const fipa::acl::AgentID& self, const std::vector< std::string >& resources)
     : DLM(protocol::RICART_AGRAWALA, self, resources)
     , mLamportClock(0)
+    , mAgingInterval(0)
+    , mIdleCounter(0)
+    , mIdleStateCapacity(1024)
 {
 }
 
 void RicartAgrawala::lock(const std::string& resource, const AgentIDList& agents)
 {
+    lock(resource, agents, lock_mode::EXCLUSIVE);
+}
+
+void RicartAgrawala::lock(const std::string& resource, const AgentIDList& agents, lock_mode::LockMode mode)
+{
+    lockTarget(resource, getPartners(agents), mode, priority::NORMAL);
+}
+
+void RicartAgrawala::requestLock(const std::string& resource, const AgentGroup& agents, priority::Priority priority)
+{
+    lockTarget(resource, agents, lock_mode::EXCLUSIVE, priority);
+}
+
+void RicartAgrawala::lockTarget(const std::string& resource, const AgentGroup& agents, lock_mode::LockMode mode,
+        priority::Priority priority)
+{
+    if(claimPrefetch(resource))
+    {
+        // Requested or held already
+        return;
+    }
+    std::map<std::string, LockTarget>::const_iterator held = mTargets.find(resource);
+    if(held != mTargets.end() && isReentrant() && !covers(held->second.mMode, mode))
+    {
+        throw std::runtime_error("RicartAgrawala::lock Cannot reenter resource '" + resource + "' in a stronger mode");
+    }
+    if(reenter(resource))
+    {
+        return;
+    }
+
     if(!hasKnownOwner(resource))
     {
         throw std::invalid_argument("RicartAgrawala: cannot lock resource '" + resource + "' -- owner is unknown. Perform discovery first");
     }
 
-    lock_state::LockState state = getLockState(resource);
     // Only act we are not holding this resource and not already interested in it
-    if(state != lock_state::NOT_INTERESTED)
+    if(mTargets.count(resource))
     {
-        if(state == lock_state::UNREACHABLE)
+        if(getLockState(resource) == lock_state::UNREACHABLE)
         {
             // An unreachable resource cannot be locked. Throw exception
             throw std::runtime_error("RicartAgrawala::lock Cannot lock UNREACHABLE resource.");
@@ -39,6 +72,44 @@ void RicartAgrawala::lock(const std::string& resource, const AgentIDList& agents
         return;
     }
 
+    // The path leads from the resource with the known owner down to the requested resource
+    LockTarget target;
+    std::string root = getOwnedRoot(resource);
+    target.mPath.push_back(root);
+    for(size_t pos = resource.find(RESOURCE_SEPARATOR, root.size() + 1); target.mPath.back() != resource;
+            pos = resource.find(RESOURCE_SEPARATOR, pos + 1))
+    {
+        target.mPath.push_back(resource.substr(0, pos));
+    }
+    target.mMode = mode;
+    target.mPriority = priority;
+    target.mAgents = agents;
+
+    for(size_t i = 0; i < target.mPath.size(); ++i)
+    {
+        const std::string& component = target.mPath[i];
+        lock_state::LockState state = getResourceLockState(component);
+        if(state == lock_state::UNREACHABLE)
+        {
+            throw std::runtime_error("RicartAgrawala::lock Cannot lock UNREACHABLE resource.");
+        }
+        lock_mode::LockMode needed = i + 1 == target.mPath.size() ? mode : getIntentionMode(mode);
+        if(state != lock_state::NOT_INTERESTED && !covers(mLockStates[component].mMode, needed))
+        {
+            // The lock cannot be upgraded, as we would wait for ourselves
+            throw std::runtime_error("RicartAgrawala::lock Cannot lock resource '" + resource + "', since '" + component
+                    + "' is already locked in a weaker mode");
+        }
+    }
+
+    mTargets[resource] = target;
+    lockRequested(resource, priority);
+    acquire(resource);
+}
+
+void RicartAgrawala::requestLock(const std::string& resource, const AgentGroup& agents, lock_mode::LockMode mode,
+        priority::Priority priority)
+{
     using namespace fipa::acl;
 
     // Update Clock
@@ -46,61 +117,307 @@ void RicartAgrawala::lock(const std::string& resource, const AgentIDList& agents
 
     // Send a message to everyone, requesting the lock -- creates a  new
     // conversation
-    ACLMessage message = prepareMessage(ACLMessage::REQUEST, getProtocolName());
-    // Our request messages are in the format "LAMPORTTIME\nRESOURCE_IDENTIFIER"
-    message.setContent(toString(mLamportClock) + "\n" + resource);
-    // Add sender and receivers
-    for(AgentIDList::const_iterator it = agents.begin(); it != agents.end(); it++)
+    // The request prototype and the content buffer are reused, so that no temporary strings are created
+    prepareMessage(mRequest, ACLMessage::REQUEST, getProtocolName());
+    // Our request messages are in the format "LAMPORTTIME\nRESOURCE_IDENTIFIER[\nPRIORITY[\nMODE]]", the priority is only
+    // given if it is not NORMAL, the mode if it is not EXCLUSIVE
+    mContentBuffer.clear();
+    appendNumber(mContentBuffer, mLamportClock);
+    mContentBuffer += '\n';
+    mContentBuffer += resource;
+    if(priority != priority::NORMAL || mode != lock_mode::EXCLUSIVE)
+    {
+        mContentBuffer += '\n';
+        appendNumber(mContentBuffer, priority);
+    }
+    if(mode != lock_mode::EXCLUSIVE)
     {
-        message.addReceiver(*it);
+        mContentBuffer += '\n';
+        appendNumber(mContentBuffer, mode);
     }
+    mRequest.setContent(mContentBuffer);
+    mRequest.setAllReceivers(*agents);
 
     // Add to outgoing messages
-    sendMessage(message);
+    sendMessage(mRequest);
 
     // Change internal state
-    mLockStates[resource].mCommunicationPartners = agents;
-    mLockStates[resource].sort();
-    mLockStates[resource].mResponded.clear();
-    mLockStates[resource].mState = lock_state::INTERESTED;
-    mLockStates[resource].mInterestTime = mLamportClock;
-    mLockStates[resource].mConversationID = message.getConversationID();
+    ResourceLockState& lockState = mLockStates[resource];
+    setCommunicationPartners(resource, agents);
+    lockState.mPendingResponses = 0;
+    mIndices.clear();
+    for(AgentIDList::const_iterator it = agents->begin(); it != agents->end(); ++it)
+    {
+        mIndices.push_back(mAgentDirectory.insert(*it));
+    }
+    lockState.mPartners.reset();
+    lockState.mResponded.reset();
+    lockState.mPartners.resize(mAgentDirectory.size(), false);
+    lockState.mResponded.resize(mAgentDirectory.size(), false);
+    for(std::vector<unsigned int>::const_iterator it = mIndices.begin(); it != mIndices.end(); ++it)
+    {
+        if(!lockState.mPartners[*it])
+        {
+            lockState.mPartners[*it] = true;
+            ++lockState.mPendingResponses;
+        }
+    }
+    lockState.mState = lock_state::INTERESTED;
+    lockState.mIdleSince = 0;
+    lockState.mInterestTime = mLamportClock;
+    lockState.mPriority = priority;
+    lockState.mMode = mode;
+    mRequestConversations.erase(lockState.mConversationID);
+    lockState.mConversationID = mRequest.getConversationID();
+    mRequestConversations[lockState.mConversationID] = resource;
     // Now a response from each agent must be received before we can enter the critical section
     LOG_DEBUG_S << "'" << mSelf.getName() << "' mark INTERESTED for resource '" << resource << "'";
+
+    // If the resource capacity exceeds the number of partners, no response is required at all
+    tryObtainLock(resource);
 }
 
-void RicartAgrawala::ResourceLockState::sort()
+void RicartAgrawala::acquire(const std::string& targetName)
 {
-    // Sort agents
-    std::sort(mCommunicationPartners.begin(), mCommunicationPartners.end());
-    std::sort(mResponded.begin(), mResponded.end());
+    LockTarget& target = mTargets[targetName];
+    while(target.mLocked < target.mPath.size())
+    {
+        const std::string& resource = target.mPath[target.mLocked];
+        lock_mode::LockMode mode = target.mLocked + 1 == target.mPath.size() ? target.mMode : getIntentionMode(target.mMode);
+        lock_state::LockState state = getResourceLockState(resource);
+        if(state == lock_state::UNREACHABLE)
+        {
+            return;
+        }
+        if(state == lock_state::NOT_INTERESTED)
+        {
+            requestLock(resource, target.mAgents, mode, target.mPriority);
+            state = getResourceLockState(resource);
+        }
+        else if(!covers(mLockStates[resource].mMode, mode))
+        {
+            // Another target uses the resource in a weaker mode, so we request it again after its release
+            mWaitingTargets[resource].push_back(targetName);
+            return;
+        }
+
+        if(state != lock_state::LOCKED)
+        {
+            mWaitingTargets[resource].push_back(targetName);
+            return;
+        }
+        ++mLockStates[resource].mUsers;
+        ++target.mLocked;
+    }
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' mark LOCKED for resource '" << targetName << "'";
+    lockGranted(targetName);
 }
 
-void RicartAgrawala::ResourceLockState::removeCommunicationPartner(const fipa::acl::AgentID& agent)
+void RicartAgrawala::resumeTargets(const std::string& resource)
 {
-    mCommunicationPartners.erase(std::remove(mCommunicationPartners.begin(), mCommunicationPartners.end(), agent), mCommunicationPartners.end());
+    std::map<std::string, std::vector<std::string> >::iterator it = mWaitingTargets.find(resource);
+    if(it == mWaitingTargets.end())
+    {
+        return;
+    }
+    std::vector<std::string> targets;
+    targets.swap(it->second);
+    mWaitingTargets.erase(it);
+    for(std::vector<std::string>::const_iterator tit = targets.begin(); tit != targets.end(); ++tit)
+    {
+        if(mTargets.count(*tit))
+        {
+            acquire(*tit);
+        }
+    }
+}
+
+lock_mode::LockMode RicartAgrawala::getIntentionMode(lock_mode::LockMode mode)
+{
+    if(mode == lock_mode::SHARED || mode == lock_mode::INTENTION_SHARED)
+    {
+        return lock_mode::INTENTION_SHARED;
+    }
+    return lock_mode::INTENTION_EXCLUSIVE;
+}
+
+bool RicartAgrawala::covers(lock_mode::LockMode held, lock_mode::LockMode needed)
+{
+    switch(held)
+    {
+        case lock_mode::EXCLUSIVE:
+            return true;
+        case lock_mode::SHARED:
+        case lock_mode::INTENTION_EXCLUSIVE:
+            return needed == held || needed == lock_mode::INTENTION_SHARED;
+        default:
+            return needed == lock_mode::INTENTION_SHARED;
+    }
+}
+
+bool RicartAgrawala::isCompatible(lock_mode::LockMode mode, lock_mode::LockMode other)
+{
+    if(mode == lock_mode::EXCLUSIVE || other == lock_mode::EXCLUSIVE)
+    {
+        return false;
+    }
+    if(mode == lock_mode::INTENTION_SHARED || other == lock_mode::INTENTION_SHARED)
+    {
+        return true;
+    }
+    // Shared and intention exclusive locks are only compatible with their own kind
+    return mode == other;
+}
+
+void RicartAgrawala::setCommunicationPartners(const std::string& resource, const AgentGroup& agents)
+{
+    ResourceLockState& lockState = mLockStates[resource];
+    if(lockState.mCommunicationPartners)
+    {
+        const AgentIDList& partners = *lockState.mCommunicationPartners;
+        for(AgentIDList::const_iterator it = partners.begin(); it != partners.end(); ++it)
+        {
+            removeParticipant(resource, *it);
+        }
+    }
+    lockState.mCommunicationPartners = agents;
+    if(agents)
+    {
+        for(AgentIDList::const_iterator it = agents->begin(); it != agents->end(); ++it)
+        {
+            addParticipant(resource, *it);
+        }
+    }
+}
+
+void RicartAgrawala::ResourceLockState::removeCommunicationPartner(const fipa::acl::AgentID& agent, unsigned int index)
+{
+    if(mCommunicationPartners)
+    {
+        // The partners might be shared with a group, so they are copied
+        boost::shared_ptr<AgentIDList> partners(new AgentIDList(*mCommunicationPartners));
+        partners->erase(std::remove(partners->begin(), partners->end(), agent), partners->end());
+        mCommunicationPartners = partners;
+    }
+    if(isPartner(index))
+    {
+        if(!mResponded[index])
+        {
+            --mPendingResponses;
+        }
+        mPartners[index] = false;
+        mResponded[index] = false;
+    }
 }
 
 
 void RicartAgrawala::unlock(const std::string& resource)
 {
+    if(leave(resource))
+    {
+        // Still held by an outer lock
+        return;
+    }
     // Only act we are actually holding this resource
     if(getLockState(resource) == lock_state::LOCKED)
     {
-        // Change internal state
-        mLockStates[resource].mState = lock_state::NOT_INTERESTED;
-        // Now a response from each agent must be received before we can enter the critical section
-        LOG_DEBUG_S << "'" << mSelf.getName() << "' mark NOT_INTERESTED for resource '" << resource << "'";
+        // The path is released bottom-up
+        std::vector<std::string> path;
+        std::map<std::string, LockTarget>::iterator it = mTargets.find(resource);
+        path.swap(it->second.mPath);
+        mTargets.erase(it);
+        for(std::vector<std::string>::reverse_iterator rit = path.rbegin(); rit != path.rend(); ++rit)
+        {
+            release(*rit);
+        }
+    }
+}
 
-        // Send all deferred messages for that resource
-        sendAllDeferredMessages(resource);
+void RicartAgrawala::release(const std::string& resource)
+{
+    ResourceLockState& lockState = mLockStates[resource];
+    if(lockState.mUsers == 0 || --lockState.mUsers > 0 || lockState.mState != lock_state::LOCKED)
+    {
+        return;
+    }
+
+    // Change internal state
+    lockState.mState = lock_state::NOT_INTERESTED;
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' mark NOT_INTERESTED for resource '" << resource << "'";
+
+    // Send all deferred messages for that resource
+    sendAllDeferredMessages(resource);
+
+    // A failure of the former communication partners does not concern us any more
+    setCommunicationPartners(resource, AgentGroup());
+
+    // Let the base class know we released the lock
+    lockReleased(resource, lockState.mConversationID);
+    mRequestConversations.erase(lockState.mConversationID);
+
+    // Targets, which need the resource in another mode, can request it now
+    resumeTargets(resource);
+
+    markIdle(resource);
+}
+
+void RicartAgrawala::setIdleStateCapacity(unsigned int states)
+{
+    mIdleStateCapacity = states;
+    evictIdleStates();
+}
+
+void RicartAgrawala::markIdle(const std::string& resource)
+{
+    std::map<std::string, ResourceLockState>::iterator it = mLockStates.find(resource);
+    if(it == mLockStates.end() || !it->second.isIdle())
+    {
+        return;
+    }
+    it->second.mIdleSince = ++mIdleCounter;
+    mIdleStates.push_back(std::make_pair(it->second.mIdleSince, it));
+    evictIdleStates();
+}
 
-        // Let the base class know we released the lock
-        lockReleased(resource, mLockStates[resource].mConversationID);
+void RicartAgrawala::evictIdleStates()
+{
+    while(mIdleStates.size() > mIdleStateCapacity)
+    {
+        std::map<std::string, ResourceLockState>::iterator it = mIdleStates.front().second;
+        bool current = it->second.mIdleSince == mIdleStates.front().first;
+        mIdleStates.pop_front();
+        // Older entries of the same state were removed before, so no entry refers to it afterwards
+        if(current && it->second.isIdle())
+        {
+            LOG_DEBUG_S << "'" << mSelf.getName() << "' reclaims idle state of resource '" << it->first << "'";
+            // The record of a request is reclaimed along with the state, should it be left over
+            lockAbandoned(it->first);
+            mLockStates.erase(it);
+        }
     }
 }
 
 lock_state::LockState RicartAgrawala::getLockState(const std::string& resource) const
+{
+    std::map<std::string, LockTarget>::const_iterator tit = mTargets.find(resource);
+    if(tit == mTargets.end())
+    {
+        // Otherwise return the default state, unless the resource cannot be reached
+        return getResourceLockState(resource) == lock_state::UNREACHABLE ? lock_state::UNREACHABLE : lock_state::NOT_INTERESTED;
+    }
+
+    const LockTarget& target = tit->second;
+    for(size_t i = 0; i < target.mPath.size() && i <= target.mLocked; ++i)
+    {
+        if(getResourceLockState(target.mPath[i]) == lock_state::UNREACHABLE)
+        {
+            return lock_state::UNREACHABLE;
+        }
+    }
+    return target.mLocked == target.mPath.size() ? lock_state::LOCKED : lock_state::INTERESTED;
+}
+
+lock_state::LockState RicartAgrawala::getResourceLockState(const std::string& resource) const
 {
     std::map<std::string, ResourceLockState>::const_iterator cit = mLockStates.find(resource);
     if(cit != mLockStates.end())
@@ -114,6 +431,13 @@ lock_state::LockState RicartAgrawala::getLockState(const std::string& resource)
     }
 }
 
+bool RicartAgrawala::isInUse(const std::string& resource) const
+{
+    // Every target locks the resources on the path from the owned resource
+    lock_state::LockState state = getResourceLockState(resource);
+    return state == lock_state::INTERESTED || state == lock_state::LOCKED || DLM::isInUse(resource);
+}
+
 bool RicartAgrawala::onIncomingMessage(const fipa::acl::ACLMessage& message)
 {
     LOG_DEBUG_S << "On incoming message: " << message.toString();
@@ -163,42 +487,103 @@ void RicartAgrawala::handleIncomingRequest(const fipa::acl::ACLMessage& message)
     LOG_DEBUG_S << "Handling incoming request";
     LamportTime otherTime;
     std::string resource;
-    extractInformation(message, otherTime, resource);
+    priority::Priority otherPriority;
+    lock_mode::LockMode otherMode;
+    extractInformation(message, otherTime, resource, otherPriority, otherMode);
 
     // Synchronize internal Lamport Clock with that of the sender
     synchronizeLamportClock(otherTime);
 
-    // Create a response
-    fipa::acl::ACLMessage response = prepareMessage(ACLMessage::AGREE, getProtocolName());
-    response.addReceiver(message.getSender());
-    // Keep the conversation ID
-    response.setConversationID(message.getConversationID());
-
-    // We send this message now, if we don't hold the resource and are not interested or have been slower (Ties in timestamps
-    // are broken my lexicographical compare of the Agent Names). Otherwise we defer it.
-    lock_state::LockState state = getLockState(resource);
+    // We send the response now, if we don't hold the resource and are not interested, if the modes are compatible or
+    // if we have been slower. Otherwise we defer it.
+    lock_state::LockState state = getResourceLockState(resource);
     if(state == lock_state::NOT_INTERESTED ||
-      (state == lock_state::INTERESTED &&
-      ( otherTime < mLockStates[resource].mInterestTime ||
-      ( otherTime == mLockStates[resource].mInterestTime &&
-        // lexicographical_compare returns true iff 1st argument is less then 2nd.
-        boost::range::lexicographical_compare(message.getSender().getName(), mSelf.getName() )  ))))
+      ((state == lock_state::INTERESTED || state == lock_state::LOCKED) && isCompatible(mLockStates[resource].mMode, otherMode)) ||
+      (state == lock_state::INTERESTED && hasPrecedence(resource, otherTime, message.getSender(), otherPriority)))
     {
-        // Update Clock
-        ++mLamportClock;
-
-        // Our response messages are in the format "TIME\nRESOURCE_IDENTIFIER"
-        response.setContent(toString(mLamportClock) +"\n" + resource);
-        sendMessage(response);
+        sendResponse(message, resource);
     }
     else
     {
-        // We will have to add the timestamp later!
-        response.setContent(resource);
-        mLockStates[resource].mDeferredMessages.push_back(response);
+        deferResponse(message, resource);
     }
 }
 
+bool RicartAgrawala::hasPrecedence(const std::string& resource, const LamportTime otherTime, const fipa::acl::AgentID& other,
+        priority::Priority otherPriority) const
+{
+    std::map<std::string, ResourceLockState>::const_iterator cit = mLockStates.find(resource);
+    if(cit == mLockStates.end())
+    {
+        return true;
+    }
+    // An agent which already responded to our request cannot take its permission back, even with a higher priority
+    unsigned int index;
+    if(mAgentDirectory.find(other, index) && cit->second.isPartner(index) && cit->second.mResponded[index])
+    {
+        return false;
+    }
+
+    const priority::Priority ownPriority = cit->second.mPriority;
+    if(mAgingInterval == 0)
+    {
+        if(otherPriority != ownPriority)
+        {
+            return otherPriority > ownPriority;
+        }
+    } else {
+        // Compare the effective timestamps (time - priority * interval), without leaving the unsigned range
+        LamportTime otherEffective = otherTime + ownPriority * mAgingInterval;
+        LamportTime ownEffective = cit->second.mInterestTime + otherPriority * mAgingInterval;
+        if(otherEffective != ownEffective)
+        {
+            return otherEffective < ownEffective;
+        }
+    }
+    // Ties in timestamps are broken my lexicographical compare of the Agent Names.
+    // lexicographical_compare returns true iff 1st argument is less then 2nd.
+    return otherTime < cit->second.mInterestTime ||
+        ( otherTime == cit->second.mInterestTime &&
+          boost::range::lexicographical_compare(other.getName(), mSelf.getName()) );
+}
+
+void RicartAgrawala::sendResponse(const fipa::acl::ACLMessage& request, const std::string& resource)
+{
+    // Keep the conversation ID
+    sendResponse(request.getSender(), request.getConversationID(), resource);
+}
+
+void RicartAgrawala::sendResponse(const fipa::acl::AgentID& receiver, const std::string& conversationID, const std::string& resource)
+{
+    // The protocol name changes in the constructors of subclasses, so the prototype is created on first use
+    if(mResponse.getProtocol() != getProtocolName())
+    {
+        mResponse = prepareMessage(ACLMessage::AGREE, getProtocolName());
+    }
+    mResponseReceivers.resize(1);
+    mResponseReceivers[0] = receiver;
+    mResponse.setAllReceivers(mResponseReceivers);
+    mResponse.setConversationID(conversationID);
+
+    // Update Clock
+    ++mLamportClock;
+
+    // Our response messages are in the format "TIME\nRESOURCE_IDENTIFIER"
+    mContentBuffer.clear();
+    appendNumber(mContentBuffer, mLamportClock);
+    mContentBuffer += '\n';
+    mContentBuffer += resource;
+    mResponse.setContent(mContentBuffer);
+    sendMessage(mResponse);
+}
+
+void RicartAgrawala::deferResponse(const fipa::acl::ACLMessage& request, const std::string& resource)
+{
+    // The timestamp is added, when the response is actually sent
+    unsigned int agent = mAgentDirectory.insert(request.getSender());
+    mLockStates[resource].mDeferredResponses.push_back(DeferredResponse(agent, request.getConversationID()));
+}
+
 void RicartAgrawala::handleIncomingResponse(const fipa::acl::ACLMessage& message)
 {
     LOG_DEBUG_S << "Handling incoming response";
@@ -211,104 +596,146 @@ void RicartAgrawala::handleIncomingResponse(const fipa::acl::ACLMessage& message
     synchronizeLamportClock(otherTime);
 
     // A response is only relevant if we're "INTERESTED"
-    if(getLockState(resource) != lock_state::INTERESTED)
+    if(getResourceLockState(resource) != lock_state::INTERESTED)
     {
         return;
     }
 
-    // Save that the sender responded
-    addRespondedAgent(message.getSender(), resource);
+    // Responses to a previous request can still arrive, if the lock was obtained before everyone responded (k-mutual exclusion)
+    if(message.getConversationID() != mLockStates[resource].mConversationID)
+    {
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' ignores outdated response from '" << message.getSender().getName() << "' for resource '" << resource << "'";
+        return;
+    }
 
-    // Check if we have enough responses, so that we don't sort and compare for each IncomingResponse
-    if(mLockStates[resource].mCommunicationPartners.size() == mLockStates[resource].mResponded.size() )
+    // Save that the sender responded, duplicate and unexpected responses are dropped
+    if(addRespondedAgent(message.getSender(), resource))
     {
-        // Sort agents who responded
-        mLockStates[resource].sort();
-        if(mLockStates[resource].mCommunicationPartners == mLockStates[resource].mResponded)
-        {
-            mLockStates[resource].mState = lock_state::LOCKED;
-            // Let the base class know we obtained the lock
-            lockObtained(resource, message.getConversationID());
-        }
-        else
-        {
-          // This really shouldn't happen.
-          throw std::runtime_error("RicartAgrawala::handleIncomingResponse received enough responses, but mCommunicationPartners not equal to mResponded");
-        }
+        tryObtainLock(resource);
     }
 }
 
-void RicartAgrawala::addRespondedAgent(const fipa::acl::AgentID& agent, std::string resource)
+void RicartAgrawala::tryObtainLock(const std::string& resource)
 {
-    // XXX if agent becomes more complex, we need to copy it from mCommunicationPartners,
-    // instead of creating a new one
-    mLockStates[resource].mResponded.push_back(agent);
+    ResourceLockState& lockState = mLockStates[resource];
+    unsigned int capacity = getResourceCapacity(resource);
+    // Up to (capacity - 1) other lock holders may still defer their response, with a capacity of 1 everyone must respond
+    if(lockState.mPendingResponses + 1 > capacity)
+    {
+        return;
+    }
+
+    lockState.mState = lock_state::LOCKED;
+    // Let the base class know we obtained the lock
+    lockObtained(resource, lockState.mConversationID);
+
+    resumeTargets(resource);
+}
+
+bool RicartAgrawala::addRespondedAgent(const fipa::acl::AgentID& agent, const std::string& resource)
+{
+    ResourceLockState& lockState = mLockStates[resource];
+    unsigned int index;
+    if(!mAgentDirectory.find(agent, index) || !lockState.isPartner(index) || lockState.mResponded[index])
+    {
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' ignores unexpected response from '" << agent.getName() << "' for resource '" << resource << "'";
+        return false;
+    }
+    lockState.mResponded[index] = true;
+    --lockState.mPendingResponses;
+    return true;
+}
+
+bool RicartAgrawala::isCommunicationPartner(const std::string& resource, const fipa::acl::AgentID& agent) const
+{
+    std::map<std::string, ResourceLockState>::const_iterator cit = mLockStates.find(resource);
+    unsigned int index;
+    return cit != mLockStates.end() && mAgentDirectory.find(agent, index) && cit->second.isPartner(index);
 }
 
 
 void RicartAgrawala::handleIncomingFailure(const fipa::acl::ACLMessage& message)
 {
     LOG_DEBUG_S << "Handling incoming failure";
-    // First determine the affected resource from the conversation id.
-    std::string conversationID = message.getConversationID();
-    std::string resource;
-    for(std::map<std::string, ResourceLockState>::const_iterator it = mLockStates.begin(); it != mLockStates.end(); it++)
+    // Only parse the original message, if the failure concerns us
+    if(getInterestedResource(message.getConversationID()).empty())
     {
-        if(it->second.mConversationID == conversationID)
-        {
-            resource = it->first;
-            break;
-        }
+        // If a response message cannot be delivered, we can ignore that
+        LOG_DEBUG_S << "Ignore error since '" << mSelf.getName() << "' is not interested in a resource of conversation '"
+            << message.getConversationID() << "'";
+        return;
     }
+    onDeliveryFailure(message.getConversationID(), getFailedReceivers(message));
+}
 
-    // Abort if we didn't find a corresponding resource, or are not interested in the resource currently
-    if(resource == "" || mLockStates[resource].mState != lock_state::INTERESTED)
+void RicartAgrawala::onDeliveryFailure(const std::string& conversationID, const fipa::acl::AgentIDList& failedReceivers)
+{
+    // Abort if we are not interested in the resource of the conversation currently
+    std::string resource = getInterestedResource(conversationID);
+    if(resource.empty())
     {
-        // If a response message cannot be delivered, we can ignore that
-        LOG_DEBUG_S << "Ignore error since '" << mSelf.getName() << "' is not interested in resource: '" << resource << "'";
         return;
     }
 
-    using namespace fipa::acl;
-    // Get intended receivers
-    std::string innerEncodedMsg = message.getContent();
-    ACLMessage errorMsg;
-    MessageParser::parseData(innerEncodedMsg, errorMsg, representation::STRING_REP);
-    AgentIDList deliveryFailedForAgents = errorMsg.getAllReceivers();
-
-    for(AgentIDList::const_iterator it = deliveryFailedForAgents.begin(); it != deliveryFailedForAgents.end(); it++)
+    for(fipa::acl::AgentIDList::const_iterator it = failedReceivers.begin(); it != failedReceivers.end(); it++)
     {
         // Now we must handle the failure appropriately
-        handleIncomingFailure(resource, it->getName());
+        handleIncomingFailure(resource, *it);
     }
 }
 
+std::string RicartAgrawala::getInterestedResource(const std::string& conversationID) const
+{
+    std::map<std::string, std::string>::const_iterator cit = mRequestConversations.find(conversationID);
+    if(cit == mRequestConversations.end())
+    {
+        return "";
+    }
+    std::map<std::string, ResourceLockState>::const_iterator sit = mLockStates.find(cit->second);
+    if(sit == mLockStates.end() || sit->second.mState != lock_state::INTERESTED)
+    {
+        return "";
+    }
+    return cit->second;
+}
+
 void RicartAgrawala::handleIncomingFailure(const std::string& resource, const fipa::acl::AgentID& intendedReceiver)
 {
     // If the physical owner of the resource failed, the ressource probably cannot be obtained any more.
-    if(mOwnedResources[resource] == intendedReceiver)
+    if(getOwner(resource) == intendedReceiver)
     {
         // Mark resource as unreachable.
         mLockStates[resource].mState = lock_state::UNREACHABLE;
         LOG_DEBUG_S << "'" << mSelf.getName()  << "' mark resource: '" << resource << "' unreachable";
+        // The targets waiting for the resource will not be granted
+        std::map<std::string, std::vector<std::string> >::const_iterator wit = mWaitingTargets.find(resource);
+        if(wit != mWaitingTargets.end())
+        {
+            for(std::vector<std::string>::const_iterator tit = wit->second.begin(); tit != wit->second.end(); ++tit)
+            {
+                lockAbandoned(*tit);
+            }
+        }
         // Send all deferred messages for that resource
         sendAllDeferredMessages(resource);
     }
     else
     {
         // The agent was not important, we just have to remove it from the list of communication partners, as we won't get a response from it
-        mLockStates[resource].removeCommunicationPartner(intendedReceiver);
+        unsigned int index;
+        if(mAgentDirectory.find(intendedReceiver, index))
+        {
+            mLockStates[resource].removeCommunicationPartner(intendedReceiver, index);
+        }
+        removeParticipant(resource, intendedReceiver);
 
         LOG_DEBUG_S << "'" << mSelf.getName()  << "' can ignore failed agent '" << intendedReceiver.getName()
             << "' since we never received a response regarding resource: '" << resource << "'";
 
-        // We have got the lock, if all agents responded
-        if(mLockStates[resource].mCommunicationPartners == mLockStates[resource].mResponded)
+        // We have got the lock, if enough of the remaining agents responded
+        if(mLockStates[resource].mState == lock_state::INTERESTED)
         {
-            mLockStates[resource].mState = lock_state::LOCKED;
-
-            // Let the base class know we obtained the lock
-            lockObtained(resource, mLockStates[resource].mConversationID);
+            tryObtainLock(resource);
         }
     }
 }
@@ -317,18 +744,24 @@ void RicartAgrawala::agentFailed(const fipa::acl::AgentID& agent)
 {
 
     LOG_DEBUG_S << "'" << mSelf.getName() << "' detected failed agent: '" << agent.getName() << "'";
-    std::map<std::string, ResourceLockState>::iterator it = mLockStates.begin();
-    // Determine all resources, where we await an answer from that agent
-    for(; it != mLockStates.end(); ++it)
+    // Determine all resources, where we await an answer from that agent. Only the resources the agent takes part
+    // in need to be checked.
+    std::vector<std::string> resources = getParticipations(agent);
+    for(std::vector<std::string>::const_iterator rit = resources.begin(); rit != resources.end(); ++rit)
     {
-        ResourceLockState lockState = it->second;
+        std::map<std::string, ResourceLockState>::iterator it = mLockStates.find(*rit);
+        if(it == mLockStates.end())
+        {
+            continue;
+        }
+        const ResourceLockState& lockState = it->second;
         // If we're interested and await an answer from that agent...
         if(lockState.mState == lock_state::INTERESTED || lockState.mState == lock_state::LOCKED)
         {
             // If we're not interested or the agent already responded, we can ignore that
             LOG_DEBUG_S << "'" << mSelf.getName() << "' detect failed agent: " << agent.getName() << " which this agent holds a resource of or is interested in";
 
-            if(std::find(lockState.mCommunicationPartners.begin(), lockState.mCommunicationPartners.end(), agent) != lockState.mCommunicationPartners.end())
+            if(isCommunicationPartner(it->first, agent))
             {
                 LOG_DEBUG_S << "'" << mSelf.getName() << "' handle failed agent: '" << agent.getName() << "'";
                 handleIncomingFailure(it->first, agent);
@@ -344,40 +777,63 @@ void RicartAgrawala::agentFailed(const fipa::acl::AgentID& agent)
 
 void RicartAgrawala::extractInformation(const fipa::acl::ACLMessage& message, LamportTime& time, std::string& resource)
 {
-    // Split by newline
-    std::vector<std::string> strs;
-    std::string s = message.getContent();
-    boost::split(strs, s, boost::is_any_of("\n"));
+    priority::Priority priority;
+    extractInformation(message, time, resource, priority);
+}
+
+void RicartAgrawala::extractInformation(const fipa::acl::ACLMessage& message, LamportTime& time, std::string& resource, priority::Priority& priority)
+{
+    lock_mode::LockMode mode;
+    extractInformation(message, time, resource, priority, mode);
+}
 
-    if(strs.size() != 2)
+void RicartAgrawala::extractInformation(const fipa::acl::ACLMessage& message, LamportTime& time, std::string& resource, priority::Priority& priority,
+        lock_mode::LockMode& mode)
+{
+    // The fields are separated by newlines, they are parsed in place instead of splitting the content
+    const std::string& content = message.getContent();
+    std::string::size_type timeEnd = content.find('\n');
+    if(timeEnd == std::string::npos)
     {
-        throw std::runtime_error("RicartAgrawala::extractInformation ACLMessage content malformed: " + s);
+        throw std::runtime_error("RicartAgrawala::extractInformation ACLMessage content malformed: " + content);
     }
-    // Save the extracted information in the references
-    time = std::strtoul(strs[0].c_str() , NULL, 10);
+    std::string::size_type resourceEnd = content.find('\n', timeEnd + 1);
 
-    resource = strs[1];
+    // Save the extracted information in the references
+    time = std::strtoul(content.c_str(), NULL, 10);
+    resource.assign(content, timeEnd + 1, resourceEnd == std::string::npos ? std::string::npos : resourceEnd - timeEnd - 1);
+    priority = priority::NORMAL;
+    mode = lock_mode::EXCLUSIVE;
+    if(resourceEnd != std::string::npos)
+    {
+        const char* field = content.c_str() + resourceEnd + 1;
+        char* end;
+        priority = static_cast<priority::Priority>(std::strtol(field, &end, 10));
+        if(end != field && *end == '\n')
+        {
+            field = end + 1;
+            mode = static_cast<lock_mode::LockMode>(std::strtol(field, &end, 10));
+        }
+        if(end == field || *end != '\0')
+        {
+            throw std::runtime_error("RicartAgrawala::extractInformation ACLMessage content malformed: " + content);
+        }
+    }
 
     LOG_DEBUG_S << "Extracted time: " << time << " and resource: " << resource;
 }
 
 void RicartAgrawala::sendAllDeferredMessages(const std::string& resource)
 {
-    for(std::list<fipa::acl::ACLMessage>::iterator it = mLockStates[resource].mDeferredMessages.begin();
-        it != mLockStates[resource].mDeferredMessages.end(); it++)
+    std::vector<DeferredResponse>& deferred = mLockStates[resource].mDeferredResponses;
+    for(std::vector<DeferredResponse>::const_iterator it = deferred.begin(); it != deferred.end(); ++it)
     {
-        fipa::acl::ACLMessage msg = *it;
-        LOG_DEBUG_S << "'" << mSelf.getName() << "' sent deferred message '" << msg.toString() << "'";
-
-        // Update Clock
-        ++mLamportClock;
-
-        // Include timestamp
-        msg.setContent(toString(mLamportClock) +"\n" + msg.getContent());
-        sendMessage(msg);
+        const AgentID& receiver = mAgentDirectory.getAgent(it->mAgent);
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' sends deferred response to '" << receiver.getName() << "' for resource '" << resource << "'";
+        sendResponse(receiver, it->mConversationID, resource);
     }
-    // Clear list
-    mLockStates[resource].mDeferredMessages.clear();
+    // Clear list, the capacity is kept for the next critical section
+    deferred.clear();
 }
 
 } // namespace distributed_locking
@@ -1,8 +1,10 @@
 #ifndef DISTRIBUTED_LOCKING_RICARD_AGRAWALA_HPP
 #define DISTRIBUTED_LOCKING_RICARD_AGRAWALA_HPP
 
-#include <list>
 #include <map>
+#include <deque>
+#include <vector>
+#include <boost/dynamic_bitset.hpp>
 #include <fipa_acl/fipa_acl.h>
 #include <distributed_locking/DLM.hpp>
 
@@ -10,6 +12,18 @@ namespace fipa {
 namespace distributed_locking {
 /**
  * Implementation of the Ricart Agrawala algorithm. For more information, see http://en.wikipedia.org/wiki/Ricart-Agrawala_algorithm
+ *
+ * Resources with a capacity k > 1 (see DLM::setResourceCapacity) are handled with Raymond's k-out-of-N extension:
+ * the lock is obtained as soon as all but (k-1) communication partners responded.
+ *
+ * Requests of a higher priority class take precedence over concurrent requests of a lower one. With an aging interval
+ * (see setAgingInterval), a request gains one priority class for each interval of Lamport time it is older than a
+ * concurrent one, so that requests of a low priority do not starve. All agents must use the same aging interval.
+ *
+ * Hierarchical resource names (e.g. "arm/joint3") can be locked in the modes of lock_mode::LockMode. The resources
+ * from the one with the known owner down to the requested one are locked one after another, the ones above with
+ * intention locks. Since every agent locks top-down and holds only resources above the one it waits for, this does
+ * not deadlock. Requests in compatible modes are responded right away, so locks on disjoint subtrees do not conflict.
  */
 class RicartAgrawala : public DLM
 {
@@ -22,10 +36,17 @@ public:
      */
     RicartAgrawala(const fipa::acl::AgentID& self, const std::vector<std::string>& resources);
 
+    using DLM::lock;
+
     /**
-     * Tries to lock a resource. Subsequently, isLocked() must be called to check the status.
+     * Tries to lock a resource exclusively. Subsequently, isLocked() must be called to check the status.
      */
     virtual void lock(const std::string& resource, const fipa::acl::AgentIDList& agents);
+    /**
+     * Tries to lock a resource in the given mode. The resources above it in the hierarchy are locked with the
+     * corresponding intention mode before.
+     */
+    void lock(const std::string& resource, const fipa::acl::AgentIDList& agents, lock_mode::LockMode mode);
     /**
      * Unlocks a resource, that must have been locked before
      */
@@ -45,13 +66,47 @@ public:
      */
     virtual void agentFailed(const fipa::acl::AgentID& agentName);
 
+    /**
+     * Handles the failure to deliver a message of one of our requests
+     */
+    virtual void onDeliveryFailure(const std::string& conversationID, const fipa::acl::AgentIDList& failedReceivers);
+
     // A typedef for the Lamport Clock and Timestamps.
     typedef unsigned long long LamportTime;
 
+    /**
+     * Sets the Lamport time, after which a waiting request gains one priority class. 0 (default) means,
+     * that requests of a higher priority class always take precedence.
+     */
+    void setAgingInterval(LamportTime interval) { mAgingInterval = interval; }
+
+    /**
+     * Gets the Lamport time, after which a waiting request gains one priority class
+     */
+    LamportTime getAgingInterval() const { return mAgingInterval; }
+
+    /**
+     * Whether locks of the two modes can be held by different agents at the same time
+     */
+    static bool isCompatible(lock_mode::LockMode mode, lock_mode::LockMode other);
+
+    /**
+     * Sets the number of idle resource states kept, i.e. of resources which are neither requested nor locked and
+     * carry no deferred responses. Beyond that, the state of the resource that became idle longest ago is
+     * reclaimed, and created again on its next use. The default is 1024.
+     */
+    void setIdleStateCapacity(unsigned int states);
+
+    /**
+     * Gets the number of idle resource states kept
+     */
+    unsigned int getIdleStateCapacity() const { return mIdleStateCapacity; }
+
 protected:
 
     // Represents the internal Lamport (Logical) clock
     LamportTime mLamportClock;
+    LamportTime mAgingInterval;
 
     /**
      * Must be called every time a message from another Agent is received, in order to sync with that Agent's clock
@@ -63,36 +118,189 @@ protected:
      */
     static std::string toString(const LamportTime time);
 
+    /**
+     * A response, which is sent when we leave the critical section. Only the receiver (as index into the
+     * agent directory) and the conversation are kept, the message is built on release.
+     */
+    struct DeferredResponse
+    {
+        unsigned int mAgent;
+        std::string mConversationID;
+
+        DeferredResponse(unsigned int agent, const std::string& conversationID)
+            : mAgent(agent)
+            , mConversationID(conversationID)
+        {}
+    };
+
     /**
      * Nested class representing an inner state for a certain resource.
      * It is mapped to its resource name.
      */
     struct ResourceLockState
     {
-        // Everyone to inform when locking
-        fipa::acl::AgentIDList mCommunicationPartners;
-        // Every agent who responded the query. Has to be reset in lock().
-        fipa::acl::AgentIDList mResponded;
-        // Messages to be sent later, by leaving the associated critical resource
-        std::list<fipa::acl::ACLMessage> mDeferredMessages;
+        // The fields read on every message come first, so that they share a cache line
         // The lock state, initially not interested (=0)
         lock_state::LockState mState;
+        // The mode we requested the lock in
+        lock_mode::LockMode mMode;
+        // Priority of our request messages
+        priority::Priority mPriority;
+        // Number of locked resources (see LockTarget), which use this lock
+        unsigned int mUsers;
+        // Number of communication partners, which did not respond yet
+        unsigned int mPendingResponses;
         // The time we sent our request messages
         LamportTime mInterestTime;
+        // When the state became idle last (see mIdleStates), 0 while it is in use
+        unsigned long long mIdleSince;
+        // The communication partners, as bits indexed by the agent directory
+        boost::dynamic_bitset<> mPartners;
+        // Every partner who responded the query, indexed by the agent directory. Has to be reset in lock().
+        boost::dynamic_bitset<> mResponded;
+        // Everyone to inform when locking, shared with the group the lock was requested for
+        AgentGroup mCommunicationPartners;
+        // Responses to be sent later, by leaving the associated critical resource
+        std::vector<DeferredResponse> mDeferredResponses;
         // The conversationID, which is relevant if we're interested and get a failure message back
         std::string mConversationID;
 
-        void sort();
-        void removeCommunicationPartner(const fipa::acl::AgentID& agent);
+        ResourceLockState() : mState(lock_state::NOT_INTERESTED), mMode(lock_mode::EXCLUSIVE), mPriority(priority::NORMAL), mUsers(0)
+            , mPendingResponses(0), mInterestTime(0), mIdleSince(0) {}
+
+        /**
+         * Whether the state holds no information beyond the defaults, so that it can be reclaimed
+         */
+        bool isIdle() const
+        {
+            return mState == lock_state::NOT_INTERESTED && mUsers == 0 && mDeferredResponses.empty() && !mCommunicationPartners;
+        }
+
+        /**
+         * Whether the agent with the given directory index is a communication partner
+         */
+        bool isPartner(unsigned int agent) const { return agent < mPartners.size() && mPartners[agent]; }
+        void removeCommunicationPartner(const fipa::acl::AgentID& agent, unsigned int index);
+    };
+
+    /**
+     * A resource locked via lock(). All resources of its path are locked one after another, from the resource
+     * with the known owner down to the resource itself.
+     */
+    struct LockTarget
+    {
+        std::vector<std::string> mPath;
+        // Number of resources of the path, which are locked already
+        unsigned int mLocked;
+        lock_mode::LockMode mMode;
+        priority::Priority mPriority;
+        AgentGroup mAgents;
+
+        LockTarget() : mLocked(0), mMode(lock_mode::EXCLUSIVE), mPriority(priority::NORMAL) {}
     };
 
     // All resources mapped to the their ResourceLockStates
     std::map<std::string, ResourceLockState> mLockStates;
+    // The resources locked via lock() mapped to their LockTargets
+    std::map<std::string, LockTarget> mTargets;
+    // The targets waiting for a resource of their path. Maps resource->targets
+    std::map<std::string, std::vector<std::string> > mWaitingTargets;
+    // The states which became idle, oldest first, together with their mIdleSince at that time. States used again
+    // meanwhile are skipped when reclaiming.
+    std::deque< std::pair<unsigned long long, std::map<std::string, ResourceLockState>::iterator> > mIdleStates;
+    unsigned long long mIdleCounter;
+    unsigned int mIdleStateCapacity;
+    // The conversations of our requests mapped to the requested resources, until the resources are released
+    std::map<std::string, std::string> mRequestConversations;
 
+    // Reused for all responses, only receiver, conversation and content are changed per response
+    fipa::acl::ACLMessage mResponse;
+    fipa::acl::AgentIDList mResponseReceivers;
+    // Reused for all requests
+    fipa::acl::ACLMessage mRequest;
+    // Buffers reused for building message contents and collecting directory indices
+    std::string mContentBuffer;
+    std::vector<unsigned int> mIndices;
+
+    /**
+     * Gets the lock state of the protocol for a single resource, regardless of the targets using it
+     */
+    lock_state::LockState getResourceLockState(const std::string& resource) const;
+    /**
+     * Whether the owner information of a resource is needed, also if only a part of it is locked
+     */
+    virtual bool isInUse(const std::string& resource) const;
+    /**
+     * Whether a lock held in one mode allows to use the resource in the other mode as well
+     */
+    static bool covers(lock_mode::LockMode held, lock_mode::LockMode needed);
+    /**
+     * Gets the mode to lock the resources above a resource with, when locking it in the given mode
+     */
+    static lock_mode::LockMode getIntentionMode(lock_mode::LockMode mode);
+    /**
+     * Tries to lock a resource exclusively with the given priority class
+     */
+    virtual void requestLock(const std::string& resource, const AgentGroup& agents, priority::Priority priority);
+    /**
+     * Tries to lock a resource in the given mode with the given priority class
+     */
+    void lockTarget(const std::string& resource, const AgentGroup& agents, lock_mode::LockMode mode,
+            priority::Priority priority);
+    /**
+     * Sends the requests for a single resource
+     */
+    virtual void requestLock(const std::string& resource, const AgentGroup& agents, lock_mode::LockMode mode,
+            priority::Priority priority);
+    /**
+     * Queues the state of a resource for reclamation, if it became idle
+     */
+    void markIdle(const std::string& resource);
+    /**
+     * Reclaims the states which became idle longest ago, until at most the idle state capacity is left
+     */
+    void evictIdleStates();
+    /**
+     * Locks the remaining resources of the path of a target, until one has to be waited for
+     */
+    void acquire(const std::string& target);
+    /**
+     * Releases a single resource, once no target uses it any more
+     */
+    void release(const std::string& resource);
+    /**
+     * Continues the targets waiting for the resource
+     */
+    void resumeTargets(const std::string& resource);
     /**
      * Handles an incoming request
      */
-    void handleIncomingRequest(const fipa::acl::ACLMessage& message);
+    virtual void handleIncomingRequest(const fipa::acl::ACLMessage& message);
+    /**
+     * Sets the communication partners for a resource and updates the participations of the agents
+     */
+    void setCommunicationPartners(const std::string& resource, const AgentGroup& agents);
+    /**
+     * Whether the agent is a communication partner for our current request of the resource
+     */
+    bool isCommunicationPartner(const std::string& resource, const fipa::acl::AgentID& agent) const;
+    /**
+     * Whether a request with the given timestamp and priority from another agent has precedence over our own request for the resource
+     */
+    bool hasPrecedence(const std::string& resource, const LamportTime otherTime, const fipa::acl::AgentID& other,
+            priority::Priority otherPriority = priority::NORMAL) const;
+    /**
+     * Responds a request right away
+     */
+    void sendResponse(const fipa::acl::ACLMessage& request, const std::string& resource);
+    /**
+     * Sends a response with the current timestamp to the receiver, in the given conversation
+     */
+    void sendResponse(const fipa::acl::AgentID& receiver, const std::string& conversationID, const std::string& resource);
+    /**
+     * Defers the response to a request, until we leave the critical section
+     */
+    void deferResponse(const fipa::acl::ACLMessage& request, const std::string& resource);
     /**
      * Handles an incoming response.
      */
@@ -110,15 +318,33 @@ protected:
      */
     void extractInformation(const fipa::acl::ACLMessage& message, LamportTime& time, std::string& resource);
     /**
-     * Sends all deferred messages for a certain resource by putting them into outgoingMessages
+     * Extracts the information from the content of a request and saves it in the passed references
+     */
+    void extractInformation(const fipa::acl::ACLMessage& message, LamportTime& time, std::string& resource, priority::Priority& priority);
+    /**
+     * Extracts the information from the content of a request, including the requested mode
+     */
+    void extractInformation(const fipa::acl::ACLMessage& message, LamportTime& time, std::string& resource, priority::Priority& priority,
+            lock_mode::LockMode& mode);
+    /**
+     * Gets the resource we are interested in with a request of the given conversation, empty if there is none
+     */
+    std::string getInterestedResource(const std::string& conversationID) const;
+    /**
+     * Marks the resource as LOCKED, if enough communication partners responded to our request
+     */
+    void tryObtainLock(const std::string& resource);
+    /**
+     * Sends all deferred responses for a certain resource by putting them into outgoingMessages
      */
     void sendAllDeferredMessages(const std::string& resource);
 
     /**
-     * Adds an agent to the ones that responded. This one-liner is encapsulated in a virtual method,
+     * Adds an agent to the ones that responded. This is encapsulated in a virtual method,
      * so that the extended algorithm can easily extend the behaviour.
+     * Returns false, if the agent is no communication partner or already responded.
      */
-    virtual void addRespondedAgent(const fipa::acl::AgentID& agent, std::string resource);
+    virtual bool addRespondedAgent(const fipa::acl::AgentID& agent, const std::string& resource);
 
 };
 } // namespace distributed_locking
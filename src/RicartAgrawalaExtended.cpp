@@ -11,21 +11,26 @@ RicartAgrawalaExtended::RicartAgrawalaExtended(const fipa::acl::AgentID& self, c
     setProtocol(protocol::RICART_AGRAWALA_EXTENDED);
 }
 
-void RicartAgrawalaExtended::lock(const std::string& resource, const AgentIDList& agents)
+void RicartAgrawalaExtended::requestLock(const std::string& resource, const AgentGroup& agents, lock_mode::LockMode mode,
+        priority::Priority priority)
 {
-    fipa::distributed_locking::RicartAgrawala::lock(resource, agents);
+    fipa::distributed_locking::RicartAgrawala::requestLock(resource, agents, mode, priority);
     // Start sending probes for all communication partners
-    for(AgentIDList::const_iterator it = agents.begin(); it != agents.end(); ++it)
+    for(AgentIDList::const_iterator it = agents->begin(); it != agents->end(); ++it)
     {
         startRequestingProbes(*it, resource);
     }
 }
 
-void RicartAgrawalaExtended::addRespondedAgent(const AgentID& agentName, const std::string& resource)
+bool RicartAgrawalaExtended::addRespondedAgent(const AgentID& agentName, const std::string& resource)
 {
-    fipa::distributed_locking::RicartAgrawala::addRespondedAgent(agentName, resource);
+    if(!fipa::distributed_locking::RicartAgrawala::addRespondedAgent(agentName, resource))
+    {
+        return false;
+    }
     // Stop sending him probes
     stopRequestingProbes(agentName, resource);
+    return true;
 }
 
 } // namespace distributed_locking
@@ -22,15 +22,17 @@ public:
      * Constructor
      */
     RicartAgrawalaExtended(const fipa::acl::AgentID& self, const std::vector<std::string>& resources);
-    
+
+protected:
     /**
-     * Tries to lock a resource. Subsequently, isLocked() must be called to check the status.
+     * Sends the requests for a single resource and starts probing the communication partners
      */
-    virtual void lock(const std::string& resource, const fipa::acl::AgentIDList& agents);
+    virtual void requestLock(const std::string& resource, const AgentGroup& agents, lock_mode::LockMode mode,
+            priority::Priority priority);
     /**
      * Adds an agent to the ones that responded.
      */
-    virtual void addRespondedAgent(const fipa::acl::AgentID& agent, const std::string& resource);
+    virtual bool addRespondedAgent(const fipa::acl::AgentID& agent, const std::string& resource);
 };
 } // namespace distributed_locking
 } // namespace fipa
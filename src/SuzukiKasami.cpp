@@ -6,6 +6,7 @@
 #include <sstream>
 #include <stdexcept>
 #include <deque>
+#include <algorithm>
 #include <base/Logging.hpp>
 
 using namespace fipa::acl;
@@ -15,6 +16,8 @@ namespace distributed_locking {
 
 SuzukiKasami::SuzukiKasami(const fipa::acl::AgentID& self, const std::vector< std::string >& resources)
     : DLM(protocol::SUZUKI_KASAMI, self, resources)
+    , mDirectedRequestTimeoutInS(0)
+    , mAgingInterval(0)
 {
     // Also hold the token at the beginning for all physically owned resources
     for(unsigned int i = 0; i < resources.size(); i++)
@@ -25,102 +28,467 @@ SuzukiKasami::SuzukiKasami(const fipa::acl::AgentID& self, const std::vector< st
 
 void SuzukiKasami::lock(const std::string& resource, const AgentIDList& agents)
 {
-    if(!hasKnownOwner(resource))
-    {
-        throw std::invalid_argument("SuzukiKasami: cannot lock resource '" + resource + "' -- owner is unknown. Perform discovery first");
-    }
+    lockResources(std::vector<std::string>(1, resource), agents);
+}
 
-    lock_state::LockState state = getLockState(resource);
-    // Only act we are not holding this resource and not already interested in it
-    if(state != lock_state::NOT_INTERESTED)
+void SuzukiKasami::requestLock(const std::string& resource, const AgentGroup& agents, priority::Priority priority)
+{
+    lockResources(std::vector<std::string>(1, resource), agents, priority);
+}
+
+void SuzukiKasami::lockResources(const std::vector<std::string>& resources, const AgentIDList& agents)
+{
+    lockResources(resources, getPartners(agents), priority::NORMAL);
+}
+
+void SuzukiKasami::lockResources(const std::vector<std::string>& resources, const AgentIDList& agents, priority::Priority priority)
+{
+    lockResources(resources, getPartners(agents), priority);
+}
+
+void SuzukiKasami::lockResources(const std::vector<std::string>& resources, const AgentGroup& agents, priority::Priority priority)
+{
+    // Check all resources first, so that either all or none are requested
+    for(std::vector<std::string>::const_iterator it = resources.begin(); it != resources.end(); ++it)
     {
-        if(state == lock_state::UNREACHABLE)
+        const std::string& resource = *it;
+        if(!hasKnownOwner(resource))
+        {
+            throw std::invalid_argument("SuzukiKasami: cannot lock resource '" + resource + "' -- owner is unknown. Perform discovery first");
+        }
+        if(getOwnedRoot(resource) != resource)
+        {
+            // There is a token for each resource of the owner, but none for its parts
+            throw std::invalid_argument("SuzukiKasami: cannot lock resource '" + resource + "' -- parts of resources are only supported by Ricart Agrawala");
+        }
+        if(getResourceCapacity(resource) != 1)
+        {
+            throw std::invalid_argument("SuzukiKasami: cannot lock resource '" + resource + "' -- k-mutual exclusion is only supported by Ricart Agrawala");
+        }
+        if(getLockState(resource) == lock_state::UNREACHABLE)
         {
             // An unreachable resource cannot be locked. Throw exception
             throw std::runtime_error("RicartAgrawala::lock Cannot lock UNREACHABLE resource.");
         }
-        return;
     }
 
-    // If we're holding the token, we can simply enter the critical section
-    if(mLockStates[resource].mHoldingToken)
+    std::vector<std::string> missing;
+    for(std::vector<std::string>::const_iterator it = resources.begin(); it != resources.end(); ++it)
     {
-        mLockStates[resource].mState = lock_state::LOCKED;
-        return;
+        const std::string& resource = *it;
+        // Only act we are not holding this resource and not already interested in it (e.g. by prefetching it)
+        if(claimPrefetch(resource) || reenter(resource) || getLockState(resource) != lock_state::NOT_INTERESTED)
+        {
+            continue;
+        }
+
+        // If we're holding the token, we can simply enter the critical section
+        if(mLockStates[resource].mHoldingToken)
+        {
+            if(mLockStates[resource].mHoldingOver)
+            {
+                ++mLockStates[resource].getCold().mReentries;
+                ++mHoldOverStatistics[resource].mReentries;
+                LOG_DEBUG_S << "'" << mSelf.getName() << "' reenters resource '" << resource << "' with held over token";
+            }
+            mLockStates[resource].mState = lock_state::LOCKED;
+            lockRequested(resource, priority);
+            lockGranted(resource);
+            continue;
+        }
+        missing.push_back(resource);
     }
 
-    requestToken(resource, agents);
+    if(!missing.empty())
+    {
+        requestTokens(missing, agents, priority);
+    }
 }
 
 void SuzukiKasami::requestToken(const std::string& resource, const AgentIDList& agents)
 {
-    // Increase sequence number
-    int requestNumber = mLockStates[resource].mRequestNumber[mSelf] + 1;
+    requestTokens(std::vector<std::string>(1, resource), getPartners(agents), priority::NORMAL);
+}
 
-    // Request token
+void SuzukiKasami::requestTokens(const std::vector<std::string>& resources, const AgentGroup& partners,
+        priority::Priority priority)
+{
+    const AgentIDList& agents = *partners;
+    // Request tokens
     using namespace fipa::acl;
     ACLMessage message = prepareMessage(ACLMessage::REQUEST, getProtocolName());
     // TODO: Content Language
-    // Our request messages are in the format "RESOURCE_IDENTIFIER\nSEQUENCE_NUMBER"
-    message.setContent(resource + "\n" + boost::lexical_cast<std::string>(requestNumber));
-    // Add receivers
-    for(AgentIDList::const_iterator it = agents.begin(); it != agents.end(); it++)
+    // Our request messages are in the format "RESOURCE_IDENTIFIER\nSEQUENCE_NUMBER", repeated for each resource,
+    // followed by "\nPRIORITY" if the priority is not NORMAL
+    std::string content;
+    for(std::vector<std::string>::const_iterator it = resources.begin(); it != resources.end(); ++it)
+    {
+        ResourceLockState& lockState = mLockStates[*it];
+        unsigned int self = getAgentIndex(lockState, mSelf);
+        // Increase sequence number
+        ++lockState.mRequestNumber[self];
+        lockState.mPriority[self] = priority;
+        lockRequested(*it, priority);
+        if(!content.empty())
+        {
+            content += "\n";
+        }
+        content += *it + "\n" + boost::lexical_cast<std::string>(lockState.mRequestNumber[self]);
+    }
+    if(priority != priority::NORMAL)
     {
-        message.addReceiver(*it);
+        content += "\n" + boost::lexical_cast<std::string>(priority);
+    }
+    message.setContent(content);
+
+    // Ask only the probable token holder first, if it is one of the agents. This is only done for single resources,
+    // as the tokens of several resources are usually held by different agents.
+    const std::string& first = resources.front();
+    AgentID holder = getProbableTokenHolder(first);
+    mLockStates[first].mHasDirectedRequest = mDirectedRequestTimeoutInS > 0 && agents.size() > 1 && resources.size() == 1
+        && std::find(agents.begin(), agents.end(), holder) != agents.end();
+    if(mLockStates[first].mHasDirectedRequest)
+    {
+        message.addReceiver(holder);
+        ColdState& cold = mLockStates[first].getCold();
+        cold.mDirectedRequest = message;
+        cold.mDirectedRequestTime = base::Time::now();
+        addTimedState(first);
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' requests token for resource '" << first << "' from probable holder '" << holder.getName() << "'";
+    } else {
+        // Add receivers
+        for(AgentIDList::const_iterator it = agents.begin(); it != agents.end(); it++)
+        {
+            message.addReceiver(*it);
+        }
     }
     // Add to outgoing messages
     sendMessage(message);
 
     // Change internal state (seq_no already changed)
-    mLockStates[resource].mRequestNumber[mSelf] = requestNumber;
-    mLockStates[resource].mCommunicationPartners = agents;
-    mLockStates[resource].mState = lock_state::INTERESTED;
-    mLockStates[resource].mConversationID[mSelf] = message.getConversationID();
-    // Now the token must be obtained before we can enter the critical section
-    LOG_DEBUG_S << "'" << mSelf.getName() << "' Token requested for resource '" << resource << "' sequence number: " << mLockStates[resource].mRequestNumber[mSelf];
+    for(std::vector<std::string>::const_iterator it = resources.begin(); it != resources.end(); ++it)
+    {
+        for(AgentIDList::const_iterator ait = agents.begin(); ait != agents.end(); ++ait)
+        {
+            addParticipant(*it, *ait);
+        }
+        mLockStates[*it].mCommunicationPartners = partners;
+        mLockStates[*it].mState = lock_state::INTERESTED;
+        setConversationID(*it, getAgentIndex(mLockStates[*it], mSelf), message.getConversationID());
+        // Now the token must be obtained before we can enter the critical section
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' Token requested for resource '" << *it << "' sequence number: "
+            << mLockStates[*it].mRequestNumber[getAgentIndex(mLockStates[*it], mSelf)];
+    }
 }
 
 void SuzukiKasami::unlock(const std::string& resource)
 {
-    LOG_DEBUG_S << "'" << mSelf.getName() << " unlocks resource '" << resource << "'";
-    // Only act we are actually holding this resource
-    if(getLockState(resource) == lock_state::LOCKED)
+    unlockResources(std::vector<std::string>(1, resource));
+}
+
+void SuzukiKasami::unlockResources(const std::vector<std::string>& resources)
+{
+    // Only act we are actually holding all of these resources
+    for(std::vector<std::string>::const_iterator it = resources.begin(); it != resources.end(); ++it)
     {
+        if(getLockState(*it) != lock_state::LOCKED)
+        {
+            throw std::invalid_argument("SuzukiKasami::unlock: resource '" + *it + "' is not locked");
+        }
+    }
+
+    for(std::vector<std::string>::const_iterator it = resources.begin(); it != resources.end(); ++it)
+    {
+        const std::string& resource = *it;
+        if(leave(resource))
+        {
+            // Still held by an outer lock
+            continue;
+        }
+        LOG_DEBUG_S << "'" << mSelf.getName() << " unlocks resource '" << resource << "'";
+        ResourceLockState& lockState = mLockStates[resource];
         // Change internal state
-        mLockStates[resource].mState = lock_state::NOT_INTERESTED;
+        lockState.mState = lock_state::NOT_INTERESTED;
 
         // Update ID to have been executed
-        mLockStates[resource].mToken.mLastRequestNumber[mSelf] = mLockStates[resource].mRequestNumber[mSelf];
+        unsigned int self = getAgentIndex(lockState, mSelf);
+        lockState.mLastRequestNumber[self] = lockState.mRequestNumber[self];
 
-        // Forward the token
-        forwardToken(resource);
-    } else{
-        throw std::invalid_argument("SuzukiKasami::unlock: resource '" + resource + "' is not locked");
+        // Keep the token for further local critical sections, or forward it
+        if(!holdOverToken(resource))
+        {
+            forwardToken(resource);
+        }
+
+        // The partners of our request are only recorded as long as they are involved otherwise
+        if(lockState.mCommunicationPartners)
+        {
+            AgentGroup partners = lockState.mCommunicationPartners;
+            for(AgentIDList::const_iterator ait = partners->begin(); ait != partners->end(); ++ait)
+            {
+                dropParticipation(resource, *ait);
+            }
+        }
     }
+    flushTokens();
 }
 
-void SuzukiKasami::forwardToken(const std::string& resource)
+void SuzukiKasami::setHoldOverPolicy(const std::string& resource, unsigned int maxReentries, double maxHoldTimeInS)
+{
+    if(maxHoldTimeInS < 0)
+    {
+        throw std::invalid_argument("SuzukiKasami::setHoldOverPolicy: hold time for resource '" + resource + "' must not be negative");
+    }
+    mHoldOverPolicies[resource].mMaxReentries = maxReentries;
+    mHoldOverPolicies[resource].mMaxHoldTimeInS = maxHoldTimeInS;
+}
+
+SuzukiKasami::HoldOverStatistics SuzukiKasami::getHoldOverStatistics(const std::string& resource) const
+{
+    std::map<std::string, HoldOverStatistics>::const_iterator cit = mHoldOverStatistics.find(resource);
+    if(cit != mHoldOverStatistics.end())
+    {
+        return cit->second;
+    }
+    return HoldOverStatistics();
+}
+
+bool SuzukiKasami::holdOverToken(const std::string& resource)
+{
+    std::map<std::string, HoldOverPolicy>::const_iterator cit = mHoldOverPolicies.find(resource);
+    if(cit == mHoldOverPolicies.end() || cit->second.mMaxReentries == 0)
+    {
+        return false;
+    }
+    const HoldOverPolicy& policy = cit->second;
+    ResourceLockState& lockState = mLockStates[resource];
+
+    // Someone else is waiting, so the token must be forwarded
+    unsigned int self = getAgentIndex(lockState, mSelf);
+    bool requested = !lockState.mQueue.empty();
+    for(unsigned int i = 0; i < lockState.mRequestNumber.size() && !requested; ++i)
+    {
+        requested = i != self && lockState.mRequestNumber[i] == lockState.mLastRequestNumber[i] + 1;
+    }
+    if(requested)
+    {
+        if(lockState.mHoldingOver)
+        {
+            ++mHoldOverStatistics[resource].mPreemptions;
+            lockState.mHoldingOver = false;
+        }
+        return false;
+    }
+
+    if(!lockState.mHoldingOver)
+    {
+        lockState.mHoldingOver = true;
+        ColdState& cold = lockState.getCold();
+        cold.mHoldOverStart = base::Time::now();
+        cold.mReentries = 0;
+        addTimedState(resource);
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' holds over token for resource '" << resource << "'";
+        return true;
+    }
+
+    // Check the budget of the current hold-over
+    const ColdState& cold = lockState.getCold();
+    if(cold.mReentries >= policy.mMaxReentries ||
+        (policy.mMaxHoldTimeInS > 0 && base::Time::now() > cold.mHoldOverStart + base::Time::fromSeconds(policy.mMaxHoldTimeInS)))
+    {
+        ++mHoldOverStatistics[resource].mExpirations;
+        lockState.mHoldingOver = false;
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' used up hold-over budget for resource '" << resource << "'";
+        return false;
+    }
+    return true;
+}
+
+void SuzukiKasami::setDirectedRequestTimeout(double timeInS)
+{
+    if(timeInS < 0)
+    {
+        throw std::invalid_argument("SuzukiKasami::setDirectedRequestTimeout: timeout must not be negative");
+    }
+    mDirectedRequestTimeoutInS = timeInS;
+}
+
+AgentID SuzukiKasami::getProbableTokenHolder(const std::string& resource) const
+{
+    std::map<std::string, ResourceLockState>::const_iterator cit = mLockStates.find(resource);
+    if(cit != mLockStates.end())
+    {
+        if(cit->second.mHoldingToken)
+        {
+            return mSelf;
+        }
+        if(cit->second.mProbableHolder != NO_AGENT)
+        {
+            return mAgentDirectory.getAgent(cit->second.mProbableHolder);
+        }
+    }
+
+    return getOwner(resource);
+}
+
+void SuzukiKasami::broadcastDirectedRequest(const std::string& resource)
+{
+    ResourceLockState& lockState = mLockStates[resource];
+    lockState.mHasDirectedRequest = false;
+
+    // Continue the conversation of the directed request, with the same request number
+    ACLMessage message = lockState.getCold().mDirectedRequest;
+    AgentIDList requested = message.getAllReceivers();
+    AgentIDList remaining;
+    if(!lockState.mCommunicationPartners)
+    {
+        return;
+    }
+    const AgentIDList& partners = *lockState.mCommunicationPartners;
+    for(AgentIDList::const_iterator it = partners.begin(); it != partners.end(); ++it)
+    {
+        if(std::find(requested.begin(), requested.end(), *it) == requested.end())
+        {
+            remaining.push_back(*it);
+        }
+    }
+    if(remaining.empty())
+    {
+        return;
+    }
+    message.setAllReceivers(remaining);
+
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' directed token request for resource '" << resource << "' timed out, asking all agents";
+    sendMessage(message);
+}
+
+void SuzukiKasami::trigger()
 {
-    // Iterate through all RequestNumbers known to the agent
-    std::map<AgentID, int>::iterator it = mLockStates[resource].mRequestNumber.begin();
-    for(; it != mLockStates[resource].mRequestNumber.end(); ++it)
+    DLM::trigger();
+
+    // Only the states with a pending directed request or a held over token are checked
+    mCheckedStates.swap(mTimedStates);
+    for(size_t i = 0; i < mCheckedStates.size(); ++i)
     {
-        // If the request number of another agent is higher than the same request number known to the token
-        // that means he requested the token. If he is not already in the queue, we add it.
-        if(it->second == mLockStates[resource].mToken.mLastRequestNumber[it->first] + 1
-            && std::find(mLockStates[resource].mToken.mQueue.begin(), mLockStates[resource].mToken.mQueue.end(), it->first)
-            == mLockStates[resource].mToken.mQueue.end()
-        )
+        std::map<std::string, ResourceLockState>::iterator it = mCheckedStates[i];
+        ResourceLockState& lockState = it->second;
+        lockState.mTimed = false;
+
+        // Ask all agents, if the probable token holder did not send the token in time
+        if(lockState.mHasDirectedRequest && lockState.mState == lock_state::INTERESTED
+            && base::Time::now() > lockState.getCold().mDirectedRequestTime + base::Time::fromSeconds(mDirectedRequestTimeoutInS))
         {
-            mLockStates[resource].mToken.mQueue.push_back(it->first);
+            broadcastDirectedRequest(it->first);
         }
+
+        // Forward the token, if its hold-over time expired
+        if(lockState.mHoldingOver && lockState.mState != lock_state::LOCKED)
+        {
+            const HoldOverPolicy& policy = mHoldOverPolicies[it->first];
+            if(policy.mMaxHoldTimeInS > 0 && base::Time::now() > lockState.getCold().mHoldOverStart + base::Time::fromSeconds(policy.mMaxHoldTimeInS))
+            {
+                ++mHoldOverStatistics[it->first].mExpirations;
+                lockState.mHoldingOver = false;
+                LOG_DEBUG_S << "'" << mSelf.getName() << "' hold-over time expired for resource '" << it->first << "'";
+                forwardToken(it->first);
+            }
+        }
+
+        // Keep checking, as long as there is a timeout to wait for
+        if((lockState.mHasDirectedRequest || lockState.mHoldingOver) && !lockState.mTimed)
+        {
+            lockState.mTimed = true;
+            mTimedStates.push_back(it);
+        }
+    }
+    mCheckedStates.clear();
+    flushTokens();
+}
+
+void SuzukiKasami::addTimedState(const std::string& resource)
+{
+    std::map<std::string, ResourceLockState>::iterator it = mLockStates.find(resource);
+    if(it != mLockStates.end() && !it->second.mTimed)
+    {
+        it->second.mTimed = true;
+        mTimedStates.push_back(it);
     }
+}
+
+void SuzukiKasami::setConversationID(const std::string& resource, unsigned int agent, const std::string& conversationID)
+{
+    ResourceLockState& lockState = mLockStates[resource];
+    const std::string& previous = lockState.getConversationID(agent);
+    if(previous == conversationID)
+    {
+        return;
+    }
+    if(!previous.empty())
+    {
+        // The previous request of the agent is superseded
+        std::map<std::string, std::vector<std::string> >::iterator it = mConversationResources.find(previous);
+        if(it != mConversationResources.end())
+        {
+            it->second.erase(std::remove(it->second.begin(), it->second.end(), resource), it->second.end());
+            if(it->second.empty())
+            {
+                mConversationResources.erase(it);
+            }
+        }
+    }
+    lockState.setConversationID(agent, conversationID);
+
+    std::vector<std::string>& resources = mConversationResources[conversationID];
+    if(std::find(resources.begin(), resources.end(), resource) == resources.end())
+    {
+        resources.push_back(resource);
+    }
+}
+
+bool SuzukiKasami::returnToken(const std::string& resource, const AgentID& receiver)
+{
+    std::map<std::string, ResourceLockState>::iterator it = mLockStates.find(resource);
+    if(it == mLockStates.end() || !it->second.mHoldingToken)
+    {
+        return false;
+    }
+    ResourceLockState& lockState = it->second;
+    if(lockState.mState == lock_state::LOCKED)
+    {
+        LOG_DEBUG_S << "'" << mSelf.getName() << " unlocks resource '" << resource << "'";
+        lockState.mState = lock_state::NOT_INTERESTED;
+        unsigned int self = getAgentIndex(lockState, mSelf);
+        lockState.mLastRequestNumber[self] = lockState.mRequestNumber[self];
+    }
+    if(receiver == mSelf)
+    {
+        return true;
+    }
+
+    LOG_DEBUG_S << "'" << mSelf.getName() << "' returns token for resource '" << resource << "' to '" << receiver.getName() << "'";
+    // The receiver does not know all requests we know. Its own request is served on receipt.
+    unsigned int index = getAgentIndex(lockState, receiver);
+    enqueueOutstandingRequests(lockState);
+    if(lockState.mQueued[index])
+    {
+        lockState.mQueue.erase(std::find(lockState.mQueue.begin(), lockState.mQueue.end(), index));
+        lockState.mQueued[index] = false;
+    }
+    sendToken(receiver, resource);
+    flushTokens();
+    return true;
+}
+
+void SuzukiKasami::forwardToken(const std::string& resource)
+{
+    ResourceLockState& lockState = mLockStates[resource];
+    enqueueOutstandingRequests(lockState);
 
     // Forward token if there's a pending request (queue not empty)
-    if(!mLockStates[resource].mToken.mQueue.empty())
+    if(!lockState.mQueue.empty())
     {
-        AgentID agent = mLockStates[resource].mToken.mQueue.front();
-        mLockStates[resource].mToken.mQueue.pop_front();
+        unsigned int index = dequeue(lockState);
+        AgentID agent = mAgentDirectory.getAgent(index);
 
         LOG_DEBUG_S << "Pending request, forward token to " << agent.getName();
         sendToken(agent, resource);
@@ -130,6 +498,36 @@ void SuzukiKasami::forwardToken(const std::string& resource)
     // Else keep token
 }
 
+void SuzukiKasami::enqueueOutstandingRequests(ResourceLockState& lockState)
+{
+    lockState.resize(mAgentDirectory.size());
+
+    // If the request number of another agent is higher than the same request number known to the token
+    // that means he requested the token. The comparison runs over the dense vectors in a single pass,
+    // without branches, so that it can be vectorized by the compiler.
+    const unsigned int agents = lockState.mRequestNumber.size();
+    mOutstanding.resize(agents);
+    if(agents != 0)
+    {
+        const int* requestNumber = &lockState.mRequestNumber[0];
+        const int* lastRequestNumber = &lockState.mLastRequestNumber[0];
+        unsigned char* outstanding = &mOutstanding[0];
+        for(unsigned int i = 0; i < agents; ++i)
+        {
+            outstanding[i] = requestNumber[i] == lastRequestNumber[i] + 1;
+        }
+    }
+
+    // If he is not already in the queue, we add it.
+    for(unsigned int i = 0; i < agents; ++i)
+    {
+        if(mOutstanding[i] && !lockState.mQueued[i])
+        {
+            lockState.enqueue(i);
+        }
+    }
+}
+
 lock_state::LockState SuzukiKasami::getLockState(const std::string& resource) const
 {
     if(mLockStates.count(resource) != 0)
@@ -148,6 +546,7 @@ bool SuzukiKasami::onIncomingMessage(const fipa::acl::ACLMessage& message)
     // Call base method as required
     if(DLM::onIncomingMessage(message))
     {
+        flushTokens();
         return true;
     }
 
@@ -164,44 +563,60 @@ bool SuzukiKasami::onIncomingMessage(const fipa::acl::ACLMessage& message)
         case ACLMessage::REQUEST:
             LOG_DEBUG_S << "Incoming Token Request";
             handleIncomingTokenRequest(message);
-            return true;
+            break;
         case ACLMessage::PROPAGATE:
             LOG_DEBUG_S << "Incoming Token";
             handleIncomingToken(message);
-            return true;
+            break;
         case ACLMessage::FAILURE:
             LOG_DEBUG_S << "Incoming Failure Message";
             handleIncomingFailure(message);
-            return true;
+            break;
         default:
             return false;
     }
+    // Send the tokens passed on while handling the message
+    flushTokens();
+    return true;
 }
 
 void SuzukiKasami::handleIncomingTokenRequest(const fipa::acl::ACLMessage& message)
 {
     // Extract information
-    std::string resource;
-    int sequenceNumber;
-    extractInformation(message, resource, sequenceNumber);
+    std::vector< std::pair<std::string, int> > requests;
+    priority::Priority priority;
+    extractInformation(message, requests, priority);
+    for(unsigned int i = 0; i < requests.size(); ++i)
+    {
+        handleIncomingTokenRequest(message, requests[i].first, requests[i].second, priority);
+    }
+}
+
+void SuzukiKasami::handleIncomingTokenRequest(const fipa::acl::ACLMessage& message, const std::string& resource, int sequenceNumber,
+        priority::Priority priority)
+{
     fipa::acl::AgentID agent = message.getSender();
 
-    // Update our request state
-    std::map<fipa::acl::AgentID, int>::const_iterator cit = mLockStates[resource].mRequestNumber.find(agent);
-    if(cit != mLockStates[resource].mRequestNumber.end())
+    ResourceLockState& lockState = mLockStates[resource];
+    if(lockState.getEpoch() != 0 && lockState.mCold->mMembers.count(agent) == 0)
+    {
+        // Agents which left must not be registered again
+        LOG_INFO_S << "'" << mSelf.getName() << "' ignores token request of non-member '" << agent.getName() << "' for resource '" << resource << "'";
+        return;
+    }
+
+    // Update our request state, request numbers start at 1
+    unsigned int index = getAgentIndex(lockState, agent);
+    if(lockState.mRequestNumber[index] < sequenceNumber)
     {
-        if(mLockStates[resource].mRequestNumber[agent] < sequenceNumber)
-        {
-            mLockStates[resource].mRequestNumber[agent] = sequenceNumber;
-            mLockStates[resource].mConversationID[agent] = message.getConversationID();
-        } else {
-            LOG_INFO_S << "'" << mSelf.getName() << "' received an outdated token request from '" << agent.getName() << "'";
-            return;
-        }
-    } else {
         LOG_DEBUG_S << "'" << mSelf.getName() << "' registering request of '" << agent.getName() << "' for resource '" << resource << "' with conversation id: " << message.getConversationID();
-        mLockStates[resource].mRequestNumber[agent] = sequenceNumber;
-        mLockStates[resource].mConversationID[agent] = message.getConversationID();
+        lockState.mRequestNumber[index] = sequenceNumber;
+        lockState.mPriority[index] = priority;
+        setConversationID(resource, index, message.getConversationID());
+        addParticipant(resource, agent);
+    } else {
+        LOG_INFO_S << "'" << mSelf.getName() << "' received an outdated token request from '" << agent.getName() << "'";
+        return;
     }
 
     // If we hold the token && are not holding the lock && the sequenceNumber
@@ -214,6 +629,14 @@ void SuzukiKasami::handleIncomingTokenRequest(const fipa::acl::ACLMessage& messa
         } else if(hasOutstandingRequest(resource, agent))
         {
             LOG_DEBUG_S << "'" << mSelf.getName() << "' agent '" << agent.getName() << "' has outstanding request";
+            if(mLockStates[resource].mHoldingOver)
+            {
+                // The token is only held over, so it is passed on the regular way
+                ++mHoldOverStatistics[resource].mPreemptions;
+                mLockStates[resource].mHoldingOver = false;
+                forwardToken(resource);
+                return;
+            }
             sendToken(agent, resource);
             return;
         } else {
@@ -227,10 +650,17 @@ void SuzukiKasami::handleIncomingTokenRequest(const fipa::acl::ACLMessage& messa
     }
 }
 
-bool SuzukiKasami::hasOutstandingRequest(const std::string& resource, const fipa::acl::AgentID& agent)
+bool SuzukiKasami::hasOutstandingRequest(const std::string& resource, const fipa::acl::AgentID& agent) const
 {
-    int currentRequestNumber = mLockStates[resource].mRequestNumber[agent];
-    int lastRequestNumber = mLockStates[resource].mToken.mLastRequestNumber[agent];
+    std::map<std::string, ResourceLockState>::const_iterator cit = mLockStates.find(resource);
+    unsigned int index;
+    if(cit == mLockStates.end() || !mAgentDirectory.find(agent, index) || index >= cit->second.mRequestNumber.size())
+    {
+        return false;
+    }
+    const ResourceLockState& lockState = cit->second;
+    int currentRequestNumber = lockState.mRequestNumber[index];
+    int lastRequestNumber = lockState.mLastRequestNumber[index];
 
     LOG_DEBUG_S << "'" << mSelf.getName() << "' resource: '" << resource << "', agent: '" << agent.getName() << "', currentRequestNumber: " << currentRequestNumber << ", lastRequestNumber: " << lastRequestNumber;
     return currentRequestNumber == lastRequestNumber + 1;
@@ -240,22 +670,262 @@ bool SuzukiKasami::hasOutstandingRequest(const std::string& resource, const fipa
 
 void SuzukiKasami::updateToken(const std::string& resource, const fipa::acl::AgentID& requestor, int sequenceNumber)
 {
-    mLockStates[resource].mToken.mQueue.push_back(requestor);
-    mLockStates[resource].mToken.mLastRequestNumber[requestor] = sequenceNumber;
+    ResourceLockState& lockState = mLockStates[resource];
+    unsigned int index = getAgentIndex(lockState, requestor);
+    if(!lockState.mQueued[index])
+    {
+        lockState.enqueue(index);
+    }
+    lockState.mLastRequestNumber[index] = sequenceNumber;
+}
+
+void SuzukiKasami::dropParticipation(const std::string& resource, const fipa::acl::AgentID& agent)
+{
+    ResourceLockState& lockState = mLockStates[resource];
+    unsigned int index;
+    if(!mAgentDirectory.find(agent, index))
+    {
+        return;
+    }
+    lockState.resize(mAgentDirectory.size());
+    bool partner = lockState.mState != lock_state::NOT_INTERESTED && lockState.mCommunicationPartners
+        && std::find(lockState.mCommunicationPartners->begin(), lockState.mCommunicationPartners->end(), agent) != lockState.mCommunicationPartners->end();
+    if(partner || lockState.mRequestNumber[index] > lockState.mLastRequestNumber[index] || lockState.mQueued[index]
+        || (!lockState.mHoldingToken && lockState.mProbableHolder == index) || isTokenHolder(resource, agent)
+        || (hasKnownOwner(resource) && getOwner(resource) == agent))
+    {
+        return;
+    }
+    removeParticipant(resource, agent);
+}
+
+void SuzukiKasami::removeRequests(const std::string& resource, const fipa::acl::AgentID& agent)
+{
+    ResourceLockState& lockState = mLockStates[resource];
+    unsigned int index = getAgentIndex(lockState, agent);
+    lockState.mRequestNumber[index] = 0;
+    lockState.mLastRequestNumber[index] = 0;
+    if(lockState.mQueued[index])
+    {
+        lockState.mQueue.erase(std::remove(lockState.mQueue.begin(), lockState.mQueue.end(), index), lockState.mQueue.end());
+        lockState.mQueued[index] = false;
+    }
+}
+
+unsigned int SuzukiKasami::getAgentIndex(ResourceLockState& lockState, const fipa::acl::AgentID& agent)
+{
+    unsigned int index = mAgentDirectory.insert(agent);
+    lockState.resize(mAgentDirectory.size());
+    return index;
+}
+
+void SuzukiKasami::restoreToken(const std::string& resource, const Token& token)
+{
+    if(token.mLastRequestNumber.size() != token.mAgents.size())
+    {
+        throw std::runtime_error("SuzukiKasami::restoreToken: token for resource '" + resource + "' is malformed");
+    }
+
+    ResourceLockState& lockState = mLockStates[resource];
+    // A token compacted for a newer membership lists exactly the members of that membership
+    if(token.mEpoch > lockState.getEpoch())
+    {
+        ColdState& cold = lockState.getCold();
+        cold.mEpoch = token.mEpoch;
+        cold.mMembers = std::set<AgentID>(token.mAgents.begin(), token.mAgents.end());
+        cold.mMembers.insert(mSelf);
+    }
+
+    lockState.mHandOffs = token.mHandOffs;
+    lockState.mLastRequestNumber.assign(lockState.mLastRequestNumber.size(), 0);
+    lockState.mQueue.clear();
+    lockState.mQueued.reset();
+
+    // Map the indices of the token to ours
+    std::vector<unsigned int> indices(token.mAgents.size());
+    for(unsigned int i = 0; i < token.mAgents.size(); ++i)
+    {
+        indices[i] = getAgentIndex(lockState, token.mAgents[i]);
+        lockState.mLastRequestNumber[indices[i]] = token.mLastRequestNumber[i];
+    }
+    std::deque<unsigned int>::const_iterator qit = token.mQueue.begin();
+    for(; qit != token.mQueue.end(); ++qit)
+    {
+        if(*qit >= indices.size())
+        {
+            throw std::runtime_error("SuzukiKasami::restoreToken: token for resource '" + resource + "' references unknown agent");
+        }
+        if(!lockState.mQueued[indices[*qit]])
+        {
+            unsigned int position = qit - token.mQueue.begin();
+            lockState.enqueue(indices[*qit]);
+            if(position < token.mQueuePriority.size() && position < token.mQueueSince.size())
+            {
+                lockState.mPriority[indices[*qit]] = token.mQueuePriority[position];
+                lockState.mQueuedSince[indices[*qit]] = token.mQueueSince[position];
+            }
+            addParticipant(resource, token.mAgents[*qit]);
+        }
+    }
+
+    if(lockState.getEpoch() != 0)
+    {
+        pruneNonMembers(resource);
+    }
+}
+
+SuzukiKasami::Token SuzukiKasami::createToken(const ResourceLockState& lockState) const
+{
+    Token token;
+    token.mEpoch = lockState.getEpoch();
+    token.mHandOffs = lockState.mHandOffs;
+    // Position of each of our agents in the agent table of the token
+    std::vector<int> positions(lockState.mLastRequestNumber.size(), -1);
+
+    if(token.mEpoch != 0)
+    {
+        // List all members, and only them
+        const std::set<AgentID>& members = lockState.mCold->mMembers;
+        std::set<AgentID>::const_iterator it = members.begin();
+        for(; it != members.end(); ++it)
+        {
+            unsigned int index;
+            int lastRequestNumber = 0;
+            if(mAgentDirectory.find(*it, index) && index < positions.size())
+            {
+                positions[index] = token.mAgents.size();
+                lastRequestNumber = lockState.mLastRequestNumber[index];
+            }
+            token.mAgents.push_back(*it);
+            token.mLastRequestNumber.push_back(lastRequestNumber);
+        }
+    } else {
+        // Agents without an executed request or a queued one are left out
+        for(unsigned int i = 0; i < lockState.mLastRequestNumber.size(); ++i)
+        {
+            if(lockState.mLastRequestNumber[i] != 0 || lockState.mQueued[i])
+            {
+                positions[i] = token.mAgents.size();
+                token.mAgents.push_back(mAgentDirectory.getAgent(i));
+                token.mLastRequestNumber.push_back(lockState.mLastRequestNumber[i]);
+            }
+        }
+    }
+
+    std::vector<unsigned int>::const_iterator it = lockState.mQueue.begin();
+    for(; it != lockState.mQueue.end(); ++it)
+    {
+        if(positions[*it] >= 0)
+        {
+            token.mQueue.push_back(positions[*it]);
+            token.mQueuePriority.push_back(lockState.mPriority[*it]);
+            token.mQueueSince.push_back(lockState.mQueuedSince[*it]);
+        }
+    }
+    return token;
+}
+
+void SuzukiKasami::setMembership(const std::string& resource, unsigned int epoch, const fipa::acl::AgentIDList& agents)
+{
+    ResourceLockState& lockState = mLockStates[resource];
+    if(epoch <= lockState.getEpoch())
+    {
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' ignores outdated membership " << epoch << " for resource '" << resource << "'";
+        return;
+    }
+    ColdState& cold = lockState.getCold();
+    cold.mEpoch = epoch;
+    cold.mMembers = std::set<AgentID>(agents.begin(), agents.end());
+    cold.mMembers.insert(mSelf);
+    pruneNonMembers(resource);
+}
+
+unsigned int SuzukiKasami::getMembershipEpoch(const std::string& resource) const
+{
+    std::map<std::string, ResourceLockState>::const_iterator cit = mLockStates.find(resource);
+    if(cit != mLockStates.end())
+    {
+        return cit->second.getEpoch();
+    }
+    return 0;
+}
+
+void SuzukiKasami::pruneNonMembers(const std::string& resource)
+{
+    ResourceLockState& lockState = mLockStates[resource];
+    const std::set<AgentID>& members = lockState.getCold().mMembers;
+    for(unsigned int i = 0; i < lockState.mRequestNumber.size(); ++i)
+    {
+        const AgentID& agent = mAgentDirectory.getAgent(i);
+        if(members.count(agent) == 0 &&
+            (lockState.mRequestNumber[i] != 0 || lockState.mLastRequestNumber[i] != 0 || lockState.mQueued[i]))
+        {
+            LOG_DEBUG_S << "'" << mSelf.getName() << "' drops requests of non-member '" << agent.getName() << "' for resource '" << resource << "'";
+            removeRequests(resource, agent);
+        }
+    }
+}
+
+void SuzukiKasami::Token::setLastRequestNumber(const fipa::acl::AgentID& agent, int requestNumber)
+{
+    mLastRequestNumber[addAgent(agent)] = requestNumber;
+}
+
+int SuzukiKasami::Token::getLastRequestNumber(const fipa::acl::AgentID& agent) const
+{
+    std::vector<AgentID>::const_iterator it = std::find(mAgents.begin(), mAgents.end(), agent);
+    if(it == mAgents.end())
+    {
+        return 0;
+    }
+    return mLastRequestNumber[it - mAgents.begin()];
+}
+
+unsigned int SuzukiKasami::Token::addAgent(const fipa::acl::AgentID& agent)
+{
+    std::vector<AgentID>::const_iterator it = std::find(mAgents.begin(), mAgents.end(), agent);
+    if(it != mAgents.end())
+    {
+        return it - mAgents.begin();
+    }
+    mAgents.push_back(agent);
+    mLastRequestNumber.push_back(0);
+    return mAgents.size() - 1;
+}
+
+void SuzukiKasami::Token::enqueue(const fipa::acl::AgentID& agent, priority::Priority priority, unsigned int since)
+{
+    mQueue.push_back(addAgent(agent));
+    mQueuePriority.push_back(priority);
+    mQueueSince.push_back(since);
 }
 
 void SuzukiKasami::handleIncomingToken(const fipa::acl::ACLMessage& message)
 {
-    // If we get a response, that likely means, we are interested in a resource
     // Extract information
-    std::string resource;
-    Token token;
-    // This HAS to be done in two steps, as resource is not known before extractInformation returns!
-    extractInformation(message, resource, token);
-    mLockStates[resource].mToken = token;
+    TokenBundle bundle;
+    extractInformation(message, bundle);
+    for(unsigned int i = 0; i < bundle.mResources.size(); ++i)
+    {
+        handleIncomingToken(message, bundle.mResources[i], bundle.mTokens[i]);
+    }
+}
+
+void SuzukiKasami::handleIncomingToken(const fipa::acl::ACLMessage& message, const std::string& resource, const Token& token)
+{
+    // If we get a response, that likely means, we are interested in a resource
+    restoreToken(resource, token);
 
     // We're defenitely holding the token now, if we're interested or not
     mLockStates[resource].mHoldingToken = true;
+    mLockStates[resource].mHasDirectedRequest = false;
+
+    // The requests served meanwhile and the former holder do not involve their agents any more
+    dropParticipation(resource, message.getSender());
+    for(AgentIDList::const_iterator it = token.mAgents.begin(); it != token.mAgents.end(); ++it)
+    {
+        dropParticipation(resource, *it);
+    }
 
     // Following, a response is only relevant if we're "INTERESTED"
     if(getLockState(resource) != lock_state::INTERESTED)
@@ -265,68 +935,64 @@ void SuzukiKasami::handleIncomingToken(const fipa::acl::ACLMessage& message)
     }
     // Now we can lock the resource
     mLockStates[resource].mState = lock_state::LOCKED;
+    lockGranted(resource);
 }
 
 void SuzukiKasami::handleIncomingFailure(const fipa::acl::ACLMessage& message)
 {
-    // First determine the affected resource from the conversation id.
-    std::string conversationID = message.getConversationID();
-    std::string resource;
+    onDeliveryFailure(message.getConversationID(), getFailedReceivers(message));
+}
 
-    std::map<std::string, ResourceLockState>::const_iterator it = mLockStates.begin();
-    for(; it != mLockStates.end(); ++it)
+void SuzukiKasami::onDeliveryFailure(const std::string& conversationID, const fipa::acl::AgentIDList& failedReceivers)
+{
+    // First determine the affected resources from the conversation id, a request can cover several resources
+    std::vector<std::string> resources;
+    std::map<std::string, std::vector<std::string> >::const_iterator cit = mConversationResources.find(conversationID);
+    if(cit != mConversationResources.end())
     {
-        const ResourceLockState& lockState = it->second;
-        std::map<fipa::acl::AgentID, std::string>::const_iterator cit = lockState.mConversationID.begin();
-        for(; cit != lockState.mConversationID.end(); ++cit)
-        {
-            if(cit->second == conversationID)
-            {
-                resource = it->first;
-                break;
-            }
-        }
+        resources = cit->second;
     }
 
-    using namespace fipa::acl;
-    // Get intended receivers
-    std::string innerEncodedMsg = message.getContent();
-    ACLMessage errorMsg;
-    MessageParser::parseData(innerEncodedMsg, errorMsg, representation::STRING_REP);
-    AgentIDList deliveryFailedForAgents = errorMsg.getAllReceivers();
-
-    for(AgentIDList::const_iterator it = deliveryFailedForAgents.begin(); it != deliveryFailedForAgents.end(); it++)
+    for(AgentIDList::const_iterator it = failedReceivers.begin(); it != failedReceivers.end(); it++)
     {
-        if(resource == "")
+        if(resources.empty())
         {
             // This means the message we tried to send was a token/response message.
             // We also have to deal with the failed agent
-            agentFailed(it->getName());
+            agentFailed(*it);
             // In the non-extended algorithm, we lost the token and will probably starve now.
         }
         else
         {
             // Now we must handle the failure appropriately
-            handleIncomingFailure(resource, it->getName());
+            for(unsigned int i = 0; i < resources.size(); ++i)
+            {
+                handleIncomingFailure(resources[i], *it);
+            }
         }
     }
+    // Send the tokens passed on while handling the failure
+    flushTokens();
 }
 
 void SuzukiKasami::handleIncomingFailure(const std::string& resource, const AgentID& intendedReceiver)
 {
     // If the physical owner of the resource failed, the ressource probably cannot be obtained any more.
-    if(mOwnedResources[resource] == intendedReceiver)
+    if(getOwner(resource) == intendedReceiver)
     {
         // Mark resource as unreachable.
         mLockStates[resource].mState = lock_state::UNREACHABLE;
+        lockAbandoned(resource);
         // We cannot update the token, as we do not possess it, but this is probably no problem if the resource cannot be used any more
         mLockStates[resource].mHoldingToken = false; // Just to be sure!
     }
     // This block cannot be triggered if only mLockHolders[resource] == intendedReceiver, as this can be erroneous
-    else if(mOwnedResources[resource] == mSelf && isTokenHolder(resource, intendedReceiver))
+    else if(getOwner(resource) == mSelf && isTokenHolder(resource, intendedReceiver))
     {
         // If we own the resource, we "get" the token again. We rediscover lost queue values by checking against our known request numbers (done in forwardToken)
         mLockStates[resource].mHoldingToken = true;
+        // The request of the failed token holder is known as outstanding to us, but must not be served again
+        removeRequests(resource, intendedReceiver);
         if(getLockState(resource) != lock_state::INTERESTED)
         {
             // If we're not interested, we forward the token
@@ -336,6 +1002,7 @@ void SuzukiKasami::handleIncomingFailure(const std::string& resource, const Agen
         {
             // Otherwise we can lock the resource
             mLockStates[resource].mState = lock_state::LOCKED;
+            lockGranted(resource);
         }
         // Otherwise somebody will foward the token to us at some point. (else block)
     }
@@ -344,10 +1011,13 @@ void SuzukiKasami::handleIncomingFailure(const std::string& resource, const Agen
         // The agent was not important (for us), we have to remove it from the list of communication partners, as we won't get a response from it
         mLockStates[resource].removeCommunicationPartner(intendedReceiver);
         // We also have to remove his requestNumber(s) and remove him from the queue (relevant if we own the token)
-        mLockStates[resource].mRequestNumber.erase(intendedReceiver);
-        mLockStates[resource].mToken.mLastRequestNumber.erase(intendedReceiver);
-        mLockStates[resource].mToken.mQueue.erase(std::remove(mLockStates[resource].mToken.mQueue.begin(), mLockStates[resource].mToken.mQueue.end(), intendedReceiver),
-                                                  mLockStates[resource].mToken.mQueue.end());
+        removeRequests(resource, intendedReceiver);
+
+        // If the probable token holder failed, we ask all other agents right away
+        if(mLockStates[resource].mHasDirectedRequest && mLockStates[resource].mState == lock_state::INTERESTED)
+        {
+            broadcastDirectedRequest(resource);
+        }
     }
 }
 
@@ -359,38 +1029,54 @@ bool SuzukiKasami::isTokenHolder(const std::string& resource, const AgentID& age
 
 void SuzukiKasami::agentFailed(const AgentID& agent)
 {
-    // Here,we have to deal with the failure for all resources, as we don't know in which he was involved
-    for(std::map<std::string, ResourceLockState>::const_iterator it = mLockStates.begin(); it != mLockStates.end(); it++)
+    // We have to deal with the failure for all resources the agent was involved in
+    std::vector<std::string> resources = getParticipations(agent);
+    for(std::vector<std::string>::const_iterator it = resources.begin(); it != resources.end(); ++it)
     {
-        handleIncomingFailure(it->first, agent);
+        if(mLockStates.count(*it) != 0)
+        {
+            handleIncomingFailure(*it, agent);
+        }
     }
+    removeParticipant(agent);
+    flushTokens();
 }
 
-void SuzukiKasami::extractInformation(const acl::ACLMessage& message, std::string& resource, int& sequence_number)
+void SuzukiKasami::extractInformation(const acl::ACLMessage& message, std::vector< std::pair<std::string, int> >& requests,
+        priority::Priority& priority)
 {
     // Split by newline
     std::vector<std::string> strs;
     std::string s = message.getContent();
     boost::split(strs, s, boost::is_any_of("\n"));
 
-    if(strs.size() != 2)
+    if(strs.size() < 2)
     {
         throw std::runtime_error("SuzukiKasami::extractInformation ACLMessage content malformed");
     }
+    // An odd number of lines means, that the priority is given
+    priority = priority::NORMAL;
+    if(strs.size() % 2 != 0)
+    {
+        priority = static_cast<priority::Priority>(boost::lexical_cast<int>(strs.back()));
+        strs.pop_back();
+    }
     // Save the extracted information in the references
-    resource = strs[0];
-    sequence_number = boost::lexical_cast<int>(strs[1]);
+    requests.clear();
+    for(unsigned int i = 0; i < strs.size(); i += 2)
+    {
+        requests.push_back(std::make_pair(strs[i], boost::lexical_cast<int>(strs[i + 1])));
+    }
 }
 
-void SuzukiKasami::extractInformation(const acl::ACLMessage& message, std::string& resource, SuzukiKasami::Token& token)
+void SuzukiKasami::extractInformation(const acl::ACLMessage& message, SuzukiKasami::TokenBundle& bundle)
 {
-    // Restore the token
+    // Restore the tokens
     // create and open an archive for input
     std::stringstream ss(message.getContent());
     boost::archive::text_iarchive ia(ss);
     // read state from archive
-    ia >> resource;
-    ia >> token;
+    ia >> bundle;
     // archive and stream closed when destructors are called
 }
 
@@ -398,40 +1084,156 @@ void SuzukiKasami::sendToken(const fipa::acl::AgentID& receiver, const std::stri
 {
     // We must unset holdingToken
     mLockStates[resource].mHoldingToken = false;
+    mLockStates[resource].mHoldingOver = false;
+    mLockStates[resource].mProbableHolder = mAgentDirectory.insert(receiver);
+    ++mLockStates[resource].mHandOffs;
+    addParticipant(resource, receiver);
 
-    using namespace fipa::acl;
-    ACLMessage tokenMessage = prepareMessage(ACLMessage::PROPAGATE, getProtocolName());
-    tokenMessage.addReceiver(receiver);
-    std::string conversationID = mLockStates[resource].mConversationID[receiver];
+    std::string conversationID = mLockStates[resource].getConversationID(mAgentDirectory.insert(receiver));
     if(conversationID.empty())
     {
         LOG_INFO_S << "'" << mSelf.getName() + "' send token to '" + receiver.getName() + "' -- though not requested";
         // continue in this conversation
-        conversationID = mLockStates[resource].mConversationID[mSelf];
+        conversationID = mLockStates[resource].getConversationID(mAgentDirectory.insert(mSelf));
     } else {
         LOG_INFO_S << "'" << mSelf.getName() + "' send token to '" + receiver.getName() + "' -- token has been requested";
     }
 
-    tokenMessage.setConversationID(conversationID);
+    // Add the token to the bundle for this receiver and conversation, it is sent by flushTokens
+    std::vector<PendingBundle>::iterator it = mPendingBundles.begin();
+    for(; it != mPendingBundles.end(); ++it)
+    {
+        if(it->mReceiver == receiver && it->mConversationID == conversationID)
+        {
+            break;
+        }
+    }
+    if(it == mPendingBundles.end())
+    {
+        it = mPendingBundles.insert(mPendingBundles.end(), PendingBundle());
+        it->mReceiver = receiver;
+        it->mConversationID = conversationID;
+    }
+    it->mBundle.mResources.push_back(resource);
+    it->mBundle.mTokens.push_back(createToken(mLockStates[resource]));
+}
+
+unsigned int SuzukiKasami::dequeue(ResourceLockState& lockState)
+{
+    // Find the first agent with the highest effective priority, which is the priority of the request plus one
+    // for each aging interval it is waiting
+    std::vector<unsigned int>::iterator best = lockState.mQueue.begin();
+    unsigned int bestPriority = 0;
+    for(std::vector<unsigned int>::iterator it = lockState.mQueue.begin(); it != lockState.mQueue.end(); ++it)
+    {
+        unsigned int effectivePriority = lockState.mPriority[*it];
+        if(mAgingInterval != 0)
+        {
+            effectivePriority += (lockState.mHandOffs - lockState.mQueuedSince[*it]) / mAgingInterval;
+        }
+        if(it == lockState.mQueue.begin() || effectivePriority > bestPriority)
+        {
+            best = it;
+            bestPriority = effectivePriority;
+        }
+    }
+    unsigned int index = *best;
+    lockState.mQueue.erase(best);
+    lockState.mQueued[index] = false;
+    return index;
+}
 
-    // Our response messages are in the format "BOOST_ARCHIVE(RESOURCE_IDENTIFIER, TOKEN)"
-    std::stringstream ss;
-    // save data to archive
-    // write class instance to archive
-    boost::archive::text_oarchive oa(ss);
-    oa << resource;
-    Token token = mLockStates[resource].mToken;
-    oa << token;
-    tokenMessage.setContent(ss.str());
-    tokenMessage.setLanguage(token.getTypeName());
+void SuzukiKasami::flushTokens()
+{
+    using namespace fipa::acl;
+    for(std::vector<PendingBundle>::const_iterator it = mPendingBundles.begin(); it != mPendingBundles.end(); ++it)
+    {
+        ACLMessage tokenMessage = prepareMessage(ACLMessage::PROPAGATE, getProtocolName());
+        tokenMessage.addReceiver(it->mReceiver);
+        tokenMessage.setConversationID(it->mConversationID);
+
+        // Our response messages are in the format "BOOST_ARCHIVE(TOKEN_BUNDLE)"
+        std::stringstream ss;
+        // save data to archive
+        // write class instance to archive
+        {
+            boost::archive::text_oarchive oa(ss);
+            oa << it->mBundle;
+        }
+        tokenMessage.setContent(ss.str());
+        tokenMessage.setLanguage(TokenBundle::getTypeName());
 
-    sendMessage(tokenMessage);
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' sends " << it->mBundle.mTokens.size() << " token(s) to '" << it->mReceiver.getName() << "'";
+        sendMessage(tokenMessage);
+    }
+    mPendingBundles.clear();
 }
 
 void SuzukiKasami::ResourceLockState::removeCommunicationPartner(const fipa::acl::AgentID& agent)
 {
-    mCommunicationPartners.erase(std::remove(mCommunicationPartners.begin(), mCommunicationPartners.end(), agent), mCommunicationPartners.end());
+    if(mCommunicationPartners)
+    {
+        // The partners might be shared with a group, so they are copied
+        boost::shared_ptr<AgentIDList> partners(new AgentIDList(*mCommunicationPartners));
+        partners->erase(std::remove(partners->begin(), partners->end(), agent), partners->end());
+        mCommunicationPartners = partners;
+    }
+}
+
+void SuzukiKasami::ResourceLockState::resize(unsigned int agents)
+{
+    if(mRequestNumber.size() < agents)
+    {
+        mRequestNumber.resize(agents, 0);
+        mLastRequestNumber.resize(agents, 0);
+        mQueued.resize(agents, false);
+        mPriority.resize(agents, priority::NORMAL);
+        mQueuedSince.resize(agents, 0);
+    }
 }
 
+void SuzukiKasami::ResourceLockState::enqueue(unsigned int agent)
+{
+    mQueue.push_back(agent);
+    mQueued[agent] = true;
+    mQueuedSince[agent] = mHandOffs;
+}
+
+SuzukiKasami::ColdState& SuzukiKasami::ResourceLockState::getCold()
+{
+    if(!mCold)
+    {
+        mCold.reset(new ColdState());
+    }
+    return *mCold;
+}
+
+void SuzukiKasami::ResourceLockState::setConversationID(unsigned int agent, const std::string& conversationID)
+{
+    for(std::vector< std::pair<unsigned int, std::string> >::iterator it = mConversationIDs.begin(); it != mConversationIDs.end(); ++it)
+    {
+        if(it->first == agent)
+        {
+            it->second = conversationID;
+            return;
+        }
+    }
+    mConversationIDs.push_back(std::make_pair(agent, conversationID));
+}
+
+const std::string& SuzukiKasami::ResourceLockState::getConversationID(unsigned int agent) const
+{
+    static const std::string none;
+    for(std::vector< std::pair<unsigned int, std::string> >::const_iterator cit = mConversationIDs.begin(); cit != mConversationIDs.end(); ++cit)
+    {
+        if(cit->first == agent)
+        {
+            return cit->second;
+        }
+    }
+    return none;
+}
+
+
 } // namespace distributed_locking
 } // namespace fipa
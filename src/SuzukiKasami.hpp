@@ -2,6 +2,11 @@
 #define DISTRIBUTED_LOCKING_SUZUKI_KASAMI_HPP
 
 #include <queue>
+#include <set>
+#include <vector>
+#include <boost/serialization/vector.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/dynamic_bitset.hpp>
 #include <fipa_acl/fipa_acl.h>
 #include <distributed_locking/DLM.hpp>
 #include <distributed_locking/AgentIDSerialization.hpp>
@@ -10,23 +15,72 @@ namespace fipa {
 namespace distributed_locking {
 /**
  * Implementation of the Suzuki Kasami algorithm. For more information, see http://en.wikipedia.org/wiki/Suzuki-Kasami_algorithm
+ *
+ * With a hold-over policy (see setHoldOverPolicy), an agent keeps the token after unlocking, as long as nobody else
+ * requested it, so that bursts of local critical sections do not each pay a token round trip.
+ *
+ * With directed requests (see setDirectedRequestTimeout), the token is requested from the probable token holder only.
+ * The other agents are asked, if the token did not arrive within the timeout.
+ *
+ * Tokens passed on to the same agent in the same conversation within one call (e.g. unlockResources) travel
+ * in a single message, see TokenBundle. Several tokens can be requested at once with lockResources.
+ *
+ * The token is passed on to the waiting agent with the highest priority class, in order of the requests within a class.
+ * With an aging interval (see setAgingInterval), a waiting request gains one priority class each time the token was
+ * passed on that many times.
  */
 class SuzukiKasami : public DLM
 {
     friend class ResourceLockState;
 public:
     /**
-     * The token used in this protocol.
+     * The token used in this protocol. Agents are referenced by their index in the agent table of the token,
+     * which only lists the agents of the current membership (see setMembership) that are relevant to the token.
      */
     struct Token
     {
         static std::string getTypeName() { return "suzuki_kasami::Token"; }
 
-        // LastRequestNumber for each of the agents
-        std::map<fipa::acl::AgentID, int> mLastRequestNumber;
+        // Membership epoch the token was compacted for, 0 if no membership is known
+        unsigned int mEpoch;
 
-         // Queue of agents waiting for the token
-        std::deque<fipa::acl::AgentID> mQueue;
+        // Number of times the token was passed on
+        unsigned int mHandOffs;
+
+        // Agents referenced by the token
+        std::vector<fipa::acl::AgentID> mAgents;
+
+        // LastRequestNumber for each of the agents, index-aligned with mAgents
+        std::vector<int> mLastRequestNumber;
+
+         // Queue of agents waiting for the token, as indices into mAgents
+        std::deque<unsigned int> mQueue;
+
+        // Priority of the queued requests and the number of hand-offs when they were queued, index-aligned with mQueue
+        std::vector<int> mQueuePriority;
+        std::vector<unsigned int> mQueueSince;
+
+        Token() : mEpoch(0), mHandOffs(0) {}
+
+        /**
+         * Gets the index of an agent in the agent table, the agent is added if it is not listed yet
+         */
+        unsigned int addAgent(const fipa::acl::AgentID& agent);
+
+        /**
+         * Sets the LastRequestNumber of an agent
+         */
+        void setLastRequestNumber(const fipa::acl::AgentID& agent, int requestNumber);
+
+        /**
+         * Gets the LastRequestNumber of an agent, 0 if the agent is not listed
+         */
+        int getLastRequestNumber(const fipa::acl::AgentID& agent) const;
+
+        /**
+         * Appends an agent to the queue
+         */
+        void enqueue(const fipa::acl::AgentID& agent, priority::Priority priority = priority::NORMAL, unsigned int since = 0);
 
         /**
          * Boost serialization method
@@ -34,9 +88,110 @@ public:
         template<class Archive>
         void serialize(Archive& ar, unsigned int version)
         {
+            ar & mEpoch;
+            ar & mHandOffs;
+            ar & mAgents;
             ar & mLastRequestNumber;
             ar & mQueue;
+            ar & mQueuePriority;
+            ar & mQueueSince;
+        }
+    };
+
+    /**
+     * Several tokens sent to the same agent in a single message. The agents referenced by the tokens are listed only
+     * once in a shared agent table.
+     */
+    struct TokenBundle
+    {
+        static std::string getTypeName() { return "suzuki_kasami::TokenBundle"; }
+
+        // The resources, index-aligned with mTokens
+        std::vector<std::string> mResources;
+        std::vector<Token> mTokens;
+
+        /**
+         * Boost serialization method, writes the shared agent table and the tokens referring to it
+         */
+        template<class Archive>
+        void save(Archive& ar, unsigned int version) const
+        {
+            std::vector<fipa::acl::AgentID> agents;
+            std::map<fipa::acl::AgentID, unsigned int> indices;
+            std::vector< std::vector<unsigned int> > tables(mTokens.size());
+            for(unsigned int t = 0; t < mTokens.size(); ++t)
+            {
+                const std::vector<fipa::acl::AgentID>& tokenAgents = mTokens[t].mAgents;
+                for(unsigned int i = 0; i < tokenAgents.size(); ++i)
+                {
+                    std::map<fipa::acl::AgentID, unsigned int>::const_iterator cit = indices.find(tokenAgents[i]);
+                    if(cit == indices.end())
+                    {
+                        cit = indices.insert(std::make_pair(tokenAgents[i], agents.size())).first;
+                        agents.push_back(tokenAgents[i]);
+                    }
+                    tables[t].push_back(cit->second);
+                }
+            }
+
+            ar << agents;
+            ar << mResources;
+            for(unsigned int t = 0; t < mTokens.size(); ++t)
+            {
+                ar << mTokens[t].mEpoch;
+                ar << mTokens[t].mHandOffs;
+                ar << tables[t];
+                ar << mTokens[t].mLastRequestNumber;
+                ar << mTokens[t].mQueue;
+                ar << mTokens[t].mQueuePriority;
+                ar << mTokens[t].mQueueSince;
+            }
+        }
+
+        /**
+         * Boost serialization method, restores the agent tables of the tokens
+         */
+        template<class Archive>
+        void load(Archive& ar, unsigned int version)
+        {
+            std::vector<fipa::acl::AgentID> agents;
+            ar >> agents;
+            ar >> mResources;
+            mTokens.resize(mResources.size());
+            for(unsigned int t = 0; t < mTokens.size(); ++t)
+            {
+                std::vector<unsigned int> table;
+                ar >> mTokens[t].mEpoch;
+                ar >> mTokens[t].mHandOffs;
+                ar >> table;
+                ar >> mTokens[t].mLastRequestNumber;
+                ar >> mTokens[t].mQueue;
+                ar >> mTokens[t].mQueuePriority;
+                ar >> mTokens[t].mQueueSince;
+                mTokens[t].mAgents.clear();
+                for(unsigned int i = 0; i < table.size(); ++i)
+                {
+                    mTokens[t].mAgents.push_back(agents.at(table[i]));
+                }
+            }
         }
+
+        BOOST_SERIALIZATION_SPLIT_MEMBER()
+    };
+
+    /**
+     * Statistics about the hold-over of the token for a resource
+     */
+    struct HoldOverStatistics
+    {
+        // Number of times the lock was obtained again with the token held over
+        unsigned int mReentries;
+        // Number of hold-overs ended by a request of another agent
+        unsigned int mPreemptions;
+        // Number of hold-overs ended since the budget was used up
+        unsigned int mExpirations;
+
+        HoldOverStatistics() : mReentries(0), mPreemptions(0), mExpirations(0) {}
     };
 
     /**
@@ -44,14 +199,87 @@ public:
      */
     SuzukiKasami(const fipa::acl::AgentID& self, const std::vector<std::string>& resources);
 
+    /**
+     * Keep the token after unlocking the resource, as long as no other agent requested it, for at most maxReentries
+     * local critical sections and maxHoldTimeInS seconds (0 means no time limit). maxReentries = 0 disables the hold-over,
+     * which is the default.
+     */
+    void setHoldOverPolicy(const std::string& resource, unsigned int maxReentries, double maxHoldTimeInS = 0);
+
+    /**
+     * Get the statistics about the hold-over of the token for a resource
+     */
+    HoldOverStatistics getHoldOverStatistics(const std::string& resource) const;
+
+    /**
+     * Sets the agents currently taking part in locking a resource. Requests of all other agents are dropped, and
+     * they are no longer listed in the token. Memberships with an epoch not greater than the current one are ignored.
+     */
+    void setMembership(const std::string& resource, unsigned int epoch, const fipa::acl::AgentIDList& agents);
+
+    /**
+     * Get the current membership epoch of a resource, 0 if no membership was set
+     */
+    unsigned int getMembershipEpoch(const std::string& resource) const;
+
+    /**
+     * Request the token from the probable token holder first, and from all other agents only if the token did not
+     * arrive within the given timeout in seconds. 0 disables directed requests, which is the default.
+     */
+    void setDirectedRequestTimeout(double timeInS);
+
+    /**
+     * Get the timeout in seconds, after which a directed request is sent to all agents
+     */
+    double getDirectedRequestTimeout() const { return mDirectedRequestTimeoutInS; }
+
+    /**
+     * Get the agent probably holding the token of a resource. This is the agent the token was last sent to, or
+     * the resource owner if unknown.
+     */
+    fipa::acl::AgentID getProbableTokenHolder(const std::string& resource) const;
+
+    /**
+     * Sets the number of hand-offs of the token, after which a waiting request gains one priority class.
+     * 0 (default) means, that requests of a higher priority class are always served first.
+     */
+    void setAgingInterval(unsigned int handOffs) { mAgingInterval = handOffs; }
+
+    /**
+     * Gets the number of hand-offs of the token, after which a waiting request gains one priority class
+     */
+    unsigned int getAgingInterval() const { return mAgingInterval; }
+
+    using DLM::lock;
+
     /**
      * Tries to lock a resource. Subsequently, isLocked() must be called to check the status.
+     * \throws std::invalid_argument if the resource is only a part of a resource of its owner, e.g. "arm/joint3" of
+     * "arm", as there is a token for whole resources only
      */
     virtual void lock(const std::string& resource, const fipa::acl::AgentIDList& agents);
     /**
      * Unlocks a resource, that must have been locked before
      */
     virtual void unlock(const std::string& resource);
+    /**
+     * Tries to lock several resources, the missing tokens are requested in a single message
+     */
+    void lockResources(const std::vector<std::string>& resources, const fipa::acl::AgentIDList& agents);
+    /**
+     * Tries to lock several resources with the given priority class
+     */
+    void lockResources(const std::vector<std::string>& resources, const fipa::acl::AgentIDList& agents, priority::Priority priority);
+    /**
+     * Unlocks several resources, tokens passed on to the same agent are sent in a single message
+     */
+    virtual void unlockResources(const std::vector<std::string>& resources);
+    /**
+     * Passes the token of a resource on to the given agent, e.g. back to the owner, instead of the next waiting agent.
+     * A held lock is released. The receiver serves the waiting agents, which are queued in the token.
+     * \return false if we do not hold the token
+     */
+    bool returnToken(const std::string& resource, const fipa::acl::AgentID& receiver);
     /**
      * Gets the lock state for a resource.
      */
@@ -66,43 +294,169 @@ public:
      * Subclasses can and should react according to the algorithm.
      */
     virtual void agentFailed(const fipa::acl::AgentID& agentName);
+    /**
+     * Handles the failure to deliver a request or token of the given conversation
+     */
+    virtual void onDeliveryFailure(const std::string& conversationID, const fipa::acl::AgentIDList& failedReceivers);
+    /**
+     * Forwards tokens, whose hold-over time expired, and sends directed requests to all agents after the timeout
+     */
+    virtual void trigger();
 
 protected:
-    
+    /**
+     * Budget for keeping the token after unlocking
+     */
+    struct HoldOverPolicy
+    {
+        unsigned int mMaxReentries;
+        double mMaxHoldTimeInS;
+
+        HoldOverPolicy() : mMaxReentries(0), mMaxHoldTimeInS(0) {}
+    };
+
+
+    // Marks unknown agents in directory indices
+    static const unsigned int NO_AGENT = static_cast<unsigned int>(-1);
+
+    /**
+     * Rarely used parts of a ResourceLockState, which are allocated on first use
+     */
+    struct ColdState
+    {
+        // Since when the token is held over, and the number of local critical sections during the hold-over
+        base::Time mHoldOverStart;
+        unsigned int mReentries;
+        // The current membership epoch, and the members if the epoch is not 0
+        unsigned int mEpoch;
+        std::set<fipa::acl::AgentID> mMembers;
+        // The pending directed request, which has not been sent to all communication partners yet
+        fipa::acl::ACLMessage mDirectedRequest;
+        base::Time mDirectedRequestTime;
+
+        ColdState() : mReentries(0), mEpoch(0) {}
+    };
+
     /**
      * Nested class representing an inner state for a certain resource.
-     * It is mapped to its resource name.
+     * It is mapped to its resource name. The fields needed for every request come first, rarely used ones are kept
+     * out of line in a ColdState. States are not copied once they are in use.
      */
     struct ResourceLockState
     {
-        // The token.
-        Token mToken;
-        // Whether the token is currently held
-        bool mHoldingToken;
-        // Everyone to inform when locking
-        fipa::acl::AgentIDList mCommunicationPartners;
-        // Last known request number for each of the agents
-        std::map<fipa::acl::AgentID, int> mRequestNumber;
         // The lock state, initially not interested (=0)
         lock_state::LockState mState;
-        // The requestor mapped to the conversationID, which is relevant if we're interested and get a failure message back
-        std::map<fipa::acl::AgentID, std::string> mConversationID;
+        // Whether the token is currently held, and whether it is held over after unlocking
+        bool mHoldingToken;
+        bool mHoldingOver;
+        // Whether a directed request is pending (see ColdState::mDirectedRequest)
+        bool mHasDirectedRequest;
+        // Whether the state is listed in mTimedStates
+        bool mTimed;
+        // Number of times the token was passed on, as far as known to us
+        unsigned int mHandOffs;
+        // Directory index of the agent the token was last sent to, NO_AGENT if unknown
+        unsigned int mProbableHolder;
+        // Everyone to inform when locking, shared with the other resources of the request and the group it was
+        // requested for
+        AgentGroup mCommunicationPartners;
+        // Last known request number for each of the agents (RN), index-aligned with mAgentDirectory
+        std::vector<int> mRequestNumber;
+        // The token, only valid while it is held: the last executed request number for each of the agents (LN),
+        // index-aligned with mAgentDirectory, and the queue of agents waiting for the token with a bit per queued agent
+        std::vector<int> mLastRequestNumber;
+        std::vector<unsigned int> mQueue;
+        boost::dynamic_bitset<> mQueued;
+        // Priority of the last known request of each of the agents, and the number of hand-offs when the request was
+        // queued, index-aligned with mAgentDirectory
+        std::vector<int> mPriority;
+        std::vector<unsigned int> mQueuedSince;
+        // The conversation of the last request of each requestor, as pairs of directory index and conversation ID.
+        // Relevant if we're interested and get a failure message back. Only few agents request a resource, so a
+        // flat list is used.
+        std::vector< std::pair<unsigned int, std::string> > mConversationIDs;
+        boost::shared_ptr<ColdState> mCold;
+
+        ResourceLockState() : mState(lock_state::NOT_INTERESTED), mHoldingToken(false), mHoldingOver(false)
+            , mHasDirectedRequest(false), mTimed(false), mHandOffs(0), mProbableHolder(NO_AGENT)
+        {}
 
         void removeCommunicationPartner(const fipa::acl::AgentID& agent);
+        /**
+         * Grows the per-agent vectors to the given number of agents
+         */
+        void resize(unsigned int agents);
+        /**
+         * Appends an agent to the queue of the token
+         */
+        void enqueue(unsigned int agent);
+        /**
+         * Gets the rarely used parts, they are created if necessary
+         */
+        ColdState& getCold();
+        /**
+         * Gets the membership epoch, 0 if there is none
+         */
+        unsigned int getEpoch() const { return mCold ? mCold->mEpoch : 0; }
+        /**
+         * Sets the conversation of the last request of an agent
+         */
+        void setConversationID(unsigned int agent, const std::string& conversationID);
+        /**
+         * Gets the conversation of the last request of an agent, empty if there is none
+         */
+        const std::string& getConversationID(unsigned int agent) const;
     };
-    
+
     // All resources mapped to the their ResourceLockStates
     std::map<std::string, ResourceLockState> mLockStates;
+    // All resources mapped to their hold-over policies and statistics
+    std::map<std::string, HoldOverPolicy> mHoldOverPolicies;
+    std::map<std::string, HoldOverStatistics> mHoldOverStatistics;
+    double mDirectedRequestTimeoutInS;
+    unsigned int mAgingInterval;
+    // Scratch buffer for the scan for outstanding requests, kept to avoid allocations
+    std::vector<unsigned char> mOutstanding;
+    // The states with a pending directed request or a held over token, which trigger checks for timeouts. The
+    // states are never erased, so the iterators stay valid.
+    std::vector< std::map<std::string, ResourceLockState>::iterator > mTimedStates;
+    // The timed states checked by the current trigger, kept to avoid allocations
+    std::vector< std::map<std::string, ResourceLockState>::iterator > mCheckedStates;
+    // The resources requested in each conversation known to the lock states, for failure handling. A request can
+    // cover several resources.
+    std::map<std::string, std::vector<std::string> > mConversationResources;
 
     /**
-     * Handles an incoming request for the token
+     * Tokens to be sent at the end of the current call, bundled per receiver and conversation
+     */
+    struct PendingBundle
+    {
+        fipa::acl::AgentID mReceiver;
+        std::string mConversationID;
+        TokenBundle mBundle;
+    };
+    std::vector<PendingBundle> mPendingBundles;
+
+    /**
+     * Handles an incoming request for one or more tokens
      */
     void handleIncomingTokenRequest(const fipa::acl::ACLMessage& message);
 
     /**
-     * Handles an incoming token
+     * Handles a request for the token of a single resource
+     */
+    void handleIncomingTokenRequest(const fipa::acl::ACLMessage& message, const std::string& resource, int sequenceNumber,
+            priority::Priority priority);
+
+    /**
+     * Handles an incoming message carrying one or more tokens
+     */
+    void handleIncomingToken(const fipa::acl::ACLMessage& message);
+
+    /**
+     * Handles an incoming token for a single resource
      */
-    virtual void handleIncomingToken(const fipa::acl::ACLMessage& message);
+    virtual void handleIncomingToken(const fipa::acl::ACLMessage& message, const std::string& resource, const Token& token);
 
     /**
      * Handles an incoming failure
@@ -115,25 +469,69 @@ protected:
     void handleIncomingFailure(const std::string& resource, const fipa::acl::AgentID& intendedReceiver);
 
     /**
-     * Extracts the information from the content and saves it in the passed references
+     * Extracts the requested resources and the sequence numbers from the content
      */
-    void extractInformation(const fipa::acl::ACLMessage& message, std::string& resource, int& sequence_number);
+    void extractInformation(const fipa::acl::ACLMessage& message, std::vector< std::pair<std::string, int> >& requests,
+            priority::Priority& priority);
 
     /**
      * Extracts the information from the content and saves it in the passed references
      */
-    void extractInformation(const fipa::acl::ACLMessage& message, std::string& resource, Token& token);
+    void extractInformation(const fipa::acl::ACLMessage& message, TokenBundle& bundle);
 
     /**
      * Send the token to the receiver. No checks (token held, lock not held) are made!
+     * The token is sent by flushTokens().
      */
     virtual void sendToken(const fipa::acl::AgentID& receiver, const std::string& resource);
 
+    /**
+     * Removes the waiting agent with the highest effective priority from the queue and returns its index
+     */
+    unsigned int dequeue(ResourceLockState& lockState);
+
+    /**
+     * Sends all tokens passed on during the current call, one message per receiver and conversation
+     */
+    void flushTokens();
+
+    /**
+     * Tries to lock a resource with the given priority class
+     */
+    virtual void requestLock(const std::string& resource, const AgentGroup& agents, priority::Priority priority);
+
+    /**
+     * Tries to lock several resources with the given priority class, sharing the agents as communication partners
+     */
+    virtual void lockResources(const std::vector<std::string>& resources, const AgentGroup& agents, priority::Priority priority);
+
     /**
      * Request the token
      */
     void requestToken(const std::string& resource, const fipa::acl::AgentIDList& agents);
 
+    /**
+     * Request the tokens of several resources in a single message
+     */
+    void requestTokens(const std::vector<std::string>& resources, const AgentGroup& agents,
+            priority::Priority priority);
+
+    /**
+     * Sends a pending directed request to all remaining communication partners
+     */
+    void broadcastDirectedRequest(const std::string& resource);
+
+    /**
+     * Lists the state of a resource in mTimedStates, so that trigger checks its timeouts
+     */
+    void addTimedState(const std::string& resource);
+
+    /**
+     * Sets the conversation of the last request of an agent for a resource, and keeps mConversationResources up to
+     * date
+     */
+    void setConversationID(const std::string& resource, unsigned int agent, const std::string& conversationID);
+
     /**
      * Update the token based on an incoming request
      */
@@ -143,13 +541,57 @@ protected:
      * Forwards the token to the next person in the queue.
      */
     virtual void forwardToken(const std::string& resource);
+    /**
+     * Adds the agents, whose requests are known to us but not served by the token yet, to the queue of the token
+     */
+    void enqueueOutstandingRequests(ResourceLockState& lockState);
     /**
      * Will always return false, as the original SuzukiKasami algorithm cannot keep track of the token owners.
      */
     virtual bool isTokenHolder(const std::string& resource, const fipa::acl::AgentID& agent);
 
+    /**
+     * Whether the agent requested the resource, and was not served yet. Does not create any state.
+     */
+    bool hasOutstandingRequest(const std::string& resource, const fipa::acl::AgentID& agent) const;
+
+    /**
+     * Removes the record, that an agent takes part in locking a resource, unless it still does: it has an
+     * outstanding request or is queued, probably holds the token, owns the resource or is a communication partner
+     * of our request
+     */
+    void dropParticipation(const std::string& resource, const fipa::acl::AgentID& agent);
 
-    bool hasOutstandingRequest(const std::string& resource, const fipa::acl::AgentID& agent);
+    /**
+     * Forgets the requests of an agent, e.g. if it failed
+     */
+    void removeRequests(const std::string& resource, const fipa::acl::AgentID& agent);
+
+    /**
+     * Gets the index of an agent in mAgentDirectory, and makes sure the lock state has an entry for it
+     */
+    unsigned int getAgentIndex(ResourceLockState& lockState, const fipa::acl::AgentID& agent);
+
+    /**
+     * Takes over a received token
+     */
+    void restoreToken(const std::string& resource, const Token& token);
+
+    /**
+     * Creates the token to be sent, compacted to the current membership
+     */
+    Token createToken(const ResourceLockState& lockState) const;
+
+    /**
+     * Drops the requests of all agents, which are not members of the current membership
+     */
+    void pruneNonMembers(const std::string& resource);
+
+    /**
+     * Starts or continues the hold-over of the token after unlocking. Returns false, if the token has to be forwarded,
+     * since the hold-over is disabled, preempted or its budget is used up.
+     */
+    bool holdOverToken(const std::string& resource);
     
 };
 } // namespace distributed_locking
@@ -1,7 +1,10 @@
 #include "SuzukiKasamiExtended.hpp"
 
 #include <string>
+#include <stdexcept>
 #include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string.hpp>
+#include <base/Logging.hpp>
 
 using namespace fipa::acl;
 
@@ -10,17 +13,27 @@ namespace distributed_locking {
 
 SuzukiKasamiExtended::SuzukiKasamiExtended(const fipa::acl::AgentID& self, const std::vector< std::string >& resources)
     : SuzukiKasami(self, resources)
+    , mDirectForwarding(false)
 {
     setProtocol(protocol::SUZUKI_KASAMI_EXTENDED);
 }
 
 void SuzukiKasamiExtended::forwardToken(const std::string& resource)
 {
-    if(mOwnedResources[resource] != mSelf)
+    if(getOwner(resource) != mSelf)
     {
+        if(mDirectForwarding)
+        {
+            // Pass the token on to the next waiting agent, if any
+            SuzukiKasami::forwardToken(resource);
+            if(!mLockStates[resource].mHoldingToken)
+            {
+                return;
+            }
+        }
         // If this instance is not the resource owner, forward the token to the
         // resource owner
-        sendToken(mOwnedResources[resource], resource);
+        sendToken(getOwner(resource), resource);
     }
     else
     {
@@ -38,43 +51,126 @@ void SuzukiKasamiExtended::sendToken(const acl::AgentID& receiver, const std::st
 {
     fipa::distributed_locking::SuzukiKasami::sendToken(receiver, resource);
     // Additional actions only need to be taken, if we're the resource owner
-    if(mOwnedResources[resource] == mSelf)
+    if(getOwner(resource) == mSelf)
     {
         // After sending the token, we must update mTokenHolders
         mTokenHolders[resource] = receiver.getName();
         // We must start sending PROBEs to the token owner
         startRequestingProbes(receiver.getName(), resource);
+    } else if(receiver != getOwner(resource))
+    {
+        // The token bypasses the owner, so he has to be told
+        sendHolderChange(receiver, resource);
+    }
+}
+
+void SuzukiKasamiExtended::sendHolderChange(const acl::AgentID& receiver, const std::string& resource)
+{
+    ACLMessage notice = prepareMessage(ACLMessage::INFORM_REF, getProtocolName());
+    notice.addReceiver(getOwner(resource));
+    // Continue the conversation, in which the token was sent
+    std::string conversationID = mLockStates[resource].getConversationID(mAgentDirectory.insert(receiver));
+    if(conversationID.empty())
+    {
+        conversationID = mLockStates[resource].getConversationID(mAgentDirectory.insert(mSelf));
+    }
+    notice.setConversationID(conversationID);
+    // Our notices are in the format "RESOURCE_IDENTIFIER\nNEW_HOLDER\nHAND_OFFS", the number of hand-offs
+    // orders notices, which are sent by different agents
+    notice.setContent(resource + "\n" + receiver.getName() + "\n" + boost::lexical_cast<std::string>(mLockStates[resource].mHandOffs));
+    sendMessage(notice);
+}
+
+bool SuzukiKasamiExtended::onIncomingMessage(const acl::ACLMessage& message)
+{
+    if(SuzukiKasami::onIncomingMessage(message))
+    {
+        return true;
+    }
+
+    if(message.getProtocol() == getProtocolName() && message.getPerformativeAsEnum() == ACLMessage::INFORM_REF)
+    {
+        handleIncomingHolderChange(message);
+        return true;
     }
+    return false;
 }
 
-void SuzukiKasamiExtended::handleIncomingToken(const acl::ACLMessage& message)
+void SuzukiKasamiExtended::handleIncomingHolderChange(const acl::ACLMessage& message)
 {
-    // We need to extract the info twice now, this is kinda bad.
-    std::string resource;
-    Token token; // Just a dummy
-    // This HAS to be done in two steps, as resource is not known before extractInformation returns!
-    extractInformation(message, resource, token);
+    std::vector<std::string> strs;
+    std::string content = message.getContent();
+    boost::split(strs, content, boost::is_any_of("\n"));
+    if(strs.size() != 3)
+    {
+        throw std::runtime_error("SuzukiKasamiExtended::handleIncomingHolderChange ACLMessage content malformed: " + content);
+    }
+    const std::string& resource = strs[0];
+    AgentID holder(strs[1]);
+    unsigned int handOffs = boost::lexical_cast<unsigned int>(strs[2]);
+
+    ResourceLockState& lockState = mLockStates[resource];
+    // Notices from different agents can overtake each other and the token
+    if(getOwner(resource) != mSelf || lockState.mHoldingToken || handOffs <= lockState.mHandOffs)
+    {
+        LOG_DEBUG_S << "'" << mSelf.getName() << "' ignores outdated holder change for resource '" << resource << "' to '" << holder.getName() << "'";
+        return;
+    }
+    lockState.mHandOffs = handOffs;
+
+    // Probe the new token holder instead of the previous one
+    AgentID previousHolder = mTokenHolders[resource];
+    stopRequestingProbes(previousHolder, resource);
+    mTokenHolders[resource] = holder;
+    mLockStates[resource].mProbableHolder = mAgentDirectory.insert(holder);
+    addParticipant(resource, holder);
+    dropParticipation(resource, previousHolder);
+    startRequestingProbes(holder, resource);
+}
 
+void SuzukiKasamiExtended::handleIncomingToken(const acl::ACLMessage& message, const std::string& resource, const Token& token)
+{
     // Before we could possibly forward the token again, we must (if we're the owner update mTokenHolders and)
     // stop sending PROBEs
-    if(mOwnedResources[resource] == mSelf)
+    if(getOwner(resource) == mSelf)
     {
+        // We must stop sending PROBEs to the former token owner. The token can overtake the notice about it.
+        stopRequestingProbes(message.getSender().getName(), resource);
+        if(mTokenHolders[resource] != message.getSender() && mTokenHolders[resource] != mSelf)
+        {
+            stopRequestingProbes(mTokenHolders[resource], resource);
+        }
         // We own the token again.
         mTokenHolders[resource] = mSelf;
+    } else {
+        // We must stop sending the PROBEs to the resource owner, which we started with our request. With direct
+        // forwarding, the token comes from another agent.
+        stopRequestingProbes(getOwner(resource), resource);
     }
-    // We must stop sending PROBEs to the former token owner
-    stopRequestingProbes(message.getSender().getName(), resource);
 
-    fipa::distributed_locking::SuzukiKasami::handleIncomingToken(message);
+    fipa::distributed_locking::SuzukiKasami::handleIncomingToken(message, resource, token);
 }
 
-void SuzukiKasamiExtended::lock(const std::string& resource, const AgentIDList& agents)
+void SuzukiKasamiExtended::lockResources(const std::vector<std::string>& resources, const AgentGroup& agents,
+        priority::Priority priority)
 {
-    fipa::distributed_locking::SuzukiKasami::lock(resource, agents);
-    if(mOwnedResources[resource] != mSelf)
+    // Resources requested already are probed already
+    std::vector<std::string> requested;
+    for(std::vector<std::string>::const_iterator it = resources.begin(); it != resources.end(); ++it)
+    {
+        if(getLockState(*it) == lock_state::NOT_INTERESTED)
+        {
+            requested.push_back(*it);
+        }
+    }
+    fipa::distributed_locking::SuzukiKasami::lockResources(resources, agents, priority);
+    for(std::vector<std::string>::const_iterator it = requested.begin(); it != requested.end(); ++it)
     {
-        // We start sending PROBEs to the resource owner
-        startRequestingProbes(mOwnedResources[resource], resource);
+        if(getOwner(*it) != mSelf && getLockState(*it) == lock_state::INTERESTED)
+        {
+            // We start sending PROBEs to the resource owner, until the token arrives
+            startRequestingProbes(getOwner(*it), *it);
+        }
     }
 }
 
@@ -10,6 +10,10 @@ namespace distributed_locking {
  * Extension of the Suzuki Kasami algorithm. PROBE->SUCCESS messages have been added, to check if agents are alive.
  * Also, the token is always forwarded via the resource owner, which makes it possible for him to keep track of the
  * token Owner and realize its failure.
+ *
+ * With direct forwarding (see setDirectForwarding), the token is passed on to the next waiting agent directly, and the
+ * resource owner gets a holder-change notice (INFORM_REF) instead. Only if nobody is waiting, the token is returned to
+ * the owner.
  */
 class SuzukiKasamiExtended : public SuzukiKasami
 {
@@ -18,6 +22,21 @@ public:
      * Constructor
      */
     SuzukiKasamiExtended(const fipa::acl::AgentID& self, const std::vector<std::string>& resources);
+
+    /**
+     * Forward the token to the next waiting agent directly, instead of via the resource owner. Disabled by default.
+     */
+    void setDirectForwarding(bool directForwarding) { mDirectForwarding = directForwarding; }
+
+    /**
+     * Whether the token is forwarded to the next waiting agent directly
+     */
+    bool isDirectForwarding() const { return mDirectForwarding; }
+
+    /**
+     * Handles holder-change notices in addition to the messages of the base protocol
+     */
+    virtual bool onIncomingMessage(const fipa::acl::ACLMessage& message);
     
     /**
      * Forwards the token to the next person in the queue, via the resource owner.
@@ -33,18 +52,31 @@ public:
      */
     virtual void sendToken(const fipa::acl::AgentID& receiver, const std::string& resource);
     /**
-     * Handles an incoming response
+     * Handles an incoming token
      */
-    virtual void handleIncomingToken(const fipa::acl::ACLMessage& message);
+    virtual void handleIncomingToken(const fipa::acl::ACLMessage& message, const std::string& resource, const Token& token);
+    using SuzukiKasami::lockResources;
     /**
-     * Tries to lock a resource. Subsequently, isLocked() must be called to check the status.
+     * Tries to lock several resources. Subsequently, isLocked() must be called to check the status.
      */
-    virtual void lock(const std::string& resource, const fipa::acl::AgentIDList& agents);
+    virtual void lockResources(const std::vector<std::string>& resources, const AgentGroup& agents,
+            priority::Priority priority);
     
 private:
     // The (logical) token holders of the owned resources. Maps resource->agent.
     // Will be equivalent to mLockHolders MOST OF THE TIME.
-    ResourceAgentMap mTokenHolders;
+    std::map<std::string, fipa::acl::AgentID> mTokenHolders;
+    bool mDirectForwarding;
+
+    /**
+     * Informs the resource owner, that the token was passed on to the receiver
+     */
+    void sendHolderChange(const fipa::acl::AgentID& receiver, const std::string& resource);
+
+    /**
+     * Handles the notice, that the token was passed on without us (resource owner only)
+     */
+    void handleIncomingHolderChange(const fipa::acl::ACLMessage& message);
 
 };
 } // namespace distributed_locking
@@ -0,0 +1,424 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/assign/list_of.hpp>
+#include <boost/foreach.hpp>
+
+#include <distributed_locking/AdaptiveDLM.hpp>
+
+#include <algorithm>
+#include <iostream>
+
+#include "TestHelper.hpp"
+
+using namespace fipa;
+using namespace fipa::distributed_locking;
+using namespace fipa::acl;
+
+BOOST_AUTO_TEST_SUITE(adaptive_dlm)
+
+/**
+ * Delivers the outgoing messages of one agent only
+ */
+void deliverMessages(const DLM::Ptr& sender, const std::list<DLM::Ptr>& dlms)
+{
+    while(sender->hasOutgoingMessages())
+    {
+        ACLMessage message = sender->popNextOutgoingMessage();
+        AgentIDList receivers = message.getAllReceivers();
+        for(std::list<DLM::Ptr>::const_iterator it = dlms.begin(); it != dlms.end(); ++it)
+        {
+            if(std::find(receivers.begin(), receivers.end(), (*it)->getSelf()) != receivers.end())
+            {
+                (*it)->onIncomingMessage(message);
+            }
+        }
+    }
+}
+
+/**
+ * A resource locked repeatedly by the same agent is switched to Suzuki Kasami, once it is idle.
+ */
+BOOST_AUTO_TEST_CASE(switch_to_token)
+{
+    BOOST_TEST_MESSAGE("adaptive_dlm/switch_to_token");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    boost::shared_ptr<AdaptiveDLM> ad1(new AdaptiveDLM(a1, rscs));
+    boost::shared_ptr<AdaptiveDLM> ad2(new AdaptiveDLM(a2, std::vector<std::string>()));
+    boost::shared_ptr<AdaptiveDLM> ad3(new AdaptiveDLM(a3, std::vector<std::string>()));
+    ad1->setDecisionWindow(4);
+    DLM::Ptr dlm1 = ad1, dlm2 = ad2, dlm3 = ad3;
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3);
+
+    dlm2->discover(rsc1, boost::assign::list_of(a1)(a3));
+    dlm3->discover(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm2->hasKnownOwner(rsc1) && dlm3->hasKnownOwner(rsc1));
+
+    for(int i = 0; i < 4; ++i)
+    {
+        BOOST_CHECK(ad2->getResourceProtocol(rsc1) == protocol::RICART_AGRAWALA);
+        dlm2->lock(rsc1, boost::assign::list_of(a1)(a3));
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+        BOOST_REQUIRE(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+        dlm2->unlock(rsc1);
+        forwardAllMessages(dlms);
+    }
+
+    // The owner proposed the switch after the last release
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(ad1->getResourceProtocol(rsc1) == protocol::SUZUKI_KASAMI);
+    BOOST_CHECK(ad2->getResourceProtocol(rsc1) == protocol::SUZUKI_KASAMI);
+    BOOST_CHECK(ad3->getResourceProtocol(rsc1) == protocol::SUZUKI_KASAMI);
+
+    // The resource is still mutually exclusive
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3));
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED || dlm3->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK(dlm2->getLockState(rsc1) != lock_state::LOCKED || dlm3->getLockState(rsc1) != lock_state::LOCKED);
+
+    DLM::Ptr first = dlm2->getLockState(rsc1) == lock_state::LOCKED ? dlm2 : dlm3;
+    DLM::Ptr second = first == dlm2 ? dlm3 : dlm2;
+    first->unlock(rsc1);
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(first->getLockState(rsc1) == lock_state::NOT_INTERESTED);
+    BOOST_CHECK(second->getLockState(rsc1) == lock_state::LOCKED);
+    second->unlock(rsc1);
+}
+
+/**
+ * A switch is rejected by an agent using the resource, and retried once the resource is idle again.
+ */
+BOOST_AUTO_TEST_CASE(switch_waits_for_idle_resource)
+{
+    BOOST_TEST_MESSAGE("adaptive_dlm/switch_waits_for_idle_resource");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    boost::shared_ptr<AdaptiveDLM> ad1(new AdaptiveDLM(a1, rscs));
+    boost::shared_ptr<AdaptiveDLM> ad2(new AdaptiveDLM(a2, std::vector<std::string>()));
+    boost::shared_ptr<AdaptiveDLM> ad3(new AdaptiveDLM(a3, std::vector<std::string>()));
+    ad1->setDecisionWindow(2);
+    DLM::Ptr dlm1 = ad1, dlm2 = ad2, dlm3 = ad3;
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3);
+
+    dlm2->discover(rsc1, boost::assign::list_of(a1)(a3));
+    dlm3->discover(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+
+    // a2 locks twice, so Suzuki Kasami is selected. a3 waits for the resource meanwhile.
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    dlm2->unlock(rsc1);
+    forwardAllMessages(dlms);
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::INTERESTED);
+
+    // a3 obtains the lock and rejects the switch the owner proposes
+    dlm2->unlock(rsc1);
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK(ad1->getResourceProtocol(rsc1) == protocol::RICART_AGRAWALA);
+    BOOST_CHECK(ad2->getResourceProtocol(rsc1) == protocol::RICART_AGRAWALA);
+
+    // The switch is retried, once a3 released the resource
+    dlm3->unlock(rsc1);
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(ad1->getResourceProtocol(rsc1) == protocol::SUZUKI_KASAMI);
+    BOOST_CHECK(ad2->getResourceProtocol(rsc1) == protocol::SUZUKI_KASAMI);
+    BOOST_CHECK(ad3->getResourceProtocol(rsc1) == protocol::SUZUKI_KASAMI);
+
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3));
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+}
+
+/**
+ * An agent discovering a resource after a switch learns the protocol from the owner, and a request with an outdated
+ * protocol is refused by the owner.
+ */
+BOOST_AUTO_TEST_CASE(late_agents)
+{
+    BOOST_TEST_MESSAGE("adaptive_dlm/late_agents");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3"), a4 ("agent4");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    boost::shared_ptr<AdaptiveDLM> ad1(new AdaptiveDLM(a1, rscs));
+    boost::shared_ptr<AdaptiveDLM> ad2(new AdaptiveDLM(a2, std::vector<std::string>()));
+    boost::shared_ptr<AdaptiveDLM> ad3(new AdaptiveDLM(a3, std::vector<std::string>()));
+    boost::shared_ptr<AdaptiveDLM> ad4(new AdaptiveDLM(a4, std::vector<std::string>()));
+    ad1->setDecisionWindow(2);
+    DLM::Ptr dlm1 = ad1, dlm2 = ad2, dlm3 = ad3, dlm4 = ad4;
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3)(dlm4);
+
+    dlm2->discover(rsc1, boost::assign::list_of(a1));
+    dlm4->discover(rsc1, boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm2->hasKnownOwner(rsc1) && dlm4->hasKnownOwner(rsc1));
+    // The owner considered a4 failed for a while, so a4 is not asked about the switch
+    ad1->agentFailed(a4);
+
+    for(int i = 0; i < 2; ++i)
+    {
+        dlm2->lock(rsc1, boost::assign::list_of(a1));
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+        BOOST_REQUIRE(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+        dlm2->unlock(rsc1);
+        forwardAllMessages(dlms);
+    }
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_REQUIRE(ad1->getResourceProtocol(rsc1) == protocol::SUZUKI_KASAMI);
+    BOOST_REQUIRE(ad2->getResourceProtocol(rsc1) == protocol::SUZUKI_KASAMI);
+    BOOST_CHECK(ad4->getResourceProtocol(rsc1) == protocol::RICART_AGRAWALA);
+
+    // a3 discovers the resource after the switch, and is told the protocol along with the owner
+    dlm3->discover(rsc1, boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm3->hasKnownOwner(rsc1));
+    BOOST_CHECK(ad3->getResourceProtocol(rsc1) == protocol::SUZUKI_KASAMI);
+
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3)(a4));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2)(a4));
+    // a4 requests with the outdated protocol, is refused and requests again with the current one
+    dlm4->lock(rsc1, boost::assign::list_of(a1)(a2)(a3));
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(ad4->getResourceProtocol(rsc1) == protocol::SUZUKI_KASAMI);
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::INTERESTED);
+    BOOST_CHECK(dlm4->getLockState(rsc1) == lock_state::INTERESTED);
+
+    // The others obtain the lock one after the other
+    dlm2->unlock(rsc1);
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::LOCKED || dlm4->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK(dlm3->getLockState(rsc1) != lock_state::LOCKED || dlm4->getLockState(rsc1) != lock_state::LOCKED);
+    DLM::Ptr first = dlm3->getLockState(rsc1) == lock_state::LOCKED ? dlm3 : dlm4;
+    DLM::Ptr second = first == dlm3 ? dlm4 : dlm3;
+    first->unlock(rsc1);
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(first->getLockState(rsc1) == lock_state::NOT_INTERESTED);
+    BOOST_CHECK(second->getLockState(rsc1) == lock_state::LOCKED);
+    second->unlock(rsc1);
+}
+
+/**
+ * Lets the test select the protocol of a resource, instead of the statistics
+ */
+class SelectableAdaptiveDLM : public AdaptiveDLM
+{
+public:
+    SelectableAdaptiveDLM(const AgentID& self, const std::vector<std::string>& resources)
+        : AdaptiveDLM(self, resources)
+    {}
+
+    void select(const std::string& resource, protocol::Protocol protocol)
+    {
+        mResourceStates[resource].mSelectedProtocol = protocol;
+        processSwitches();
+    }
+};
+
+/**
+ * After a switch away from Suzuki Kasami, the token is not granted to an outdated request by its last holder, but
+ * only by the owner after refusing the request.
+ */
+BOOST_AUTO_TEST_CASE(token_returned_on_switch)
+{
+    BOOST_TEST_MESSAGE("adaptive_dlm/token_returned_on_switch");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3"), a4 ("agent4");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    boost::shared_ptr<SelectableAdaptiveDLM> ad1(new SelectableAdaptiveDLM(a1, rscs));
+    boost::shared_ptr<AdaptiveDLM> ad2(new AdaptiveDLM(a2, std::vector<std::string>()));
+    boost::shared_ptr<AdaptiveDLM> ad3(new AdaptiveDLM(a3, std::vector<std::string>()));
+    boost::shared_ptr<AdaptiveDLM> ad4(new AdaptiveDLM(a4, std::vector<std::string>()));
+    DLM::Ptr dlm1 = ad1, dlm2 = ad2, dlm3 = ad3, dlm4 = ad4;
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3)(dlm4);
+
+    dlm2->discover(rsc1, boost::assign::list_of(a1));
+    dlm3->discover(rsc1, boost::assign::list_of(a1));
+    dlm4->discover(rsc1, boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    ad1->select(rsc1, protocol::SUZUKI_KASAMI);
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_REQUIRE(ad4->getResourceProtocol(rsc1) == protocol::SUZUKI_KASAMI);
+
+    // a3 keeps the token after its critical section
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm3->getLockState(rsc1) == lock_state::LOCKED);
+    dlm3->unlock(rsc1);
+    forwardAllMessages(dlms);
+
+    // a4 is not asked about the switch back to Ricart Agrawala
+    ad1->agentFailed(a4);
+    ad1->select(rsc1, protocol::RICART_AGRAWALA);
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_REQUIRE(ad1->getResourceProtocol(rsc1) == protocol::RICART_AGRAWALA);
+    BOOST_REQUIRE(ad3->getResourceProtocol(rsc1) == protocol::RICART_AGRAWALA);
+    BOOST_REQUIRE(ad4->getResourceProtocol(rsc1) == protocol::SUZUKI_KASAMI);
+
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3)(a4));
+    for(int i = 0; i < 2; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_REQUIRE(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+
+    // a4 requests the token. a3, which held it last, answers before the owner does.
+    dlm4->lock(rsc1, boost::assign::list_of(a1)(a2)(a3));
+    deliverMessages(dlm4, dlms);
+    deliverMessages(dlm3, dlms);
+    BOOST_CHECK(dlm4->getLockState(rsc1) != lock_state::LOCKED);
+    deliverMessages(dlm1, dlms);
+    BOOST_CHECK(dlm4->getLockState(rsc1) != lock_state::LOCKED);
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(ad4->getResourceProtocol(rsc1) == protocol::RICART_AGRAWALA);
+    BOOST_CHECK(dlm4->getLockState(rsc1) == lock_state::INTERESTED);
+
+    dlm2->unlock(rsc1);
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(dlm4->getLockState(rsc1) == lock_state::LOCKED);
+    dlm4->unlock(rsc1);
+}
+
+/**
+ * A switch is aborted by an agent discovering the resource meanwhile, as it was not asked.
+ */
+BOOST_AUTO_TEST_CASE(discovery_aborts_switch)
+{
+    BOOST_TEST_MESSAGE("adaptive_dlm/discovery_aborts_switch");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    boost::shared_ptr<AdaptiveDLM> ad1(new AdaptiveDLM(a1, rscs));
+    boost::shared_ptr<AdaptiveDLM> ad2(new AdaptiveDLM(a2, std::vector<std::string>()));
+    boost::shared_ptr<AdaptiveDLM> ad3(new AdaptiveDLM(a3, std::vector<std::string>()));
+    ad1->setDecisionWindow(2);
+    DLM::Ptr dlm1 = ad1, dlm2 = ad2, dlm3 = ad3;
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3);
+
+    dlm2->discover(rsc1, boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    for(int i = 0; i < 2; ++i)
+    {
+        dlm2->lock(rsc1, boost::assign::list_of(a1));
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+        BOOST_REQUIRE(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+        dlm2->unlock(rsc1);
+        if(i == 0)
+        {
+            forwardAllMessages(dlms);
+        }
+    }
+    // The owner proposes the switch on the release, a3 discovers the resource before a2 answers
+    dlm3->discover(rsc1, boost::assign::list_of(a1));
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_REQUIRE(dlm3->hasKnownOwner(rsc1));
+    BOOST_CHECK(ad1->getResourceProtocol(rsc1) == protocol::RICART_AGRAWALA);
+    BOOST_CHECK(ad2->getResourceProtocol(rsc1) == protocol::RICART_AGRAWALA);
+    BOOST_CHECK(ad3->getResourceProtocol(rsc1) == protocol::RICART_AGRAWALA);
+
+    // The switch is retried with a3, once the lock was released again
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+    for(int i = 0; i < 2; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_REQUIRE(dlm3->getLockState(rsc1) == lock_state::LOCKED);
+    dlm3->unlock(rsc1);
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(ad1->getResourceProtocol(rsc1) == protocol::SUZUKI_KASAMI);
+    BOOST_CHECK(ad2->getResourceProtocol(rsc1) == protocol::SUZUKI_KASAMI);
+    BOOST_CHECK(ad3->getResourceProtocol(rsc1) == protocol::SUZUKI_KASAMI);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
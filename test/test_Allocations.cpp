@@ -0,0 +1,234 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/assign/list_of.hpp>
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <new>
+#include <distributed_locking/DLM.hpp>
+
+#include "TestHelper.hpp"
+
+using namespace fipa;
+using namespace fipa::distributed_locking;
+using namespace fipa::acl;
+
+namespace {
+// Heap allocations and their bytes are only counted while enabled
+bool gCountAllocations = false;
+unsigned long gAllocations = 0;
+unsigned long gAllocatedBytes = 0;
+// Bytes currently allocated, always tracked. The size is kept in front of each block, padded to keep the alignment.
+long gLiveBytes = 0;
+const std::size_t HEADER_SIZE = 16;
+}
+
+// Dynamic exception specifications are an error since C++17
+#if __cplusplus >= 201103L
+#define THROWS_BAD_ALLOC
+#define THROWS_NOTHING noexcept
+#else
+#define THROWS_BAD_ALLOC throw(std::bad_alloc)
+#define THROWS_NOTHING throw()
+#endif
+
+void* operator new(std::size_t size) THROWS_BAD_ALLOC
+{
+    if(gCountAllocations)
+    {
+        ++gAllocations;
+        gAllocatedBytes += size;
+    }
+    char* memory = static_cast<char*>(std::malloc(HEADER_SIZE + size));
+    if(memory == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    *reinterpret_cast<std::size_t*>(memory) = size;
+    gLiveBytes += size;
+    return memory + HEADER_SIZE;
+}
+
+void operator delete(void* memory) THROWS_NOTHING
+{
+    if(memory == NULL)
+    {
+        return;
+    }
+    char* block = static_cast<char*>(memory) - HEADER_SIZE;
+    gLiveBytes -= *reinterpret_cast<std::size_t*>(block);
+    std::free(block);
+}
+
+void* operator new[](std::size_t size) THROWS_BAD_ALLOC
+{
+    return operator new(size);
+}
+
+void operator delete[](void* memory) THROWS_NOTHING
+{
+    operator delete(memory);
+}
+
+BOOST_AUTO_TEST_SUITE(allocations)
+
+/**
+ * Delivers all messages between the agents, reusing a single message object
+ */
+void deliver(const std::vector<DLM::Ptr>& dlms, ACLMessage& message)
+{
+    for(std::vector<DLM::Ptr>::const_iterator it = dlms.begin(); it != dlms.end(); ++it)
+    {
+        while((*it)->hasOutgoingMessages())
+        {
+            (*it)->popNextOutgoingMessage(message);
+            for(std::vector<DLM::Ptr>::const_iterator rit = dlms.begin(); rit != dlms.end(); ++rit)
+            {
+                if(rit != it)
+                {
+                    (*rit)->onIncomingMessage(message);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Delivers all messages to their receivers among the agents
+ */
+void deliverToReceivers(const std::vector<DLM::Ptr>& dlms)
+{
+    for(std::vector<DLM::Ptr>::const_iterator it = dlms.begin(); it != dlms.end(); ++it)
+    {
+        while((*it)->hasOutgoingMessages())
+        {
+            ACLMessage message = (*it)->popNextOutgoingMessage();
+            AgentIDList receivers = message.getAllReceivers();
+            for(std::vector<DLM::Ptr>::const_iterator rit = dlms.begin(); rit != dlms.end(); ++rit)
+            {
+                if(std::find(receivers.begin(), receivers.end(), (*rit)->getSelf()) != receivers.end())
+                {
+                    (*rit)->onIncomingMessage(message);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Counts the heap allocations of Ricart Agrawala critical sections. After the first rounds, which create the
+ * per-resource state, message prototypes and buffers, no critical section may allocate more than a fixed bound.
+ * The rounds are not compared exactly, as a conversation ID growing by a digit can cost a string allocation.
+ */
+BOOST_AUTO_TEST_CASE(ricart_agrawala_critical_section)
+{
+    BOOST_TEST_MESSAGE("allocations/ricart_agrawala_critical_section");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    std::vector<DLM::Ptr> dlms;
+    dlms.push_back(DLM::create(protocol::RICART_AGRAWALA, a1, rscs));
+    dlms.push_back(DLM::create(protocol::RICART_AGRAWALA, a2, std::vector<std::string>()));
+    AgentIDList agents(1, a1);
+    ACLMessage message;
+
+    dlms[1]->discover(rsc1, agents);
+    deliver(dlms, message);
+    deliver(dlms, message);
+    BOOST_REQUIRE(dlms[1]->hasKnownOwner(rsc1));
+
+    const unsigned int rounds = 8;
+    // Allocations measured for a critical section after the warm-up, including the copies of the messages
+    const unsigned long maxAllocations = 35;
+    unsigned long warmUp = 0, steady = 0;
+    for(unsigned int i = 0; i < 2 * rounds; ++i)
+    {
+        gAllocations = 0;
+        gCountAllocations = true;
+        dlms[1]->lock(rsc1, agents);
+        deliver(dlms, message);
+        deliver(dlms, message);
+        bool locked = dlms[1]->getLockState(rsc1) == lock_state::LOCKED;
+        dlms[1]->unlock(rsc1);
+        deliver(dlms, message);
+        gCountAllocations = false;
+
+        BOOST_REQUIRE(locked);
+        (i < rounds ? warmUp : steady) += gAllocations;
+        if(i >= rounds)
+        {
+            BOOST_CHECK_LE(gAllocations, maxAllocations);
+        }
+    }
+
+    BOOST_TEST_MESSAGE("Allocations per critical section: " << warmUp / rounds << " during warm-up, " << steady / rounds << " afterwards");
+}
+
+/**
+ * Measures the heap memory needed for the state of idle Suzuki Kasami resources. The owner creates the state of all
+ * its resources up front, so the bytes allocated by the constructor are a bound of the memory of resources never
+ * locked. Resources locked once keep more state at every agent taking part, which is measured after one critical
+ * section per resource.
+ */
+BOOST_AUTO_TEST_CASE(suzuki_kasami_bytes_per_resource)
+{
+    BOOST_TEST_MESSAGE("allocations/suzuki_kasami_bytes_per_resource");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1");
+    const unsigned int resourceCount = 1000;
+    std::vector<std::string> rscs;
+    for(unsigned int i = 0; i < resourceCount; ++i)
+    {
+        rscs.push_back("resource" + boost::lexical_cast<std::string>(i));
+    }
+
+    gAllocations = 0;
+    gAllocatedBytes = 0;
+    gCountAllocations = true;
+    DLM::Ptr dlm = DLM::create(protocol::SUZUKI_KASAMI, a1, rscs);
+    gCountAllocations = false;
+
+    BOOST_TEST_MESSAGE("Bytes per resource: " << gAllocatedBytes / resourceCount << " in " << gAllocations / resourceCount << " allocations");
+    for(unsigned int i = 0; i < resourceCount; ++i)
+    {
+        BOOST_REQUIRE(dlm->getLockState(rscs[i]) == lock_state::NOT_INTERESTED);
+    }
+    BOOST_CHECK(gAllocatedBytes / resourceCount < 1024);
+
+    // Every resource is locked once by one of the partners, which discovers it first
+    AgentID a2 ("agent2"), a3 ("agent3"), a4 ("agent4");
+    std::vector<DLM::Ptr> dlms;
+    dlms.push_back(dlm);
+    dlms.push_back(DLM::create(protocol::SUZUKI_KASAMI, a2, std::vector<std::string>()));
+    dlms.push_back(DLM::create(protocol::SUZUKI_KASAMI, a3, std::vector<std::string>()));
+    dlms.push_back(DLM::create(protocol::SUZUKI_KASAMI, a4, std::vector<std::string>()));
+    AgentIDList partners = boost::assign::list_of(a1)(a2)(a3)(a4);
+
+    long liveBytes = gLiveBytes;
+    for(unsigned int i = 0; i < resourceCount; ++i)
+    {
+        DLM::Ptr requester = dlms[1 + i % 3];
+        AgentIDList others;
+        std::remove_copy(partners.begin(), partners.end(), std::back_inserter(others), requester->getSelf());
+        requester->discover(rscs[i], others);
+        deliverToReceivers(dlms);
+        deliverToReceivers(dlms);
+        requester->lock(rscs[i], others);
+        deliverToReceivers(dlms);
+        deliverToReceivers(dlms);
+        BOOST_REQUIRE(requester->getLockState(rscs[i]) == lock_state::LOCKED);
+        requester->unlock(rscs[i]);
+        deliverToReceivers(dlms);
+    }
+    long bytesPerResource = (gLiveBytes - liveBytes) / static_cast<long>(resourceCount);
+
+    BOOST_TEST_MESSAGE("Bytes per resource after a critical section, over all " << dlms.size() << " agents: " << bytesPerResource);
+    BOOST_CHECK(bytesPerResource < 4096);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
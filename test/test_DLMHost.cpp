@@ -0,0 +1,142 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/assign/list_of.hpp>
+
+#include <distributed_locking/DLMHost.hpp>
+
+#include <iostream>
+
+#include "TestHelper.hpp"
+
+using namespace fipa;
+using namespace fipa::distributed_locking;
+using namespace fipa::acl;
+
+BOOST_AUTO_TEST_SUITE(dlm_host)
+
+/**
+ * Forwards the messages between a host and a DLM outside of it
+ */
+void forwardMessages(DLMHost& host, DLM& remote)
+{
+    host.trigger();
+    remote.trigger();
+    while(host.hasOutgoingMessages())
+    {
+        ACLMessage msg = host.popNextOutgoingMessage();
+        AgentIDList receivers = msg.getAllReceivers();
+        BOOST_CHECK(std::find(receivers.begin(), receivers.end(), remote.getSelf()) != receivers.end());
+        BOOST_CHECK(!host.isHosted(receivers.front()));
+        remote.onIncomingMessage(msg);
+    }
+    while(remote.hasOutgoingMessages())
+    {
+        host.onIncomingMessage(remote.popNextOutgoingMessage());
+    }
+}
+
+/**
+ * Hosted agents lock a resource without any message leaving the host.
+ */
+BOOST_AUTO_TEST_CASE(local_delivery)
+{
+    BOOST_TEST_MESSAGE("dlm_host/local_delivery");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    DLMHost host;
+    DLM::Ptr dlm1 = host.addAgent(protocol::RICART_AGRAWALA, a1, rscs);
+    DLM::Ptr dlm2 = host.addAgent(protocol::RICART_AGRAWALA, a2, std::vector<std::string>());
+    DLM::Ptr dlm3 = host.addAgent(protocol::RICART_AGRAWALA, a3, std::vector<std::string>());
+    BOOST_CHECK_EQUAL(host.getAgentCount(), 3);
+    BOOST_CHECK(host.getAgent(a2) == dlm2);
+    BOOST_CHECK_THROW(host.addAgent(protocol::RICART_AGRAWALA, a2, std::vector<std::string>()), std::invalid_argument);
+    BOOST_CHECK_THROW(host.getAgent(AgentID("agent4")), std::invalid_argument);
+
+    dlm2->discover(rsc1, boost::assign::list_of(a1)(a3));
+    dlm3->discover(rsc1, boost::assign::list_of(a1)(a2));
+    host.trigger();
+    BOOST_CHECK(dlm2->hasKnownOwner(rsc1) && dlm3->hasKnownOwner(rsc1));
+
+    // All messages are delivered in a single cycle
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3));
+    host.trigger();
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+    host.trigger();
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::INTERESTED);
+
+    dlm2->unlock(rsc1);
+    host.trigger();
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::NOT_INTERESTED);
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::LOCKED);
+    dlm3->unlock(rsc1);
+    host.trigger();
+
+    BOOST_CHECK(!host.hasOutgoingMessages());
+    BOOST_CHECK_THROW(host.popNextOutgoingMessage(), std::runtime_error);
+
+    // Spread the agents over trigger slots
+    BOOST_CHECK_THROW(host.setTriggerSlots(0), std::invalid_argument);
+    host.setTriggerSlots(2);
+    BOOST_CHECK_EQUAL(host.getTriggerSlots(), 2);
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+    host.trigger();
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::LOCKED);
+    dlm3->unlock(rsc1);
+
+    host.removeAgent(a3);
+    BOOST_CHECK_EQUAL(host.getAgentCount(), 2);
+    BOOST_CHECK(!host.isHosted(a3));
+    // The messages of a removed agent are not collected any more
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+    host.trigger();
+    BOOST_CHECK(dlm3->hasOutgoingMessages());
+    BOOST_CHECK(!host.hasOutgoingMessages());
+}
+
+/**
+ * Hosted agents lock a resource together with an agent outside of the host.
+ */
+BOOST_AUTO_TEST_CASE(remote_agents)
+{
+    BOOST_TEST_MESSAGE("dlm_host/remote_agents");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    DLMHost host;
+    DLM::Ptr dlm1 = host.addAgent(protocol::RICART_AGRAWALA, a1, rscs);
+    DLM::Ptr dlm2 = host.addAgent(protocol::RICART_AGRAWALA, a2, std::vector<std::string>());
+    DLM::Ptr dlm3 = DLM::create(protocol::RICART_AGRAWALA, a3, std::vector<std::string>());
+
+    dlm2->discover(rsc1, boost::assign::list_of(a1)(a3));
+    dlm3->discover(rsc1, boost::assign::list_of(a1)(a2));
+    forwardMessages(host, *dlm3);
+    forwardMessages(host, *dlm3);
+    BOOST_REQUIRE(dlm2->hasKnownOwner(rsc1) && dlm3->hasKnownOwner(rsc1));
+
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+    forwardMessages(host, *dlm3);
+    forwardMessages(host, *dlm3);
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::LOCKED);
+
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3));
+    forwardMessages(host, *dlm3);
+    forwardMessages(host, *dlm3);
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::INTERESTED);
+
+    dlm3->unlock(rsc1);
+    forwardMessages(host, *dlm3);
+    forwardMessages(host, *dlm3);
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::NOT_INTERESTED);
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,155 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/assign/list_of.hpp>
+#include <boost/foreach.hpp>
+
+#include <distributed_locking/HierarchicalDLM.hpp>
+
+#include <iostream>
+
+#include "TestHelper.hpp"
+
+using namespace fipa;
+using namespace fipa::distributed_locking;
+using namespace fipa::acl;
+
+BOOST_AUTO_TEST_SUITE(hierarchical_dlm)
+
+/**
+ * Two teams, each with a coordinator and a member. The members compete for a resource via their coordinators.
+ */
+BOOST_AUTO_TEST_CASE(two_teams)
+{
+    BOOST_TEST_MESSAGE("hierarchical_dlm/two_teams");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    // Team A: coordinator c1 and member m1, team B: coordinator c2 and member m2
+    AgentID c1 ("coordinator1"), m1 ("member1"), c2 ("coordinator2"), m2 ("member2");
+    // Define critical resource, owned by c1
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    boost::shared_ptr<HierarchicalDLM> hc1(new HierarchicalDLM(c1, rscs));
+    boost::shared_ptr<HierarchicalDLM> hm1(new HierarchicalDLM(m1, std::vector<std::string>()));
+    boost::shared_ptr<HierarchicalDLM> hc2(new HierarchicalDLM(c2, std::vector<std::string>()));
+    boost::shared_ptr<HierarchicalDLM> hm2(new HierarchicalDLM(m2, std::vector<std::string>()));
+    hc1->setCoordinators(boost::assign::list_of(c2));
+    hc2->setCoordinators(boost::assign::list_of(c1));
+    hm1->setCoordinator(c1);
+    hm2->setCoordinator(c2);
+
+    DLM::Ptr dlmc1 = hc1, dlmm1 = hm1, dlmc2 = hc2, dlmm2 = hm2;
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlmc1)(dlmm1)(dlmc2)(dlmm2);
+
+    dlmm1->discover(rsc1, boost::assign::list_of(c1)(c2)(m2));
+    dlmm2->discover(rsc1, boost::assign::list_of(c1)(c2)(m1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlmm1->hasKnownOwner(rsc1) && dlmm2->hasKnownOwner(rsc1));
+
+    // m1 locks via its coordinator, the request only goes to c1
+    dlmm1->lock(rsc1, boost::assign::list_of(c1)(c2)(m2));
+    BOOST_REQUIRE(dlmm1->hasOutgoingMessages());
+    ACLMessage request = dlmm1->popNextOutgoingMessage();
+    BOOST_CHECK(request.getAllReceivers() == boost::assign::list_of(c1).convert_to_container<AgentIDList>());
+    dlmc1->onIncomingMessage(request);
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(dlmm1->getLockState(rsc1) == lock_state::LOCKED);
+
+    // m2 and c1 want the resource too, the coordinator of team A serves itself first
+    dlmm2->lock(rsc1, boost::assign::list_of(c2));
+    dlmc1->lock(rsc1, std::vector<AgentID>());
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(dlmm2->getLockState(rsc1) == lock_state::INTERESTED);
+    BOOST_CHECK(dlmc1->getLockState(rsc1) == lock_state::INTERESTED);
+
+    dlmm1->unlock(rsc1);
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(dlmm1->getLockState(rsc1) == lock_state::NOT_INTERESTED);
+    BOOST_CHECK(dlmc1->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK(dlmm2->getLockState(rsc1) == lock_state::INTERESTED);
+
+    // Once team A is done, team B gets the resource
+    dlmc1->unlock(rsc1);
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(dlmc1->getLockState(rsc1) == lock_state::NOT_INTERESTED);
+    BOOST_CHECK(dlmm2->getLockState(rsc1) == lock_state::LOCKED);
+
+    dlmm2->unlock(rsc1);
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(dlmm2->getLockState(rsc1) == lock_state::NOT_INTERESTED);
+}
+
+/**
+ * The batch size limits how often a coordinator passes the lock on within its team.
+ */
+BOOST_AUTO_TEST_CASE(batch_size)
+{
+    BOOST_TEST_MESSAGE("hierarchical_dlm/batch_size");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID c1 ("coordinator1"), m1 ("member1"), c2 ("coordinator2");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    boost::shared_ptr<HierarchicalDLM> hc1(new HierarchicalDLM(c1, rscs, protocol::SUZUKI_KASAMI));
+    boost::shared_ptr<HierarchicalDLM> hm1(new HierarchicalDLM(m1, std::vector<std::string>(), protocol::SUZUKI_KASAMI));
+    boost::shared_ptr<HierarchicalDLM> hc2(new HierarchicalDLM(c2, std::vector<std::string>(), protocol::SUZUKI_KASAMI));
+    hc1->setCoordinators(boost::assign::list_of(c2));
+    hc2->setCoordinators(boost::assign::list_of(c1));
+    hm1->setCoordinator(c1);
+    hc1->setMaxBatchSize(1);
+
+    DLM::Ptr dlmc1 = hc1, dlmm1 = hm1, dlmc2 = hc2;
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlmc1)(dlmm1)(dlmc2);
+
+    dlmm1->discover(rsc1, boost::assign::list_of(c1)(c2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlmm1->hasKnownOwner(rsc1) && dlmc2->hasKnownOwner(rsc1));
+
+    // c1 holds the token, so it gets the lock right away
+    dlmc1->lock(rsc1, std::vector<AgentID>());
+    BOOST_CHECK(dlmc1->getLockState(rsc1) == lock_state::LOCKED);
+
+    dlmm1->lock(rsc1, std::vector<AgentID>());
+    dlmc2->lock(rsc1, std::vector<AgentID>());
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+
+    // With a batch size of 1, c2 is served before m1
+    dlmc1->unlock(rsc1);
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(dlmc2->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK(dlmm1->getLockState(rsc1) == lock_state::INTERESTED);
+
+    dlmc2->unlock(rsc1);
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(dlmm1->getLockState(rsc1) == lock_state::LOCKED);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,190 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/assign/list_of.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <distributed_locking/LockCombiner.hpp>
+
+#include "TestHelper.hpp"
+
+using namespace fipa;
+using namespace fipa::distributed_locking;
+using namespace fipa::acl;
+
+BOOST_AUTO_TEST_SUITE(lock_combiner)
+
+/**
+ * Forwards the messages between a combiner and a DLM
+ */
+void forwardMessages(LockCombiner& combiner, DLM& remote)
+{
+    combiner.trigger();
+    remote.trigger();
+    while(combiner.hasOutgoingMessages())
+    {
+        remote.onIncomingMessage(combiner.popNextOutgoingMessage());
+    }
+    while(remote.hasOutgoingMessages())
+    {
+        combiner.onIncomingMessage(remote.popNextOutgoingMessage());
+    }
+}
+
+/**
+ * State shared by the locking threads, only changed while holding the lock
+ */
+struct CriticalSection
+{
+    unsigned int mInside;
+    unsigned int mEntries;
+    bool mOverlapped;
+    // Number of threads, which could not lock
+    unsigned int mFailures;
+    boost::mutex mFailureMutex;
+
+    CriticalSection() : mInside(0), mEntries(0), mOverlapped(false), mFailures(0) {}
+};
+
+/**
+ * Locks a resource a number of times
+ */
+void lockRepeatedly(LockCombiner* combiner, const std::string& resource, const AgentIDList& agents, unsigned int times,
+        CriticalSection* section)
+{
+    for(unsigned int i = 0; i < times; ++i)
+    {
+        try
+        {
+            combiner->lock(resource, agents);
+        } catch(const std::runtime_error&)
+        {
+            boost::mutex::scoped_lock guard(section->mFailureMutex);
+            ++section->mFailures;
+            return;
+        }
+        if(++section->mInside != 1)
+        {
+            section->mOverlapped = true;
+        }
+        ++section->mEntries;
+        boost::this_thread::yield();
+        --section->mInside;
+        combiner->unlock(resource);
+    }
+}
+
+/**
+ * Forwards messages, until the threads are done with the given number of entries or have failed
+ */
+void waitForThreads(boost::thread_group& group, LockCombiner& combiner, DLM& remote, unsigned int entries, CriticalSection& section)
+{
+    // The entries are read without the lock, which is fine for waiting
+    for(unsigned int i = 0; i < 10000 && *static_cast<volatile unsigned int*>(&section.mEntries) < entries; ++i)
+    {
+        forwardMessages(combiner, remote);
+        boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+    group.join_all();
+}
+
+/**
+ * Threads of one agent share the distributed lock, within the fairness budget
+ */
+BOOST_AUTO_TEST_CASE(local_hand_overs)
+{
+    BOOST_TEST_MESSAGE("lock_combiner/local_hand_overs");
+    AgentID a1 ("agent1"), a2 ("agent2");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    DLM::Ptr dlm1 = DLM::create(protocol::RICART_AGRAWALA, a1, rscs);
+    DLM::Ptr dlm2 = DLM::create(protocol::RICART_AGRAWALA, a2, std::vector<std::string>());
+    dlm2->discover(rsc1, boost::assign::list_of(a1));
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2));
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2));
+    // a1 holds the resource, so all threads will queue up locally
+    dlm1->lock(rsc1, boost::assign::list_of(a2));
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2));
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2));
+    BOOST_REQUIRE(dlm1->getLockState(rsc1) == lock_state::LOCKED);
+
+    LockCombiner combiner(dlm2);
+    BOOST_CHECK_EQUAL(combiner.getFairnessBudget(), 8);
+    BOOST_CHECK_THROW(combiner.unlock(rsc1), std::invalid_argument);
+    AgentIDList agents = boost::assign::list_of(a1);
+    CriticalSection section;
+    boost::thread_group group;
+    for(unsigned int i = 0; i < 4; ++i)
+    {
+        group.create_thread(boost::bind(&lockRepeatedly, &combiner, rsc1, agents, 4, &section));
+    }
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    forwardMessages(combiner, *dlm1);
+    BOOST_CHECK_EQUAL(combiner.getDistributedAcquisitions(), 0);
+    dlm1->unlock(rsc1);
+    waitForThreads(group, combiner, *dlm1, 16, section);
+    BOOST_CHECK_EQUAL(section.mEntries, 16);
+    BOOST_CHECK(!section.mOverlapped);
+    // Every distributed lock is handed over up to 8 times
+    BOOST_CHECK_EQUAL(combiner.getDistributedAcquisitions() + combiner.getLocalHandOvers(), 16);
+    BOOST_CHECK(combiner.getDistributedAcquisitions() >= 2);
+    BOOST_CHECK(combiner.getLocalHandOvers() > 0);
+    forwardMessages(combiner, *dlm1);
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::NOT_INTERESTED);
+
+    // Without a budget, every lock is a distributed one
+    combiner.setFairnessBudget(0);
+    unsigned int handOvers = combiner.getLocalHandOvers();
+    unsigned int acquisitions = combiner.getDistributedAcquisitions();
+    CriticalSection unbatched;
+    for(unsigned int i = 0; i < 3; ++i)
+    {
+        group.create_thread(boost::bind(&lockRepeatedly, &combiner, rsc1, agents, 3, &unbatched));
+    }
+    waitForThreads(group, combiner, *dlm1, 9, unbatched);
+    BOOST_CHECK_EQUAL(unbatched.mEntries, 9);
+    BOOST_CHECK(!unbatched.mOverlapped);
+    BOOST_CHECK_EQUAL(combiner.getLocalHandOvers(), handOvers);
+    BOOST_CHECK_EQUAL(combiner.getDistributedAcquisitions(), acquisitions + 9);
+}
+
+/**
+ * Waiting threads fail, if the resource becomes unreachable
+ */
+BOOST_AUTO_TEST_CASE(unreachable_resource)
+{
+    BOOST_TEST_MESSAGE("lock_combiner/unreachable_resource");
+    AgentID a1 ("agent1"), a2 ("agent2");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    DLM::Ptr dlm1 = DLM::create(protocol::RICART_AGRAWALA, a1, rscs);
+    DLM::Ptr dlm2 = DLM::create(protocol::RICART_AGRAWALA, a2, std::vector<std::string>());
+    dlm2->discover(rsc1, boost::assign::list_of(a1));
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2));
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2));
+    LockCombiner combiner(dlm2);
+    // The owner of an unknown resource is not known
+    BOOST_CHECK_THROW(combiner.lock("unknown", boost::assign::list_of(a1)), std::invalid_argument);
+
+    CriticalSection section;
+    AgentIDList agents = boost::assign::list_of(a1);
+    boost::thread_group group;
+    for(unsigned int i = 0; i < 2; ++i)
+    {
+        group.create_thread(boost::bind(&lockRepeatedly, &combiner, rsc1, agents, 1, &section));
+    }
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    // The owner a1 is dead
+    BOOST_REQUIRE(combiner.hasOutgoingMessages());
+    ACLMessage request = combiner.popNextOutgoingMessage();
+    combiner.onDeliveryFailure(request.getConversationID(), request.getAllReceivers());
+    group.join_all();
+    BOOST_CHECK_EQUAL(section.mEntries, 0);
+    BOOST_CHECK_EQUAL(section.mFailures, 2);
+    BOOST_CHECK_THROW(combiner.lock(rsc1, agents), std::runtime_error);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
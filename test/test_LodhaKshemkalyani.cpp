@@ -0,0 +1,120 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/assign/list_of.hpp>
+#include <boost/foreach.hpp>
+#include <iostream>
+#include <distributed_locking/DLM.hpp>
+
+#include "TestHelper.hpp"
+
+using namespace fipa;
+using namespace fipa::distributed_locking;
+using namespace fipa::acl;
+
+/**
+ * Forwards all messages that currently await and counts the responses (AGREE) per receiver
+ */
+static unsigned int forwardAndCountResponses(std::list<DLM::Ptr> dlms)
+{
+    unsigned int responses = 0;
+    BOOST_FOREACH(DLM::Ptr sender, dlms)
+    {
+        sender->trigger();
+    }
+    BOOST_FOREACH(DLM::Ptr sender, dlms)
+    {
+        while(sender->hasOutgoingMessages())
+        {
+            ACLMessage msg = sender->popNextOutgoingMessage();
+            AgentIDList receivers = msg.getAllReceivers();
+            BOOST_FOREACH(DLM::Ptr receiver, dlms)
+            {
+                if(std::find(receivers.begin(), receivers.end(), receiver->getSelf()) != receivers.end())
+                {
+                    if(msg.getPerformativeAsEnum() == ACLMessage::AGREE)
+                    {
+                        ++responses;
+                    }
+                    receiver->onIncomingMessage(msg);
+                }
+            }
+        }
+    }
+    return responses;
+}
+
+/**
+ * Lets three agents request a resource at the same time and returns the number of responses sent until everyone
+ * was in the critical section once.
+ */
+static unsigned int runContention(protocol::Protocol implementation)
+{
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    DLM::Ptr dlm1 = DLM::create(implementation, a1, rscs);
+    DLM::Ptr dlm2 = DLM::create(implementation, a2, std::vector<std::string>());
+    DLM::Ptr dlm3 = DLM::create(implementation, a3, std::vector<std::string>());
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3);
+
+    dlm2->discover(rsc1, boost::assign::list_of(a1)(a3));
+    dlm3->discover(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm2->hasKnownOwner(rsc1) && dlm3->hasKnownOwner(rsc1));
+
+    // Everyone requests the resource, before any request is delivered
+    dlm1->lock(rsc1, boost::assign::list_of(a2)(a3));
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3));
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+
+    unsigned int responses = 0;
+    unsigned int entered = 0;
+    for(int round = 0; round < 10 && entered < 3; ++round)
+    {
+        responses += forwardAndCountResponses(dlms);
+
+        unsigned int locked = 0;
+        BOOST_FOREACH(DLM::Ptr dlm, dlms)
+        {
+            if(dlm->getLockState(rsc1) == lock_state::LOCKED)
+            {
+                ++locked;
+                ++entered;
+                dlm->unlock(rsc1);
+            }
+        }
+        // Mutual exclusion holds
+        BOOST_REQUIRE(locked <= 1);
+    }
+    responses += forwardAndCountResponses(dlms);
+
+    BOOST_CHECK_EQUAL(entered, 3);
+    BOOST_FOREACH(DLM::Ptr dlm, dlms)
+    {
+        BOOST_CHECK(dlm->getLockState(rsc1) == lock_state::NOT_INTERESTED);
+    }
+    return responses;
+}
+
+BOOST_AUTO_TEST_SUITE(lodha_kshemkalyani)
+
+/**
+ * Concurrent requests act as implicit replies, so fewer responses are sent than with Ricart Agrawala
+ */
+BOOST_AUTO_TEST_CASE(concurrent_requests)
+{
+    BOOST_TEST_MESSAGE("lodha_kshemkalyani/concurrent_requests");
+
+    unsigned int responsesRA = runContention(protocol::RICART_AGRAWALA);
+    unsigned int responsesLK = runContention(protocol::LODHA_KSHEMKALYANI);
+    // Ricart Agrawala always needs N-1 responses per critical section
+    BOOST_CHECK_EQUAL(responsesRA, 6);
+    // With Lodha Kshemkalyani, only the deferred responses to the lower priority requests remain
+    BOOST_CHECK_EQUAL(responsesLK, 3);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
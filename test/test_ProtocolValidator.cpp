@@ -0,0 +1,208 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/assign/list_of.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <distributed_locking/DLM.hpp>
+#include <distributed_locking/ProtocolTable.hpp>
+#include <distributed_locking/ProtocolValidator.hpp>
+
+#include <fstream>
+#include <sstream>
+
+#include "TestHelper.hpp"
+
+using namespace fipa;
+using namespace fipa::distributed_locking;
+using namespace fipa::acl;
+
+BOOST_AUTO_TEST_SUITE(protocol_validator)
+
+/**
+ * Gets the value of an attribute of an XML element, empty if it has none
+ */
+std::string getAttribute(const std::string& element, const std::string& attribute)
+{
+    std::string::size_type start = element.find(" " + attribute + "=\"");
+    if(start == std::string::npos)
+    {
+        return "";
+    }
+    start += attribute.size() + 3;
+    return element.substr(start, element.find('"', start) - start);
+}
+
+/**
+ * The compiled tables have to describe the same state machines as the SCXML files
+ */
+BOOST_AUTO_TEST_CASE(tables_match_protocol_descriptions)
+{
+    BOOST_TEST_MESSAGE("protocol_validator/tables_match_protocol_descriptions");
+    std::vector<std::string> protocols = ProtocolTable::getProtocols();
+    BOOST_CHECK(ProtocolTable::get("unknown") == NULL);
+
+    for(protocol::Protocol p = protocol::DLM_DISCOVER; p <= protocol::PROTOCOL_END; p = (protocol::Protocol) (p + 1))
+    {
+        BOOST_CHECK_MESSAGE(ProtocolTable::get(DLM::getProtocolTxt(p)) != NULL, "no table for " << DLM::getProtocolTxt(p));
+    }
+
+    for(std::vector<std::string>::const_iterator it = protocols.begin(); it != protocols.end(); ++it)
+    {
+        std::ifstream file((getProtocolPath() + "/" + *it).c_str());
+        BOOST_REQUIRE_MESSAGE(file.good(), "cannot read the description of " << *it);
+        std::stringstream description;
+        description << file.rdbuf();
+        std::string scxml = description.str();
+
+        const ProtocolTable* table = ProtocolTable::get(*it);
+        BOOST_REQUIRE(table != NULL);
+        std::string::size_type start = scxml.find("<scxml");
+        BOOST_CHECK_EQUAL(getAttribute(scxml.substr(start, scxml.find('>', start) - start), "initial"),
+                boost::lexical_cast<std::string>(table->getInitialState()));
+
+        // Walk through the states and their transitions in order
+        std::vector<ProtocolTable::Transition>::const_iterator transition = table->getTransitions().begin();
+        std::vector<unsigned int> finalStates;
+        std::string state;
+        for(std::string::size_type pos = scxml.find('<'); pos != std::string::npos; pos = scxml.find('<', pos + 1))
+        {
+            std::string element = scxml.substr(pos, scxml.find('>', pos) - pos);
+            if(element.compare(0, 6, "<state") == 0)
+            {
+                state = getAttribute(element, "id");
+                if(!getAttribute(element, "final").empty())
+                {
+                    finalStates.push_back(boost::lexical_cast<unsigned int>(state));
+                }
+            } else if(element.compare(0, 11, "<transition") == 0)
+            {
+                BOOST_REQUIRE_MESSAGE(transition != table->getTransitions().end(), *it << ": missing transition " << element);
+                BOOST_CHECK_EQUAL(state, boost::lexical_cast<std::string>(transition->mState));
+                BOOST_CHECK_EQUAL(getAttribute(element, "performative"), transition->mPerformative);
+                BOOST_CHECK_EQUAL(getAttribute(element, "from"), transition->mFrom);
+                BOOST_CHECK_EQUAL(getAttribute(element, "to"), transition->mTo);
+                BOOST_CHECK_EQUAL(getAttribute(element, "target"), boost::lexical_cast<std::string>(transition->mTarget));
+                ++transition;
+            }
+        }
+        BOOST_CHECK_MESSAGE(transition == table->getTransitions().end(), *it << ": the table has more transitions");
+        BOOST_CHECK(finalStates == table->getFinalStates());
+    }
+}
+
+/**
+ * Creates a message of a conversation
+ */
+ACLMessage createMessage(ACLMessage::Performative performative, const AgentID& sender, const AgentID& receiver,
+        const std::string& conversationID)
+{
+    ACLMessage message(performative);
+    message.setSender(sender);
+    message.addReceiver(receiver);
+    message.setProtocol(DLM::getProtocolTxt(protocol::RICART_AGRAWALA));
+    message.setConversationID(conversationID);
+    return message;
+}
+
+/**
+ * Check messages against the state machine, with different validation levels
+ */
+BOOST_AUTO_TEST_CASE(validation_levels)
+{
+    BOOST_TEST_MESSAGE("protocol_validator/validation_levels");
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+
+    ProtocolValidator validator;
+    BOOST_CHECK(validator.getLevel() == validation::FULL);
+    BOOST_CHECK(validator.update(createMessage(ACLMessage::REQUEST, a1, a2, "c1")));
+    BOOST_CHECK(validator.update(createMessage(ACLMessage::AGREE, a2, a1, "c1")));
+    // Only the initiator confirms
+    BOOST_CHECK(!validator.update(createMessage(ACLMessage::CONFIRM, a2, a3, "c1")));
+    BOOST_CHECK(validator.update(createMessage(ACLMessage::CONFIRM, a1, a3, "c1")));
+    // Not part of the protocol at all
+    BOOST_CHECK(!validator.update(createMessage(ACLMessage::PROPOSE, a1, a2, "c1")));
+    BOOST_CHECK(!validator.update(createMessage(ACLMessage::PROPOSE, a1, a2, "c2")));
+    // Delivery failures are accepted anywhere
+    BOOST_CHECK(validator.update(createMessage(ACLMessage::FAILURE, AgentID("mts"), a1, "c1")));
+    BOOST_CHECK_EQUAL(validator.getViolations(), 3);
+
+    // A conversation seen in its middle
+    BOOST_CHECK(validator.update(createMessage(ACLMessage::CONFIRM, a2, a3, "c3")));
+    BOOST_CHECK(validator.update(createMessage(ACLMessage::DISCONFIRM, a2, a3, "c3")));
+    BOOST_CHECK(!validator.update(createMessage(ACLMessage::REQUEST, a2, a3, "c3")));
+    BOOST_CHECK_EQUAL(validator.getViolations(), 4);
+
+    // Embedded validators count their violations at the outer one
+    ProtocolValidator embedded;
+    validator.share(embedded);
+    BOOST_CHECK(!embedded.update(createMessage(ACLMessage::PROPOSE, a1, a2, "c4")));
+    BOOST_CHECK_EQUAL(validator.getViolations(), 5);
+
+    validator.setLevel(validation::OFF);
+    BOOST_CHECK(embedded.getLevel() == validation::OFF);
+    BOOST_CHECK(validator.update(createMessage(ACLMessage::PROPOSE, a1, a2, "c5")));
+    BOOST_CHECK_EQUAL(validator.getViolations(), 5);
+
+    // A sample rate of 1 checks every conversation
+    BOOST_CHECK_THROW(validator.setSampleRate(0), std::invalid_argument);
+    validator.setLevel(validation::SAMPLED);
+    validator.setSampleRate(1);
+    BOOST_CHECK(!validator.update(createMessage(ACLMessage::PROPOSE, a1, a2, "c6")));
+    validator.setSampleRate(4);
+    unsigned int violations = validator.getViolations();
+    for(unsigned int i = 0; i < 100; ++i)
+    {
+        validator.update(createMessage(ACLMessage::PROPOSE, a1, a2, "c" + boost::lexical_cast<std::string>(i)));
+    }
+    BOOST_CHECK(validator.getViolations() > violations && validator.getViolations() - violations < 100);
+}
+
+/**
+ * Locking with the implemented protocols does not violate their descriptions
+ */
+BOOST_AUTO_TEST_CASE(no_violations_when_locking)
+{
+    BOOST_TEST_MESSAGE("protocol_validator/no_violations_when_locking");
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    for(protocol::Protocol p = protocol::PROTOCOL_START; p <= protocol::PROTOCOL_END; p = (protocol::Protocol) (p + 1))
+    {
+        if(p == protocol::HIERARCHICAL)
+        {
+            // Needs teams to be set up
+            continue;
+        }
+        DLM::Ptr dlm1 = DLM::create(p, a1, rscs);
+        DLM::Ptr dlm2 = DLM::create(p, a2, std::vector<std::string>());
+        DLM::Ptr dlm3 = DLM::create(p, a3, std::vector<std::string>());
+        std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3);
+        BOOST_CHECK(dlm1->getValidationLevel() == validation::FULL);
+
+        dlm2->discover(rsc1, boost::assign::list_of(a1)(a3));
+        dlm3->discover(rsc1, boost::assign::list_of(a1)(a2));
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+
+        dlm2->lock(rsc1, boost::assign::list_of(a1)(a3));
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+        dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+        BOOST_CHECK_MESSAGE(dlm2->getLockState(rsc1) == lock_state::LOCKED, DLM::getProtocolTxt(p));
+        dlm2->unlock(rsc1);
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+        BOOST_CHECK_MESSAGE(dlm3->getLockState(rsc1) == lock_state::LOCKED, DLM::getProtocolTxt(p));
+        dlm3->unlock(rsc1);
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+
+        BOOST_CHECK_MESSAGE(dlm1->getProtocolViolations() + dlm2->getProtocolViolations() + dlm3->getProtocolViolations() == 0,
+                DLM::getProtocolTxt(p));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
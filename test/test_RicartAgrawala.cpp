@@ -2,8 +2,10 @@
 #include <boost/assign/list_of.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
 #include <iostream>
 #include <distributed_locking/DLM.hpp>
+#include <distributed_locking/RicartAgrawala.hpp>
 
 #include "TestHelper.hpp"
 
@@ -379,4 +381,762 @@ BOOST_AUTO_TEST_CASE(same_time_conflict)
     BOOST_CHECK(dlm1->getLockState(rsc1) == lock_state::INTERESTED);
 }
 
+/**
+ * A resource with capacity 2 can be held by two agents at the same time, the third one has to wait.
+ */
+BOOST_AUTO_TEST_CASE(k_mutual_exclusion)
+{
+    BOOST_TEST_MESSAGE("ricart_agrawala/k_mutual_exclusion");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    // Create 3 Agents
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    // Define critical resource
+    std::string rsc1 = "resource";
+    // and a vector containing it
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    // Create 3 DLM::Ptrs, a1 owns the resource and allows 2 concurrent holders
+    DLM::Ptr dlm1 = DLM::create(protocol::RICART_AGRAWALA, a1, rscs);
+    DLM::Ptr dlm2 = DLM::create(protocol::RICART_AGRAWALA, a2, std::vector<std::string>());
+    DLM::Ptr dlm3 = DLM::create(protocol::RICART_AGRAWALA, a3, std::vector<std::string>());
+    dlm1->setResourceCapacity(rsc1, 2);
+    BOOST_CHECK_THROW(dlm2->setResourceCapacity(rsc1, 2), std::invalid_argument);
+
+    // The capacity is distributed with the owner information
+    dlm2->discover(rsc1, boost::assign::list_of(a1)(a3));
+    dlm3->discover(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2)(dlm3));
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2)(dlm3));
+    BOOST_REQUIRE(dlm2->hasKnownOwner(rsc1) && dlm3->hasKnownOwner(rsc1));
+    BOOST_CHECK_EQUAL(dlm2->getResourceCapacity(rsc1), 2);
+    BOOST_CHECK_EQUAL(dlm3->getResourceCapacity(rsc1), 2);
+
+    // a2 and a3 both obtain the lock
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3));
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2)(dlm3));
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(boost::assign::list_of(dlm3)(dlm1)(dlm2));
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2)(dlm3));
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::LOCKED);
+
+    // a1 is the third one and has to wait
+    dlm1->lock(rsc1, boost::assign::list_of(a2)(a3));
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2)(dlm3));
+    BOOST_CHECK(dlm1->getLockState(rsc1) == lock_state::INTERESTED);
+
+    // As soon as a2 releases, a1 gets the lock
+    dlm2->unlock(rsc1);
+    forwardAllMessages(boost::assign::list_of(dlm2)(dlm1)(dlm3));
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::NOT_INTERESTED);
+    BOOST_CHECK(dlm1->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::LOCKED);
+
+    // The late response of a2 must not count for a new request of a3
+    dlm3->unlock(rsc1);
+    forwardAllMessages(boost::assign::list_of(dlm3)(dlm1)(dlm2));
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3));
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2)(dlm3));
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(boost::assign::list_of(dlm3)(dlm1)(dlm2));
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2)(dlm3));
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::INTERESTED);
+
+    dlm1->unlock(rsc1);
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2)(dlm3));
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::LOCKED);
+}
+
+/**
+ * Deferred responses are sent on release, in the conversations of the requests and with increasing timestamps.
+ */
+BOOST_AUTO_TEST_CASE(deferred_responses)
+{
+    BOOST_TEST_MESSAGE("ricart_agrawala/deferred_responses");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    DLM::Ptr dlm1 = DLM::create(protocol::RICART_AGRAWALA, a1, rscs);
+    DLM::Ptr dlm2 = DLM::create(protocol::RICART_AGRAWALA, a2, std::vector<std::string>());
+    DLM::Ptr dlm3 = DLM::create(protocol::RICART_AGRAWALA, a3, std::vector<std::string>());
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3);
+
+    dlm1->lock(rsc1, boost::assign::list_of(a2)(a3));
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm1->getLockState(rsc1) == lock_state::LOCKED);
+
+    dlm2->discover(rsc1, boost::assign::list_of(a1)(a3));
+    dlm3->discover(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+
+    // Both requests are deferred by the lock holder
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3));
+    ACLMessage request2 = dlm2->popNextOutgoingMessage();
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+    ACLMessage request3 = dlm3->popNextOutgoingMessage();
+    dlm1->onIncomingMessage(request2);
+    dlm1->onIncomingMessage(request3);
+    BOOST_CHECK(!dlm1->hasOutgoingMessages());
+
+    dlm1->unlock(rsc1);
+    BOOST_REQUIRE(dlm1->hasOutgoingMessages());
+    ACLMessage response2 = dlm1->popNextOutgoingMessage();
+    BOOST_REQUIRE(dlm1->hasOutgoingMessages());
+    ACLMessage response3 = dlm1->popNextOutgoingMessage();
+    BOOST_CHECK(!dlm1->hasOutgoingMessages());
+
+    BOOST_CHECK(response2.getPerformativeAsEnum() == ACLMessage::AGREE);
+    BOOST_CHECK(response2.getAllReceivers() == boost::assign::list_of(a2).convert_to_container<AgentIDList>());
+    BOOST_CHECK_EQUAL(response2.getConversationID(), request2.getConversationID());
+    BOOST_CHECK(response3.getAllReceivers() == boost::assign::list_of(a3).convert_to_container<AgentIDList>());
+    BOOST_CHECK_EQUAL(response3.getConversationID(), request3.getConversationID());
+
+    std::vector<std::string> content2, content3;
+    std::string s2 = response2.getContent(), s3 = response3.getContent();
+    boost::split(content2, s2, boost::is_any_of("\n"));
+    boost::split(content3, s3, boost::is_any_of("\n"));
+    BOOST_REQUIRE(content2.size() == 2 && content3.size() == 2);
+    BOOST_CHECK_EQUAL(content2[1], rsc1);
+    BOOST_CHECK(boost::lexical_cast<int>(content2[0]) < boost::lexical_cast<int>(content3[0]));
+}
+
+/**
+ * Duplicate responses and responses of agents, which were not asked, do not count.
+ */
+BOOST_AUTO_TEST_CASE(unexpected_responses)
+{
+    BOOST_TEST_MESSAGE("ricart_agrawala/unexpected_responses");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3"), a4 ("agent4");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    DLM::Ptr dlm1 = DLM::create(protocol::RICART_AGRAWALA, a1, rscs);
+    DLM::Ptr dlm2 = DLM::create(protocol::RICART_AGRAWALA, a2, std::vector<std::string>());
+    DLM::Ptr dlm3 = DLM::create(protocol::RICART_AGRAWALA, a3, std::vector<std::string>());
+
+    dlm1->lock(rsc1, boost::assign::list_of(a2)(a3));
+    ACLMessage request = dlm1->popNextOutgoingMessage();
+    dlm2->onIncomingMessage(request);
+    dlm3->onIncomingMessage(request);
+    ACLMessage response2 = dlm2->popNextOutgoingMessage();
+    ACLMessage response3 = dlm3->popNextOutgoingMessage();
+
+    dlm1->onIncomingMessage(response2);
+    dlm1->onIncomingMessage(response2);
+    BOOST_CHECK(dlm1->getLockState(rsc1) == lock_state::INTERESTED);
+
+    ACLMessage stray = response3;
+    stray.setSender(a4);
+    dlm1->onIncomingMessage(stray);
+    BOOST_CHECK(dlm1->getLockState(rsc1) == lock_state::INTERESTED);
+
+    dlm1->onIncomingMessage(response3);
+    BOOST_CHECK(dlm1->getLockState(rsc1) == lock_state::LOCKED);
+    dlm1->unlock(rsc1);
+}
+
+/**
+ * The failure of an agent only affects the resources it takes part in.
+ */
+BOOST_AUTO_TEST_CASE(failure_of_partner)
+{
+    BOOST_TEST_MESSAGE("ricart_agrawala/failure_of_partner");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string rsc1 = "resource1", rsc2 = "resource2";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+    rscs.push_back(rsc2);
+
+    DLM::Ptr dlm1 = DLM::create(protocol::RICART_AGRAWALA, a1, rscs);
+    DLM::Ptr dlm3 = DLM::create(protocol::RICART_AGRAWALA, a3, std::vector<std::string>());
+
+    // a2 is asked for resource1 only, and never responds
+    dlm1->lock(rsc1, boost::assign::list_of(a2)(a3));
+    dlm3->onIncomingMessage(dlm1->popNextOutgoingMessage());
+    dlm1->lock(rsc2, boost::assign::list_of(a3));
+    dlm3->onIncomingMessage(dlm1->popNextOutgoingMessage());
+    dlm1->onIncomingMessage(dlm3->popNextOutgoingMessage());
+    dlm1->onIncomingMessage(dlm3->popNextOutgoingMessage());
+    BOOST_CHECK(dlm1->getLockState(rsc1) == lock_state::INTERESTED);
+    BOOST_CHECK(dlm1->getLockState(rsc2) == lock_state::LOCKED);
+
+    dlm1->agentFailed(a2);
+    BOOST_CHECK(dlm1->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK(dlm1->getLockState(rsc2) == lock_state::LOCKED);
+
+    // After the release, the failure of a former partner is ignored
+    dlm1->unlock(rsc1);
+    dlm1->agentFailed(a3);
+    BOOST_CHECK(dlm1->getLockState(rsc1) == lock_state::NOT_INTERESTED);
+    BOOST_CHECK(dlm1->getLockState(rsc2) == lock_state::LOCKED);
+    dlm1->unlock(rsc2);
+}
+
+/**
+ * A request of a higher priority class is served first, even if it was issued later.
+ */
+BOOST_AUTO_TEST_CASE(priorities)
+{
+    BOOST_TEST_MESSAGE("ricart_agrawala/priorities");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    DLM::Ptr dlm1 = DLM::create(protocol::RICART_AGRAWALA, a1, rscs);
+    DLM::Ptr dlm2 = DLM::create(protocol::RICART_AGRAWALA, a2, std::vector<std::string>());
+    DLM::Ptr dlm3 = DLM::create(protocol::RICART_AGRAWALA, a3, std::vector<std::string>());
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3);
+
+    dlm2->discover(rsc1, boost::assign::list_of(a1)(a3));
+    dlm3->discover(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+
+    dlm1->lock(rsc1, boost::assign::list_of(a2)(a3));
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm1->getLockState(rsc1) == lock_state::LOCKED);
+
+    // The bulk job requests first, the urgent one concurrently
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3), priority::LOW);
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2), priority::URGENT);
+    forwardAllMessages(dlms);
+
+    dlm1->unlock(rsc1);
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::INTERESTED);
+
+    dlm3->unlock(rsc1);
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+
+    BOOST_CHECK_EQUAL(dlm3->getLatencyStatistics(priority::URGENT).mCount, 1);
+    BOOST_CHECK_EQUAL(dlm2->getLatencyStatistics(priority::LOW).mCount, 1);
+    BOOST_CHECK_EQUAL(dlm2->getLatencyStatistics(priority::URGENT).mCount, 0);
+    BOOST_CHECK_EQUAL(dlm1->getLatencyStatistics(priority::NORMAL).mCount, 1);
+    dlm2->unlock(rsc1);
+}
+
+/**
+ * Locks on disjoint parts of a hierarchical resource do not conflict, while a lock on the whole resource does.
+ */
+BOOST_AUTO_TEST_CASE(intention_locks)
+{
+    BOOST_TEST_MESSAGE("ricart_agrawala/intention_locks");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string arm = "arm", joint1 = "arm/joint1", joint2 = "arm/joint2";
+    std::vector<std::string> rscs;
+    rscs.push_back(arm);
+
+    boost::shared_ptr<RicartAgrawala> ra1(new RicartAgrawala(a1, rscs));
+    boost::shared_ptr<RicartAgrawala> ra2(new RicartAgrawala(a2, std::vector<std::string>()));
+    boost::shared_ptr<RicartAgrawala> ra3(new RicartAgrawala(a3, std::vector<std::string>()));
+    DLM::Ptr dlm1 = ra1, dlm2 = ra2, dlm3 = ra3;
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3);
+
+    // The owner of the arm answers for its joints
+    dlm2->discover(joint1, boost::assign::list_of(a1)(a3));
+    dlm3->discover(joint2, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm2->hasKnownOwner(joint1) && dlm3->hasKnownOwner(joint2));
+    BOOST_REQUIRE(dlm2->hasKnownOwner(arm) && dlm3->hasKnownOwner(joint1));
+
+    // Both joints can be locked at the same time
+    dlm2->lock(joint1, boost::assign::list_of(a1)(a3));
+    dlm3->lock(joint2, boost::assign::list_of(a1)(a2));
+    for(int i = 0; i < 4; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(dlm2->getLockState(joint1) == lock_state::LOCKED);
+    BOOST_CHECK(dlm3->getLockState(joint2) == lock_state::LOCKED);
+    BOOST_CHECK(dlm2->getLockState(arm) == lock_state::NOT_INTERESTED);
+
+    // The whole arm has to wait for both joints
+    dlm1->lock(arm, boost::assign::list_of(a2)(a3));
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm1->getLockState(arm) == lock_state::INTERESTED);
+    dlm2->unlock(joint1);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm1->getLockState(arm) == lock_state::INTERESTED);
+    dlm3->unlock(joint2);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm1->getLockState(arm) == lock_state::LOCKED);
+
+    // Shared locks on a joint wait for the lock on the arm, and do not conflict among each other
+    ra2->lock(joint1, boost::assign::list_of(a1)(a3), lock_mode::SHARED);
+    ra3->lock(joint1, boost::assign::list_of(a1)(a2), lock_mode::SHARED);
+    for(int i = 0; i < 4; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(dlm2->getLockState(joint1) == lock_state::INTERESTED);
+    BOOST_CHECK(dlm3->getLockState(joint1) == lock_state::INTERESTED);
+    dlm1->unlock(arm);
+    for(int i = 0; i < 4; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(dlm2->getLockState(joint1) == lock_state::LOCKED);
+    BOOST_CHECK(dlm3->getLockState(joint1) == lock_state::LOCKED);
+
+    // The arm cannot be locked exclusively by an agent holding an intention lock on it
+    BOOST_CHECK_THROW(dlm2->lock(arm, boost::assign::list_of(a1)(a3)), std::runtime_error);
+    dlm2->unlock(joint1);
+    dlm3->unlock(joint1);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm2->getLockState(joint1) == lock_state::NOT_INTERESTED);
+    BOOST_CHECK(dlm3->getLockState(joint1) == lock_state::NOT_INTERESTED);
+}
+
+/**
+ * Locks can refer to a group of agents instead of a list. Changes of the group do not affect a pending request.
+ */
+BOOST_AUTO_TEST_CASE(groups)
+{
+    BOOST_TEST_MESSAGE("ricart_agrawala/groups");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    DLM::Ptr dlm1 = DLM::create(protocol::RICART_AGRAWALA, a1, rscs);
+    DLM::Ptr dlm2 = DLM::create(protocol::RICART_AGRAWALA, a2, std::vector<std::string>());
+    DLM::Ptr dlm3 = DLM::create(protocol::RICART_AGRAWALA, a3, std::vector<std::string>());
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3);
+
+    BOOST_CHECK_THROW(dlm2->lockGroup(rsc1, "team"), std::invalid_argument);
+    dlm2->defineGroup("team", boost::assign::list_of(a1));
+    dlm2->joinGroup("team", a3);
+    dlm2->joinGroup("team", a3);
+    BOOST_CHECK_EQUAL(dlm2->getGroupVersion("team"), 2);
+    DLM::AgentGroup team = dlm2->getGroup("team");
+    BOOST_CHECK_EQUAL(team->size(), 2);
+
+    dlm2->discover(rsc1, *team);
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+
+    dlm1->lock(rsc1, boost::assign::list_of(a2)(a3));
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm1->getLockState(rsc1) == lock_state::LOCKED);
+
+    dlm2->lockGroup(rsc1, "team");
+    // The pending request shares the snapshot of the group instead of copying it
+    BOOST_CHECK(team.use_count() > 2);
+    BOOST_REQUIRE(dlm2->hasOutgoingMessages());
+    ACLMessage request = dlm2->popNextOutgoingMessage();
+    BOOST_CHECK(request.getAllReceivers() == *team);
+    dlm1->onIncomingMessage(request);
+    dlm3->onIncomingMessage(request);
+
+    // Leaving the group does not change the pending request, a3 still has to respond
+    dlm2->leaveGroup("team", a3);
+    BOOST_CHECK_EQUAL(dlm2->getGroupVersion("team"), 3);
+    BOOST_CHECK_EQUAL(team->size(), 2);
+    BOOST_CHECK_EQUAL(dlm2->getGroup("team")->size(), 1);
+
+    dlm1->unlock(rsc1);
+    for(int i = 0; i < 3; ++i)
+    {
+        forwardAllMessages(dlms);
+    }
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    dlm2->unlock(rsc1);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::NOT_INTERESTED);
+}
+
+/**
+ * Exposes the number of resource states, to check their reclamation
+ */
+class InspectableRicartAgrawala : public RicartAgrawala
+{
+public:
+    InspectableRicartAgrawala(const AgentID& self, const std::vector<std::string>& resources)
+        : RicartAgrawala(self, resources)
+    {}
+
+    unsigned int getResourceStateCount() const { return mLockStates.size(); }
+    unsigned int getPendingRequestCount() const { return mPendingRequests.size(); }
+    unsigned int getParticipationCount(const AgentID& agent) const { return getParticipations(agent).size(); }
+};
+
+/**
+ * Idle resource states are reclaimed beyond the idle state capacity, and owner information beyond the owner cache
+ * capacity.
+ */
+BOOST_AUTO_TEST_CASE(state_eviction)
+{
+    BOOST_TEST_MESSAGE("ricart_agrawala/state_eviction");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2");
+    std::vector<std::string> rscs = boost::assign::list_of("r0")("r1")("r2")("r3");
+
+    DLM::Ptr dlm1 = DLM::create(protocol::RICART_AGRAWALA, a1, rscs);
+    boost::shared_ptr<InspectableRicartAgrawala> ra2(new InspectableRicartAgrawala(a2, std::vector<std::string>()));
+    DLM::Ptr dlm2 = ra2;
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2);
+
+    ra2->setIdleStateCapacity(2);
+    for(size_t i = 0; i < rscs.size(); ++i)
+    {
+        dlm2->discover(rscs[i], boost::assign::list_of(a1));
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+        dlm2->lock(rscs[i], boost::assign::list_of(a1));
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+        BOOST_REQUIRE(dlm2->getLockState(rscs[i]) == lock_state::LOCKED);
+        dlm2->unlock(rscs[i]);
+        forwardAllMessages(dlms);
+        BOOST_CHECK(ra2->getResourceStateCount() <= 2);
+    }
+    ra2->setIdleStateCapacity(0);
+    BOOST_CHECK_EQUAL(ra2->getResourceStateCount(), 0);
+    BOOST_CHECK_EQUAL(ra2->getPendingRequestCount(), 0);
+
+    // A reclaimed state is created again
+    dlm2->lock("r0", boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm2->getLockState("r0") == lock_state::LOCKED);
+    BOOST_CHECK_EQUAL(ra2->getResourceStateCount(), 1);
+    dlm2->unlock("r0");
+    forwardAllMessages(dlms);
+    BOOST_CHECK_EQUAL(ra2->getResourceStateCount(), 0);
+
+    // The owner information known before is regarded as used in the order of the resource names
+    dlm2->setOwnerCacheCapacity(2);
+    BOOST_CHECK(!dlm2->hasKnownOwner("r0"));
+    BOOST_CHECK(!dlm2->hasKnownOwner("r1"));
+    BOOST_CHECK(dlm2->hasKnownOwner("r2"));
+    BOOST_CHECK(dlm2->hasKnownOwner("r3"));
+
+    // Locking r3 makes it the most recently used, so rediscovering r0 displaces r2
+    dlm2->lock("r3", boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm2->getLockState("r3") == lock_state::LOCKED);
+    dlm2->unlock("r3");
+    forwardAllMessages(dlms);
+    dlm2->discover("r0", boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm2->hasKnownOwner("r0"));
+    BOOST_CHECK(!dlm2->hasKnownOwner("r2"));
+    BOOST_CHECK(dlm2->hasKnownOwner("r3"));
+
+    // The owner of a held resource is not forgotten, even if it is the least recently used one
+    dlm2->lock("r3", boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm2->getLockState("r3") == lock_state::LOCKED);
+    dlm2->discover("r1", boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    dlm2->discover("r2", boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(!dlm2->hasKnownOwner("r0"));
+    BOOST_CHECK(!dlm2->hasKnownOwner("r1"));
+    BOOST_CHECK(dlm2->hasKnownOwner("r2"));
+    BOOST_CHECK(dlm2->hasKnownOwner("r3"));
+
+    // Overheard queries of other agents do not displace the owner information used
+    DLM::Ptr dlm3 = DLM::create(protocol::RICART_AGRAWALA, AgentID("agent3"), std::vector<std::string>());
+    std::list<DLM::Ptr> all = boost::assign::list_of(dlm1)(dlm2)(dlm3);
+    dlm3->discover("r1", boost::assign::list_of(a1)(a2));
+    forwardAllMessages(all);
+    forwardAllMessages(all);
+    BOOST_CHECK(dlm3->hasKnownOwner("r1"));
+    BOOST_CHECK(dlm2->hasKnownOwner("r2"));
+    BOOST_CHECK(dlm2->hasKnownOwner("r3"));
+
+    // So the release still reaches the owner
+    dlm2->unlock("r3");
+    bool released = false;
+    while(dlm2->hasOutgoingMessages())
+    {
+        ACLMessage message = dlm2->popNextOutgoingMessage();
+        released = released || message.getPerformativeAsEnum() == ACLMessage::DISCONFIRM;
+        dlm1->onIncomingMessage(message);
+    }
+    BOOST_CHECK(released);
+
+    // The owner never forgets its own resources
+    dlm1->setOwnerCacheCapacity(1);
+    for(size_t i = 0; i < rscs.size(); ++i)
+    {
+        BOOST_CHECK(dlm1->hasKnownOwner(rscs[i]));
+    }
+}
+
+/**
+ * The owners are only recorded as participants as long as their owner information is cached, also for overheard
+ * discoveries and for resources locked before
+ */
+BOOST_AUTO_TEST_CASE(participations_bounded_by_owner_cache)
+{
+    BOOST_TEST_MESSAGE("ricart_agrawala/participations_bounded_by_owner_cache");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::vector<std::string> rscs = boost::assign::list_of("r0")("r1")("r2")("r3")("r4")("r5");
+
+    DLM::Ptr dlm1 = DLM::create(protocol::RICART_AGRAWALA, a1, rscs);
+    boost::shared_ptr<InspectableRicartAgrawala> ra2(new InspectableRicartAgrawala(a2, std::vector<std::string>()));
+    DLM::Ptr dlm2 = ra2;
+    boost::shared_ptr<InspectableRicartAgrawala> ra3(new InspectableRicartAgrawala(a3, std::vector<std::string>()));
+    DLM::Ptr dlm3 = ra3;
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3);
+
+    ra2->setOwnerCacheCapacity(2);
+    ra3->setOwnerCacheCapacity(2);
+    for(size_t i = 0; i < rscs.size(); ++i)
+    {
+        // agent3 overhears the discoveries of agent2
+        dlm2->discover(rscs[i], boost::assign::list_of(a1)(a3));
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+        BOOST_REQUIRE(dlm2->hasKnownOwner(rscs[i]));
+        BOOST_CHECK(ra2->getParticipationCount(a1) <= 2);
+        BOOST_CHECK(ra3->getParticipationCount(a1) <= 2);
+    }
+    BOOST_CHECK_EQUAL(ra2->getParticipationCount(a1), 2);
+
+    ra2->setIdleStateCapacity(1);
+    for(size_t i = 0; i < rscs.size(); ++i)
+    {
+        dlm2->discover(rscs[i], boost::assign::list_of(a1));
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+        dlm2->lock(rscs[i], boost::assign::list_of(a1));
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+        BOOST_REQUIRE(dlm2->getLockState(rscs[i]) == lock_state::LOCKED);
+        dlm2->unlock(rscs[i]);
+        forwardAllMessages(dlms);
+        BOOST_CHECK(ra2->getParticipationCount(a1) <= 3);
+    }
+}
+
+/**
+ * Test reporting delivery failures directly, without a FAILURE message
+ */
+BOOST_AUTO_TEST_CASE(delivery_failure_api)
+{
+    BOOST_TEST_MESSAGE("ricart_agrawala/delivery_failure_api");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    DLM::Ptr dlm1 = DLM::create(protocol::RICART_AGRAWALA, a1, rscs);
+    DLM::Ptr dlm2 = DLM::create(protocol::RICART_AGRAWALA, a2, std::vector<std::string>());
+    dlm2->discover(rsc1, boost::assign::list_of(a1)(a3));
+    forwardAllMessages(boost::assign::list_of(dlm2)(dlm1));
+    forwardAllMessages(boost::assign::list_of(dlm2)(dlm1));
+    BOOST_REQUIRE(dlm2->hasKnownOwner(rsc1));
+
+    // a3 is dead, only a1 answers
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3));
+    ACLMessage request = dlm2->popNextOutgoingMessage();
+    // Failures of unknown conversations are ignored
+    dlm2->onDeliveryFailure("unknown", boost::assign::list_of(a1));
+    dlm2->onDeliveryFailure(request.getConversationID(), boost::assign::list_of(a3));
+    dlm1->onIncomingMessage(request);
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2));
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2));
+
+    // a3 does not own the resource, so a2 gets it
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    dlm2->unlock(rsc1);
+    forwardAllMessages(boost::assign::list_of(dlm2)(dlm1));
+
+    // Now the owner is unreachable
+    dlm2->lock(rsc1, boost::assign::list_of(a1));
+    request = dlm2->popNextOutgoingMessage();
+    dlm2->onDeliveryFailure(request.getConversationID(), request.getAllReceivers());
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::UNREACHABLE);
+}
+
+/**
+ * Test prefetching locks, taking them over and releasing them after the prefetch window
+ */
+BOOST_AUTO_TEST_CASE(prefetch)
+{
+    BOOST_TEST_MESSAGE("ricart_agrawala/prefetch");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    DLM::Ptr dlm1 = DLM::create(protocol::RICART_AGRAWALA, a1, rscs);
+    DLM::Ptr dlm2 = DLM::create(protocol::RICART_AGRAWALA, a2, std::vector<std::string>());
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2);
+    dlm2->discover(rsc1, boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_CHECK_THROW(dlm2->setPrefetchWindow(-1), std::invalid_argument);
+
+    // The lock is granted in the background, and taken over without further messages
+    dlm2->prefetch(rsc1, boost::assign::list_of(a1));
+    BOOST_CHECK(dlm2->isPrefetched(rsc1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    dlm2->lock(rsc1, boost::assign::list_of(a1));
+    BOOST_CHECK(!dlm2->isPrefetched(rsc1));
+    BOOST_CHECK(!dlm2->hasOutgoingMessages());
+    // Once taken over, the lock is not released by the window
+    dlm2->setPrefetchWindow(0);
+    dlm2->trigger();
+    dlm2->trigger();
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    // Locks held already are not prefetched
+    dlm2->prefetch(rsc1, boost::assign::list_of(a1));
+    BOOST_CHECK(!dlm2->isPrefetched(rsc1));
+    dlm2->unlock(rsc1);
+    forwardAllMessages(dlms);
+
+    // A lock not taken over in time is released again
+    dlm2->setPrefetchWindow(0.1);
+    dlm2->prefetch(rsc1, boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    dlm2->trigger();
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    usleep(200000);
+    dlm2->trigger();
+    BOOST_CHECK(!dlm2->isPrefetched(rsc1));
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::NOT_INTERESTED);
+    forwardAllMessages(dlms);
+    dlm1->lock(rsc1, boost::assign::list_of(a2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm1->getLockState(rsc1) == lock_state::LOCKED);
+    dlm1->unlock(rsc1);
+    forwardAllMessages(dlms);
+
+    // A prefetched lock can be released without taking it over
+    dlm2->setPrefetchWindow(10);
+    dlm2->prefetch(rsc1, boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    dlm2->unlock(rsc1);
+    BOOST_CHECK(!dlm2->isPrefetched(rsc1));
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::NOT_INTERESTED);
+    forwardAllMessages(dlms);
+
+    // A prefetch, whose request failed, is not taken over
+    dlm2->prefetch(rsc1, boost::assign::list_of(a1));
+    BOOST_REQUIRE(dlm2->hasOutgoingMessages());
+    ACLMessage request = dlm2->popNextOutgoingMessage();
+    dlm2->onDeliveryFailure(request.getConversationID(), request.getAllReceivers());
+    BOOST_REQUIRE(dlm2->getLockState(rsc1) == lock_state::UNREACHABLE);
+    BOOST_CHECK_THROW(dlm2->lock(rsc1, boost::assign::list_of(a1)), std::runtime_error);
+    BOOST_CHECK(!dlm2->isPrefetched(rsc1));
+}
+
+/**
+ * Test nested locks in reentrant mode, which release the resource with the outermost unlock only
+ */
+BOOST_AUTO_TEST_CASE(reentrant_locks)
+{
+    BOOST_TEST_MESSAGE("ricart_agrawala/reentrant_locks");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    DLM::Ptr dlm1 = DLM::create(protocol::RICART_AGRAWALA, a1, rscs);
+    DLM::Ptr dlm2 = DLM::create(protocol::RICART_AGRAWALA, a2, std::vector<std::string>());
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2);
+    dlm2->discover(rsc1, boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+
+    // By default, locking again does nothing, and the first unlock releases the resource
+    BOOST_CHECK(!dlm2->isReentrant());
+    dlm2->lock(rsc1, boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    dlm2->lock(rsc1, boost::assign::list_of(a1));
+    BOOST_CHECK_EQUAL(dlm2->getLockCount(rsc1), 1);
+    dlm2->unlock(rsc1);
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::NOT_INTERESTED);
+    BOOST_CHECK_EQUAL(dlm2->getLockCount(rsc1), 0);
+    forwardAllMessages(dlms);
+
+    dlm2->setReentrant(true);
+    dlm2->lock(rsc1, boost::assign::list_of(a1));
+    // Also counted while waiting for the lock
+    dlm2->lock(rsc1, boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    dlm2->lock(rsc1, boost::assign::list_of(a1));
+    BOOST_CHECK(!dlm2->hasOutgoingMessages());
+    BOOST_CHECK_EQUAL(dlm2->getLockCount(rsc1), 3);
+
+    // a1 has to wait until the outermost unlock
+    dlm1->lock(rsc1, boost::assign::list_of(a2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    dlm2->unlock(rsc1);
+    dlm2->unlock(rsc1);
+    BOOST_CHECK(!dlm2->hasOutgoingMessages());
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK_EQUAL(dlm2->getLockCount(rsc1), 1);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm1->getLockState(rsc1) == lock_state::INTERESTED);
+    dlm2->unlock(rsc1);
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::NOT_INTERESTED);
+    BOOST_CHECK(dlm1->getLockState(rsc1) == lock_state::LOCKED);
+    dlm1->unlock(rsc1);
+    forwardAllMessages(dlms);
+
+    // A shared lock cannot be reentered exclusively
+    RicartAgrawala& ra2 = dynamic_cast<RicartAgrawala&>(*dlm2);
+    ra2.lock(rsc1, boost::assign::list_of(a1), lock_mode::SHARED);
+    BOOST_CHECK_THROW(ra2.lock(rsc1, boost::assign::list_of(a1), lock_mode::EXCLUSIVE), std::runtime_error);
+    ra2.lock(rsc1, boost::assign::list_of(a1), lock_mode::SHARED);
+    BOOST_CHECK_EQUAL(dlm2->getLockCount(rsc1), 2);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,8 +2,10 @@
 #include <boost/assign/list_of.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include <distributed_locking/DLM.hpp>
+#include <distributed_locking/SuzukiKasami.hpp>
 
 #include <iostream>
 
@@ -152,6 +154,40 @@ BOOST_AUTO_TEST_CASE(basic_hold_and_release)
     forwardAllMessages(boost::assign::list_of(dlm1)(dlm2)(dlm3));
 }
 
+/**
+ * Only whole resources have a token, so their parts cannot be locked
+ */
+BOOST_AUTO_TEST_CASE(hierarchical_names)
+{
+    BOOST_TEST_MESSAGE("suzuki_kasami/hierarchical_names");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2");
+    std::vector<std::string> rscs;
+    rscs.push_back("arm");
+
+    DLM::Ptr dlm1 = DLM::create(protocol::SUZUKI_KASAMI, a1, rscs);
+    DLM::Ptr dlm2 = DLM::create(protocol::SUZUKI_KASAMI, a2, std::vector<std::string>());
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2);
+
+    // The owner answers with the resource the part belongs to
+    dlm2->discover("arm/joint3", boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm2->hasKnownOwner("arm/joint3"));
+    BOOST_CHECK_THROW(dlm2->lock("arm/joint3", boost::assign::list_of(a1)), std::invalid_argument);
+    BOOST_CHECK(dlm2->getLockState("arm/joint3") == lock_state::NOT_INTERESTED);
+    BOOST_CHECK_THROW(dlm1->lock("arm/joint3", boost::assign::list_of(a2)), std::invalid_argument);
+
+    // The whole resource can be locked
+    dlm2->lock("arm", boost::assign::list_of(a1));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm2->getLockState("arm") == lock_state::LOCKED);
+    dlm2->unlock("arm");
+    forwardAllMessages(dlms);
+}
+
 /**
  * Two agents want the same resource. A2 wants it while
  * a1 holds the lock.
@@ -204,4 +240,390 @@ BOOST_AUTO_TEST_CASE(two_agents_conflict)
     forwardAllMessages(boost::assign::list_of(dlm1)(dlm2));
 }
 
+/**
+ * Token requests are sent to the probable token holder first, and to all agents after a timeout
+ */
+BOOST_AUTO_TEST_CASE(directed_requests)
+{
+    BOOST_TEST_MESSAGE("suzuki_kasami/directed_requests");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    boost::shared_ptr<SuzukiKasami> sk1(new SuzukiKasami(a1, rscs));
+    boost::shared_ptr<SuzukiKasami> sk2(new SuzukiKasami(a2, std::vector<std::string>()));
+    boost::shared_ptr<SuzukiKasami> sk3(new SuzukiKasami(a3, std::vector<std::string>()));
+    sk2->setDirectedRequestTimeout(0.5);
+    sk3->setDirectedRequestTimeout(0.5);
+    DLM::Ptr dlm1 = sk1, dlm2 = sk2, dlm3 = sk3;
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3);
+
+    dlm2->discover(rsc1, boost::assign::list_of(a1)(a3));
+    dlm3->discover(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm2->hasKnownOwner(rsc1) && dlm3->hasKnownOwner(rsc1));
+
+    // The owner initially holds the token, so only he is asked
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3));
+    BOOST_REQUIRE(dlm2->hasOutgoingMessages());
+    ACLMessage request = dlm2->popNextOutgoingMessage();
+    BOOST_CHECK(request.getAllReceivers() == boost::assign::list_of(a1).convert_to_container<AgentIDList>());
+    dlm1->onIncomingMessage(request);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK(sk1->getProbableTokenHolder(rsc1) == a2);
+
+    // a3 asks the owner in vain, and everyone else after the timeout
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::INTERESTED);
+    sleep(1);
+    forwardAllMessages(dlms);
+
+    dlm2->unlock(rsc1);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK(sk2->getProbableTokenHolder(rsc1) == a3);
+    dlm3->unlock(rsc1);
+}
+
+/**
+ * Many agents request the token at once, everyone must be served exactly once
+ */
+BOOST_AUTO_TEST_CASE(many_agents)
+{
+    BOOST_TEST_MESSAGE("suzuki_kasami/many_agents");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    const unsigned int numberOfAgents = 20;
+    std::vector<AgentID> agents;
+    std::list<DLM::Ptr> dlms;
+    for(unsigned int i = 0; i < numberOfAgents; ++i)
+    {
+        AgentID agent("agent" + boost::lexical_cast<std::string>(i));
+        agents.push_back(agent);
+        // The first agent owns the resource
+        dlms.push_back(DLM::create(protocol::SUZUKI_KASAMI, agent, i == 0 ? rscs : std::vector<std::string>()));
+    }
+    DLM::Ptr owner = dlms.front();
+
+    BOOST_FOREACH(DLM::Ptr dlm, dlms)
+    {
+        AgentIDList others;
+        std::remove_copy(agents.begin(), agents.end(), std::back_inserter(others), dlm->getSelf());
+        if(dlm != owner)
+        {
+            dlm->discover(rsc1, others);
+        }
+    }
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+
+    owner->lock(rsc1, AgentIDList());
+    BOOST_REQUIRE(owner->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_FOREACH(DLM::Ptr dlm, dlms)
+    {
+        if(dlm != owner)
+        {
+            AgentIDList others;
+            std::remove_copy(agents.begin(), agents.end(), std::back_inserter(others), dlm->getSelf());
+            dlm->lock(rsc1, others);
+        }
+    }
+    forwardAllMessages(dlms);
+    owner->unlock(rsc1);
+
+    std::set<AgentID> served;
+    for(unsigned int round = 0; round < 3 * numberOfAgents && served.size() < numberOfAgents - 1; ++round)
+    {
+        forwardAllMessages(dlms);
+        unsigned int locked = 0;
+        BOOST_FOREACH(DLM::Ptr dlm, dlms)
+        {
+            if(dlm->getLockState(rsc1) == lock_state::LOCKED)
+            {
+                ++locked;
+                BOOST_CHECK(served.insert(dlm->getSelf()).second);
+                dlm->unlock(rsc1);
+            }
+        }
+        BOOST_REQUIRE(locked <= 1);
+    }
+    BOOST_CHECK_EQUAL(served.size(), numberOfAgents - 1);
+}
+
+/**
+ * Agents which left the membership are no longer listed in the token
+ */
+BOOST_AUTO_TEST_CASE(token_compaction)
+{
+    BOOST_TEST_MESSAGE("suzuki_kasami/token_compaction");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    boost::shared_ptr<SuzukiKasami> sk1(new SuzukiKasami(a1, rscs));
+    boost::shared_ptr<SuzukiKasami> sk2(new SuzukiKasami(a2, std::vector<std::string>()));
+    DLM::Ptr dlm1 = sk1, dlm2 = sk2;
+    DLM::Ptr dlm3 = DLM::create(protocol::SUZUKI_KASAMI, a3, std::vector<std::string>());
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3);
+
+    dlm2->discover(rsc1, boost::assign::list_of(a1)(a3));
+    dlm3->discover(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+
+    // a3 uses the resource once, and returns the token to the owner on his request
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm3->getLockState(rsc1) == lock_state::LOCKED);
+    dlm3->unlock(rsc1);
+    dlm1->lock(rsc1, boost::assign::list_of(a2)(a3));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm1->getLockState(rsc1) == lock_state::LOCKED);
+
+    // a3 leaves
+    sk1->setMembership(rsc1, 1, boost::assign::list_of(a1)(a2));
+    sk2->setMembership(rsc1, 1, boost::assign::list_of(a1)(a2));
+    BOOST_CHECK_EQUAL(sk1->getMembershipEpoch(rsc1), 1);
+    // Outdated memberships are ignored
+    sk1->setMembership(rsc1, 1, boost::assign::list_of(a1)(a2)(a3));
+
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3));
+    forwardAllMessages(dlms);
+    dlm1->unlock(rsc1);
+    BOOST_REQUIRE(dlm1->hasOutgoingMessages());
+    ACLMessage tokenMessage = dlm1->popNextOutgoingMessage();
+    BOOST_REQUIRE(tokenMessage.getPerformativeAsEnum() == ACLMessage::PROPAGATE);
+
+    SuzukiKasami::TokenBundle bundle;
+    {
+        std::stringstream ss(tokenMessage.getContent());
+        boost::archive::text_iarchive ia(ss);
+        ia >> bundle;
+    }
+    BOOST_REQUIRE_EQUAL(bundle.mTokens.size(), 1);
+    BOOST_CHECK_EQUAL(bundle.mResources.front(), rsc1);
+    const SuzukiKasami::Token& token = bundle.mTokens.front();
+    BOOST_CHECK_EQUAL(token.mEpoch, 1);
+    BOOST_CHECK_EQUAL(token.mAgents.size(), 2);
+    BOOST_CHECK_EQUAL(token.getLastRequestNumber(a3), 0);
+    BOOST_CHECK_EQUAL(token.getLastRequestNumber(a1), 1);
+
+    dlm2->onIncomingMessage(tokenMessage);
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    dlm2->unlock(rsc1);
+
+    // Requests of agents outside the membership are neither registered nor queued, so a2 keeps the token
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    dlm2->lock(rsc1, boost::assign::list_of(a1));
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    dlm2->unlock(rsc1);
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::INTERESTED);
+    dlm2->lock(rsc1, boost::assign::list_of(a1));
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+}
+
+/**
+ * Tokens of several resources are requested in a single message and passed on in a single bundle.
+ */
+BOOST_AUTO_TEST_CASE(token_bundles)
+{
+    BOOST_TEST_MESSAGE("suzuki_kasami/token_bundles");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string rsc1 = "resource1", rsc2 = "resource2";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+    rscs.push_back(rsc2);
+
+    DLM::Ptr dlm1(new SuzukiKasami(a1, rscs));
+    boost::shared_ptr<SuzukiKasami> sk2(new SuzukiKasami(a2, std::vector<std::string>()));
+    boost::shared_ptr<SuzukiKasami> sk3(new SuzukiKasami(a3, std::vector<std::string>()));
+    DLM::Ptr dlm2 = sk2, dlm3 = sk3;
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3);
+
+    BOOST_FOREACH(const std::string& rsc, rscs)
+    {
+        dlm2->discover(rsc, boost::assign::list_of(a1)(a3));
+        dlm3->discover(rsc, boost::assign::list_of(a1)(a2));
+    }
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+
+    // A single request for both tokens, the owner sends both in a single message
+    sk2->lockResources(rscs, boost::assign::list_of(a1)(a3));
+    BOOST_REQUIRE(dlm2->hasOutgoingMessages());
+    ACLMessage request = dlm2->popNextOutgoingMessage();
+    BOOST_CHECK(!dlm2->hasOutgoingMessages());
+    dlm1->onIncomingMessage(request);
+    dlm3->onIncomingMessage(request);
+    BOOST_REQUIRE(dlm1->hasOutgoingMessages());
+    ACLMessage tokens = dlm1->popNextOutgoingMessage();
+    BOOST_CHECK(tokens.getPerformativeAsEnum() == ACLMessage::PROPAGATE);
+    BOOST_CHECK(tokens.getLanguage() == SuzukiKasami::TokenBundle::getTypeName());
+    BOOST_CHECK(!dlm1->hasOutgoingMessages());
+    dlm2->onIncomingMessage(tokens);
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK(dlm2->getLockState(rsc2) == lock_state::LOCKED);
+
+    // a3 waits for both resources, releasing them passes both tokens on at once
+    sk3->lockResources(rscs, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::INTERESTED);
+    BOOST_CHECK(dlm3->getLockState(rsc2) == lock_state::INTERESTED);
+
+    sk2->unlockResources(rscs);
+    BOOST_REQUIRE(dlm2->hasOutgoingMessages());
+    tokens = dlm2->popNextOutgoingMessage();
+    BOOST_CHECK(tokens.getAllReceivers() == boost::assign::list_of(a3).convert_to_container<AgentIDList>());
+    BOOST_CHECK(!dlm2->hasOutgoingMessages());
+    dlm3->onIncomingMessage(tokens);
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK(dlm3->getLockState(rsc2) == lock_state::LOCKED);
+
+    sk3->unlockResources(rscs);
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::NOT_INTERESTED);
+    BOOST_CHECK(dlm3->getLockState(rsc2) == lock_state::NOT_INTERESTED);
+}
+
+/**
+ * The token is passed on to the request of the highest priority class, unless a request of a lower class waited
+ * long enough.
+ */
+BOOST_AUTO_TEST_CASE(priorities)
+{
+    BOOST_TEST_MESSAGE("suzuki_kasami/priorities");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    boost::shared_ptr<SuzukiKasami> sk1(new SuzukiKasami(a1, rscs));
+    boost::shared_ptr<SuzukiKasami> sk2(new SuzukiKasami(a2, std::vector<std::string>()));
+    boost::shared_ptr<SuzukiKasami> sk3(new SuzukiKasami(a3, std::vector<std::string>()));
+    DLM::Ptr dlm1 = sk1, dlm2 = sk2, dlm3 = sk3;
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3);
+    sk1->setAgingInterval(1);
+    sk2->setAgingInterval(1);
+    sk3->setAgingInterval(1);
+
+    dlm2->discover(rsc1, boost::assign::list_of(a1)(a3));
+    dlm3->discover(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+
+    dlm1->lock(rsc1, std::vector<AgentID>());
+    BOOST_REQUIRE(dlm1->getLockState(rsc1) == lock_state::LOCKED);
+
+    // The bulk job requests first, but the normal request is served first
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3), priority::LOW);
+    forwardAllMessages(dlms);
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    dlm1->unlock(rsc1);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::INTERESTED);
+
+    // After one hand-off, the bulk job has aged to the normal class and is served before the later normal request
+    dlm1->lock(rsc1, boost::assign::list_of(a2)(a3));
+    forwardAllMessages(dlms);
+    dlm3->unlock(rsc1);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK(dlm1->getLockState(rsc1) == lock_state::INTERESTED);
+
+    dlm2->unlock(rsc1);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(dlm1->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK_EQUAL(dlm2->getLatencyStatistics(priority::LOW).mCount, 1);
+    BOOST_CHECK_EQUAL(dlm1->getLatencyStatistics(priority::NORMAL).mCount, 2);
+    dlm1->unlock(rsc1);
+}
+
+class InspectableSuzukiKasami : public SuzukiKasami
+{
+public:
+    InspectableSuzukiKasami(const AgentID& self, const std::vector<std::string>& resources)
+        : SuzukiKasami(self, resources)
+    {}
+
+    unsigned int getParticipationCount(const AgentID& agent) const { return getParticipations(agent).size(); }
+};
+
+/**
+ * Agents are only recorded as participants as long as their requests are outstanding or they probably hold the token
+ */
+BOOST_AUTO_TEST_CASE(served_requests_forgotten)
+{
+    BOOST_TEST_MESSAGE("suzuki_kasami/served_requests_forgotten");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::vector<std::string> rscs = boost::assign::list_of("r0")("r1")("r2")("r3");
+
+    boost::shared_ptr<InspectableSuzukiKasami> sk1(new InspectableSuzukiKasami(a1, rscs));
+    boost::shared_ptr<SuzukiKasami> sk2(new SuzukiKasami(a2, std::vector<std::string>()));
+    boost::shared_ptr<InspectableSuzukiKasami> sk3(new InspectableSuzukiKasami(a3, std::vector<std::string>()));
+    sk1->setDirectedRequestTimeout(0);
+    sk2->setDirectedRequestTimeout(0);
+    sk3->setDirectedRequestTimeout(0);
+    DLM::Ptr dlm1 = sk1, dlm2 = sk2, dlm3 = sk3;
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3);
+
+    for(size_t i = 0; i < rscs.size(); ++i)
+    {
+        dlm2->discover(rscs[i], boost::assign::list_of(a1)(a3));
+        dlm3->discover(rscs[i], boost::assign::list_of(a1)(a2));
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+
+        // The token travels from the owner to agent2 and agent3, and back to the owner
+        dlm2->lock(rscs[i], boost::assign::list_of(a1)(a3));
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+        BOOST_REQUIRE(dlm2->getLockState(rscs[i]) == lock_state::LOCKED);
+        dlm3->lock(rscs[i], boost::assign::list_of(a1)(a2));
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+        dlm2->unlock(rscs[i]);
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+        BOOST_REQUIRE(dlm3->getLockState(rscs[i]) == lock_state::LOCKED);
+        dlm1->lock(rscs[i], boost::assign::list_of(a2)(a3));
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+        dlm3->unlock(rscs[i]);
+        forwardAllMessages(dlms);
+        forwardAllMessages(dlms);
+        BOOST_REQUIRE(dlm1->getLockState(rscs[i]) == lock_state::LOCKED);
+        dlm1->unlock(rscs[i]);
+
+        BOOST_CHECK_EQUAL(sk1->getParticipationCount(a2), 0);
+        BOOST_CHECK_EQUAL(sk1->getParticipationCount(a3), 0);
+        BOOST_CHECK_EQUAL(sk3->getParticipationCount(a2), 0);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -46,8 +46,9 @@ BOOST_AUTO_TEST_CASE(token_serialization)
     std::stringstream ss;
     SuzukiKasami::Token tokenIn;
     {
-        tokenIn.mLastRequestNumber[agent0] = 1;
-        tokenIn.mQueue.push_back(agent1);
+        tokenIn.mEpoch = 2;
+        tokenIn.setLastRequestNumber(agent0, 1);
+        tokenIn.enqueue(agent1);
 
         // Our response messages are in the format "BOOST_ARCHIVE(RESOURCE_IDENTIFIER, TOKEN)"
         boost::archive::text_oarchive oa(ss);
@@ -67,9 +68,10 @@ BOOST_AUTO_TEST_CASE(token_serialization)
     BOOST_REQUIRE_MESSAGE(resourceIn == resourceOut, "Resource: " << resourceIn << " vs. " << resourceOut);
     fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
 
-    BOOST_REQUIRE_MESSAGE(tokenOut.mLastRequestNumber[agent0] == 1, "Token out (#" << tokenOut.mLastRequestNumber.size() << ") : "<< agent0.getName() << ": " << tokenOut.mLastRequestNumber[agent0] << " vs. 1");
+    BOOST_REQUIRE_MESSAGE(tokenOut.mEpoch == 2, "Token epoch " << tokenOut.mEpoch << " vs. 2");
+    BOOST_REQUIRE_MESSAGE(tokenOut.getLastRequestNumber(agent0) == 1, "Token out (#" << tokenOut.mLastRequestNumber.size() << ") : "<< agent0.getName() << ": " << tokenOut.getLastRequestNumber(agent0) << " vs. 1");
     BOOST_REQUIRE_MESSAGE(tokenOut.mQueue.size() == 1, "Token queue size 1");
-    BOOST_REQUIRE_MESSAGE(tokenOut.mQueue.front() == agent1, "Token queue contains " << agent1.getName());
+    BOOST_REQUIRE_MESSAGE(tokenOut.mAgents.at(tokenOut.mQueue.front()) == agent1, "Token queue contains " << agent1.getName());
 }
 
 /**
@@ -204,4 +206,151 @@ BOOST_AUTO_TEST_CASE(non_responding_agent)
     BOOST_CHECK_THROW(dlm2->lock(rsc1, boost::assign::list_of(a1)), std::runtime_error);
 }
 
+/**
+ * Test keeping the token for local critical sections after unlocking
+ */
+BOOST_AUTO_TEST_CASE(hold_over)
+{
+    BOOST_TEST_MESSAGE("suzuki_kasami_extended_hold_over");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    // A1 is resource owner, A2 keeps the token for up to 2 local reentries
+    DLM::Ptr dlm1 = DLM::create(protocol::SUZUKI_KASAMI_EXTENDED, a1, rscs);
+    boost::shared_ptr<SuzukiKasamiExtended> sk2(new SuzukiKasamiExtended(a2, std::vector<std::string>()));
+    sk2->setHoldOverPolicy(rsc1, 2);
+    DLM::Ptr dlm2 = sk2;
+
+    dlm2->discover(rsc1, boost::assign::list_of(a1));
+    forwardAllMessages(boost::assign::list_of(dlm2)(dlm1));
+    forwardAllMessages(boost::assign::list_of(dlm2)(dlm1));
+    BOOST_REQUIRE(dlm2->hasKnownOwner(rsc1));
+
+    dlm2->lock(rsc1, boost::assign::list_of(a1));
+    forwardAllMessages(boost::assign::list_of(dlm2)(dlm1));
+    forwardAllMessages(boost::assign::list_of(dlm2)(dlm1));
+    BOOST_REQUIRE(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    forwardAllMessages(boost::assign::list_of(dlm2)(dlm1));
+
+    // The token is kept, so relocking requires no messages
+    for(int i = 0; i < 2; ++i)
+    {
+        dlm2->unlock(rsc1);
+        BOOST_CHECK(!dlm2->hasOutgoingMessages());
+        dlm2->lock(rsc1, boost::assign::list_of(a1));
+        BOOST_CHECK(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+        BOOST_CHECK(!dlm2->hasOutgoingMessages());
+    }
+    BOOST_CHECK_EQUAL(sk2->getHoldOverStatistics(rsc1).mReentries, 2);
+
+    // Now the budget is used up, and the token is returned to the owner
+    dlm2->unlock(rsc1);
+    BOOST_CHECK(dlm2->hasOutgoingMessages());
+    BOOST_CHECK_EQUAL(sk2->getHoldOverStatistics(rsc1).mExpirations, 1);
+    forwardAllMessages(boost::assign::list_of(dlm2)(dlm1));
+
+    dlm2->lock(rsc1, boost::assign::list_of(a1));
+    forwardAllMessages(boost::assign::list_of(dlm2)(dlm1));
+    forwardAllMessages(boost::assign::list_of(dlm2)(dlm1));
+    BOOST_REQUIRE(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+    dlm2->unlock(rsc1);
+
+    // A request of another agent ends the hold-over
+    dlm1->lock(rsc1, boost::assign::list_of(a2));
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2));
+    forwardAllMessages(boost::assign::list_of(dlm1)(dlm2));
+    BOOST_CHECK(dlm1->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK_EQUAL(sk2->getHoldOverStatistics(rsc1).mPreemptions, 1);
+    dlm1->unlock(rsc1);
+}
+
+/**
+ * Exposes the probed agents, to check that probing stops
+ */
+class InspectableSuzukiKasamiExtended : public SuzukiKasamiExtended
+{
+public:
+    InspectableSuzukiKasamiExtended(const AgentID& self, const std::vector<std::string>& resources)
+        : SuzukiKasamiExtended(self, resources)
+    {}
+
+    bool isProbing(const AgentID& agent) const { return mProbeRunners.count(agent) != 0; }
+};
+
+/**
+ * Test forwarding the token directly to the next waiting agent
+ */
+BOOST_AUTO_TEST_CASE(direct_forwarding)
+{
+    BOOST_TEST_MESSAGE("suzuki_kasami_extended_direct_forwarding");
+    fipa::acl::StateMachineFactory::setProtocolResourceDir( getProtocolPath() );
+
+    AgentID a1 ("agent1"), a2 ("agent2"), a3 ("agent3");
+    std::string rsc1 = "resource";
+    std::vector<std::string> rscs;
+    rscs.push_back(rsc1);
+
+    // A1 is resource owner
+    boost::shared_ptr<InspectableSuzukiKasamiExtended> sk1(new InspectableSuzukiKasamiExtended(a1, rscs));
+    boost::shared_ptr<InspectableSuzukiKasamiExtended> sk2(new InspectableSuzukiKasamiExtended(a2, std::vector<std::string>()));
+    boost::shared_ptr<InspectableSuzukiKasamiExtended> sk3(new InspectableSuzukiKasamiExtended(a3, std::vector<std::string>()));
+    sk2->setDirectForwarding(true);
+    sk3->setDirectForwarding(true);
+    DLM::Ptr dlm1 = sk1, dlm2 = sk2, dlm3 = sk3;
+    std::list<DLM::Ptr> dlms = boost::assign::list_of(dlm1)(dlm2)(dlm3);
+
+    dlm2->discover(rsc1, boost::assign::list_of(a1)(a3));
+    dlm3->discover(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm2->hasKnownOwner(rsc1) && dlm3->hasKnownOwner(rsc1));
+
+    dlm2->lock(rsc1, boost::assign::list_of(a1)(a3));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+    BOOST_REQUIRE(dlm2->getLockState(rsc1) == lock_state::LOCKED);
+
+    dlm3->lock(rsc1, boost::assign::list_of(a1)(a2));
+    forwardAllMessages(dlms);
+    forwardAllMessages(dlms);
+
+    // The token goes to a3 directly, the owner gets a notice
+    dlm2->unlock(rsc1);
+    bool tokenSent = false, noticeSent = false;
+    while(dlm2->hasOutgoingMessages())
+    {
+        ACLMessage msg = dlm2->popNextOutgoingMessage();
+        if(msg.getPerformativeAsEnum() == ACLMessage::PROPAGATE)
+        {
+            tokenSent = true;
+            BOOST_CHECK(msg.getAllReceivers() == boost::assign::list_of(a3).convert_to_container<AgentIDList>());
+            dlm3->onIncomingMessage(msg);
+        } else if(msg.getPerformativeAsEnum() == ACLMessage::INFORM_REF)
+        {
+            noticeSent = true;
+            BOOST_CHECK(msg.getAllReceivers() == boost::assign::list_of(a1).convert_to_container<AgentIDList>());
+            dlm1->onIncomingMessage(msg);
+        }
+    }
+    BOOST_CHECK(tokenSent && noticeSent);
+    BOOST_CHECK(dlm3->getLockState(rsc1) == lock_state::LOCKED);
+    BOOST_CHECK(sk1->isTokenHolder(rsc1, a3));
+
+    // Nobody is waiting, so the token is returned to the owner
+    dlm3->unlock(rsc1);
+    forwardAllMessages(dlms);
+    BOOST_CHECK(sk1->isTokenHolder(rsc1, a1));
+    dlm1->lock(rsc1, boost::assign::list_of(a2)(a3));
+    BOOST_CHECK(dlm1->getLockState(rsc1) == lock_state::LOCKED);
+
+    // Nobody probes anymore, also a3 which got the token from a2
+    BOOST_CHECK(!sk1->isProbing(a3));
+    BOOST_CHECK(!sk2->isProbing(a1));
+    BOOST_CHECK(!sk3->isProbing(a1));
+}
+
 BOOST_AUTO_TEST_SUITE_END()